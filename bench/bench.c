@@ -0,0 +1,103 @@
+/* Support shared by the benchmark programs */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+#include "core/proc.h"
+#include "net/core/mbuf.h"
+#include "core/socket.h"
+#include "core/usock.h"
+#include "core/daemon.h"
+#include "main.h"
+#include "unix/timer_unix.h"
+
+#include "bench/bench.h"
+
+/* Bring up NOS as main() does, short of the console: the clock thread,
+ * sockets, and the background daemons other than the keyboard. The
+ * caller carries on as process "bench".
+ */
+void
+bench_init(void)
+{
+	struct daemon *tp;
+
+	kinit();
+	if(unix_timer_start() != 0){
+		fprintf(stderr,"Can't start timer thread\n");
+		exit(1);
+	}
+	sockinit();
+	Cmdpp = mainproc("bench");
+	for(tp = Daemons;tp->name != NULL;tp++){
+		if(strcmp(tp->name,"keyboard") != 0)
+			newproc(tp->name,tp->stksize,tp->fp,0,NULL,NULL,0);
+	}
+}
+
+/* Wall clock time in seconds, for rates */
+double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CPU cycle counter, or 0 where there isn't one we can read */
+uint64
+bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Send bytes over TCP to a port on the loopback address, in writes of
+ * wsize, and wait for the receiver to close its end after reading
+ * them all. Returns the seconds taken, or -1 if the connection fails.
+ */
+double
+bench_bulk(uint port,long bytes,int wsize)
+{
+	struct ksockaddr_in fsocket;
+	struct mbuf *bp;
+	char *buf;
+	int s,n;
+	double t;
+
+	buf = (char *)callocw(1,wsize);
+	s = ksocket(kAF_INET,kSOCK_STREAM,0);
+	fsocket.sin_family = kAF_INET;
+	fsocket.sin_addr.s_addr = 0x7f000001L;
+	fsocket.sin_port = port;
+	t = bench_now();
+	if(kconnect(s,(struct ksockaddr *)&fsocket,SOCKSIZE) == -1){
+		close_s(s);
+		free(buf);
+		return -1;
+	}
+	while(bytes > 0){
+		n = min(bytes,wsize);
+		if(ksend(s,buf,n,0) != n){
+			close_s(s);
+			free(buf);
+			return -1;
+		}
+		bytes -= n;
+	}
+	kshutdown(s,1);
+	while(recv_mbuf(s,&bp,0,NULL,NULL) > 0)
+		free_p(&bp);
+	t = bench_now() - t;
+	close_s(s);
+	free(buf);
+	return t;
+}
@@ -0,0 +1,16 @@
+#ifndef	_KA9Q_BENCH_H
+#define	_KA9Q_BENCH_H
+
+#include "global.h"
+
+/* Support shared by the benchmark programs. Results are written with
+ * the host's stdio, since there's no NOS console session to print on.
+ */
+
+/* In bench.c: */
+void bench_init(void);
+double bench_now(void);
+uint64 bench_cycles(void);
+double bench_bulk(uint port,long bytes,int wsize);
+
+#endif	/* _KA9Q_BENCH_H */
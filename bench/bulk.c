@@ -0,0 +1,50 @@
+/* Bulk send benchmark: send to the discard server over the loopback
+ * interface, in writes of several sizes, and report the rate and the
+ * CPU cycles taken per byte. Both ends are in this process, so the
+ * cycles cover sending and receiving alike.
+ *
+ * usage: bench_bulk [megabytes]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "commands.h"
+#include "net/core/mbuf.h"
+#include "core/socket.h"
+#include "net/inet/tcp.h"
+
+#include "bench/bench.h"
+
+static int Wsizes[] = { 64, 1460, 8192, 65536 };
+
+int
+main(int argc,char *argv[])
+{
+	long bytes = 64L << 20;
+	uint64 cycles;
+	double t;
+	int i;
+
+	if(argc > 1)
+		bytes = atol(argv[1]) << 20;
+	bench_init();
+	Tcp_mss = 1460;
+	Tcp_window = 65535;	/* Before the server's listener takes it */
+	dis1(1,NULL,NULL);
+
+	for(i=0;i<(int)(sizeof(Wsizes)/sizeof(Wsizes[0]));i++){
+		cycles = bench_cycles();
+		t = bench_bulk(IPPORT_DISCARD,bytes,Wsizes[i]);
+		cycles = bench_cycles() - cycles;
+		if(t < 0){
+			fprintf(stderr,"Transfer failed\n");
+			return 1;
+		}
+		printf("%5d-byte writes: %.1f MB/s, %.2f cycles/byte\n",
+		 Wsizes[i],bytes / t / 1e6,(double)cycles / bytes);
+	}
+	return 0;
+}
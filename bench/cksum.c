@@ -0,0 +1,125 @@
+/* Checksum benchmark: the CRC-16 FCS (crc_update()) and the Internet
+ * checksum (lcsum()) across packet sizes, each against a reference
+ * that does it the simple way, one byte or one word at a time. The
+ * results are first checked against the references over random
+ * lengths and alignments.
+ *
+ * usage: bench_cksum [megabytes]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "lib/util/crc.h"
+#include "net/inet/ip.h"
+
+#include "bench/bench.h"
+
+#define	BUFSIZE	70000
+#define	NCHECK	200000
+
+static void ref_crc(uint8 *buf,uint len,uint16 *crc);
+static uint ref_lcsum(uint16 *buf,uint cnt);
+
+static uint Sizes[] = { 40, 576, 1500, 8192, 65536 };
+
+int
+main(int argc,char *argv[])
+{
+	static uint8 buf[BUFSIZE];
+	uint16 *wp;
+	uint16 a,b;
+	uint len,off;
+	long i,n,mbytes = 100;
+	int k,errors = 0;
+	volatile uint sum = 0;
+	double t[4];
+
+	if(argc > 1)
+		mbytes = atol(argv[1]);
+	bench_init();
+
+	srandom(1);
+	for(i=0;i<BUFSIZE;i++)
+		buf[i] = random();
+	for(i=0;i<NCHECK;i++){
+		len = random() % 2000;
+		if(i % 1000 == 0)
+			len = random() % 32768;
+		off = random() % 16;
+		a = b = random();
+		ref_crc(buf + off,len,&a);
+		crc_update(buf + off,len,&b);
+		if(a != b && errors++ < 5)
+			fprintf(stderr,"crc_update: %u bytes at %u: %04x, should be %04x\n",
+			 len,off,b,a);
+
+		/* Runs of 0xffff exercise the carries */
+		wp = (uint16 *)(buf + 2*off);
+		if(i % 7 == 0)
+			memset(wp,0xff,len * 2);
+		if(ref_lcsum(wp,len) != lcsum(wp,len) && errors++ < 5)
+			fprintf(stderr,"lcsum: %u words at %u: %04x, should be %04x\n",
+			 len,2*off,lcsum(wp,len),ref_lcsum(wp,len));
+		if(i % 7 == 0){
+			for(n=0;n<len*2;n++)
+				((uint8 *)wp)[n] = random();
+		}
+	}
+	printf("%d checks, %d errors\n",NCHECK,errors);
+
+	printf("%6s %12s %12s %12s %12s (MB/s)\n","bytes",
+	 "FCS bytewise","crc_update","sum wordwise","lcsum");
+	for(k=0;k<sizeof(Sizes)/sizeof(Sizes[0]);k++){
+		len = Sizes[k];
+		n = mbytes * 1000000 / len;
+		a = FCS_START;
+		t[0] = bench_now();
+		for(i=0;i<n;i++)
+			ref_crc(buf,len,&a);
+		t[0] = bench_now() - t[0];
+		t[1] = bench_now();
+		for(i=0;i<n;i++)
+			crc_update(buf,len,&a);
+		t[1] = bench_now() - t[1];
+		t[2] = bench_now();
+		for(i=0;i<n;i++)
+			sum += ref_lcsum((uint16 *)buf,len/2);
+		t[2] = bench_now() - t[2];
+		t[3] = bench_now();
+		for(i=0;i<n;i++)
+			sum += lcsum((uint16 *)buf,len/2);
+		t[3] = bench_now() - t[3];
+		printf("%6u %12.0f %12.0f %12.0f %12.0f\n",len,
+		 n * len / t[0] / 1e6,n * len / t[1] / 1e6,
+		 n * len / t[2] / 1e6,n * len / t[3] / 1e6);
+	}
+	return errors != 0;
+}
+
+/* The FCS a byte at a time from Fcstab */
+static void
+ref_crc(uint8 *buf,uint len,uint16 *crc)
+{
+	uint16 fcs = *crc;
+
+	while(len-- != 0)
+		fcs = FCS(fcs,*buf++);
+	*crc = fcs;
+}
+
+/* The one's complement sum a word at a time */
+static uint
+ref_lcsum(uint16 *buf,uint cnt)
+{
+	uint32 sum = 0;
+
+	while(cnt-- != 0)
+		sum += *buf++;
+	while(sum > 65535)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ((sum >> 8) | (sum << 8)) & 0xffff;
+}
@@ -0,0 +1,186 @@
+/* FTP benchmark: RETR a large binary file from the FTP server over the
+ * loopback interface and report the transfer rate. A small client here
+ * speaks to the server over a control connection and takes the data
+ * with recv_mbuf(), so the server side dominates. The first transfer
+ * is checked byte for byte and also warms the host's page cache.
+ *
+ * usage: bench_ftp [megabytes [transfers]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/std/stdio.h"
+#include "global.h"
+#include "net/core/mbuf.h"
+#include "core/socket.h"
+#include "core/usock.h"
+#include "files.h"
+#include "commands.h"
+
+#include "bench/bench.h"
+
+#define	PATTERN(i)	((uint8)((i) * 131 + ((i) >> 12)))
+
+static int reply(kFILE *control);
+static long retr(kFILE *control,int check);
+
+int
+main(int argc,char *argv[])
+{
+	char dir[] = "/tmp/bench_ftpXXXXXX";
+	char path[64],users[64];
+	static uint8 buf[65536];
+	FILE *fp;
+	long mbytes = 256;
+	long size,i,got;
+	int runs = 3;
+	int r,s;
+	struct ksockaddr_in fsocket;
+	kFILE *control;
+	double t;
+
+	if(argc > 1)
+		mbytes = atol(argv[1]);
+	if(argc > 2)
+		runs = atoi(argv[2]);
+	size = mbytes << 20;
+	bench_init();
+
+	/* The file, and an ftpusers giving us its directory */
+	if(mkdtemp(dir) == NULL){
+		perror(dir);
+		return 1;
+	}
+	sprintf(path,"%s/big.dat",dir);
+	sprintf(users,"%s/ftpusers",dir);
+	if((fp = fopen(path,"w")) == NULL){
+		perror(path);
+		return 1;
+	}
+	for(i=0;i<size;i++){
+		buf[i % sizeof(buf)] = PATTERN(i);
+		if(i % sizeof(buf) == sizeof(buf) - 1 || i == size - 1)
+			fwrite(buf,1,i % sizeof(buf) + 1,fp);
+	}
+	fclose(fp);
+	fp = fopen(users,"w");
+	fprintf(fp,"bench * %s 7\n",dir);
+	fclose(fp);
+	Userfile = users;
+
+	ftpstart(1,NULL,NULL);
+	s = ksocket(kAF_INET,kSOCK_STREAM,0);
+	fsocket.sin_family = kAF_INET;
+	fsocket.sin_addr.s_addr = 0x7f000001L;
+	fsocket.sin_port = IPPORT_FTP;
+	if(kconnect(s,(struct ksockaddr *)&fsocket,SOCKSIZE) == -1){
+		fprintf(stderr,"Can't connect to the FTP server\n");
+		return 1;
+	}
+	control = kfdopen(s,"r+t");
+	if(reply(control) != 220){
+		fprintf(stderr,"No greeting from the FTP server\n");
+		return 1;
+	}
+	kfprintf(control,"USER bench\n");
+	kfflush(control);
+	reply(control);
+	kfprintf(control,"PASS bench\n");
+	kfflush(control);
+	if(reply(control) != 230){
+		fprintf(stderr,"FTP login failed\n");
+		return 1;
+	}
+	kfprintf(control,"TYPE I\n");
+	kfflush(control);
+	reply(control);
+
+	for(r=0;r<runs;r++){
+		t = bench_now();
+		got = retr(control,r == 0);
+		t = bench_now() - t;
+		if(got != size){
+			fprintf(stderr,"RETR gave %ld bytes of %ld\n",got,size);
+			return 1;
+		}
+		printf("RETR %ld MB: %.2f s, %.1f MB/s%s\n",mbytes,t,
+		 size / t / 1e6,r == 0 ? " (checked)" : "");
+	}
+	kfprintf(control,"QUIT\n");
+	kfflush(control);
+	reply(control);
+	kfclose(control);
+
+	unlink(path);
+	unlink(users);
+	rmdir(dir);
+	return 0;
+}
+
+/* Read a reply, skipping continuation lines; returns its code */
+static int
+reply(kFILE *control)
+{
+	char line[256];
+
+	for(;;){
+		if(kfgets(line,sizeof(line),control) == NULL)
+			return -1;
+		if(strlen(line) > 3 && line[3] != '-')
+			return atoi(line);
+	}
+}
+
+/* Fetch the file over a new data connection. Returns the bytes
+ * received, or -1 if they weren't what was in the file
+ */
+static long
+retr(kFILE *control,int check)
+{
+	struct ksockaddr_in lsocket;
+	struct mbuf *bp,*bp1;
+	long got = 0;
+	long off;
+	int d,i,len;
+	int bad = 0;
+	uint8 *cp;
+
+	d = ksocket(kAF_INET,kSOCK_STREAM,0);
+	klisten(d,0);	/* Accept only one connection, on this socket */
+	i = SOCKSIZE;
+	getsockname(d,(struct ksockaddr *)&lsocket,&i);
+	kfprintf(control,"PORT 127,0,0,1,%u,%u\n",
+	 hibyte(lsocket.sin_port),lobyte(lsocket.sin_port));
+	kfflush(control);
+	if(reply(control) != 200)
+		return -1;
+	kfprintf(control,"RETR big.dat\n");
+	kfflush(control);
+	if(reply(control) != 150)
+		return -1;
+	i = 0;
+	d = kaccept(d,NULL,&i);
+	while(recv_mbuf(d,&bp,0,NULL,NULL) > 0){
+		off = got;
+		for(bp1 = bp;check && bp1 != NULL;bp1 = bp1->next){
+			for(cp = bp1->data,len = bp1->cnt;len != 0;len--,off++){
+				if(*cp++ != PATTERN(off)){
+					fprintf(stderr,"Wrong data at %ld\n",off);
+					bad = 1;
+					check = 0;
+					break;
+				}
+			}
+		}
+		got += len_p(bp);
+		free_p(&bp);
+	}
+	close_s(d);
+	if(reply(control) != 226 || bad)
+		return -1;
+	return got;
+}
@@ -0,0 +1,146 @@
+/* Mail area benchmark: open a large mail area (50,000 messages by
+ * default) the way the POP server and the mailbox do, first with no
+ * index beside it and then with the index the first open left, and
+ * report the times. The messages found are checked against what was
+ * written.
+ *
+ * usage: bench_mailidx [messages]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/std/stdio.h"
+#include "global.h"
+#include "files.h"
+#include "mailbox.h"
+#include "bm.h"
+#include "lib/smtp/mailidx.h"
+#include "service/pop/pop.h"
+
+#include "bench/bench.h"
+
+static long writearea(char *name,int nmsgs);
+static int pop_open(char *what,int nmsgs,long size);
+
+int
+main(int argc,char *argv[])
+{
+	char dir[] = "/tmp/bench_mailXXXXXX";
+	char txt[64],idx[64],areas[64];
+	int nmsgs = 50000;
+	int errors = 0;
+	long size;
+	struct mbx *m;
+	double t;
+
+	if(argc > 1)
+		nmsgs = atoi(argv[1]);
+	bench_init();
+
+	if(mkdtemp(dir) == NULL){
+		perror(dir);
+		return 1;
+	}
+	sprintf(txt,"%s/bench.txt",dir);
+	sprintf(idx,"%s/bench.idx",dir);
+	sprintf(areas,"%s/areas",dir);	/* Never created */
+	Mailspool = dir;
+	Arealist = areas;
+	size = writearea(txt,nmsgs);
+	printf("%d messages, %ld bytes\n",nmsgs,size);
+
+	errors += pop_open("POP open, no index",nmsgs,size);
+	errors += pop_open("POP open, indexed",nmsgs,size);
+
+	m = (struct mbx *)callocw(1,sizeof(struct mbx));
+	strcpy(m->name,"bench");
+	strcpy(m->area,"bench");
+	Maxlet = nmsgs + 1;
+	t = bench_now();
+	scanmail(m);
+	t = bench_now() - t;
+	printf("mailbox open, indexed: %.3f s\n",t);
+	if(m->nmsgs != nmsgs){
+		fprintf(stderr,"mailbox found %d messages\n",m->nmsgs);
+		errors++;
+	}
+	closenotes(m);
+	free(m);
+
+	unlink(txt);
+	unlink(idx);
+	rmdir(dir);
+	printf("%d errors\n",errors);
+	return errors != 0;
+}
+
+/* Open the area as the POP server would, and close it unchanged */
+static int
+pop_open(char *what,int nmsgs,long size)
+{
+	struct pop_scb *scb;
+	long total;
+	int i,errors = 0;
+	double t;
+
+	scb = (struct pop_scb *)callocw(1,sizeof(struct pop_scb));
+	strcpy(scb->username,"bench");
+	t = bench_now();
+	open_folder(scb);
+	t = bench_now() - t;
+	printf("%s: %.3f s\n",what,t);
+
+	total = 0;
+	for(i=0;i<scb->folder.nmsgs;i++)
+		total += scb->folder.msgs[i].size;
+	if(scb->folder_len != nmsgs || total != size){
+		fprintf(stderr,"%s: %d messages, %ld bytes\n",what,
+		 scb->folder_len,total);
+		errors++;
+	}
+	close_folder(scb);
+	free(scb);
+	return errors;
+}
+
+/* Write an area of nmsgs messages of a few to a few dozen lines;
+ * returns its size
+ */
+static long
+writearea(char *name,int nmsgs)
+{
+	static char chars[] = "abcdefghij klmnop";
+	FILE *fp;
+	int i,j,k,nlines,len;
+	long size;
+
+	if((fp = fopen(name,"w")) == NULL){
+		perror(name);
+		exit(1);
+	}
+	srandom(1);
+	for(i=0;i<nmsgs;i++){
+		fprintf(fp,"From user%d@example.com Mon Jan  1 00:00:00 2024\n",i);
+		fprintf(fp,"Date: Mon, 1 Jan 2024 00:00:%02d\n",i % 60);
+		fprintf(fp,"From: user%d@example.com\nTo: bench@nos\n",i);
+		fprintf(fp,"Subject: message %d\n",i);
+		if(i % 4 == 0)
+			fprintf(fp,"Status: R\n");
+		fprintf(fp,"\n");
+		nlines = 3 + random() % 38;
+		for(j=0;j<nlines;j++){
+			len = random() % (j % 7 == 0 ? 200 : 70);
+			for(k=0;k<len;k++)
+				putc(chars[random() % (sizeof(chars) - 1)],fp);
+			putc('\n',fp);
+		}
+		putc('\n',fp);
+	}
+	size = ftell(fp);
+	fclose(fp);
+	return size;
+}
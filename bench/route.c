@@ -0,0 +1,141 @@
+/* Routing table benchmark: load a large table of prefixes, check
+ * rt_lookup() against a brute force search, then time lookups over
+ * uniformly random destinations and over a skewed stream where a few
+ * hosts get most of the traffic.
+ *
+ * usage: bench_route [prefixes [lookups]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "net/core/iface.h"
+#include "net/inet/ip.h"
+
+#include "bench/bench.h"
+
+#define	NHOT	64	/* Hosts taking most of the skewed stream */
+#define	NCHECK	4000	/* Lookups checked by brute force */
+
+static int32 *Targets;
+static unsigned int *Bits;
+static int Nprefix;
+
+static int32 rand32(void);
+static int32 randdest(void);
+static struct route *brute(int32 addr);
+static double timeit(int32 *dest,long n);
+
+int
+main(int argc,char *argv[])
+{
+	int32 *dest,hot[NHOT],addr;
+	long nlookup = 2000000;
+	long i;
+	int r,errors;
+	struct route *rp,*bp;
+
+	Nprefix = 100000;
+	if(argc > 1)
+		Nprefix = atoi(argv[1]);
+	if(argc > 2)
+		nlookup = atol(argv[2]);
+	bench_init();
+
+	/* Mostly /24s, as a real table is, with shorter prefixes for
+	 * them to nest inside and a few host routes
+	 */
+	Targets = (int32 *)calloc(Nprefix,sizeof(int32));
+	Bits = (unsigned int *)calloc(Nprefix,sizeof(unsigned int));
+	srandom(1);
+	for(i=0;i<Nprefix;i++){
+		r = random() % 100;
+		if(r < 60)
+			Bits[i] = 24;
+		else if(r < 85)
+			Bits[i] = 16 + random() % 8;
+		else if(r < 95)
+			Bits[i] = 8 + random() % 8;
+		else
+			Bits[i] = 25 + random() % 8;
+		Targets[i] = randdest() & (~0L << (32 - Bits[i]));
+		if(rt_add(Targets[i],Bits[i],0,&Loopback,1,0,0) == NULL){
+			fprintf(stderr,"rt_add %d failed\n",(int)i);
+			return 1;
+		}
+	}
+	/* Check random destinations and ones inside the table's prefixes */
+	errors = 0;
+	for(i=0;i<NCHECK;i++){
+		addr = (i & 1) ? randdest()
+		 : Targets[random() % Nprefix] | (rand32() & 0xff);
+		rp = rt_lookup(addr);
+		bp = brute(addr);
+		if(bp == NULL ? rp != NULL
+		 : rp == NULL || rp->bits != bp->bits || rp->target != bp->target){
+			if(errors++ < 5)
+				fprintf(stderr,"%08lx: rt_lookup gives %08lx/%u, should be %08lx/%u\n",
+				 (unsigned long)addr,
+				 rp ? (unsigned long)rp->target : 0UL,rp ? rp->bits : 0,
+				 bp ? (unsigned long)bp->target : 0UL,bp ? bp->bits : 0);
+		}
+	}
+	printf("%d prefixes loaded, %d lookups checked, %d errors\n",
+	 Nprefix,NCHECK,errors);
+
+	dest = (int32 *)calloc(nlookup,sizeof(int32));
+	for(i=0;i<nlookup;i++)
+		dest[i] = randdest();
+	printf("random: %.0f lookups/sec\n",nlookup / timeit(dest,nlookup));
+
+	for(r=0;r<NHOT;r++)
+		hot[r] = Targets[random() % Nprefix] | (rand32() & 0xff);
+	for(i=0;i<nlookup;i++)
+		dest[i] = (random() % 10) != 0 ? hot[random() % NHOT] : randdest();
+	printf("skewed: %.0f lookups/sec\n",nlookup / timeit(dest,nlookup));
+	return errors != 0;
+}
+
+static int32
+rand32(void)
+{
+	return (int32)(((uint32)random() << 16) ^ (uint32)random());
+}
+
+/* A unicast destination */
+static int32
+randdest(void)
+{
+	return (int32)((((uint32)1 + random() % 223) << 24)
+	 | ((uint32)rand32() & 0xffffff));
+}
+
+/* The longest matching prefix, the slow way */
+static struct route *
+brute(int32 addr)
+{
+	int i,best = -1;
+	int32 mask;
+
+	for(i=0;i<Nprefix;i++){
+		mask = ~0L << (32 - Bits[i]);
+		if(((addr ^ Targets[i]) & mask) == 0
+		 && (best == -1 || Bits[i] > Bits[best]))
+			best = i;
+	}
+	return best == -1 ? NULL : rt_blookup(Targets[best],Bits[best]);
+}
+
+static double
+timeit(int32 *dest,long n)
+{
+	double t;
+	long i;
+
+	t = bench_now();
+	for(i=0;i<n;i++)
+		rt_lookup(dest[i]);
+	return bench_now() - t;
+}
@@ -0,0 +1,199 @@
+/* Byte-stuffing benchmark: encode and decode frames through the SLIP
+ * (and so KISS) and async HDLC framers, over random payloads and over
+ * worst-case ones made entirely of bytes that need escaping. Every
+ * decoded frame is checked against what was sent.
+ *
+ * SLIP goes through slip_raw() and the slip_rx() process on a dummy
+ * device; HDLC through ahdlctx() and ahdlcrx().
+ *
+ * usage: bench_stuff [frames [size]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "core/proc.h"
+#include "net/core/mbuf.h"
+#include "net/core/iface.h"
+#include "net/slip/slip.h"
+#include "net/sppp/ahdlc.h"
+
+#include "bench/bench.h"
+
+static uint8 *Payload;		/* Frame being sent */
+static uint Size = 1500;
+static long Nframes = 100000;
+static struct mbuf *Line;	/* Encoded frame, as sent to the device */
+static long Fed;		/* Frames handed to slip_rx() */
+static long Received;		/* Frames back from slip_rx() */
+static long Errors;
+
+static struct iftype Benchtype;
+static struct iface Benchif;
+
+static int line_send(int dev,struct mbuf **bpp);
+static int line_get(int dev,uint8 **cpp);
+static void line_release(int dev,int cnt);
+static void slip_recvd(struct iface *ifp,struct mbuf **bpp);
+static void check(struct mbuf **bpp);
+static void slip_bench(char *name);
+static void hdlc_bench(char *name);
+static void report(char *what,char *name,double t);
+
+int
+main(int argc,char *argv[])
+{
+	uint i;
+
+	if(argc > 1)
+		Nframes = atol(argv[1]);
+	if(argc > 2)
+		Size = atoi(argv[2]);
+	bench_init();
+
+	/* A dummy SLIP interface whose line is a buffer in memory */
+	Benchtype.name = "bench";
+	Benchtype.rcvf = slip_recvd;
+	Benchif.name = "bench";
+	Benchif.iftype = &Benchtype;
+	Benchif.raw = slip_raw;
+	Slip[0].iface = &Benchif;
+	Slip[0].send = line_send;
+	Slip[0].get = line_get;
+	Slip[0].release = line_release;
+
+	Payload = (uint8 *)malloc(Size);
+	srandom(1);
+	for(i=0;i<Size;i++)
+		Payload[i] = random();
+	Payload[0] = 0x45;	/* slip_rx() looks for IP or VJ headers */
+	slip_bench("random");
+	for(i=1;i<Size;i++)
+		Payload[i] = (i & 1) ? FR_END : FR_ESC;
+	slip_bench("worst case");
+
+	for(i=0;i<Size;i++)
+		Payload[i] = random();
+	hdlc_bench("random");
+	for(i=0;i<Size;i++)
+		Payload[i] = (i & 1) ? HDLC_FLAG : HDLC_ESC_ASYNC;
+	hdlc_bench("worst case");
+
+	printf("%ld errors\n",Errors);
+	return Errors != 0;
+}
+
+static void
+slip_bench(char *name)
+{
+	struct mbuf *bp;
+	long n;
+	double t;
+
+	t = bench_now();
+	for(n=0;n<Nframes;n++){
+		free_p(&Line);
+		bp = qdata(Payload,Size);
+		slip_raw(&Benchif,&bp);
+	}
+	report("SLIP encode",name,bench_now() - t);
+
+	/* Feed the last frame to the receiver process Nframes times */
+	Fed = Received = 0;
+	t = bench_now();
+	newproc("slip rx",1024,slip_rx,0,NULL,NULL,0);
+	while(Received < Nframes)
+		kwait(&Received);
+	report("SLIP decode",name,bench_now() - t);
+	free_p(&Line);
+}
+
+static void
+hdlc_bench(char *name)
+{
+	struct ahdlc hdlc;
+	struct mbuf *bp;
+	uint8 *cp,*end;
+	long n;
+	double t;
+
+	t = bench_now();
+	for(n=0;n<Nframes;n++){
+		free_p(&Line);
+		Line = ahdlctx(qdata(Payload,Size));
+	}
+	report("HDLC encode",name,bench_now() - t);
+
+	init_hdlc(&hdlc,Size + 2);
+	t = bench_now();
+	for(n=0;n<Nframes;n++){
+		end = Line->data + Line->cnt;
+		for(cp = Line->data;cp < end;cp++){
+			if((bp = ahdlcrx(&hdlc,*cp)) != NULL)
+				check(&bp);
+		}
+	}
+	report("HDLC decode",name,bench_now() - t);
+	if(hdlc.rxframes != Nframes){
+		fprintf(stderr,"HDLC: %ld of %ld frames received\n",
+		 (long)hdlc.rxframes,Nframes);
+		Errors++;
+	}
+	free_p(&Line);
+}
+
+static void
+report(char *what,char *name,double t)
+{
+	printf("%s, %s %u-byte frames: %.1f MB/s\n",what,name,Size,
+	 (double)Nframes * Size / t / 1e6);
+}
+
+/* The dummy device: transmitted frames are kept in Line, and the
+ * receiver is handed that frame again and again
+ */
+static int
+line_send(int dev,struct mbuf **bpp)
+{
+	Line = *bpp;
+	*bpp = NULL;
+	return 0;
+}
+static int
+line_get(int dev,uint8 **cpp)
+{
+	if(Fed == Nframes)
+		return 0;	/* slip_rx() exits */
+	Fed++;
+	*cpp = Line->data;
+	return Line->cnt;
+}
+static void
+line_release(int dev,int cnt)
+{
+}
+
+/* Frames from slip_rx(), by way of the network process */
+static void
+slip_recvd(struct iface *ifp,struct mbuf **bpp)
+{
+	check(bpp);
+	Received++;
+	ksignal(&Received,1);
+}
+
+static void
+check(struct mbuf **bpp)
+{
+	static uint8 *buf;
+
+	if(buf == NULL)
+		buf = (uint8 *)malloc(Size);
+	if(len_p(*bpp) != Size || pullup(bpp,buf,Size) != Size
+	 || memcmp(buf,Payload,Size) != 0)
+		Errors++;
+	free_p(bpp);
+}
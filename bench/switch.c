@@ -0,0 +1,79 @@
+/* Process switch benchmark: two processes wake each other with
+ * ksignal() and kwait() in turn, and the switch rate is reported;
+ * then the cost of creating a process that exits at once. The process
+ * backend is chosen when NOS is built (UNIX_COROUTINES), so build both
+ * ways to compare them.
+ *
+ * usage: bench_switch [round trips]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "core/proc.h"
+
+#include "bench/bench.h"
+
+#define	NSPAWN	20000
+
+static int Ping,Pong;
+static int Spawned;
+
+static void pong(int i,void *v1,void *v2);
+static void spawned(int i,void *v1,void *v2);
+
+int
+main(int argc,char *argv[])
+{
+	long n = 500000;
+	long i;
+	double t;
+
+	if(argc > 1)
+		n = atol(argv[1]);
+	bench_init();
+#ifdef	UNIX_COROUTINES
+	printf("coroutine processes\n");
+#else
+	printf("pthread processes\n");
+#endif
+	newproc("pong",1024,pong,0,NULL,NULL,0);
+	kwait(NULL);	/* Let it get to its first kwait */
+
+	t = bench_now();
+	for(i=0;i<n;i++){
+		ksignal(&Ping,1);
+		kwait(&Pong);
+	}
+	t = bench_now() - t;
+	printf("ping-pong: %.0f switches/sec, %.0f ns each\n",
+	 2 * n / t,t / (2 * n) * 1e9);
+
+	t = bench_now();
+	for(i=0;i<NSPAWN;i++){
+		newproc("spawned",1024,spawned,0,NULL,NULL,0);
+		while(Spawned <= i)
+			kwait(&Spawned);
+	}
+	t = bench_now() - t;
+	printf("newproc and exit: %.1f us each\n",t / NSPAWN * 1e6);
+	return 0;
+}
+
+static void
+pong(int i,void *v1,void *v2)
+{
+	for(;;){
+		kwait(&Ping);
+		ksignal(&Pong,1);
+	}
+}
+
+static void
+spawned(int i,void *v1,void *v2)
+{
+	Spawned++;
+	ksignal(&Spawned,1);
+}
@@ -0,0 +1,69 @@
+/* TCP loss benchmark: bulk transfers to the discard server through the
+ * network simulator (net/inet/sim.c) at 1% to 5% packet loss, with
+ * and without selective acknowledgments, reporting the goodput of
+ * each. The simulator delays each packet by the given propagation
+ * delay in each direction.
+ *
+ * usage: bench_tcpsim [bytes [delay ms]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "commands.h"
+#include "net/core/mbuf.h"
+#include "core/socket.h"
+#include "net/inet/tcp.h"
+
+#include "bench/bench.h"
+
+static void sim(char *param,long value);
+
+int
+main(int argc,char *argv[])
+{
+	long bytes = 1000000;
+	long delay = 10;
+	int loss,sack;
+	double t;
+
+	if(argc > 1)
+		bytes = atol(argv[1]);
+	if(argc > 2)
+		delay = atol(argv[2]);
+	bench_init();
+	Tcp_mss = 1460;
+	Tcp_window = 32768;	/* Before the server's listener takes it */
+	dis1(1,NULL,NULL);
+	sim("propdelay",delay);
+
+	for(loss=1;loss<=5;loss++){
+		sim("loss",loss);
+		for(sack=0;sack<=1;sack++){
+			Tcp_sack = sack;
+			srandom(loss);
+			if((t = bench_bulk(IPPORT_DISCARD,bytes,8192)) < 0){
+				fprintf(stderr,"Transfer failed\n");
+				return 1;
+			}
+			printf("%d%% loss, SACK %-3s: %.1f kB/s\n",loss,
+			 sack ? "on" : "off",bytes / t / 1000);
+		}
+	}
+	return 0;
+}
+
+static void
+sim(char *param,long value)
+{
+	char buf[20];
+	char *argv[3];
+
+	sprintf(buf,"%ld",value);
+	argv[0] = "sim";
+	argv[1] = param;
+	argv[2] = buf;
+	dosim(3,argv,NULL);
+}
@@ -0,0 +1,79 @@
+/* Timer benchmark: start and stop a large population of timers, as the
+ * TCP, LAPB and NET/ROM retransmission timers do, and report the rate.
+ *
+ * usage: bench_timer [timers [rounds]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "core/timer.h"
+
+#include "bench/bench.h"
+
+static void expired(void *arg);
+
+int
+main(int argc,char *argv[])
+{
+	struct timer *timers;
+	int ntimers = 100000;
+	int rounds = 10;
+	int i,r;
+	long ops;
+	double t;
+
+	if(argc > 1)
+		ntimers = atoi(argv[1]);
+	if(argc > 2)
+		rounds = atoi(argv[2]);
+	bench_init();
+
+	timers = (struct timer *)calloc(ntimers,sizeof(struct timer));
+	srandom(1);
+	for(i=0;i<ntimers;i++){
+		/* Long enough that none fire while we're at it */
+		set_timer(&timers[i],1000 + random() % 60000);
+		timers[i].func = expired;
+		timers[i].arg = &timers[i];
+	}
+	/* Start them all, then stop them in a scattered order */
+	ops = 0;
+	t = bench_now();
+	for(r=0;r<rounds;r++){
+		for(i=0;i<ntimers;i++)
+			start_timer(&timers[i]);
+		for(i=0;i<ntimers;i++)
+			stop_timer(&timers[(i * 7919L) % ntimers]);
+		ops += 2L * ntimers;
+	}
+	t = bench_now() - t;
+	printf("start/stop: %d timers, %ld ops in %.3f s: %.0f ops/sec\n",
+	 ntimers,ops,t,ops / t);
+
+	/* Restart running timers, as every ack does to a retransmit timer */
+	for(i=0;i<ntimers;i++)
+		start_timer(&timers[i]);
+	ops = 0;
+	t = bench_now();
+	for(r=0;r<rounds;r++){
+		for(i=0;i<ntimers;i++)
+			start_timer(&timers[(i * 7919L) % ntimers]);
+		ops += ntimers;
+	}
+	t = bench_now() - t;
+	printf("restart: %d timers, %ld ops in %.3f s: %.0f ops/sec\n",
+	 ntimers,ops,t,ops / t);
+	for(i=0;i<ntimers;i++)
+		stop_timer(&timers[i]);
+	free(timers);
+	return 0;
+}
+
+static void
+expired(void *arg)
+{
+	fprintf(stderr,"timer %p expired during the run\n",arg);
+}
@@ -0,0 +1,73 @@
+/* Window benchmark: bulk transfers to the discard server through the
+ * network simulator (net/inet/sim.c) over a 50 ms round trip, with
+ * fixed windows of several sizes and then with auto-tuning, reporting
+ * the throughput of each. A fixed window can't carry more than one
+ * window per round trip. The discard server is restarted for each run,
+ * since its listener fixes the window of the connections it accepts.
+ *
+ * usage: bench_window [bytes [rtt ms]]
+ */
+#include "top.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "commands.h"
+#include "net/core/mbuf.h"
+#include "core/socket.h"
+#include "net/inet/tcp.h"
+
+#include "bench/bench.h"
+
+static void run(char *what,long bytes);
+
+static int32 Windows[] = { DEF_WND, 16384, 65535 };
+
+int
+main(int argc,char *argv[])
+{
+	char buf[32];
+	char *args[3];
+	long bytes = 1000000;
+	long rtt = 50;
+	int i;
+
+	if(argc > 1)
+		bytes = atol(argv[1]);
+	if(argc > 2)
+		rtt = atol(argv[2]);
+	bench_init();
+	Tcp_mss = 1460;
+	sprintf(buf,"%ld",rtt / 2);
+	args[0] = "sim";
+	args[1] = "propdelay";
+	args[2] = buf;
+	dosim(3,args,NULL);
+
+	Tcp_autotune = 0;
+	for(i=0;i<(int)(sizeof(Windows)/sizeof(Windows[0]));i++){
+		Tcp_window = Windows[i];
+		sprintf(buf,"window %ld",(long)Windows[i]);
+		run(buf,bytes);
+	}
+	Tcp_autotune = 1;
+	Tcp_window = DEF_WND;
+	run("auto-tuned",bytes);
+	return 0;
+}
+
+static void
+run(char *what,long bytes)
+{
+	double t;
+
+	dis1(1,NULL,NULL);
+	t = bench_bulk(IPPORT_DISCARD,bytes,8192);
+	dis0(1,NULL,NULL);
+	if(t < 0){
+		fprintf(stderr,"Transfer failed\n");
+		exit(1);
+	}
+	printf("%-14s: %.1f kB/s\n",what,bytes / t / 1000);
+}
@@ -45,6 +45,7 @@
 #include <fcntl.h>
 #include "bm.h"
 #include "mailbox.h"
+#include "lib/smtp/mailidx.h"
 
 #ifdef SETVBUF
 #define		MYBUF	1024
@@ -54,7 +55,7 @@ extern long kftell();
 static char Badmsg[] = "Invalid Message number %d\n";
 static char Nomail[] = "No messages\n";
 static char Noaccess[] = "Unable to access %s\n";
-static int readnotes(struct mbx *m,kFILE *ifile,int update);
+static int readnotes(struct mbx *m,struct mailarea *ma,int update);
 static long isnewmail(struct mbx *m);
 static int initnotes(struct mbx *m);
 static int lockit(struct mbx *m);
@@ -66,31 +67,26 @@ static int
 initnotes(m)
 struct mbx *m;
 {
-	kFILE	*ktmpfile();
-	kFILE	*ifile;
 	register struct	let *cmsg;
+	struct mailarea ma;
 	char buf[256];
 	int 	i, ret;
 
+	mfclose(m);
 	sprintf(buf,"%s/%s.txt",Mailspool,m->area);
-	if ((ifile = kfopen(buf,READ_TEXT)) == NULL)
+	if ((m->mfile = kfopen(buf,READ_TEXT)) == NULL)
 		return 0;
-	kfseek(ifile,0L,2);	 /* go to end of file */
-	m->mboxsize = kftell(ifile);
-	krewind(ifile);
-	if(!STRICMP(m->area,m->name)) /* our private mail area */
-		m->mysize = m->mboxsize;
-	if ((m->mfile = ktmpfile()) == NULL) {
-		(void) kfclose(ifile);
+	if (mi_open(buf,&ma) != 0) {
+		mfclose(m);
 		return -1;
 	}
+	m->mboxsize = ma.size;
+	if(!STRICMP(m->area,m->name)) /* our private mail area */
+		m->mysize = m->mboxsize;
 #ifdef	SETVBUF
 	if (m->stdinbuf == NULL)
 		m->stdinbuf = mallocw(MYBUF);
-	ksetvbuf(ifile, m->stdinbuf, _kIOFBF, MYBUF);
-	if (m->stdoutbuf == NULL)
-		m->stdoutbuf = mallocw(MYBUF);
-	ksetvbuf(m->mfile, m->stdoutbuf, _kIOFBF, MYBUF);
+	ksetvbuf(m->mfile, m->stdinbuf, _kIOFBF, MYBUF);
 #endif
 	m->nmsgs = 0;
 	m->current = 0;
@@ -100,12 +96,8 @@ struct mbx *m;
 	/* Allocate space for reading messages */
 	free(m->mbox);
 	m->mbox = (struct let *)callocw(Maxlet+1,sizeof(struct let));
-	ret = readnotes(m,ifile,0);
-	(void) kfclose(ifile);
-#ifdef SETVBUF
-	free(m->stdinbuf);
-	m->stdinbuf = NULL;
-#endif
+	ret = readnotes(m,&ma,0);
+	mi_free(&ma);
 	if (ret != 0)
 		return -1;
 	for (cmsg = &m->mbox[1],i = 1; i <= m->nmsgs; i++, cmsg++)  
@@ -121,65 +113,35 @@ struct mbx *m;
 	return 0;
 }
 
-/* readnotes assumes that ifile is pointing to the first
- * message that needs to be read.  For initial reads of a
- * notesfile, this will be the beginning of the file.  For
- * rereads when new mail arrives, it will be the first new
- * message.
+/* readnotes lists the messages in the area's index. They are read in
+ * place from the area file, m->mfile, so only their extents are needed;
+ * whatever reads a whole header leaves out its Status line. For rereads
+ * when new mail arrives, the status of the messages already read in is
+ * kept.
  */
 static int
-readnotes(m,ifile,update)
+readnotes(m,ma,update)
 struct mbx *m;
-kFILE *ifile ;
+struct mailarea *ma;
 int update;	/* true if this is not the initial read of the notesfile */
 {
-	char 	tstring[LINELEN];
-	long	cpos;
 	register struct	let *cmsg;
-	register char *line;
-
-	cmsg = (struct let *)NULL;
-	line = tstring;
-	while(kfgets(line,LINELEN,ifile) != NULL) {
-		/* scan for begining of a message */
-		if(strncmp(line,"From ",5) == 0) {
-			kwait(NULL);
-			cpos = kftell(m->mfile);
-			kfputs(line,m->mfile);
-			if (m->nmsgs == Maxlet) {
-				kprintf("Mail box full: > %d messages\n",Maxlet);
-				mfclose(m);
-				return -1;
-			}
-			m->nmsgs++;
-			cmsg = &m->mbox[m->nmsgs];
-			cmsg->start = cpos;
-			if(!update)
-				cmsg->status = 0;
-			cmsg->size = strlen(line);
-			while (kfgets(line,LINELEN,ifile) != NULL) {
-				if (*line == '\n') { /* done header part */
-					cmsg->size++;
-					kputc(*line, m->mfile);
-					break;
-				}
-				if (htype(line) == STATUS) {
-					if (line[8] == 'R') 
-						cmsg->status |= BM_READ;
-					continue;
-				}
-				cmsg->size += strlen(line);
-				if (kfputs(line,m->mfile) == kEOF) {
-					kprintf("tmp file: %s",ksys_errlist[kerrno]);
-					mfclose(m);
-					return -1;
-				}
+	struct mailmsg *mp;
+	int i;
 
-			}
-		} else if (cmsg) {
-			cmsg->size += strlen(line);
-			kfputs(line,m->mfile);
+	for(i = 0, mp = ma->msgs; i < ma->nmsgs; i++, mp++) {
+		if (m->nmsgs == Maxlet) {
+			kprintf("Mail box full: > %d messages\n",Maxlet);
+			mfclose(m);
+			return -1;
 		}
+		m->nmsgs++;
+		cmsg = &m->mbox[m->nmsgs];
+		cmsg->start = mp->start;
+		cmsg->size = mp->size;
+		if(!update)
+			cmsg->status = 0;
+		cmsg->status |= mp->status & BM_READ;
 	}
 	return 0;
 }
@@ -327,14 +289,13 @@ int noheader;
 	kfseek(m->mfile,m->mbox[msg].start,0);
 	size = m->mbox[msg].size;
 
-	if (noheader) {
-		/* skip header */
-		while (size > 0 && kfgets(tstring,sizeof(tstring),m->mfile)
-		       != NULL) {
-			size -= strlen(tstring);
-			if (*tstring == '\n')
-				break;
-		}
+	/* The header, less its Status line, unless it's not wanted */
+	while (size > 0 && kfgets(tstring,sizeof(tstring),m->mfile) != NULL) {
+		size -= strlen(tstring);
+		if (!noheader && htype(tstring) != STATUS)
+			kfputs(tstring,tfile);
+		if (*tstring == '\n')
+			break;
 	}
 	while (size > 0 && kfgets(tstring,sizeof(tstring),m->mfile)
 	       != NULL) {
@@ -379,17 +340,19 @@ void *p;
 	}
 	return 0;
 }
-/* close the temp file while coping mail back to the mailbox */
+/* close the mail area, writing it back first if it was changed */
 int
 closenotes(m)
 struct mbx *m;
 {
 	register struct	let *cmsg;
 	register char *line;
-	char tstring[LINELEN], buf[256];
-	long size;
-	int i, nostatus = 0, nodelete;
+	char tstring[LINELEN], buf[256], tmpname[256];
+	long size, pos;
+	int i, len, nostatus = 0, nodelete;
 	kFILE	*nfile;
+	struct mailarea ma;
+	struct mailmsg *mp;
 
 	if (m->mfile == NULL)
 		return 0;
@@ -430,61 +393,100 @@ struct mbx *m;
 	if(lockit(m))
 		return -1;
 	sprintf(buf,"%s/%s.txt",Mailspool,m->area);
-	if ((nfile = kfopen(buf,WRITE_TEXT)) == NULL) {
-		kprintf(Noaccess,buf);
+	sprintf(tmpname,"%s/%s.tmp",Mailspool,m->area);
+	/* Build the new file beside the old and rename it into place,
+	 * since a POP session may be reading the old one as it stands
+	 */
+	if ((nfile = kfopen(tmpname,WRITE_TEXT)) == NULL) {
+		kprintf(Noaccess,tmpname);
 		mfclose(m);
 		m->mboxsize = 0;
 		rmlock(Mailspool,m->area);
 		return -1;
 	}
-	/* copy tmp file back to notes file */
+	/* copy the messages kept to the new file, indexing it as we go */
+	memset(&ma,0,sizeof(ma));
+	pos = 0;
 	for (cmsg = &m->mbox[1],i = 1; i <= m->nmsgs; i++, cmsg++) {
 		kfseek(m->mfile,cmsg->start,0);
 		size = cmsg->size;
 		/* It is not possible to delete messages if nodelete is set */
 		if ((cmsg->status & BM_DELETE) && !nodelete)
 			continue;
+		mp = mi_add(&ma);
+		mp->start = pos;
 		/* copy the header */
 		while (size > 0 && kfgets(line,LINELEN,m->mfile) != NULL) {
-			size -= strlen(line);
+			size -= (len = strlen(line));
 			if (*line == '\n') {
-				if (cmsg->status & BM_FORWARDED)
-					kfprintf(nfile,"%s%s\n",Hdrs[XFORWARD],
-						m->name);
-				if ((cmsg->status & BM_READ) != 0 && !nostatus)
-					kfprintf(nfile,"%sR\n",Hdrs[STATUS]);
-				kfprintf(nfile,"\n");
+				if (cmsg->status & BM_FORWARDED) {
+					pos += kfprintf(nfile,"%s%s\n",
+						Hdrs[XFORWARD],m->name);
+					mp->lines++;
+				}
+				if ((cmsg->status & BM_READ) != 0 && !nostatus) {
+					pos += kfprintf(nfile,"%sR\n",
+						Hdrs[STATUS]);
+					mp->lines++;
+					mp->status |= BM_READ;
+				}
+				pos += kfprintf(nfile,"\n");
+				mp->lines++;
 				break;
 			}
+			if (htype(line) == STATUS)
+				continue;	/* Replaced above */
 			kfputs(line,nfile);
+			pos += len;
+			if (line[len-1] == '\n')
+				mp->lines++;
 			/* kwait(NULL);  can cause problems if exiting NOS */
 		}
+		mp->hdrlen = pos - mp->start;
 		while (size > 0 && kfgets(line,LINELEN,m->mfile) != NULL) {
 			kfputs(line,nfile);
-			size -= strlen(line);
+			size -= (len = strlen(line));
+			pos += len;
+			if (line[len-1] == '\n')
+				mp->lines++;
 			/* kwait(NULL);   dont want no damaged files */
-			if (kferror(nfile)) {
-				kprintf("Error writing mail file\n");
-				(void) kfclose(nfile);
-				mfclose(m);
-				m->mboxsize = 0;
-				rmlock(Mailspool,m->area);
-				return -1;
-			}
+			if (kferror(nfile))
+				goto writerr;
 		}
+		mp->size = pos - mp->start;
 	}
 	m->nmsgs = 0;
+	if (kfflush(nfile) != 0 || kferror(nfile))
+		goto writerr;
+	(void) kfclose(nfile);
+	unlink(buf);
+	mi_remove(buf);
 	if (!STRICMP(m->name,m->area))
-		m->mysize = kftell(nfile); /* Update the size of our mailbox */
+		m->mysize = pos; /* Update the size of our mailbox */
 	/* remove a zero length file */
-	if (kftell(nfile) == 0L)
-		(void) unlink(buf);
-	(void) kfclose(nfile);
+	if (pos == 0L)
+		(void) unlink(tmpname);
+	else {
+		rename(tmpname,buf);
+		ma.size = pos;
+		mi_write(buf,&ma);
+	}
+	mi_free(&ma);
 	mfclose(m);
 	m->mboxsize = 0;
 	rmlock(Mailspool,m->area);
 	kwait(NULL);
 	return 0;
+
+writerr:
+	kprintf("Error writing mail file\n");
+	(void) kfclose(nfile);
+	unlink(tmpname);
+	mi_free(&ma);
+	mfclose(m);
+	m->mboxsize = 0;
+	rmlock(Mailspool,m->area);
+	return -1;
 }
 
 /* Returns 1 if name is a public message Area, 0 otherwise */
@@ -573,7 +575,7 @@ void *p;
 	register int c, col, lin;
 	char	buf[MAXCOL+2], *cp, *cp2;
 	int	msg, cnt, i, usemore, verbose, mbxheader, pathcol;
-	int	header, lastheader;
+	int	header, lastheader, inheader;
 	long 	size;
 
 	m = (struct mbx *) p;
@@ -597,6 +599,7 @@ void *p;
 		m->current = msg;
 		header = NOHEADER;
 		mbxheader = 0;
+		inheader = 1;
 		if(*argv[0] == 'v')
 			verbose = 1;	/* display all header lines */
 		else
@@ -666,8 +669,10 @@ void *p;
 			if(col == 1 && !verbose && !mbxheader)
 			     /* last header line reached */
 			     mbxheader = 1;
-			if(verbose)
+			if(verbose && !(inheader && htype(buf) == STATUS))
 				kfputs(buf,kstdout);
+			if(col == 1)
+				inheader = 0;
 			if(!verbose && !mbxheader){
 				lastheader = header;
 				if(!isspace(*buf))
@@ -828,6 +833,7 @@ scanmail(m)		 /* Get any new mail */
 struct mbx *m;
 {
 	kFILE *nfile;
+	struct mailarea ma;
 	int ret, cnt;
 	char buf[256];
 	long diff;
@@ -849,20 +855,27 @@ struct mbx *m;
 	sprintf(buf,"%s/%s.txt",Mailspool,m->area);
 	if ((nfile = kfopen(buf,READ_TEXT)) == NULL)
 		kprintf(Noaccess,buf);
-	else {
-		/* rewind tempfile */
-		kfseek(m->mfile,0L,0);
+	else if (mi_open(buf,&ma) != 0) {
+		kprintf(Noaccess,buf);
+		(void) kfclose(nfile);
+	} else {
+		/* Read from the area as it now stands */
+		(void) kfclose(m->mfile);
+		m->mfile = nfile;
+#ifdef	SETVBUF
+		ksetvbuf(m->mfile, m->stdinbuf, _kIOFBF, MYBUF);
+#endif
 		cnt = m->nmsgs;
 		/* Reread all messages since size they may have changed
 		 * in size after a X-Forwarded-To line was added.
 		 */
 		m->nmsgs = 0;
-		ret = readnotes(m,nfile,1);   /* get the mail */
+		ret = readnotes(m,&ma,1);   /* get the mail */
 		m->newmsgs += m->nmsgs - cnt;
-		m->mboxsize = kftell(nfile);
+		m->mboxsize = ma.size;
 		if(!STRICMP(m->name,m->area))
 			m->mysize = m->mboxsize;
-		(void) kfclose(nfile);
+		mi_free(&ma);
 		if (ret != 0)
 			kprintf("Error updating mail file\n");
 	}
@@ -914,7 +927,7 @@ char *name;
 	return cnt;
 }
 
-/* close the temporary mail file */
+/* close the mail area file */
 static void
 mfclose(m)
 struct mbx *m;
@@ -923,8 +936,8 @@ struct mbx *m;
 		kfclose(m->mfile);
 	m->mfile = NULL;
 #ifdef SETVBUF
-	free(m->stdoutbuf);
-	m->stdoutbuf = NULL;
+	free(m->stdinbuf);
+	m->stdinbuf = NULL;
 #endif
 }
 
@@ -107,7 +107,7 @@ int argc;
 char *argv[];
 void *p;
 {
-	int i,bits;
+	int bits;
 	struct route *rp;
 
 	if(argc >= 2)
@@ -121,11 +121,9 @@ void *p;
 "Dest            Len Interface    Gateway          Metric  P Timer  Use\n");
 
 	for(bits=31;bits>=0;bits--){
-		for(i=0;i<HASHMOD;i++){
-			for(rp = Routes[bits][i];rp != NULL;rp = rp->next){
-				if(dumproute(rp) == kEOF)
-					return 0;
-			}
+		for(rp = Routes[bits];rp != NULL;rp = rp->next){
+			if(dumproute(rp) == kEOF)
+				return 0;
 		}
 	}
 	if(R_default.iface != NULL)
@@ -237,18 +235,16 @@ void *p;
 {
 	struct route *rp;
 	struct route *rptmp;
-	int i,j;
+	int j;
 	
 	if(R_default.timer.state == TIMER_RUN){
 		rt_drop(0,0);	/* Drop default route */
 	}
-	for(i=0;i<HASHMOD;i++){
-		for(j=0;j<32;j++){
-			for(rp = Routes[j][i];rp != NULL;rp = rptmp){
-				rptmp = rp->next;
-				if(rp->timer.state == TIMER_RUN){
-					rt_drop(rp->target,rp->bits);
-				}
+	for(j=0;j<32;j++){
+		for(rp = Routes[j];rp != NULL;rp = rptmp){
+			rptmp = rp->next;
+			if(rp->timer.state == TIMER_RUN){
+				rt_drop(rp->target,rp->bits);
 			}
 		}
 	}
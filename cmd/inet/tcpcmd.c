@@ -18,10 +18,18 @@
 #include "net/inet/tcp.h"
 
 int Tcp_tstamps = 1;
+int Tcp_sack = 1;
+int Tcp_autotune = 1;
+int32 Tcp_maxwnd = DEF_MAXWND;
+struct tcp_cc *Tcp_cc = &Tcp_ccs[0];	/* Default congestion control */
 
+static int doautotune(int argc,char *argv[],void *p);
+static int docc(int argc,char *argv[],void *p);
 static int doirtt(int argc,char *argv[],void *p);
+static int domaxwnd(int argc,char *argv[],void *p);
 static int domss(int argc,char *argv[],void *p);
 static int dortt(int argc,char *argv[],void *p);
+static int dosack(int argc,char *argv[],void *p);
 static int dotcpkick(int argc,char *argv[],void *p);
 static int dotcpreset(int argc,char *argv[],void *p);
 static int dotcpstat(int argc,char *argv[],void *p);
@@ -35,11 +43,15 @@ static void tcprepstat(int interval,void *p1,void *p2);
 
 /* TCP subcommand table */
 static struct cmds Tcpcmds[] = {
+	{ "autotune",	doautotune,	0, 0,	NULL },
+	{ "cc",		docc,		0, 0,	NULL },
 	{ "irtt",	doirtt,		0, 0,	NULL },
 	{ "kick",	dotcpkick,	0, 2,	"tcp kick <tcb>" },
+	{ "maxwindow",	domaxwnd,	0, 0,	NULL },
 	{ "mss",	domss,		0, 0,	NULL },
 	{ "reset",	dotcpreset,	0, 2,	"tcp reset <tcb>" },
 	{ "rtt",	dortt,		0, 3,	"tcp rtt <tcb> <val>" },
+	{ "sack",	dosack,		0, 0,	NULL },
 	{ "status",	dotcpstat,	0, 0,	"tcp stat <tcb> [<interval>]" },
 	{ "syndata",	dosyndata,	0, 0,	NULL },
 	{ "timestamps",	dotimestamps,	0, 0,   NULL },
@@ -71,6 +83,59 @@ void *p;
 {
 	return setbool(&Tcp_tstamps,"TCP timestamps",argc,argv);
 }
+static int
+doautotune(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	return setbool(&Tcp_autotune,"TCP buffer auto-tuning",argc,argv);
+}
+static int
+dosack(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	return setbool(&Tcp_sack,"TCP selective acks",argc,argv);
+}
+
+/* Show or set the congestion control algorithm, either the default for
+ * new connections or, if a TCB is given, that of one connection
+ */
+static int
+docc(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	struct tcb *tcb = NULL;
+	struct tcp_cc *cc;
+
+	if(argc > 1 && cc_lookup(argv[1]) == NULL
+	 && tcpval((struct tcb *)htol(argv[1]))){
+		tcb = (struct tcb *)htol(argv[1]);
+		argc--;
+		argv++;
+	}
+	if(argc < 2){
+		kprintf("TCP congestion control: %s (",
+		 tcb != NULL ? tcb->cc->name : Tcp_cc->name);
+		for(cc = Tcp_ccs;cc->name != NULL;cc++)
+			kprintf("%s%s",cc == Tcp_ccs ? "" : " ",cc->name);
+		kprintf(")\n");
+		return 0;
+	}
+	if((cc = cc_lookup(argv[1])) == NULL){
+		kprintf("Unknown algorithm %s\n",argv[1]);
+		return 1;
+	}
+	if(tcb != NULL)
+		cc_set(tcb,cc);
+	else
+		Tcp_cc = cc;
+	return 0;
+}
 
 /* Eliminate a TCP connection */
 static int
@@ -157,6 +222,16 @@ void *p;
 	return setuns(&Tcp_mss,"TCP MSS",argc,argv);
 }
 
+/* Set the largest size auto-tuning may take the buffers to */
+static int
+domaxwnd(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	return setlong(&Tcp_maxwnd,"TCP max auto-tuned window",argc,argv);
+}
+
 /* Set default window size */
 static int
 dowindow(argc,argv,p)
@@ -254,6 +329,10 @@ tstat()
 	}
 	if((j % 2) == 0)
 		kprintf("\n");
+	kprintf("TCB lookups: %lu, probes %lu (avg %lu.%02lu)\n",
+	 Tcb_lookups,Tcb_probes,
+	 Tcb_lookups != 0 ? Tcb_probes/Tcb_lookups : 0,
+	 Tcb_lookups != 0 ? (Tcb_probes%Tcb_lookups)*100/Tcb_lookups : 0);
 
 	kprintf(__FWPTR"  Rcv-Q  Snd-Q           Local socket          Remote socket State\n", "&TCB");
 	for(tcb=Tcbs;tcb != NULL;tcb = tcb->next){
@@ -340,6 +419,8 @@ struct tcb *tcb;
 		kprintf("     INF");
 	if(tcb->flags.retran)
 		kprintf(" Retry");
+	if(tcb->flags.recovery)
+		kprintf(" Recovery");
 	kprintf("\n");
 
 	kprintf("Timer        Count  Duration  Last RTT      SRTT      Mdev   Method\n");
@@ -356,16 +437,39 @@ struct tcb *tcb;
 	}
 	kprintf(" %10lu%10lu%10lu%10lu%10lu",(long)read_timer(&tcb->timer),
 	 (long)dur_timer(&tcb->timer),tcb->rtt,tcb->srtt,tcb->mdev);
-	kprintf("   %s\n",tcb->flags.ts_ok ? "timestamps":"standard");
+	kprintf("   %s%s\n",tcb->flags.ts_ok ? "timestamps":"standard",
+	 tcb->flags.sack_ok ? " sack":"");
 
-	if(tcb->reseq != (struct reseq *)NULL){
-		struct reseq *rp;
+	kprintf("Congestion control: %s",tcb->cc->name);
+	if(tcb->cc->pacing_rate != NULL)
+		kprintf("  pacing %lu bytes/sec",(*tcb->cc->pacing_rate)(tcb));
+	kprintf("\n");
+	if(tcb->cc->status != NULL)
+		(*tcb->cc->status)(tcb);
+	kprintf("Buffers: send %lu recv %lu  window scale %u/%u  recv RTT %lu\n",
+	 tcb->limit,tcb->window,tcb->snd.wind_scale,tcb->rcv.wind_scale,
+	 tcb->rcvrtt);
 
-		kprintf("Reassembly queue:\n");
-		for(rp = tcb->reseq;rp != (struct reseq *)NULL; rp = rp->next){
-			kprintf("  seq x%lx %u bytes\n",rp->seg.seq,rp->length);
+	if(tcb->nreseq != 0){
+		struct reseq *rp;
+		int32 bytes = 0;
+
+		for(rp = tcb->reseq;rp < &tcb->reseq[tcb->nreseq];rp++)
+			bytes += rp->length;
+		kprintf("Reassembly queue: %d ranges (of %d), %lu bytes\n",
+		 tcb->nreseq,TCP_MAXRESEQ,bytes);
+		for(rp = tcb->reseq;rp < &tcb->reseq[tcb->nreseq];rp++){
+			kprintf("  seq x%lx %u bytes%s\n",rp->seg.seq,rp->length,
+			 rp->seg.flags.fin ? " FIN" : "");
 		}
 	}
+	if(tcb->sacked != NULL){
+		struct sackent *sp;
+
+		kprintf("SACK scoreboard:\n");
+		for(sp = tcb->sacked;sp != NULL;sp = sp->next)
+			kprintf("  seq x%lx-x%lx\n",sp->start,sp->end);
+	}
 }
 static int
 keychar(c)
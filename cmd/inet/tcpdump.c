@@ -36,6 +36,7 @@ int check;		/* 0 if checksum test is to be bypassed */
 	struct pseudo_header ph;
 	uint csum;
 	uint dlen;
+	int i;
 
 	if(bpp == NULL || *bpp == NULL)
 		return;
@@ -77,6 +78,10 @@ int check;		/* 0 if checksum test is to be bypassed */
 		kfprintf(fp," WSCALE %u",seg.wsopt);
 	if(seg.flags.tstamp)
 		kfprintf(fp," TSTAMP %lu TSECHO %lu",seg.tsval,seg.tsecr);
+	if(seg.flags.sackperm)
+		kfprintf(fp," SACKOK");
+	for(i=0;i<seg.nsack;i++)
+		kfprintf(fp," SACK x%lx-x%lx",seg.sack[i].start,seg.sack[i].end);
 	if((dlen = len_p(*bpp)) != 0)
 		kfprintf(fp," Data %u",dlen);
 	if(check && csum != 0)
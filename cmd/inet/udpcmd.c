@@ -35,7 +35,7 @@ int n;
 	if(n == 0)
 		kprintf("&UCB      Rcv-Q  Local socket\n");
 
-	return kprintf("%09p%6u  %s\n",udp,udp->rcvcnt,pinet(&udp->socket));
+	return kprintf("%09p%6u  %s\n",udp,len_mq(&udp->rcvq),pinet(&udp->socket));
 }
 
 /* Dump UDP statistics and control blocks */
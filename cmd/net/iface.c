@@ -78,7 +78,7 @@ showiface(struct iface *ifp)
 	 kprintf("           output forward to %s\n",ifp->forw->name);
 	kprintf("           sent: ip %lu tot %lu idle %s qlen %u",
 	ifp->ipsndcnt,ifp->rawsndcnt,tformat(secclock() - ifp->lastsent),
-	 len_q(ifp->outq));
+	 len_mq(&ifp->outq));
 	if(ifp->outlim != 0)
 		kprintf("/%u",ifp->outlim);
 	if(ifp->txbusy)
@@ -86,6 +86,11 @@ showiface(struct iface *ifp)
 	kprintf("\n");
 	kprintf("           recv: ip %lu tot %lu idle %s\n",
 	 ifp->iprecvcnt,ifp->rawrecvcnt,tformat(secclock() - ifp->lastrecv));
+	if(ifp->txproc != NULL){
+		kprintf("           tx batches: 1 %lu 2-3 %lu 4-7 %lu 8-15 %lu 16 %lu\n",
+		 ifp->txhist[0],ifp->txhist[1],ifp->txhist[2],ifp->txhist[3],
+		 ifp->txhist[4]);
+	}
 }
 
 /* Set interface parameters */
@@ -62,8 +62,38 @@ int	Smtpmode = 0;
 
 static struct smtpcli *cli_session[MAXSESSIONS]; /* queue of client sessions  */
 
+/* The outbound queue is read from disk once and then kept up to date as
+ * jobs are queued and sent, so that a tick needn't open every work file.
+ * Routes are looked up once per destination host rather than once per
+ * job, and a host that can't be reached is left alone for a while,
+ * doubling the wait each time it fails again.
+ */
+static struct smtpq *Smtpq;		/* Index of the outbound queue */
+static struct smtpq *Smtpqtail;
+static struct smtpq *Smtpqnew;		/* Jobs queued while it's being read */
+static struct smtpq *Smtpqnewtail;
+static int Smtpqloaded;			/* Index has been read from disk */
+static int Smtpqloading;		/* ...and is being read right now */
+static struct smtphost *Smtphosts;	/* Hosts we have mail for */
+static int32 Smtpbackmin = SMTPBACKMIN;
+static int32 Smtpbackmax = SMTPBACKMAX;
+static int Smtpticking;
+
 static void del_job(struct smtp_job *jp);
 static void del_session(struct smtpcli *cb);
+static int dobackoff(int argc,char *argv[],void *p);
+static int dosmtphosts(int argc,char *argv[],void *p);
+static struct smtphost *gethost(char *name);
+static void hostdone(int32 addr,int ok);
+static void hostfail(struct smtphost *hp);
+static void smtpq_done(struct smtp_job *jp);
+static void smtpq_free(struct smtpq *qp);
+static void smtpq_link(struct smtpq **headp,struct smtpq **tailp,
+	struct smtpq *qp);
+static void smtpq_load(void);
+static struct smtpq *smtpq_new(char *id,char *host,char *from);
+static void smtpq_unlink(struct smtpq **headp,struct smtpq **tailp,
+	struct smtpq *qp);
 static int dogateway(int argc,char *argv[],void *p);
 static int dosmtpmaxcli(int argc,char *argv[],void *p);
 static int dotimer(int argc,char *argv[],void *p);
@@ -80,13 +110,15 @@ static void retmail(struct smtpcli *cb);
 static void sendcmd(struct smtpcli *cb,char *fmt,...);
 static int smtpsendfile(struct smtpcli *cb);
 static int setsmtpmode(int argc,char *argv[],void *p);
-static struct smtp_job *setupjob(struct smtpcli *cb,char *id,char *from);
+static struct smtp_job *setupjob(struct smtpcli *cb,struct smtpq *qp);
 static void smtp_send(int unused,void *cb1,void *p);
 static int smtpkick(int argc,char *argv[],void *p);
 
 static struct cmds Smtpcmds[] = {
+	{ "backoff",	dobackoff,	0,	0,	NULL },
 	{ "batch",	dobatch,	0,	0,	NULL },
 	{ "gateway",	dogateway,	0,	0,	NULL },
+	{ "hosts",	dosmtphosts,	0,	0,	NULL },
 	{ "mode",	setsmtpmode,	0,	0,	NULL },
 	{ "kick",	smtpkick,	0,	0,	NULL },
 	{ "kill",	dosmtpkill,	0,	2,	"kill <jobnumber>" },
@@ -156,14 +188,62 @@ char *argv[];
 void *p;
 {
 	int32 n;
+	struct smtphost *hp;
 
 	if(argc < 2){
 		kprintf("%s\n",inet_ntoa(Gateway));
 	} else if((n = resolve(argv[1])) == 0){
 		kprintf(Badhost,argv[1]);
 		return 1;
-	} else
+	} else {
 		Gateway = n;
+		/* Routes may have changed, and unknown hosts now have one */
+		for(hp = Smtphosts;hp != NULL;hp = hp->next){
+			hp->expires = 0;
+			if(hp->addr == 0)
+				hp->retry = hp->backoff = 0;
+		}
+	}
+	return 0;
+}
+
+/* Set the shortest and longest retry delays after a failure */
+static int
+dobackoff(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	if(argc < 2){
+		kprintf("%ld/%ld\n",(long)Smtpbackmin,(long)Smtpbackmax);
+		return 0;
+	}
+	Smtpbackmin = atol(argv[1]);
+	Smtpbackmax = argc > 2 ? atol(argv[2]) : Smtpbackmin;
+	if(Smtpbackmax < Smtpbackmin)
+		Smtpbackmax = Smtpbackmin;
+	return 0;
+}
+
+/* List the hosts we have mail for, with their routes and retry times */
+static int
+dosmtphosts(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	struct smtphost *hp;
+	int32 now;
+
+	now = secclock();
+	kprintf("Host                 Route            Jobs Retry\n");
+	for(hp = Smtphosts;hp != NULL;hp = hp->next){
+		kprintf("%-20s %-16s %4d",hp->name,
+		 hp->addr != 0 ? inet_ntoa(hp->addr) : "",hp->refs);
+		if(hp->retry > now)
+			kprintf(" %ld",(long)(hp->retry - now));
+		kprintf("\n");
+	}
 	return 0;
 }
 
@@ -194,11 +274,12 @@ void *p;
 	char	status;
 	struct stat stbuf;
 	struct tm *tminfo, *localtime();
+	struct filedir *fdp;
 	kFILE *fp;
 
 	kprintf("S     Job    Size Date  Time  Host                 From\n");
-	filedir(Mailqueue,0,line);
-	while(line[0] != '\0') {
+	fdp = filedir_open(Mailqueue);
+	while(filedir_next(fdp,line) == 0) {
 		sprintf(tstring,"%s/%s",Mailqdir,line);
 		if ((fp = kfopen(tstring,READ_TEXT)) == NULL) {
 			kprintf("Can't open %s: %s\n",tstring,ksys_errlist[kerrno]);
@@ -232,8 +313,8 @@ void *p;
 		kprintf("\n");
 		(void) kfclose(fp);
 		kwait(NULL);
-		filedir(Mailqueue,1,line);
 	}
+	filedir_close(fdp);
 	return 0;
 }
 
@@ -246,6 +327,8 @@ void *p;
 {
 	char s[SLINELEN];
 	char *cp,c;
+	struct smtpq *qp;
+
 	sprintf(s,"%s/%s.lck",Mailqdir,argv[1]);
 	cp = strrchr(s,'.');
 	if (!access(s,0)) {
@@ -261,6 +344,18 @@ void *p;
 		kprintf("Job id %s not found\n",argv[1]);
 	strcpy(cp,".txt");
 	(void) unlink(s);
+	/* A job already handed to a session is dropped by it when it finds
+	 * the files gone
+	 */
+	for(qp = Smtpq;qp != NULL;qp = qp->next){
+		if(strcmp(qp->jobname,argv[1]) == 0){
+			if(!qp->busy){
+				smtpq_unlink(&Smtpq,&Smtpqtail,qp);
+				smtpq_free(qp);
+			}
+			break;
+		}
+	}
 	return 0;
 }
 
@@ -295,6 +390,8 @@ void *p;
 		kprintf(Badhost,argv[1]);
 		return 1;
 	}
+	if(argc < 2)
+		smtpq_load();	/* Pick up jobs queued behind our back */
 	smtptick(addr);
 	return 0;
 }
@@ -302,123 +399,113 @@ void *p;
 /* This is the routine that gets called every so often to do outgoing
  * mail processing. When called with a null argument, it runs the entire
  * queue; if called with a specific non-zero IP address from the remote
- * kick server, it only starts up sessions to that address.
+ * kick server, it only starts up sessions to that address, and forgets
+ * any earlier failures to reach it.
  */
 int
 smtptick(target)
 int32 target;
 {
 	register struct smtpcli *cb;
+	struct smtpq *qp;
+	struct smtphost *hp,*hpprev,*hpnext;
 	struct smtp_job *jp;
 	struct list *ap;
-	char	tmpstring[LINELEN], wfilename[13], prefix[9];
-	char	from[LINELEN], to[LINELEN];
-	char *cp, *cp1;
-	int32 destaddr;
-	kFILE *wfile;
+	int32 now;
 
 #ifdef SMTPTRACE
 	if (Smtptrace > 5)
 		kprintf("smtp daemon entered, target = %s\n",inet_ntoa(target));
 #endif
-	if(availmem() != 0){
-		/* Memory is tight, don't do anything */
+	if(availmem() != 0 || Smtpticking){
+		/* Memory is tight, or the timer and a kick overlap;
+		 * don't do anything
+		 */
 		/* Restart timer */
 		start_timer(&Smtpcli_t);
 		return 0;
 	}
-	for(filedir(Mailqueue,0,wfilename);wfilename[0] != '\0';
-		filedir(Mailqueue,1,wfilename)){
-
-		/* save the prefix of the file name which it job id */
-		cp = wfilename;
-		cp1 = prefix;
-		while (*cp && *cp != '.')
-			*cp1++ = *cp++;
-		*cp1 = '\0';
-
-		/* lock this file from the smtp daemon */
-		if (mlock(Mailqdir,prefix))
-			continue;
+	Smtpticking = 1;
+	if(!Smtpqloaded)
+		smtpq_load();
 
-		sprintf(tmpstring,"%s/%s",Mailqdir,wfilename);
-		if ((wfile = kfopen(tmpstring,READ_TEXT)) == NULL) {
-			/* probably too many open files */
-			(void) rmlock(Mailqdir,prefix);
-			/* continue to next message. The failure
-			* may be temporary */
+	/* Find routes for the hosts that are due a try. This may block,
+	 * so it's done before the queue itself is walked.
+	 */
+	for(hp = Smtphosts;hp != NULL;hp = hp->next){
+		if(target != 0 && hp->addr == target)
+			hp->retry = hp->backoff = 0;
+		now = secclock();
+		if(hp->refs == 0 || hp->retry > now || hp->expires > now)
 			continue;
+		hp->addr = mailroute(hp->name);
+		hp->expires = secclock() + SMTPROUTETTL;
+		if(hp->addr == 0){
+			kprintf("** smtp: Unknown address %s\n",hp->name);
+			hp->expires = 0;
+			hostfail(hp);
 		}
-
-		(void) kfgets(tmpstring,LINELEN,wfile);	/* read target host */
-		rip(tmpstring);
-
-		if ((destaddr = mailroute(tmpstring)) == 0) {
-			kfclose(wfile);
-			kprintf("** smtp: Unknown address %s\n",tmpstring);
-			(void) rmlock(Mailqdir,prefix);
+	}
+	now = secclock();
+	for(qp = Smtpq;qp != NULL;qp = qp->next){
+		hp = qp->host;
+		if(qp->busy || hp->addr == 0 || hp->retry > now)
 			continue;
-		}
-		if(target != 0 && destaddr != target){
-			kfclose(wfile);
-			(void) rmlock(Mailqdir,prefix);
+		if(target != 0 && hp->addr != target)
 			continue;	/* Not the proper target of a kick */
+		if((cb = lookup(hp->addr)) != NULL && cb->lock){
+			/* This system is already is sending mail lets not
+			* interfere with its send queue.
+			*/
+			continue;
 		}
-		if ((cb = lookup(destaddr)) == NULL) {
-			/* there are enough processes running already */
-			if (Smtpsessions >= Smtpmaxcli) {
+		if (cb == NULL && Smtpsessions >= Smtpmaxcli) {
+			/* there are enough processes running already;
+			 * only jobs for hosts being sent to can go now
+			 */
 #ifdef SMTPTRACE
-				if (Smtptrace) {
-					kprintf("smtp daemon: too many processes\n");
-				}
-#endif
-				kfclose(wfile);
-				(void) rmlock(Mailqdir,prefix);
-				break;
+			if (Smtptrace) {
+				kprintf("smtp daemon: too many processes\n");
 			}
+#endif
+			continue;
+		}
+		/* lock this file from the smtp daemon */
+		if (mlock(Mailqdir,qp->jobname))
+			continue;
+		if (cb == NULL) {
 			if ((cb = newcb()) == NULL) {
-				kfclose(wfile);
-				(void) rmlock(Mailqdir,prefix);
-				break;
-			} 
-			cb->ipdest = destaddr;
-			cb->destname = strdup(tmpstring);
-		} else {
-			if(cb->lock){
-				/* This system is already is sending mail lets not
-				* interfere with its send queue.
-				*/
-				kfclose(wfile);
-				(void) rmlock(Mailqdir,prefix);
+				(void) rmlock(Mailqdir,qp->jobname);
 				continue;
 			}
+			cb->ipdest = hp->addr;
+			cb->destname = strdup(hp->name);
 		}
-
-		(void) kfgets(from,LINELEN,wfile);	/* read from */
-		rip(from);
-		if ((jp = setupjob(cb,prefix,from)) == NULL) {
-			kfclose(wfile);
-			(void) rmlock(Mailqdir,prefix);
-			del_session(cb);
-			break;
-		}
-		while (kfgets(to,LINELEN,wfile) != NULL) {
-			rip(to);
-			if (addlist(&jp->to,to,DOMAIN) == NULL) {
-				kfclose(wfile);
-				del_session(cb);
-			}
-		}
-		kfclose(wfile);
+		jp = setupjob(cb,qp);
 #ifdef SMTPTRACE
 		if (Smtptrace > 1) {
-			kprintf("queue job %s From: %s To:",prefix,from);
+			kprintf("queue job %s From: %s To:",jp->jobname,jp->from);
 			for (ap = jp->to; ap != NULL; ap = ap->next)
 				kprintf(" %s",ap->val);
 			kprintf("\n");
 		}
 #endif
 	}
+	/* Forget hosts we no longer have mail for, once they're due */
+	for(hpprev = NULL,hp = Smtphosts;hp != NULL;hp = hpnext){
+		hpnext = hp->next;
+		if(hp->refs != 0 || hp->retry > now){
+			hpprev = hp;
+			continue;
+		}
+		if(hpprev == NULL)
+			Smtphosts = hpnext;
+		else
+			hpprev->next = hpnext;
+		free(hp->name);
+		free(hp);
+	}
+	Smtpticking = 0;
 
 	/* start sending that mail */
 	execjobs();
@@ -435,6 +522,9 @@ int32 target;
  * SMTP commands are sent in one swell foop before waiting for any of
  * the responses. Unfortunately, this breaks many brain-damaged SMTP servers
  * out there, so provisions have to be made to operate SMTP in lock-step mode.
+ * In lock-step mode we say EHLO, and if the server offers PIPELINING
+ * (RFC 2920) the commands for each message are batched anyway, since it
+ * has told us it can take them.
  */
 static void
 smtp_send(unused,cb1,p)
@@ -450,7 +540,9 @@ void *p;
 	int rcpts;
 	int goodrcpt;
 	int i,s;
-	int init = 1;
+	int init = Smtpbatch;
+	int batch = Smtpbatch;
+	int greeted = 0;
 
 	cb = (struct smtpcli *)cb1;
 	cb->lock = 1;
@@ -465,6 +557,7 @@ void *p;
 #endif
 	if(kconnect(s,(struct ksockaddr *)&fsocket,SOCKSIZE) == 0){
 		cb->network = kfdopen(s,"r+t");
+		rcode = 0;
 #ifdef SMTPTRACE
 		if (Smtptrace) 
 			kprintf("Connected\n");
@@ -477,28 +570,48 @@ void *p;
 #endif
 		logmsg(s,"SMTP %s Connect failed: %s",psocket(&fsocket),
 		    cp != NULL ? cp : "");
+		close_s(s);
+		rcode = -1;
+		goto quit;
 	}
-	if(!Smtpbatch){
+	if(Smtpbatch){
+		/* Say HELO */
+		sendcmd(cb,"HELO %s\n",Hostname);
+	} else {
 		rcode = getresp(cb,200);
 		if(rcode == -1 || rcode >= 400)
 			goto quit;
-	}
-	/* Say HELO */
-	sendcmd(cb,"HELO %s\n",Hostname);
-	if(!Smtpbatch){
+		/* Say EHLO, or HELO if that isn't understood */
+		cb->pipelining = 0;
+		sendcmd(cb,"EHLO %s\n",Hostname);
 		rcode = getresp(cb,200);
-		if(rcode == -1 || rcode >= 400)
+		if(rcode == -1)
 			goto quit;
+		if(rcode >= 400){
+			/* Don't return the refusal with the mail */
+			del_list(cb->errlog);
+			cb->errlog = NULL;
+			sendcmd(cb,"HELO %s\n",Hostname);
+			rcode = getresp(cb,200);
+			if(rcode == -1 || rcode >= 400)
+				goto quit;
+		}
+		greeted = 1;
+		batch = cb->pipelining;
 	}
 	do {	/* For each message... */
 
 		/* if this file open fails, skip it */
-		if ((cb->tfile = kfopen(cb->tname,READ_TEXT)) == NULL)
+		if ((cb->tfile = kfopen(cb->tname,READ_TEXT)) == NULL){
+			/* ...for good, if the job has been killed */
+			if(access(cb->wname,0) != 0)
+				smtpq_done(cb->jobq);
 			continue;
+		}
 
 		/* Send MAIL and RCPT commands */
 		sendcmd(cb,"MAIL FROM:<%s>\n",cb->jobq->from);
-		if(!Smtpbatch){
+		if(!batch){
 			rcode = getresp(cb,200);
 			if(rcode == -1 || rcode >= 400)
 				goto quit;
@@ -507,7 +620,7 @@ void *p;
 		goodrcpt = 0;
 		for (tp = cb->jobq->to; tp != NULL; tp = tp->next){
 			sendcmd(cb,"RCPT TO:<%s>\n",tp->val);
-			if(!Smtpbatch){
+			if(!batch){
 				rcode = getresp(cb,200);
 				if(rcode == -1)
 					goto quit;
@@ -518,12 +631,12 @@ void *p;
 		}
 		/* Send DATA command */
 		sendcmd(cb,"DATA\n");
-		if(!Smtpbatch){
+		if(!batch){
 			rcode = getresp(cb,200);
 			if(rcode == -1 || rcode >= 400)
 				goto quit;
 		}
-		if(Smtpbatch){
+		if(batch){
 			/* Now wait for the responses to come back. The first time
 			 * we do this, we wait first for the start banner and
 			 * HELO response. In any case, we wait for the response to
@@ -535,6 +648,7 @@ void *p;
 					goto quit;
 			}
 			init = 0;
+			greeted = 1;
 
 			/* Now process the responses to the RCPT commands */
 			for(i=rcpts;i!=0;i--){
@@ -573,6 +687,7 @@ void *p;
 			/* Unlink the textfile */
 			(void) unlink(cb->tname);
 			(void) unlink(cb->wname);	/* unlink workfile */
+			smtpq_done(cb->jobq);
 			logmsg(s,"SMTP sent job %s To: %s From: %s",
 			 cb->jobq->jobname,cb->jobq->to->val,cb->jobq->from);
 		}
@@ -583,10 +698,15 @@ quit:
 		retmail(cb);
 		(void) unlink(cb->wname);	/* unlink workfile */
 		(void) unlink(cb->tname);	/* unlink text */
+		smtpq_done(cb->jobq);
 	}
 	(void) kfclose(cb->network);
 	if(cb->tfile != NULL)
 		kfclose(cb->tfile);
+	/* Leave the host alone for a while if we couldn't get through to
+	 * it; anything it said after greeting us is about the mail
+	 */
+	hostdone(cb->ipdest,rcode != -1 && (greeted || rcode < 400));
 	cb->lock = 0;
 	del_session(cb);
 }
@@ -683,6 +803,8 @@ register struct smtp_job *jp;
 {
 	if ( *jp->jobname != '\0')
 		(void) rmlock(Mailqdir,jp->jobname);
+	if (jp->qp != NULL)
+		jp->qp->busy = 0;	/* Try it again later */
 	free(jp->from);
 	del_list(jp->to);
 	free(jp);
@@ -781,25 +903,29 @@ execjobs()
 	}
 }
 	
-/* add this job to control block queue */
+/* add this queued job to control block queue */
 static struct smtp_job *
-setupjob(cb,id,from)
+setupjob(cb,qp)
 struct smtpcli *cb;
-char *id,*from;
+struct smtpq *qp;
 {
-	register struct smtp_job *p1,*p2;
+	register struct smtp_job *p1;
+	struct list *ap,**tpp;
 
 	p1 = (struct smtp_job *)callocw(1,sizeof(struct smtp_job));
-	p1->from = strdup(from);
-	strcpy(p1->jobname,id);
+	p1->from = strdup(qp->from);
+	strcpy(p1->jobname,qp->jobname);
+	tpp = &p1->to;
+	for(ap = qp->to;ap != NULL;ap = ap->next)
+		tpp = &addlist(tpp,ap->val,ap->type)->next;	/* Keep order */
+	p1->qp = qp;
+	qp->busy = 1;
 	/* now add to end of jobq */
-	if ((p2 = cb->jobq) == NULL)
+	if (cb->jobq == NULL)
 		cb->jobq = p1;
-	else {
-		while(p2->next != NULL)
-			p2 = p2->next;
-		p2->next = p1;
-	}
+	else
+		cb->jobtail->next = p1;
+	cb->jobtail = p1;
 	return p1;
 }
 
@@ -846,6 +972,228 @@ char *dest;
 	
 }
 
+/* Find or make the entry for a destination host */
+static struct smtphost *
+gethost(name)
+char *name;
+{
+	struct smtphost *hp;
+
+	for(hp = Smtphosts;hp != NULL;hp = hp->next)
+		if(strcmp(hp->name,name) == 0)
+			return hp;
+	hp = (struct smtphost *)callocw(1,sizeof(struct smtphost));
+	hp->name = strdup(name);
+	hp->next = Smtphosts;
+	Smtphosts = hp;
+	return hp;
+}
+
+/* Put off the next try at a host that couldn't be reached */
+static void
+hostfail(hp)
+struct smtphost *hp;
+{
+	if(hp->backoff == 0)
+		hp->backoff = Smtpbackmin;
+	else if((hp->backoff *= 2) > Smtpbackmax)
+		hp->backoff = Smtpbackmax;
+	hp->retry = secclock() + hp->backoff;
+}
+
+/* Note how a session to addr went, for every host whose mail goes there */
+static void
+hostdone(addr,ok)
+int32 addr;
+int ok;
+{
+	struct smtphost *hp;
+
+	for(hp = Smtphosts;hp != NULL;hp = hp->next){
+		if(hp->addr != addr)
+			continue;
+		if(ok)
+			hp->retry = hp->backoff = 0;
+		else
+			hostfail(hp);
+	}
+}
+
+/* Make a queue index entry, not yet on any list */
+static struct smtpq *
+smtpq_new(id,host,from)
+char *id,*host,*from;
+{
+	struct smtpq *qp;
+
+	qp = (struct smtpq *)callocw(1,sizeof(struct smtpq));
+	strncpy(qp->jobname,id,sizeof(qp->jobname)-1);
+	qp->host = gethost(host);
+	qp->host->refs++;
+	qp->from = strdup(from);
+	return qp;
+}
+
+/* Free a queue index entry that's been taken off its list */
+static void
+smtpq_free(qp)
+struct smtpq *qp;
+{
+	qp->host->refs--;
+	free(qp->from);
+	del_list(qp->to);
+	free(qp);
+}
+
+/* Add an entry to the end of a list of them */
+static void
+smtpq_link(headp,tailp,qp)
+struct smtpq **headp,**tailp;
+struct smtpq *qp;
+{
+	qp->next = NULL;
+	qp->prev = *tailp;
+	if(*tailp != NULL)
+		(*tailp)->next = qp;
+	else
+		*headp = qp;
+	*tailp = qp;
+}
+
+/* Take an entry off a list of them */
+static void
+smtpq_unlink(headp,tailp,qp)
+struct smtpq **headp,**tailp;
+struct smtpq *qp;
+{
+	if(qp->prev != NULL)
+		qp->prev->next = qp->next;
+	else
+		*headp = qp->next;
+	if(qp->next != NULL)
+		qp->next->prev = qp->prev;
+	else
+		*tailp = qp->prev;
+}
+
+/* Add a job just placed in the queue to the index. Called by queuejob()
+ * while it still holds the job's lock.
+ */
+void
+smtpq_add(id,host,from,to)
+char *id,*host,*from;
+struct list *to;
+{
+	struct smtpq *qp;
+	struct list *ap;
+
+	if(!Smtpqloaded)
+		return;	/* It'll be read from disk with the rest */
+	qp = smtpq_new(id,host,from);
+	/* Same order as if it had been read from the work file */
+	for(ap = to;ap != NULL;ap = ap->next)
+		addlist(&qp->to,ap->val,DOMAIN);
+	if(Smtpqloading)
+		smtpq_link(&Smtpqnew,&Smtpqnewtail,qp);
+	else
+		smtpq_link(&Smtpq,&Smtpqtail,qp);
+}
+
+/* Drop a job that's been sent or given up on from the index */
+static void
+smtpq_done(jp)
+struct smtp_job *jp;
+{
+	if(jp->qp == NULL)
+		return;
+	smtpq_unlink(&Smtpq,&Smtpqtail,jp->qp);
+	smtpq_free(jp->qp);
+	jp->qp = NULL;
+}
+
+/* (Re)build the index of the outbound queue from the work files, keeping
+ * the entries of jobs already handed to sessions; their files are locked,
+ * so they aren't read again.
+ */
+static void
+smtpq_load()
+{
+	struct smtpq *qp,*qpnext,*dp,*head = NULL,*tail = NULL;
+	char	tmpstring[LINELEN], wfilename[13], prefix[9];
+	char	from[LINELEN], to[LINELEN];
+	char *cp, *cp1;
+	struct filedir *fdp;
+	kFILE *wfile;
+	int n = 0;
+
+	if(Smtpqloading)
+		return;
+	Smtpqloaded = Smtpqloading = 1;
+	for(qp = Smtpq;qp != NULL;qp = qpnext){
+		qpnext = qp->next;
+		if(!qp->busy){
+			smtpq_unlink(&Smtpq,&Smtpqtail,qp);
+			smtpq_free(qp);
+		}
+	}
+	fdp = filedir_open(Mailqueue);
+	while(filedir_next(fdp,wfilename) == 0){
+
+		if((++n % 64) == 0)
+			kwait(NULL);	/* Let others run now and then */
+
+		/* save the prefix of the file name which it job id */
+		cp = wfilename;
+		cp1 = prefix;
+		while (*cp && *cp != '.')
+			*cp1++ = *cp++;
+		*cp1 = '\0';
+
+		/* Skip jobs being sent or being queued */
+		if (mlock(Mailqdir,prefix))
+			continue;
+
+		sprintf(tmpstring,"%s/%s",Mailqdir,wfilename);
+		if ((wfile = kfopen(tmpstring,READ_TEXT)) == NULL) {
+			(void) rmlock(Mailqdir,prefix);
+			continue;
+		}
+		(void) kfgets(tmpstring,LINELEN,wfile);	/* read target host */
+		rip(tmpstring);
+		(void) kfgets(from,LINELEN,wfile);	/* read from */
+		rip(from);
+		qp = smtpq_new(prefix,tmpstring,from);
+		while (kfgets(to,LINELEN,wfile) != NULL) {
+			rip(to);
+			addlist(&qp->to,to,DOMAIN);
+		}
+		kfclose(wfile);
+		(void) rmlock(Mailqdir,prefix);
+		smtpq_link(&head,&tail,qp);
+	}
+	filedir_close(fdp);
+	/* A job queued after we started may also have been read above */
+	for(qp = Smtpqnew;qp != NULL;qp = qp->next){
+		for(dp = head;dp != NULL;dp = dp->next){
+			if(strcmp(dp->jobname,qp->jobname) == 0){
+				smtpq_unlink(&head,&tail,dp);
+				smtpq_free(dp);
+				break;
+			}
+		}
+	}
+	for(qp = head;qp != NULL;qp = qpnext){
+		qpnext = qp->next;
+		smtpq_link(&Smtpq,&Smtpqtail,qp);
+	}
+	for(qp = Smtpqnew;qp != NULL;qp = qpnext){
+		qpnext = qp->next;
+		smtpq_link(&Smtpq,&Smtpqtail,qp);
+	}
+	Smtpqnew = Smtpqnewtail = NULL;
+	Smtpqloading = 0;
+}
+
 /* save line in error list */
 static void
 logerr(cb,line)
@@ -923,6 +1271,10 @@ int mincode;	/* Keep reading until at least this code comes back */
 		}
 		rip(line);		/* Remove cr/lf */
 		rval = atoi(line);
+		/* Note the extensions offered in reply to EHLO */
+		if(rval == 250 && strlen(line) >= 14
+		 && STRNICMP(&line[4],"PIPELINING",10) == 0)
+			cb->pipelining = 1;
 #ifdef	SMTPTRACE
 		if(Smtptrace)
 			kprintf("smtp recv: %s\n",line);/* Display to user */
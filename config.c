@@ -95,7 +95,7 @@ static void axnr(struct iface *iface,struct ax25_cb *axp,uint8 *src,
 	uint8 *dest,struct mbuf **bp,int mcast);
 #endif	/* AX25 */
 
-struct mbuf *Hopper;		/* Queue of incoming packets */
+struct mqueue Hopper;		/* Queue of incoming packets */
 unsigned Nsessions = NSESSIONS;
 unsigned Nsock = DEFNSOCK;		/* Number of socket entries */
 
@@ -539,52 +539,60 @@ struct socklink Socklink[] = {
 	 * socket,	bind,		listen,		connect,
 	 * accept,	recv,		send,		qlen,
 	 * kick,	shut,		close,		check,
-	 * error,	state,		status,		eol_seq
+	 * error,	state,		status,		eol_seq,
+	 * poll
 	 */
 	{ TYPE_TCP,
 	so_tcp,		NULL,		so_tcp_listen,	so_tcp_conn,
 	TRUE,		so_tcp_recv,	so_tcp_send,	so_tcp_qlen,
 	so_tcp_kick,	so_tcp_shut,	so_tcp_close,	checkipaddr,
-	Tcpreasons,	tcpstate,	so_tcp_stat,	Inet_eol },
+	Tcpreasons,	tcpstate,	so_tcp_stat,	Inet_eol,
+	so_tcp_poll },
 
 	{ TYPE_UDP,
 	so_udp,		so_udp_bind,	NULL,		so_udp_conn,
 	FALSE,		so_udp_recv,	so_udp_send,	so_udp_qlen,
 	NULL,		NULL,		so_udp_close,	checkipaddr,
-	NULL,		NULL,		so_udp_stat,	Inet_eol },
+	NULL,		NULL,		so_udp_stat,	Inet_eol,
+	so_udp_poll },
 
 #ifdef	AX25
 	{ TYPE_AX25I,
 	so_ax_sock,	NULL,		so_ax_listen,	so_ax_conn,
 	TRUE,		so_ax_recv,	so_ax_send,	so_ax_qlen,
 	so_ax_kick,	so_ax_shut,	so_ax_close,	checkaxaddr,
-	Axreasons,	axstate,	so_ax_stat,	Ax25_eol },
+	Axreasons,	axstate,	so_ax_stat,	Ax25_eol,
+	NULL },
 
 	{ TYPE_AX25UI,
 	so_axui_sock,	so_axui_bind,	NULL,		so_axui_conn,
 	FALSE,		so_axui_recv,	so_axui_send,	so_axui_qlen,
 	NULL,		NULL,		so_axui_close,	checkaxaddr,
-	NULL,		NULL,		NULL,		Ax25_eol },
+	NULL,		NULL,		NULL,		Ax25_eol,
+	NULL },
 #endif	/* AX25 */
 
 	{ TYPE_RAW,
 	so_ip_sock,	NULL,		NULL,		so_ip_conn,
 	FALSE,		so_ip_recv,	so_ip_send,	so_ip_qlen,
 	NULL,		NULL,		so_ip_close,	checkipaddr,
-	NULL,		NULL,		NULL,		Inet_eol },
+	NULL,		NULL,		NULL,		Inet_eol,
+	NULL },
 
 #ifdef	NETROM
 	{ TYPE_NETROML3,
 	so_n3_sock,	NULL,		NULL,		so_n3_conn,
 	FALSE,		so_n3_recv,	so_n3_send,	so_n3_qlen,
 	NULL,		NULL,		so_n3_close,	checknraddr,
-	NULL,		NULL,		NULL,		Ax25_eol },
+	NULL,		NULL,		NULL,		Ax25_eol,
+	NULL },
 
 	{ TYPE_NETROML4,
 	so_n4_sock,	NULL,		so_n4_listen,	so_n4_conn,
 	TRUE,		so_n4_recv,	so_n4_send,	so_n4_qlen,
 	so_n4_kick,	so_n4_shut,	so_n4_close,	checknraddr,
-	Nr4reasons,	nrstate,	so_n4_stat,	Ax25_eol },
+	Nr4reasons,	nrstate,	so_n4_stat,	Ax25_eol,
+	NULL },
 #endif	/* NETROM */
 
 #ifdef	LOCSOCK
@@ -592,13 +600,15 @@ struct socklink Socklink[] = {
 	so_los,		NULL,		NULL,		NULL,
 	TRUE,		so_lo_recv,	so_los_send,	so_los_qlen,
 	NULL,		so_loc_shut,	so_loc_close,	NULL,
-	NULL,		NULL,		so_loc_stat,	Eol },
+	NULL,		NULL,		so_loc_stat,	Eol,
+	so_loc_poll },
 
 	{ TYPE_LOCAL_DGRAM,
 	so_lod,		NULL,		NULL,		NULL,
 	FALSE,		so_lo_recv,	so_lod_send,	so_lod_qlen,
 	NULL,		so_loc_shut,	so_loc_close,	NULL,
-	NULL,		NULL,		so_loc_stat,	Eol },
+	NULL,		NULL,		so_loc_stat,	Eol,
+	so_loc_poll },
 #endif
 
 	{ -1 },
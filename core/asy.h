@@ -39,6 +39,8 @@ int asy_write(int dev,const void *buf,unsigned short cnt);
 int get_rlsd_asy(int dev, int new_rlsd);
 #endif
 int get_asy(int dev);
+int get_asy_burst(int dev,uint8 **bufp);
+void release_asy(int dev,int cnt);
 void fp_stop(void);
 
 #ifndef UNIX
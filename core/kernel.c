@@ -34,6 +34,7 @@ struct proc *Waittab[PHASH];	/* Waiting process list */
 struct proc *Susptab;		/* Suspended processes */
 static struct mbuf *Killq;
 struct ksig Ksig;
+struct procpool Procpool;	/* Finished processes kept for reuse */
 int Kdebug;		/* Control display of current task on screen */
 
 static void addproc(struct proc *entry);
@@ -90,6 +91,29 @@ int freeargs		/* If set, free arg list on parg1 at termination */
 ){
 	struct proc *pp;
 
+#ifdef UNIX
+	/* Recycle a finished process if there's one with a big enough
+	 * stack; it's waiting in poolself() and picks up pc from there
+	 */
+	stksize = max(stksize,32768);
+	for(pp = Waittab[phash(&Procpool)];pp != NULL;pp = pp->next){
+		if(pp->event == &Procpool && pp->stksize >= stksize)
+			break;
+	}
+	if(pp != NULL){
+		delproc(pp);
+		pp->flags.waiting = 0;
+		pp->flags.pooled = 0;
+		pp->event = NULL;
+		pp->retval = 0;
+		Procpool.cnt--;
+		Procpool.reused++;
+		chname(pp,name);
+		pp->pc = pc;
+		goto setargs;
+	}
+	Procpool.created++;
+#endif
 	/* Create process descriptor */
 	pp = (struct proc *)callocw(1,sizeof(struct proc));
 
@@ -112,6 +136,9 @@ int freeargs		/* If set, free arg list on parg1 at termination */
 	/* Do machine-dependent initialization of stack */
 	psetup(pp,iarg,parg1,parg2,pc);
 
+#ifdef UNIX
+setargs:
+#endif
 	pp->flags.freeargs = freeargs;
 	pp->iarg = iarg;
 	pp->parg1 = parg1;
@@ -198,6 +225,49 @@ killself(void)
 	for(;;)
 		kwait(NULL);
 }
+#ifdef UNIX
+/* Called by the machine-dependent layer when a process function returns.
+ * Rather than have the killer tear the process down, release what it
+ * was using and park it in the pool, where newproc() can hand it a new
+ * function to run without creating a new thread and stack. Returns
+ * when that happens; if the pool is full, kills the process instead.
+ */
+void
+poolself(void)
+{
+	char **argv;
+	struct proc *pp = Curproc;
+
+	if(Procpool.cnt >= PROCPOOL)
+		killself();	/* Doesn't return */
+
+	kfclose(pp->input);
+	kfclose(pp->output);
+	pp->input = pp->output = NULL;
+	stop_timer(&pp->alarm);
+
+	/* Alert everyone waiting for this proc to die */
+	ksignal(pp,0);
+
+	if(pp->flags.freeargs){
+		argv = pp->parg1;
+		while(pp->iarg-- != 0)
+			free(*argv++);
+		free(pp->parg1);
+	}
+	pp->flags.freeargs = 0;
+	pp->flags.sset = 0;
+	pp->perrno = 0;
+	chname(pp,"pool");
+
+	if(++Procpool.cnt > Procpool.hiwat)
+		Procpool.hiwat = Procpool.cnt;
+	pp->flags.pooled = 1;
+	while(pp->flags.pooled)
+		kwait(&Procpool);
+}
+#endif
+
 /* Process used by processes that want to kill themselves */
 void
 killer(int i,void *v1,void *v2)
@@ -33,7 +33,7 @@ int *fromlen
 ){
 	int s;
 
-	while(up->cb.local != NULL && up->cb.local->q == NULL
+	while(up->cb.local != NULL && up->cb.local->q.head == NULL
 	  && up->cb.local->peer != NULL){
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
@@ -47,7 +47,7 @@ int *fromlen
 		kerrno = kEBADF;
 		return -1;
 	}
-	if(up->cb.local->q == NULL &&
+	if(up->cb.local->q.head == NULL &&
 	   up->cb.local->peer == NULL){
 		kerrno = kENOTCONN;
 		return -1;
@@ -56,12 +56,21 @@ int *fromlen
 	 * first packet on the queue. For stream sockets,
 	 * this will return everything.
 	 */
-	*bpp = dequeue(&up->cb.local->q);
-	if(up->cb.local->q == NULL && (up->cb.local->flags & LOC_SHUTDOWN)){
+	if(up->type == TYPE_LOCAL_STREAM)
+		*bpp = take_mq(&up->cb.local->q);
+	else
+		*bpp = dequeue_mq(&up->cb.local->q);
+	if(up->cb.local->q.head == NULL && (up->cb.local->flags & LOC_SHUTDOWN)){
 		s = up->index;
-		close_s(s);
+		close_s(s);	/* Does its own wakeups */
+	} else {
+		/* Writers block on us; a poller on the writing end is
+		 * registered with our peer
+		 */
+		sockwake(up,0);
+		if(up->cb.local->peer != NULL && up->cb.local->peer != up)
+			sockwake(up->cb.local->peer,0);
 	}
-	ksignal(up,0);
 	return len_p(*bpp);
 }
 int
@@ -75,11 +84,11 @@ struct ksockaddr *to
 		kerrno = kENOTCONN;
 		return -1;
 	}
-	append(&up->cb.local->peer->cb.local->q,bpp);
-	ksignal(up->cb.local->peer,0);
+	append_mq(&up->cb.local->peer->cb.local->q,bpp);
+	sockwake(up->cb.local->peer,0);
 	/* If high water mark has been reached, block */
 	while(up->cb.local->peer != NULL &&
-	      len_p(up->cb.local->peer->cb.local->q) >=
+	      up->cb.local->peer->cb.local->q.bytes >=
 	      up->cb.local->peer->cb.local->hiwat){
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
@@ -105,11 +114,11 @@ struct ksockaddr *to
 		kerrno = kENOTCONN;
 		return -1;
 	}
-	enqueue(&up->cb.local->peer->cb.local->q,bpp);
-	ksignal(up->cb.local->peer,0);
+	enqueue_mq(&up->cb.local->peer->cb.local->q,bpp);
+	sockwake(up->cb.local->peer,0);
 	/* If high water mark has been reached, block */
 	while(up->cb.local->peer != NULL &&
-	      len_q(up->cb.local->peer->cb.local->q) >=
+	      len_mq(&up->cb.local->peer->cb.local->q) >=
 	      up->cb.local->peer->cb.local->hiwat){
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
@@ -131,12 +140,12 @@ so_lod_qlen(struct usock *up,int rtx)
 
 	switch(rtx){
 	case 0:
-		len = len_q(up->cb.local->q);
+		len = len_mq(&up->cb.local->q);
 		break;
 	case 1:
 		len = -1;
 		if(up->cb.local->peer != NULL)
-			len = len_q(up->cb.local->peer->cb.local->q);
+			len = len_mq(&up->cb.local->peer->cb.local->q);
 		break;
 	}
 	return len;
@@ -148,12 +157,12 @@ so_los_qlen(struct usock *up,int rtx)
 
 	switch(rtx){
 	case 0:
-		len = len_p(up->cb.local->q);
+		len = up->cb.local->q.bytes;
 		break;
 	case 1:
 		len = -1;
 		if(up->cb.local->peer != NULL)
-			len = len_p(up->cb.local->peer->cb.local->q);
+			len = up->cb.local->peer->cb.local->q.bytes;
 		break;
 	}
 	return len;
@@ -165,7 +174,7 @@ so_loc_shut(struct usock *up,int how)
 
 	s = up->index;
 
-	if(up->cb.local->q == NULL)
+	if(up->cb.local->q.head == NULL)
 		close_s(s);
 	else
 		up->cb.local->flags = LOC_SHUTDOWN;
@@ -176,12 +185,30 @@ so_loc_close(struct usock *up)
 {
 	if(up->cb.local->peer != NULL){
 		up->cb.local->peer->cb.local->peer = NULL;
-		ksignal(up->cb.local->peer,0);
+		sockwake(up->cb.local->peer,0);
 	}
-	free_q(&up->cb.local->q);
+	free_mq(&up->cb.local->q);
 	free(up->cb.local);
 	return 0;
 }
+/* Readiness for kpoll() */
+int
+so_loc_poll(struct usock *up)
+{
+	struct loc *lp = up->cb.local;
+	struct loc *pp;
+	int mask = 0;
+
+	if(lp->q.head != NULL)
+		mask |= kPOLLIN;
+	if(lp->peer == NULL)
+		return mask | kPOLLIN | kPOLLHUP;
+	pp = lp->peer->cb.local;
+	if(up->type == TYPE_LOCAL_STREAM ? pp->q.bytes < pp->hiwat
+	 : len_mq(&pp->q) < pp->hiwat)
+		mask |= kPOLLOUT;
+	return mask;
+}
 char *
 lopsocket(struct ksockaddr *p)
 {
@@ -27,10 +27,11 @@ struct proc {
 #ifdef UNIX
 		unsigned int run:1;		/* Process to run when awake */
 		unsigned int exit:1;		/* Process to exit when awake*/
+		unsigned int pooled:1;		/* Finished, waiting for reuse */
 #endif
 	} flags;
 	int perrno;		/* Last error encountered */
-#ifdef UNIX
+#if defined(UNIX) && !defined(UNIX_COROUTINES)
 	pthread_t thread;       /* The POSIX thread handle for this process */
 	pthread_cond_t cond;	/* Semaphore for waking this process */
 #else
@@ -39,7 +40,7 @@ struct proc {
 	jmp_buf sig;		/* State for alert signal */
 	int signo;		/* Arg to alert to cause signal */
 	void *event;		/* Wait event */
-#ifndef UNIX
+#if !defined(UNIX) || defined(UNIX_COROUTINES)
 	void *stack;		/* Process stack */
 #endif
 	unsigned stksize;	/* Size of same */
@@ -59,6 +60,16 @@ extern struct proc *Waittab[];	/* Head of wait list */
 extern struct proc *Rdytab;	/* Head of ready list */
 extern struct proc *Curproc;	/* Currently running process */
 extern struct proc *Susptab;	/* Suspended processes */
+
+/* Pool of finished processes waiting to be reused by newproc() */
+#define	PROCPOOL	16	/* Most processes kept in the pool */
+struct procpool {
+	unsigned cnt;		/* Processes in the pool */
+	unsigned hiwat;		/* Most ever in the pool */
+	int32 reused;		/* newproc() calls satisfied from the pool */
+	int32 created;		/* newproc() calls that made a new process */
+};
+extern struct procpool Procpool;
 extern int Kdebug;		/* Control display of current task on screen */
 
 struct sigentry {
@@ -100,6 +111,7 @@ void alert(struct proc *pp,int val);
 void chname(struct proc *pp,char *newname);
 void killproc(struct proc **ppp);
 void killself(void);
+void poolself(void);
 struct proc *mainproc(char *name);
 struct proc *newproc(char *name,unsigned int stksize,
 	void (*pc)(int,void *,void *),
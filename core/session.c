@@ -8,6 +8,7 @@
 #include "global.h"
 #include "net/core/mbuf.h"
 #include "core/proc.h"
+#include "core/timer.h"
 #include "telnet.h"
 #include "core/tty.h"
 #include "core/session.h"
@@ -25,6 +26,11 @@ struct session *Current;
 struct session *Lastcurr;
 char Notval[] = "Not a valid control block\n";
 static char Badsess[] = "Invalid session\n";
+
+#ifdef	TICKLESS
+static struct timer Sesflush_timer;
+static void sesflush_t(void *p);
+#endif
 char *Sestypes[] = {
 	"",
 	"Telnet",
@@ -457,3 +463,23 @@ sesflush(void)
 	if(Current != NULL)
 		kfflush(Current->output);
 }
+#ifdef	TICKLESS
+/* With a tickless clock nothing calls sesflush() periodically, so the
+ * display stream code calls this when it starts buffering new output
+ */
+void
+sesflush_later(void)
+{
+	if(run_timer(&Sesflush_timer))
+		return;
+	set_timer(&Sesflush_timer,SESFLUSH);
+	Sesflush_timer.func = sesflush_t;
+	Sesflush_timer.arg = NULL;
+	start_timer(&Sesflush_timer);
+}
+static void
+sesflush_t(void *p)
+{
+	sesflush();
+}
+#endif
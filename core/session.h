@@ -77,8 +77,12 @@ int keywait(char *prompt,int flush);
 struct session *sessptr(char *cp);
 struct session *newsession(char *name,int type,int makecur);
 void sesflush(void);
+#ifdef	TICKLESS
+void sesflush_later(void);
+#endif
 void upload(int unused,void *sp1,void *p);
 
 #define	ALERT_EOF	1
+#define	SESFLUSH	55	/* Output flush delay, ms (one PC clock tick) */
 
 #endif  /* _KA9Q_SESSION_H */
@@ -321,6 +321,87 @@ int *peernamelen	/* Length of peer name */
 	}
 	return i;
 }
+/* Return the kPOLL* conditions currently true of a socket. Protocols
+ * that know better supply a poll routine; otherwise judge by the receive
+ * queue length.
+ */
+static int
+sockpoll(struct usock *up)
+{
+	struct socklink *sp = up->sp;
+
+	if(sp->poll != NULL)
+		return (*sp->poll)(up);
+	if(!so_is_connected(up))
+		return kPOLLIN|kPOLLHUP;
+	if(sp->qlen != NULL && (*sp->qlen)(up,0) > 0)
+		return kPOLLIN|kPOLLOUT;
+	return kPOLLOUT;
+}
+/* Wait until at least one of a set of sockets is ready, in the manner of
+ * poll(). Each entry's revents is set to the conditions found among those
+ * asked for in events; kPOLLHUP and kPOLLNVAL are always reported.
+ * timeout is in milliseconds; 0 means just look, and a negative value
+ * waits indefinitely. Returns the number of entries with revents set,
+ * 0 on timeout, or -1 with kerrno set if the wait was interrupted.
+ *
+ * Rather than scanning repeatedly, the caller's event is hung on each
+ * socket while it sleeps and the protocol upcalls signal it through
+ * sockwake(). Only one process should poll a given socket at a time.
+ */
+int
+kpoll(
+struct kpollfd *fds,	/* Sockets and conditions of interest */
+int nfds,		/* Number of entries in fds */
+int32 timeout		/* Milliseconds, or < 0 to wait forever */
+){
+	struct usock *up;
+	int i,n,ret;
+	char ev;		/* Its address is our wait event */
+
+	if(fds == NULL && nfds != 0){
+		kerrno = kEFAULT;
+		return -1;
+	}
+	if(timeout > 0)
+		kalarm(timeout);
+	for(;;){
+		n = 0;
+		for(i=0;i<nfds;i++){
+			if((up = itop(fds[i].fd)) == NULL)
+				fds[i].revents = kPOLLNVAL;
+			else
+				fds[i].revents = sockpoll(up)
+				 & (fds[i].events | kPOLLHUP);
+			if(fds[i].revents != 0)
+				n++;
+		}
+		if(n != 0 || timeout == 0)
+			break;
+		if(timeout > 0 && Curproc->alarm.state != TIMER_RUN)
+			break;	/* Expired while we were runnable */
+
+		for(i=0;i<nfds;i++)
+			itop(fds[i].fd)->pollev = &ev;
+		ret = kwait(&ev);
+		for(i=0;i<nfds;i++){
+			/* Some may have been closed while we slept */
+			if((up = itop(fds[i].fd)) != NULL && up->pollev == &ev)
+				up->pollev = NULL;
+		}
+		if(ret == kEALARM && timeout > 0){
+			n = 0;
+			break;
+		} else if(ret != 0){
+			kerrno = ret;
+			n = -1;
+			break;
+		}
+	}
+	if(timeout > 0)
+		kalarm(0L);
+	return n;
+}
 /* Low-level receive routine. Passes mbuf back to user; more efficient than
  * higher-level functions recv() and recvfrom(). Datagram sockets ignore
  * the len parameter.
@@ -549,7 +630,9 @@ int how		/* (see above) */
 	} else if((*sp->shut)(up,how) == -1){
 		return -1;
 	}
-	ksignal(up,0);
+	/* The shut routine may itself have closed the socket */
+	if((up = itop(s)) != NULL)
+		sockwake(up,0);
 	return 0;
 }
 /* Close a socket, freeing it for reuse. Try to do a graceful close on a
@@ -575,11 +658,23 @@ int s		/* Socket index */
 	free(up->name);
 	free(up->peername);
 
-	ksignal(up,0);	/* Wake up anybody doing an accept() or recv() */
+	sockwake(up,0);	/* Wake up anybody doing an accept() or recv() */
 	Usock[_fd_seq(up->index)] = NULL;
 	free(up);
 	return 0;
 }
+/* Wake processes waiting on a socket, including any kpoll() it's part of.
+ * Protocol upcalls use this in place of a bare ksignal() on the socket.
+ */
+void
+sockwake(struct usock *up,int n)
+{
+	if(up == NULL)
+		return;
+	ksignal(up,n);
+	if(up->pollev != NULL)
+		ksignal(up->pollev,1);
+}
 /* Increment reference count for specified socket */
 int
 usesock(int s)
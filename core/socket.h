@@ -51,6 +51,17 @@
 
 extern char *Sock_errlist[];
 
+/* Readiness polling; see kpoll() */
+struct kpollfd {
+	int fd;			/* Socket index */
+	short events;		/* Conditions of interest */
+	short revents;		/* Conditions found */
+};
+#define	kPOLLIN		0x01	/* Receive (or accept) won't block */
+#define	kPOLLOUT	0x04	/* Send won't block */
+#define	kPOLLHUP	0x10	/* Connection gone; always reported */
+#define	kPOLLNVAL	0x20	/* Not a socket; always reported */
+
 /* In socket.c: */
 extern int Axi_sock;	/* Socket listening to AX25 (there can be only one) */
 
@@ -58,6 +69,7 @@ int kaccept(int s,struct ksockaddr *peername,int *peernamelen);
 int kbind(int s,struct ksockaddr *name,int namelen);
 int close_s(int s);
 int kconnect(int s,struct ksockaddr *peername,int peernamelen);
+int kpoll(struct kpollfd *fds,int nfds,int32 timeout);
 char *eolseq(int s);
 void freesock(struct proc *pp);
 int kgetpeername(int s,struct ksockaddr *peername,int *peernamelen);
@@ -93,7 +93,7 @@ int red;
 	for(i=0;i<Nsock;i++){
 		up = Usock[i];
 		if(up != NULL && up->type == TYPE_LOCAL_STREAM)
-			mbuf_crunch(&up->cb.local->q);
+			crunch_mq(&up->cb.local->q);
 	}
 }
 
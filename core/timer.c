@@ -14,24 +14,51 @@
 #include "core/socket.h"
 #include "lib/std/errno.h"
 
-/* Head of running timer chain.
- * The list of running timers is sorted in increasing order of expiration;
- * i.e., the first timer to expire is always at the head of the list.
+/* Hierarchical timing wheel holding the running timers.
+ * Wheel[0] has one slot per tick; a timer due within TW_SIZE ticks of
+ * Wheel_clock sits in the Wheel[0] slot indexed by the low bits of its
+ * expiration time. Timers further out sit in Wheel[1], Wheel[2]...
+ * indexed by successively higher groups of bits of the expiration time.
+ * Whenever the low bits of Wheel_clock wrap to zero, the next slot of
+ * the level above is emptied and its timers redistributed ("cascaded")
+ * into the finer levels below.
  */
-static struct timer *Timers;
+#define	TW_BITS		8		/* log2 of slots per level */
+#define	TW_SIZE		(1 << TW_BITS)
+#define	TW_MASK		(TW_SIZE - 1)
+#define	TW_LEVELS	4		/* TW_LEVELS * TW_BITS must cover 32 bits */
+
+static struct timer *Wheel[TW_LEVELS][TW_SIZE];
+static uint32 Wheel_clock;	/* Next tick to be processed */
+static int32 Ntimers;		/* Count of running timers */
+int32 Timer_late;		/* Worst expiry lateness seen, ticks */
+
+#ifdef	TICKLESS
+/* Earliest tick at which timerproc needs to run, published to the
+ * clock driver. Read and written only with interrupts disabled.
+ */
+static int Next_valid;		/* Zero when no timers are running */
+static int32 Next_expire;
+static uint32 Next_gen;		/* Bumped on every publication */
+#endif
 
 static void t_alarm(void *x);
+static void tw_insert(struct timer *t);
+static void tw_remove(struct timer *t);
+static int tw_cascade(int level);
+static void tw_run(int32 clock);
+#ifdef	TICKLESS
+static uint32 tw_next(void);
+static void tw_publish(int valid,int32 next);
+#endif
 
 /* Process that handles clock ticks */
 void
 timerproc(int i,void *v1,void *v2)
 {
-	register struct timer *t;
-	register struct timer *expired;
 	void (**vf)(void);
 	int i_state;
 	int tmp;
-	int32 clock;
 
 	for(;;){
 		/* Atomic read and decrement of Tick */
@@ -57,52 +84,193 @@ timerproc(int i,void *v1,void *v2)
 
 		kwait(NULL);	/* Let them all do their writes */
 
-		if(Timers == NULL)
-			continue;	/* No active timers, all done */
-
-		/* Initialize null expired timer list */
-		expired = NULL;
-		clock = rdclock();
+		tw_run(rdclock());
+#ifdef	TICKLESS
+		tw_publish(Ntimers != 0,tw_next());
+#endif
+		kwait(NULL);	/* Let them run before handling more ticks */
+	}
+}
+/* Expire the timers due at every tick up to and including clock */
+static void
+tw_run(int32 clock)
+{
+	register struct timer *t;
+	struct timer *expired;
+	int index;
+	int level;
 
-		/* Move expired timers to expired list. Note use of
-		 * subtraction and comparison to zero rather than the
-		 * more obvious simple comparison; this avoids
-		 * problems when the clock count wraps around.
-		 */
-		while(Timers != NULL && (clock - Timers->expiration) >= 0){
-			if(Timers->next == Timers){
-				kprintf("PANIC: Timer loop at %lx\n",
-				 (long)Timers);
-				iostop();
-				exit(1);
+	/* Note use of subtraction and comparison to zero rather
+	 * than the more obvious simple comparison; this avoids
+	 * problems when the clock count wraps around.
+	 */
+	while(Ntimers != 0 && (int32)(clock - Wheel_clock) >= 0){
+		index = Wheel_clock & TW_MASK;
+		if(index == 0){
+			/* Bring down the next batch from the coarser levels,
+			 * stopping at the first one that hasn't wrapped
+			 */
+			for(level = 1;level < TW_LEVELS;level++){
+				if(tw_cascade(level) != 0)
+					break;
 			}
-			/* Save Timers since stop_timer will change it */
-			t = Timers;
-			stop_timer(t);
-			t->state = TIMER_EXPIRE;
-			/* Add to expired timer list */
-			t->next = expired;
-			expired = t;
 		}
+		Wheel_clock++;
+		if(Wheel[0][index] == NULL)
+			continue;
+
+		/* Detach the slot onto a private expired list so that
+		 * timers restarted by a notify function land back on
+		 * the wheel rather than on this list
+		 */
+		expired = Wheel[0][index];
+		Wheel[0][index] = NULL;
+		expired->prevp = &expired;
+
 		/* Now go through the list of expired timers, removing each
-		 * one and kicking the notify function, if there is one
+		 * one and kicking the notify function, if there is one.
+		 * A notify function may stop any timer still on the list,
+		 * so take them off one at a time.
 		 */
 		while((t = expired) != NULL){
-			expired = t->next;
+			tw_remove(t);
+			t->state = TIMER_EXPIRE;
+			if(clock - t->expiration > Timer_late)
+				Timer_late = clock - t->expiration;
 			if(t->func){
 				(*t->func)(t->arg);
 			}
 		}
-		kwait(NULL);	/* Let them run before handling more ticks */
 	}
+	if(Ntimers == 0)
+		Wheel_clock = clock + 1;	/* No active timers, all done */
+}
+#ifdef	TICKLESS
+/* Return the earliest tick at which the wheel needs servicing: either
+ * the first occupied level 0 slot or the first cascade of an occupied
+ * higher level slot, whichever comes first.
+ */
+static uint32
+tw_next(void)
+{
+	uint32 next,t;
+	int level,shift,j;
+	int found = 0;
+
+	/* Level 0 slots hold exactly one tick each */
+	next = Wheel_clock + TW_SIZE;	/* In case the wheel is empty */
+	for(j=0;j<TW_SIZE;j++){
+		if(Wheel[0][(Wheel_clock + j) & TW_MASK] != NULL){
+			next = Wheel_clock + j;
+			found = 1;
+			break;
+		}
+	}
+	/* A higher level slot is cascaded when the clock reaches the first
+	 * tick that is aligned to that level and indexes that slot
+	 */
+	for(level=1;level<TW_LEVELS;level++){
+		shift = TW_BITS*level;
+		t = ((Wheel_clock + (1UL << shift) - 1) >> shift) << shift;
+		for(j=0;j<TW_SIZE;j++,t += 1UL << shift){
+			if(found && (int32)(t - next) >= 0)
+				break;
+			if(Wheel[level][(t >> shift) & TW_MASK] != NULL){
+				next = t;
+				found = 1;
+				break;
+			}
+		}
+	}
+	return next;
+}
+/* Hand the clock driver a new earliest expiration */
+static void
+tw_publish(int valid,int32 next)
+{
+	int i_state;
+
+	i_state = disable();
+	Next_valid = valid;
+	Next_expire = next;
+	Next_gen++;
+	clock_kick();
+	restore(i_state);
+}
+/* Called by the clock driver with interrupts disabled. Returns 0 when no
+ * timers are running; otherwise returns 1 and the tick at which the timer
+ * process must next be woken. *gen changes whenever the answer does.
+ */
+int
+next_timer(int32 *next,uint32 *gen)
+{
+	*gen = Next_gen;
+	*next = Next_expire;
+	return Next_valid;
+}
+#endif
+/* Put a timer on the wheel slot covering its expiration time */
+static void
+tw_insert(struct timer *t)
+{
+	struct timer **slot;
+	uint32 delta;
+	int level;
+
+	if((int32)(t->expiration - Wheel_clock) < 0){
+		/* Already overdue; run it on the very next tick */
+		slot = &Wheel[0][Wheel_clock & TW_MASK];
+	} else {
+		delta = t->expiration - Wheel_clock;
+		for(level = 0;level < TW_LEVELS-1;level++){
+			if(delta < (1UL << (TW_BITS * (level+1))))
+				break;
+		}
+		slot = &Wheel[level][((uint32)t->expiration >> (TW_BITS*level))
+		 & TW_MASK];
+	}
+	t->next = *slot;
+	if(t->next != NULL)
+		t->next->prevp = &t->next;
+	t->prevp = slot;
+	*slot = t;
+	Ntimers++;
+}
+/* Unlink a timer from whatever slot (or expired) list it's on */
+static void
+tw_remove(struct timer *t)
+{
+	*t->prevp = t->next;
+	if(t->next != NULL)
+		t->next->prevp = t->prevp;
+	t->next = NULL;
+	t->prevp = NULL;
+	Ntimers--;
+}
+/* Redistribute the timers in the current slot of the given level into
+ * the levels below. Returns the slot index, which is zero when this
+ * level has also wrapped and the next level up must be cascaded too.
+ */
+static int
+tw_cascade(int level)
+{
+	struct timer *t,*list;
+	int index;
+
+	index = ((uint32)Wheel_clock >> (TW_BITS*level)) & TW_MASK;
+	list = Wheel[level][index];
+	Wheel[level][index] = NULL;
+	while((t = list) != NULL){
+		list = t->next;
+		Ntimers--;
+		tw_insert(t);
+	}
+	return index;
 }
 /* Start a timer */
 void
 start_timer(struct timer *t)
 {
-	register struct timer *tnext;
-	struct timer *tprev = NULL;
-
 	if(t == NULL)
 		return;
 	if(t->state == TIMER_RUN)
@@ -110,53 +278,30 @@ start_timer(struct timer *t)
 	if(t->duration == 0)
 		return;		/* A duration value of 0 disables the timer */
 
+	if(Ntimers == 0)
+		Wheel_clock = rdclock();	/* Idle wheel, resync */
 	t->expiration = rdclock() + t->duration;
 	t->state = TIMER_RUN;
-
-	/* Find right place on list for this guy. Once again, note use
-	 * of subtraction and comparison with zero rather than direct
-	 * comparison of expiration times.
-	 */
-	for(tnext = Timers;tnext != NULL;tprev=tnext,tnext = tnext->next){
-		if((tnext->expiration - t->expiration) >= 0)
-			break;
-	}
-	/* At this point, tprev points to the entry that should go right
-	 * before us, and tnext points to the entry just after us. Either or
-	 * both may be null.
-	 */
-	if(tprev == NULL)
-		Timers = t;		/* Put at beginning */
-	else
-		tprev->next = t;
-
-	t->next = tnext;
+	tw_insert(t);
+#ifdef	TICKLESS
+	/* Wake the clock driver early if this one is due first */
+	if(!Next_valid || (t->expiration - Next_expire) < 0)
+		tw_publish(1,t->expiration);
+#endif
 }
 /* Stop a timer */
 void
 stop_timer(struct timer *timer)
 {
-	register struct timer *t;
-	struct timer *tlast = NULL;
-
 	if(timer == NULL || timer->state != TIMER_RUN)
 		return;
 
-	/* Verify that timer is really on list */
-	for(t = Timers;t != NULL;tlast = t,t = t->next)
-		if(t == timer)
-			break;
-
-	if(t == NULL)
+	if(timer->prevp == NULL)
 		return;		/* Should probably panic here */
 
-	/* Delete from active timer list */
-	if(tlast != NULL)
-		tlast->next = t->next;
-	else
-		Timers = t->next;	/* Was first on list */
-
-	t->state = TIMER_STOP;
+	/* Delete from its wheel slot */
+	tw_remove(timer);
+	timer->state = TIMER_STOP;
 }
 /* Return milliseconds remaining on this timer */
 int32
@@ -5,19 +5,21 @@
 
 /* Software timers
  * There is one of these structures for each simulated timer.
- * Whenever the timer is running, it is on a linked list
- * pointed to by "Timers". The list is sorted in ascending order of
- * expiration, with the first timer to expire at the head. This
- * allows the timer process to avoid having to scan the entire list
- * on every clock tick; once it finds an unexpired timer, it can
- * stop searching.
+ * Whenever the timer is running, it is on one of the slot lists of a
+ * hierarchical timing wheel (see timer.c). Level 0 of the wheel has
+ * one slot per tick for the next few hundred ticks, and each higher
+ * level covers a much longer span per slot. As the clock advances, the
+ * timers in a higher level slot are "cascaded" down into the finer
+ * grained level below.
  *
  * Stopping a timer or letting it expire causes it to be removed
- * from the list. Starting a timer puts it on the list at the right
- * place.
+ * from its slot list. Starting a timer puts it on the list of the
+ * slot covering its expiration time. Both operations take constant
+ * time regardless of the number of running timers.
  */
 struct timer {
 	struct timer *next;	/* Linked-list pointer */
+	struct timer **prevp;	/* Back pointer to whatever points at us */
 	int32 duration;		/* Duration of timer, in ticks */
 	int32 expiration;	/* Clock time at expiration */
 	void (*func)(void *);	/* Function to call at expiration */
@@ -29,13 +31,18 @@ struct timer {
 };
 #define	MAX_TIME	MAXINT32 /* Max long integer */
 #ifndef	MSPTICK
+#ifdef	TICKLESS
+#define	MSPTICK		1		/* Clock driver wakes only when needed */
+#else
 #define	MSPTICK		55		/* Milliseconds per tick */
 #endif
+#endif
 /* Useful user macros that hide the timer structure internals */
 #define	dur_timer(t)	((t)->duration*MSPTICK)
 #define	run_timer(t)	((t)->state == TIMER_RUN)
 
 extern int Tick;
+extern int32 Timer_late;	/* Worst timer lateness, ticks; reset by ps */
 extern void (*Cfunc[])();	/* List of clock tick functions */
 
 /* In timer.c: */
@@ -46,10 +53,16 @@ void set_timer(struct timer *t,int32 x);
 void start_timer(struct timer *t);
 void stop_timer(struct timer *timer);
 char *tformat(int32 t);
+#ifdef	TICKLESS
+int next_timer(int32 *next,uint32 *gen);
+#endif
 
 /* In hardware.c: */
 int32 msclock(void);
 int32 secclock(void);
 int32 usclock(void);
+#ifdef	TICKLESS
+void clock_kick(void);
+#endif
 
 #endif	/* _KA9Q_TIMER_H */
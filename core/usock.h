@@ -13,7 +13,7 @@
 
 struct loc {
 	struct usock *peer;
-	struct mbuf *q;
+	struct mqueue q;
 	int hiwat;		/* Flow control point */
 	int flags;
 #define	LOC_SHUTDOWN	1
@@ -46,6 +46,7 @@ struct socklink {
 	char *(*state)(struct usock *);
 	int (*status)(struct usock *);
 	char *eol;
+	int (*poll)(struct usock *);	/* Readiness for kpoll(), kPOLL* bits */
 };
 extern struct socklink Socklink[];
 
@@ -89,6 +90,7 @@ struct usock {
 	uint8 errcodes[4];	/* Protocol-specific error codes */
 	uint8 tos;		/* Internet type-of-service */
 	int flag;		/* Mode flags, defined in socket.h */
+	void *pollev;		/* Event of a kpoll() waiting on this socket */
 };
 extern char *(*Psock[])(struct ksockaddr *);
 extern char Badsocket[];
@@ -97,6 +99,7 @@ extern struct usock **Usock;
 extern unsigned Nsock;
 
 struct usock *itop(int s);
+void sockwake(struct usock *up,int n);
 void st_garbage(int red);
 int so_ip_autobind(struct usock *up);
 
@@ -161,6 +164,7 @@ int so_lod_qlen(struct usock *up,int rtx);
 int so_los_qlen(struct usock *up,int rtx);
 int so_loc_shut(struct usock *up,int how);
 int so_loc_close(struct usock *up);
+int so_loc_poll(struct usock *up);
 char *lopsocket(struct ksockaddr *p);
 int so_loc_stat(struct usock *up);
 
@@ -198,6 +202,7 @@ int so_tcp_qlen(struct usock *up,int rtx);
 int so_tcp_kick(struct usock *up);
 int so_tcp_shut(struct usock *up,int how);
 int so_tcp_close(struct usock *up);
+int so_tcp_poll(struct usock *up);
 char *tcpstate(struct usock *up);
 int so_tcp_stat(struct usock *up);
 
@@ -211,6 +216,7 @@ int so_udp_send(struct usock *up,struct mbuf **bp,struct ksockaddr *to);
 int so_udp_qlen(struct usock *up,int rtx);
 int so_udp_shut(struct usock *up,int how);
 int so_udp_close(struct usock *up);
+int so_udp_poll(struct usock *up);
 int so_udp_stat(struct usock *up);
 
 #endif /* _KA9Q_USOCK_H */
@@ -26,6 +26,8 @@
 #define	READ_TEXT	"rt"
 #define	WRITE_TEXT	"wt"
 #define	APPEND_TEXT	"at+"
+#define	UPDATE_BINARY	"rb+"
+#define	UPDATE_TEXT	"rt+"
 
 #else
 
@@ -35,6 +37,8 @@
 #define	READ_TEXT	"r"
 #define	WRITE_TEXT	"w"
 #define	APPEND_TEXT	"a+"
+#define	UPDATE_BINARY	"r+"
+#define	UPDATE_TEXT	"r+"
 
 #endif
 
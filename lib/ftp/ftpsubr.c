@@ -3,6 +3,13 @@
  */
 #include "top.h"
 
+#ifdef UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 #include "lib/std/stdio.h"
 #include "global.h"
 #include "net/core/mbuf.h"
@@ -15,6 +22,136 @@
 
 #define	MD5BLOCK	64	/* Preferred MD5 block size */
 
+#ifdef UNIX
+#define	MAPCHUNK	262144L	/* Bytes of file mapped per mbuf */
+
+/* A window of a file mapped for sending */
+struct filemap {
+	struct filemap *next;
+	char *base;
+	long len;
+};
+static struct filemap *Filemaps;
+static long Pagemask;
+
+static long sendmapped(kFILE *fp,kFILE *network,enum verb_level verb,
+	long *hmark);
+
+/* SIGBUS handler. Touching a mapped page beyond the end of a file that
+ * was truncated after it was mapped (e.g., by a STOR to the same name)
+ * raises SIGBUS, which could happen anywhere the queued data is read.
+ * Rather than let that take the whole program down, put zero-filled
+ * pages over the rest of the window, so the access is retried and the
+ * other end gets zeros where the file was cut short. Faults anywhere
+ * else get the default action when they recur.
+ */
+static void
+mapfault(int sig,siginfo_t *info,void *context)
+{
+	struct filemap *mp;
+	char *addr,*page;
+
+	addr = (char *)info->si_addr;
+	for(mp = Filemaps;mp != NULL;mp = mp->next){
+		if(addr >= mp->base && addr < mp->base + mp->len){
+			page = (char *)((unsigned long)addr & ~Pagemask);
+			if(mmap(page,mp->base + mp->len - page,PROT_READ,
+			 MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED,-1,0) != MAP_FAILED)
+				return;
+			break;
+		}
+	}
+	signal(SIGBUS,SIG_DFL);
+}
+/* Release routine for mbufs referring to a mapped file */
+static void
+unmap_mbuf(struct mbuf *bp)
+{
+	struct filemap *mp,*prev = NULL;
+
+	for(mp = Filemaps;mp != NULL;prev = mp,mp = mp->next){
+		if(mp->base == (char *)bp->data){
+			if(prev == NULL)
+				Filemaps = mp->next;
+			else
+				prev->next = mp->next;
+			free(mp);
+			break;
+		}
+	}
+	munmap(bp->data,bp->size);
+}
+/* Send the rest of a binary file by mapping it and handing the mapped
+ * pages to the socket as external mbufs, so the data goes from the page
+ * cache into TCP segments without being copied. Stops early, leaving the
+ * file positioned after what was sent, if the file can't be mapped.
+ * Returns the count of bytes sent, or -1 on a network error.
+ *
+ * The pages are referenced until TCP has had them acknowledged; if the
+ * file is truncated meanwhile, mapfault() sends zeros in place of what
+ * was lost.
+ */
+static long
+sendmapped(fp,network,verb,hmark)
+kFILE *fp;
+kFILE *network;
+enum verb_level verb;
+long *hmark;
+{
+	static int handler;
+	struct sigaction sa;
+	struct stat statbuf;
+	struct filemap *mp;
+	struct mbuf *bp;
+	long offset,base,maplen;
+	long total = 0;
+	void *map;
+	uint cnt;
+
+	if(fp->type != _FL_FILE || fstat(kfileno(fp),&statbuf) == -1
+	 || !S_ISREG(statbuf.st_mode))
+		return 0;
+	if(!handler){
+		Pagemask = sysconf(_SC_PAGESIZE) - 1;
+		memset(&sa,0,sizeof(sa));
+		sa.sa_sigaction = mapfault;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		if(sigaction(SIGBUS,&sa,NULL) == -1)
+			return 0;
+		handler = 1;
+	}
+	offset = kftell(fp);
+	kfflush(network);	/* Keep anything already written in order */
+	while(offset < statbuf.st_size){
+		base = offset & ~Pagemask;
+		maplen = min(MAPCHUNK,statbuf.st_size - base);
+		map = mmap(NULL,maplen,PROT_READ,MAP_SHARED,kfileno(fp),base);
+		if(map == MAP_FAILED)
+			break;
+		mp = (struct filemap *)mallocw(sizeof(struct filemap));
+		mp->base = (char *)map;
+		mp->len = maplen;
+		mp->next = Filemaps;
+		Filemaps = mp;
+		bp = ext_mbuf(map,maplen,unmap_mbuf);
+		bp->data += offset - base;
+		bp->cnt -= offset - base;
+		cnt = bp->cnt;
+		if(send_mbuf(kfileno(network),&bp,0,NULL,0) == -1)
+			return -1;
+		offset += cnt;
+		total += cnt;
+		while(verb == V_HASH && total >= *hmark+1000){
+			kputchar('#');
+			*hmark += 1000;
+		}
+	}
+	kfseek(fp,offset,kSEEK_SET);
+	return total;
+}
+#endif
+
 /* Send a file (opened by caller) on a network socket.
  * Normal return: count of bytes sent
  * Error return: -1
@@ -46,6 +183,17 @@ enum verb_level verb;	/* Verbosity level */
 		kfmode(network,STREAM_ASCII);
 		break;
 	}
+#ifdef UNIX
+	/* Binary files go straight from the page cache where possible;
+	 * whatever can't be mapped is copied as usual below
+	 */
+	if(mode != ASCII_TYPE
+	 && (total = sendmapped(fp,network,verb,&hmark)) == -1){
+		if(verb == V_HASH)
+			kputchar('\n');
+		return -1;
+	}
+#endif
 	buf = mallocw(kBUFSIZ);
 	for(;;){
 		if((cnt = kfread(buf,1,kBUFSIZ,fp)) == 0){
@@ -0,0 +1,382 @@
+/* Mail area index. See mailidx.h.
+ *
+ * The index file is a header (magic number, size and modification time
+ * of the area file, message count) followed by one entry per message,
+ * all as 32-bit words in network order. Delivery appends entries and
+ * then rewrites the header, so a reader that catches it half done sees
+ * the old size, takes the index to be stale and scans instead.
+ */
+#include "top.h"
+
+#include "lib/std/stdio.h"
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef	UNIX
+#include <unistd.h>
+#endif
+#include "global.h"
+#include "net/core/mbuf.h"
+#include "core/proc.h"
+#include "mailbox.h"
+#include "bm.h"
+#include "lib/smtp/mailidx.h"
+
+#define	MI_MAGIC	0x4e4d4931L	/* "NMI1" */
+#define	MI_HDR		16		/* Bytes of header */
+#define	MI_ENT		20		/* Bytes per message entry */
+#define	MI_COPYBUF	4096		/* Buffer size for mi_copy() */
+
+static int Mi_busy;	/* An index is being written */
+
+static char *mi_name(char *txtname,char *ext);
+static int mi_read(char *txtname,struct stat *sp,struct mailarea *ma);
+static void mi_putent(kFILE *fp,struct mailmsg *mp);
+static void mi_puthdr(kFILE *fp,long size,long mtime,long nmsgs);
+
+/* Return the area file's name with its extension replaced */
+static char *
+mi_name(char *txtname,char *ext)
+{
+	char *name;
+
+	name = strdup(txtname);
+	strcpy(&name[strlen(name)-3],ext);
+	return name;
+}
+
+/* Add a cleared entry to the end of an area's message list */
+struct mailmsg *
+mi_add(struct mailarea *ma)
+{
+	struct mailmsg *newmsgs;
+
+	if(ma->nmsgs == ma->maxmsgs){
+		ma->maxmsgs = ma->maxmsgs == 0 ? 64 : 2 * ma->maxmsgs;
+		newmsgs = (struct mailmsg *)mallocw(ma->maxmsgs
+		 * sizeof(struct mailmsg));
+		if(ma->nmsgs != 0)
+			memcpy(newmsgs,ma->msgs,ma->nmsgs * sizeof(struct mailmsg));
+		free(ma->msgs);
+		ma->msgs = newmsgs;
+	}
+	newmsgs = &ma->msgs[ma->nmsgs++];
+	memset(newmsgs,0,sizeof(struct mailmsg));
+	return newmsgs;
+}
+
+/* Load the index of an area file, provided it is current for the
+ * status given. Returns -1 if it isn't.
+ */
+static int
+mi_read(char *txtname,struct stat *sp,struct mailarea *ma)
+{
+	kFILE *fp;
+	char *name;
+	uint8 hdr[MI_HDR];
+	uint8 *buf,*cp;
+	long i,n;
+
+	name = mi_name(txtname,"idx");
+	fp = kfopen(name,READ_BINARY);
+	free(name);
+	if(fp == NULL)
+		return -1;
+	if(kfread(hdr,1,MI_HDR,fp) != MI_HDR
+	 || get32(&hdr[0]) != MI_MAGIC
+	 || get32(&hdr[4]) != (int32)sp->st_size
+	 || get32(&hdr[8]) != (int32)sp->st_mtime
+	 || (n = get32(&hdr[12])) < 0){
+		kfclose(fp);
+		return -1;
+	}
+	if(n == 0){
+		kfclose(fp);
+		ma->size = sp->st_size;
+		return 0;
+	}
+	buf = mallocw(n * MI_ENT);
+	if(kfread(buf,1,n * MI_ENT,fp) != n * MI_ENT){
+		free(buf);
+		kfclose(fp);
+		return -1;
+	}
+	kfclose(fp);
+	ma->msgs = (struct mailmsg *)mallocw(n * sizeof(struct mailmsg));
+	ma->maxmsgs = ma->nmsgs = n;
+	ma->size = sp->st_size;
+	for(i=0,cp=buf;i<n;i++,cp += MI_ENT){
+		ma->msgs[i].start = get32(&cp[0]);
+		ma->msgs[i].size = get32(&cp[4]);
+		ma->msgs[i].hdrlen = get32(&cp[8]);
+		ma->msgs[i].lines = get32(&cp[12]);
+		ma->msgs[i].status = get32(&cp[16]);
+	}
+	free(buf);
+	return 0;
+}
+
+/* Write an entry at the current position */
+static void
+mi_putent(kFILE *fp,struct mailmsg *mp)
+{
+	uint8 buf[MI_ENT];
+
+	put32(&buf[0],mp->start);
+	put32(&buf[4],mp->size);
+	put32(&buf[8],mp->hdrlen);
+	put32(&buf[12],mp->lines);
+	put32(&buf[16],mp->status);
+	kfwrite(buf,1,MI_ENT,fp);
+}
+
+/* Write the header at the start of the index */
+static void
+mi_puthdr(kFILE *fp,long size,long mtime,long nmsgs)
+{
+	uint8 buf[MI_HDR];
+
+	put32(&buf[0],MI_MAGIC);
+	put32(&buf[4],size);
+	put32(&buf[8],mtime);
+	put32(&buf[12],nmsgs);
+	kfseek(fp,0L,kSEEK_SET);
+	kfwrite(buf,1,MI_HDR,fp);
+}
+
+/* Fill in the message list of an area file from its index, first
+ * rebuilding the index if it is missing or out of date. Returns -1 if
+ * the area can't be read; ma is left empty.
+ */
+int
+mi_open(char *txtname,struct mailarea *ma)
+{
+	kFILE *fp;
+	struct stat st;
+	int ret;
+
+	memset(ma,0,sizeof(struct mailarea));
+	if(stat(txtname,&st) != 0)
+		return -1;
+	if(mi_read(txtname,&st,ma) == 0)
+		return 0;
+
+	if((fp = kfopen(txtname,READ_TEXT)) == NULL)
+		return -1;
+	ret = mi_scan(fp,0L,ma);
+	kfclose(fp);
+	if(ret != 0){
+		mi_free(ma);
+		return -1;
+	}
+	mi_write(txtname,ma);
+	return 0;
+}
+
+/* Read an area file from offset from, which must be the start of a
+ * line, to the end and add entries for the messages found. Text before
+ * the first "From " line doesn't belong to any message.
+ */
+int
+mi_scan(kFILE *fp,long from,struct mailarea *ma)
+{
+	char line[LINELEN];
+	struct mailmsg *mp = NULL;
+	long pos;
+	int len,bol = 1,inhdr = 0;
+
+	if(kfseek(fp,from,kSEEK_SET) != 0)
+		return -1;
+	pos = from;
+	while(kfgets(line,sizeof(line),fp) != NULL){
+		len = strlen(line);
+		if(bol && strncmp(line,"From ",5) == 0){
+			if(inhdr)
+				mp->hdrlen = mp->size;
+			if((ma->nmsgs % 64) == 0)
+				kwait(NULL);	/* Let others run now and then */
+			mp = mi_add(ma);
+			mp->start = pos;
+			inhdr = 1;
+		}
+		if(mp != NULL){
+			mp->size += len;
+			if(inhdr && bol){
+				if(line[0] == '\n'){
+					mp->hdrlen = mp->size;
+					inhdr = 0;
+				} else if(htype(line) == STATUS
+				 && line[8] == 'R')
+					mp->status |= BM_READ;
+			}
+		}
+		bol = (len > 0 && line[len-1] == '\n');
+		if(bol && mp != NULL)
+			mp->lines++;
+		pos += len;
+	}
+	if(inhdr)
+		mp->hdrlen = mp->size;
+	ma->size = pos;
+	return kferror(fp) ? -1 : 0;
+}
+
+/* Write a fresh index for an area file whose messages are listed in ma.
+ * Nothing is written unless the file is still the size ma describes.
+ * Returns -1 if no index was written.
+ */
+int
+mi_write(char *txtname,struct mailarea *ma)
+{
+	kFILE *fp;
+	struct stat st;
+	char *tmpname,*name;
+	int i;
+
+	if(Mi_busy)
+		return -1;	/* Someone else is at it; let them */
+	if(stat(txtname,&st) != 0 || st.st_size != ma->size)
+		return -1;
+	Mi_busy = 1;
+	tmpname = mi_name(txtname,"idt");
+	if((fp = kfopen(tmpname,WRITE_BINARY)) == NULL){
+		free(tmpname);
+		Mi_busy = 0;
+		return -1;
+	}
+	mi_puthdr(fp,ma->size,(long)st.st_mtime,(long)ma->nmsgs);
+	for(i=0;i<ma->nmsgs;i++)
+		mi_putent(fp,&ma->msgs[i]);
+	if(kfflush(fp) != 0 || kferror(fp)){
+		kfclose(fp);
+		unlink(tmpname);
+		free(tmpname);
+		Mi_busy = 0;
+		return -1;
+	}
+	kfclose(fp);
+	name = mi_name(txtname,"idx");
+	unlink(name);
+	rename(tmpname,name);
+	free(name);
+	free(tmpname);
+	Mi_busy = 0;
+	return 0;
+}
+
+/* Index the messages just appended to an area file, starting at offset
+ * start. The area must be locked, and start and mtime must be the size
+ * and modification time of the file before they were added. If the
+ * index wasn't current then, it is removed to be rebuilt when next
+ * needed. Returns -1 if the index wasn't brought up to date.
+ */
+int
+mi_append(char *txtname,long start,long mtime)
+{
+	kFILE *fp,*ifp = NULL;
+	struct mailarea ma;
+	struct stat st;
+	uint8 hdr[MI_HDR];
+	char *name;
+	long n;
+	int i,ret = -1;
+
+	if(Mi_busy)
+		return -1;
+	if((fp = kfopen(txtname,READ_TEXT)) == NULL)
+		return -1;
+	memset(&ma,0,sizeof(ma));
+	if(start == 0){
+		/* A new area; index it from scratch */
+		if(mi_scan(fp,0L,&ma) == 0)
+			ret = mi_write(txtname,&ma);
+		kfclose(fp);
+		mi_free(&ma);
+		return ret;
+	}
+	Mi_busy = 1;
+	name = mi_name(txtname,"idx");
+	if((ifp = kfopen(name,UPDATE_BINARY)) == NULL)
+		goto done;	/* Nothing to keep up to date */
+	if(kfread(hdr,1,MI_HDR,ifp) != MI_HDR
+	 || get32(&hdr[0]) != MI_MAGIC
+	 || get32(&hdr[4]) != (int32)start
+	 || get32(&hdr[8]) != (int32)mtime
+	 || (n = get32(&hdr[12])) < 0)
+		goto stale;
+	/* The new messages must begin a line of their own, or a scan
+	 * wouldn't find them where we say they are
+	 */
+	if(kfseek(fp,start-1,kSEEK_SET) != 0 || kgetc(fp) != '\n')
+		goto stale;
+	if(mi_scan(fp,start,&ma) != 0
+	 || fstat(kfileno(fp),&st) != 0 || st.st_size != ma.size)
+		goto stale;
+
+	kfseek(ifp,MI_HDR + n * MI_ENT,kSEEK_SET);
+	for(i=0;i<ma.nmsgs;i++)
+		mi_putent(ifp,&ma.msgs[i]);
+	if(kfflush(ifp) != 0 || kferror(ifp))
+		goto stale;
+	mi_puthdr(ifp,ma.size,(long)st.st_mtime,n + ma.nmsgs);
+	if(kfflush(ifp) != 0 || kferror(ifp))
+		goto stale;
+	ret = 0;
+	goto done;
+stale:
+	kfclose(ifp);
+	ifp = NULL;
+	unlink(name);
+done:
+	if(ifp != NULL)
+		kfclose(ifp);
+	free(name);
+	kfclose(fp);
+	mi_free(&ma);
+	Mi_busy = 0;
+	return ret;
+}
+
+/* Remove the index of an area file */
+void
+mi_remove(char *txtname)
+{
+	char *name;
+
+	name = mi_name(txtname,"idx");
+	unlink(name);
+	free(name);
+}
+
+/* Release an area's message list */
+void
+mi_free(struct mailarea *ma)
+{
+	free(ma->msgs);
+	memset(ma,0,sizeof(struct mailarea));
+}
+
+/* Copy len bytes from offset start of in, or from its current position
+ * if start is -1, to the current position of out. Returns -1 if they
+ * couldn't all be copied.
+ */
+int
+mi_copy(kFILE *in,long start,long len,kFILE *out)
+{
+	char *buf;
+	int n;
+
+	if(start != -1 && kfseek(in,start,kSEEK_SET) != 0)
+		return -1;
+	buf = mallocw(MI_COPYBUF);
+	while(len > 0){
+		n = (int)min(len,(long)MI_COPYBUF);
+		if((n = kfread(buf,1,n,in)) <= 0)
+			break;
+		if(kfwrite(buf,1,n,out) != n)
+			break;
+		len -= n;
+	}
+	free(buf);
+	return len == 0 ? 0 : -1;
+}
@@ -0,0 +1,40 @@
+#ifndef _KA9Q_MAILIDX_H
+#define _KA9Q_MAILIDX_H
+
+/* mailidx.h -- index of the messages in a mail area file
+ *
+ * Beside each <area>.txt in the mail spool there may be an <area>.idx
+ * giving the offset, length and read status of every message in it, so
+ * that the mailbox and the POP server can open an area without reading
+ * it through. Delivery appends to the index as it appends to the area.
+ * The index is only believed while the size and modification time it
+ * records still match the area file; otherwise it's rebuilt by a scan.
+ */
+
+/* One message in an area file */
+struct mailmsg {
+	long start;	/* Offset of its "From " line */
+	long size;	/* Bytes, up to the next "From " line */
+	long hdrlen;	/* Bytes of header, through the blank line */
+	long lines;	/* Newlines in the message */
+	int status;	/* BM_READ if it has a "Status: R" header */
+};
+
+/* The messages in an area file */
+struct mailarea {
+	long size;		/* Bytes of the area file described */
+	int nmsgs;		/* Entries in use in msgs[] */
+	int maxmsgs;		/* Entries allocated in msgs[] */
+	struct mailmsg *msgs;
+};
+
+int mi_open(char *txtname,struct mailarea *ma);
+int mi_scan(kFILE *fp,long from,struct mailarea *ma);
+int mi_write(char *txtname,struct mailarea *ma);
+int mi_append(char *txtname,long start,long mtime);
+struct mailmsg *mi_add(struct mailarea *ma);
+void mi_remove(char *txtname);
+void mi_free(struct mailarea *ma);
+int mi_copy(kFILE *in,long start,long len,kFILE *out);
+
+#endif	/* _KA9Q_MAILIDX_H */
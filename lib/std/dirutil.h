@@ -5,9 +5,14 @@
 #include "global.h"
 #endif
 
+struct filedir;
+
 /* In dirutil.c */
 kFILE *dir(char *path,int full);
 int filedir(char *name,int times,char *ret_str);
+struct filedir *filedir_open(char *name);
+int filedir_next(struct filedir *fdp,char *ret_str);
+void filedir_close(struct filedir *fdp);
 int getdir(char *path,int full,kFILE *file);
 
 /* In pathname.c: */
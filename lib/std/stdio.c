@@ -28,8 +28,12 @@
 #include "core/usock.h"
 #include "core/socket.h"
 #include "core/display.h"
+#include "core/session.h"
 #include "core/asy.h"
 #include "lib/std/errno.h"
+#ifdef UNIX
+#include "unix/fileio_unix.h"
+#endif
 
 #define	_CREAT(a,b)	creat((a),(b))
 #ifdef UNIX
@@ -49,6 +53,15 @@
 static void _fclose(kFILE *fp);
 static struct mbuf *_fillbuf(kFILE *fp,int cnt);
 static kFILE *_fcreat(void);
+static int _fflush(kFILE *fp,int behind);
+static struct mbuf *_fileget(kFILE *fp,int cnt);
+static long _fileput(kFILE *fp,struct mbuf **bpp,int behind);
+#ifdef UNIX
+static int _fwait(kFILE *fp);
+static int _fdrain(kFILE *fp);
+static struct fioreq *_fiohold(kFILE *fp);
+static void _fiorelease(kFILE *fp);
+#endif
 
 kFILE *_Files;
 int _clrtmp = 1;
@@ -94,9 +107,14 @@ kFILE *fp
 	if(strchr(mode,'t') != NULL)
 		textmode = 1;
 	
-	if(create)
+	if(create){
 		fd = _CREAT(filename,S_IREAD|S_IWRITE);
-	else
+		if(fd != -1 && modef == O_RDWR){
+			/* creat() opens for writing only */
+			_CLOSE(fd);
+			fd = _OPEN(filename,modef);
+		}
+	} else
 		fd = _OPEN(filename,modef);
 	if(fd == -1)
 		return NULL;
@@ -416,10 +434,16 @@ kfputc(int c,kFILE *fp)
 		eol = 0;
 	}
 	bp = fp->obuf;
-	if(bp != NULL && bp->size - bp->cnt < nbytes && kfflush(fp) == kEOF)
+	if(bp != NULL && bp->size - bp->cnt < nbytes
+	 && _fflush(fp,fp->bufmode == _kIOFBF) == kEOF)
 		return kEOF;
-	if(fp->obuf == NULL)
+	if(fp->obuf == NULL){
 		fp->obuf = ambufw(max(nbytes,fp->bufsize));
+#ifdef	TICKLESS
+		if(fp->type == _FL_DISPLAY)
+			sesflush_later();
+#endif
+	}
 
 	bp = fp->obuf;
 	if(eol)
@@ -430,7 +454,7 @@ kfputc(int c,kFILE *fp)
 
 	if(bp->cnt == bp->size || (fp->bufmode == _kIONBF)
 	 || ((fp->bufmode == _kIOLBF) && eol)){
-		if(kfflush(fp) == kEOF)
+		if(_fflush(fp,fp->bufmode == _kIOFBF) == kEOF)
 			return kEOF;
 	}
 	return c;
@@ -513,15 +537,39 @@ _kfgetc(kFILE *fp)
 	return PULLCHAR(&fp->ibuf);
 }
 
-/* Flush output on a stream. All actual output is done here. */
+/* Flush output on a stream */
 int
 kfflush(kFILE *fp)
+{
+	return _fflush(fp,0);
+}
+/* All actual output is done here. If behind is set, a file stream's
+ * buffer is only started on its way to the disk; the write is finished
+ * (and any error reported) by the next operation on the stream.
+ */
+static int
+_fflush(kFILE *fp,int behind)
 {
 	struct mbuf *bp;
-	int cnt;
+	long cnt;
 
-	if(fp == NULL || fp->cookie != _COOKIE || fp->obuf == NULL)
+	if(fp == NULL || fp->cookie != _COOKIE)
+		return 0;
+	if(fp->obuf == NULL){
+#ifdef UNIX
+		/* Nothing new, but finish any write-behind */
+		if(!behind && fp->type == _FL_FILE){
+			int ret;
+
+			_fiohold(fp);
+			ret = _fwait(fp);
+			_fiorelease(fp);
+			if(ret == -1)
+				return kEOF;
+		}
+#endif
 		return 0;
+	}
 
 	bp = fp->obuf;
 	fp->obuf = NULL;
@@ -541,21 +589,11 @@ kfflush(kFILE *fp)
 	case _FL_SOCK:
 		return send_mbuf(fp->fd,&bp,0,NULL,0);
 	case _FL_FILE:
-		do {
-			if(fp->flags.append)
-				_LSEEK(fp->fd,0L,kSEEK_END);
-			else
-				_LSEEK(fp->fd,fp->offset,kSEEK_SET);
-			cnt = _WRITE(fp->fd,bp->data,bp->cnt);
-			if(cnt > 0)
-				fp->offset += cnt;
-			if(cnt != bp->cnt){
-				fp->flags.err = 1;
-				free_p(&bp);
-				return kEOF;
-			}
-			free_mbuf(&bp);
-		} while(bp != NULL);
+		cnt = len_p(bp);
+		if(_fileput(fp,&bp,behind) != cnt){
+			fp->flags.err = 1;
+			return kEOF;
+		}
 		return 0;
 	case _FL_DISPLAY:
 		do {
@@ -714,14 +752,9 @@ kFILE *fp
 
 	/* Optimization for large binary file writes */
 	if(fp->type == _FL_FILE && !fp->flags.ascii && bytes >= fp->bufsize){
-		kfflush(fp);
-		if(fp->flags.append)
-			_LSEEK(fp->fd,0L,kSEEK_END);
-		else
-			_LSEEK(fp->fd,fp->offset,kSEEK_SET);
-		cnt = _WRITE(fp->fd,icp,bytes);
-		if(cnt > 0)
-			fp->offset += cnt;
+		_fflush(fp,1);
+		bp = qdata(icp,bytes);
+		cnt = _fileput(fp,&bp,fp->bufmode == _kIOFBF);
 		if(cnt != bytes)
 			return cnt/size;
 		return n;
@@ -739,7 +772,7 @@ kFILE *fp
 		bp = fp->obuf;
 		if(bp != NULL && bp->cnt + eollen > bp->size){
 			/* Current obuf is full; flush it */
-			if(kfflush(fp) == kEOF)
+			if(_fflush(fp,fp->bufmode == _kIOFBF) == kEOF)
 				return (bytes - n*size)/size;
 		}
 		if((bp = fp->obuf) == NULL){
@@ -750,6 +783,10 @@ kFILE *fp
 			asize = bytes+(eollen-1)*newlines;
 			asize = max(fp->bufsize,asize);
 			bp = fp->obuf = ambufw(asize);
+#ifdef	TICKLESS
+			if(fp->type == _FL_DISPLAY)
+				sesflush_later();
+#endif
 		}
 		if(fp->flags.ascii && newlines != 0){
 			/* Copy text to buffer, expanding newlines */
@@ -782,7 +819,7 @@ kFILE *fp
 	 * last character)
 	 */
 	if(fp->bufmode == _kIONBF || bp->cnt == bp->size || doflush){
-		if(kfflush(fp) == kEOF)
+		if(_fflush(fp,fp->bufmode == _kIOFBF) == kEOF)
 			return (bytes - n*size)/size;
 	}
 	return n;
@@ -790,7 +827,6 @@ kFILE *fp
 static struct mbuf *
 _fillbuf(kFILE *fp,int cnt)
 {
-	struct mbuf *bp;
 	int i;
 
 	if(fp->ibuf != NULL)
@@ -823,23 +859,8 @@ _fillbuf(kFILE *fp,int cnt)
 		return fp->ibuf;
 	case _FL_FILE:
 		/* Read from file */
-		cnt = max(fp->bufsize,cnt);
-		bp = ambufw(cnt);		
-		_LSEEK(fp->fd,fp->offset,kSEEK_SET);
-		cnt = _READ(fp->fd,bp->data,cnt);
-		if(cnt < 0)
-			fp->flags.err = 1;
-		if(cnt == 0)
-			fp->flags.eof = 1;
-		if(cnt <= 0){
-			free_p(&bp);	/* Nothing successfully read */
-			return NULL;
-		}
-		fp->offset += cnt;	/* Update pointer */
-		/* Buffer successfully read, store it */
-		bp->cnt = cnt;
-		fp->ibuf = bp;
-		return bp;
+		fp->ibuf = _fileget(fp,max(fp->bufsize,cnt));
+		return fp->ibuf;
 	case _FL_DISPLAY:	/* Displays are write-only */
 		return NULL;
 	}
@@ -855,7 +876,7 @@ kFILE *fp
 	struct mbuf *bp;
 	size_t bytes;
 	size_t cnt;
-	int c, tmp;
+	int c;
 	size_t tot = 0;
 	uint8 *ocp;
 	uint8 *cp;
@@ -867,10 +888,16 @@ kFILE *fp
 
 	ocp = ptr;
 	while(bytes != 0){
-		/* Optimization for large binary file reads */
+#ifndef UNIX
+		/* Optimization for large binary file reads. With the I/O
+		 * done by host threads, the data has to come back in an
+		 * mbuf anyway, so just fill a big enough input buffer.
+		 */
 		if(fp->ibuf == NULL
 		 && fp->type == _FL_FILE && !fp->flags.ascii
 		 && bytes >= kBUFSIZ){
+			int tmp;
+
 			_LSEEK(fp->fd,fp->offset,kSEEK_SET);
 			tmp = _READ(fp->fd,ocp,bytes);
 			if(tmp < 0)
@@ -881,6 +908,7 @@ kFILE *fp
 				return tmp/size;
 			return n;
 		}
+#endif
 		/* Replenish input buffer if necessary */
 		if(fp->ibuf == NULL){
 			if(tot != 0 && fp->flags.partread){
@@ -1007,6 +1035,206 @@ ktmpfile(void)
 		fp->flags.tmp = 1;
 	return fp;
 }
+#ifdef UNIX
+/* File streams hand their reads and writes to the host I/O threads
+ * (see unix/fileio_unix.c) so that a slow disk holds up only the process
+ * using the stream. The one request block per stream also carries
+ * write-behind, a full buffer being written while the caller fills the
+ * next, and read-ahead, the buffer following the one last read.
+ *
+ * A stream may be shared between processes (Logfp, or through kfdup),
+ * so the request is held by one process at a time, from before it is
+ * started until it has been waited for; anyone else wanting the stream
+ * waits for it to be released.
+ */
+static struct fioreq *
+_fioreq(kFILE *fp)
+{
+	if(fp->fio == NULL)
+		fp->fio = callocw(1,sizeof(struct fioreq));
+	return fp->fio;
+}
+/* Take the stream's request, waiting for any other holder to finish */
+static struct fioreq *
+_fiohold(kFILE *fp)
+{
+	struct fioreq *rq;
+
+	for(;;){
+		rq = _fioreq(fp);
+		if(!rq->held)
+			break;
+		kwait(&rq->held);
+	}
+	rq->held = 1;
+	return rq;
+}
+/* Give up the stream's request and wake whoever is waiting for it */
+static void
+_fiorelease(kFILE *fp)
+{
+	fp->fio->held = 0;
+	ksignal(&fp->fio->held,0);
+}
+/* Finish any write-behind. The request must be held.
+ * Returns -1 if it failed.
+ */
+static int
+_fwait(kFILE *fp)
+{
+	struct fioreq *rq = fp->fio;
+	int ret = 0;
+
+	if(rq == NULL || rq->op == FIO_READ || !rq->busy)
+		return 0;
+	if(fio_wait(rq) != rq->cnt){
+		fp->flags.err = 1;
+		ret = -1;
+	}
+	free_p(&rq->bp);
+	return ret;
+}
+/* Finish any write-behind and discard any read-ahead. The request must
+ * be held. Returns -1 if the write-behind failed.
+ */
+static int
+_fdrain(kFILE *fp)
+{
+	struct fioreq *rq = fp->fio;
+
+	if(_fwait(fp) == -1)
+		return -1;
+	if(rq != NULL && rq->op == FIO_READ){
+		fio_wait(rq);
+		free_p(&rq->bp);
+	}
+	return 0;
+}
+#endif
+
+/* Read up to cnt bytes from a file stream at its current offset.
+ * Returns NULL, with the eof or err flag set, if nothing was read.
+ */
+static struct mbuf *
+_fileget(kFILE *fp,int cnt)
+{
+	struct mbuf *bp = NULL;
+	long n;
+#ifdef UNIX
+	struct fioreq *rq = _fiohold(fp);
+
+	_fwait(fp);
+	if(rq->op == FIO_READ && (rq->busy || rq->bp != NULL)){
+		/* Use the read-ahead if it's where we are now. At end of
+		 * file, look again in case the file has grown since.
+		 */
+		if((n = fio_wait(rq)) > 0 && rq->offset == fp->offset){
+			bp = rq->bp;
+			bp->cnt = n;
+			rq->bp = NULL;
+		} else
+			free_p(&rq->bp);
+	}
+	if(bp == NULL){
+		rq->op = FIO_READ;
+		rq->fd = fp->fd;
+		rq->offset = fp->offset;
+		rq->cnt = cnt;
+		rq->bp = ambufw(cnt);
+		n = fio_io(rq);
+		bp = rq->bp;
+		rq->bp = NULL;
+		if(n > 0)
+			bp->cnt = n;
+	}
+#else
+	bp = ambufw(cnt);
+	_LSEEK(fp->fd,fp->offset,kSEEK_SET);
+	n = _READ(fp->fd,bp->data,cnt);
+	if(n > 0)
+		bp->cnt = n;
+#endif
+	if(n < 0)
+		fp->flags.err = 1;
+	if(n == 0)
+		fp->flags.eof = 1;
+	if(n <= 0){
+#ifdef UNIX
+		_fiorelease(fp);
+#endif
+		free_p(&bp);	/* Nothing successfully read */
+		return NULL;
+	}
+	fp->offset += n;	/* Update pointer */
+#ifdef UNIX
+	if(n == cnt){
+		/* Looks sequential; start on the next buffer */
+		rq->offset = fp->offset;
+		rq->bp = ambufw(cnt);
+		fio_start(rq);
+	}
+	_fiorelease(fp);
+#endif
+	return bp;
+}
+/* Write the chain *bpp to a file stream at its current offset, or at the
+ * end in append mode, consuming it. Returns the bytes written. With
+ * behind set, the write is only started and assumed to succeed.
+ */
+static long
+_fileput(kFILE *fp,struct mbuf **bpp,int behind)
+{
+	long n,cnt;
+#ifdef UNIX
+	struct fioreq *rq = _fiohold(fp);
+
+	if(_fdrain(fp) == -1){
+		/* The last write-behind failed */
+		_fiorelease(fp);
+		free_p(bpp);
+		return -1;
+	}
+	rq->op = fp->flags.append ? FIO_APPEND : FIO_WRITE;
+	rq->fd = fp->fd;
+	rq->offset = fp->offset;
+	rq->cnt = cnt = len_p(*bpp);
+	rq->bp = *bpp;
+	*bpp = NULL;
+	fio_start(rq);
+	if(behind){
+		fp->offset += cnt;
+		_fiorelease(fp);
+		return cnt;
+	}
+	n = fio_wait(rq);
+	free_p(&rq->bp);
+	if(n > 0)
+		fp->offset += n;
+	_fiorelease(fp);
+	return n;
+#else
+	struct mbuf *bp;
+
+	n = 0;
+	while((bp = *bpp) != NULL){
+		if(fp->flags.append)
+			_LSEEK(fp->fd,0L,kSEEK_END);
+		else
+			_LSEEK(fp->fd,fp->offset + n,kSEEK_SET);
+		cnt = _WRITE(fp->fd,bp->data,bp->cnt);
+		if(cnt > 0)
+			n += cnt;
+		if(cnt != bp->cnt)
+			break;
+		free_mbuf(bpp);
+	}
+	free_p(bpp);
+#endif
+	if(n > 0)
+		fp->offset += n;
+	return n;
+}
+
 /* Do everything to close a stream except freeing the descriptor
  * The reference count is left unchanged, and the descriptor is still
  * on the list
@@ -1046,6 +1274,12 @@ _fclose(kFILE *fp)
 		close_s(fp->fd);
 		break;
 	case _FL_FILE:
+#ifdef UNIX
+		_fiohold(fp);
+		_fdrain(fp);
+		free(fp->fio);
+		fp->fio = NULL;
+#endif
 		_CLOSE(fp->fd);
 		fp->offset = 0;
 		break;
@@ -1102,7 +1336,11 @@ kread(int fd,void *buf,unsigned cnt)
 	}
 	switch(type){
 	case _FL_FILE:
+#ifdef UNIX
+		res = fio_read(fd,buf,cnt);
+#else
 		res = (int)_READ(fd,buf,cnt);
+#endif
 		if (res == -1)
 			kerrno = translate_sys_errno(errno);
 		return res;
@@ -1127,7 +1365,11 @@ kwrite(int fd,const void *buf,unsigned cnt)
 	}
 	switch(type){
 	case _FL_FILE:
+#ifdef UNIX
+		res = fio_write(fd,buf,cnt);
+#else
 		res = (int)_WRITE(fd,buf,cnt);
+#endif
 		if (res == -1)
 			kerrno = translate_sys_errno(errno);
 		return res;
@@ -58,6 +58,9 @@ struct _file{
 	char eol[EOL_LEN];	/* Text mode end-of-line sequence, if any */
 	int bufsize;		/* Size of buffer to use */
 	void *ptr;		/* File name or display pointer */
+#ifdef UNIX
+	struct fioreq *fio;	/* Host I/O request, _FL_FILE only */
+#endif
 #ifdef HAVE_FUNOPEN
 	FILE *osfp;
 #endif
@@ -71,11 +71,48 @@ crc_init(uint16 *crc)
 	*crc = FCS_START;
 }
 	
+/* Tables for computing the FCS eight bytes at a time ("slicing by 8").
+ * Fcs8[k][i] is the effect on the CRC of byte value i followed by k
+ * zero bytes, so Fcs8[0] is the same as Fcstab. Built on first use.
+ */
+static uint16 Fcs8[8][256];
+static int Fcs8_ready;
+
+static void
+fcs8_init(void)
+{
+	int i,k;
+
+	for(i=0;i<256;i++){
+		Fcs8[0][i] = Fcstab[i];
+		for(k=1;k<8;k++)
+			Fcs8[k][i] = FCS(Fcs8[k-1][i],0);
+	}
+	Fcs8_ready = 1;
+}
+
 /* Update a running CRC */
 void
 crc_update(uint8 *buf, uint len, uint16 *pcrc)
 {
 	uint16 crc = *pcrc;
+
+	if(len >= 16){
+		if(!Fcs8_ready)
+			fcs8_init();
+		/* Fold each group of eight bytes in with one lookup per
+		 * byte, all independent of each other
+		 */
+		while(len >= 8){
+			crc ^= buf[0] | (buf[1] << 8);
+			crc = Fcs8[7][crc & 0xff] ^ Fcs8[6][crc >> 8]
+			 ^ Fcs8[5][buf[2]] ^ Fcs8[4][buf[3]]
+			 ^ Fcs8[3][buf[4]] ^ Fcs8[2][buf[5]]
+			 ^ Fcs8[1][buf[6]] ^ Fcs8[0][buf[7]];
+			buf += 8;
+			len -= 8;
+		}
+	}
 	while(len-- != 0)
 		crc = FCS(crc,*buf++);
 	*pcrc = crc;
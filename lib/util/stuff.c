@@ -0,0 +1,64 @@
+/* Byte-stuffing support for the async framers
+ *
+ * SLIP, KISS and asynchronous HDLC all transmit most bytes unchanged and
+ * escape a small set of special values. Rather than testing every byte
+ * in turn, stuff_run() finds the length of the leading run that needs no
+ * attention by looking at a machine word at a time, so the framers can
+ * copy that run in bulk and handle only the odd special byte themselves.
+ */
+#include "top.h"
+#include "global.h"
+
+#include <string.h>
+
+#include "lib/util/stuff.h"
+
+typedef unsigned long sword;		/* Unit of scanning */
+#define	ONES	((sword)~0UL / 0xff)	/* 0x0101...01 */
+#define	HIGHS	(ONES * 0x80)		/* 0x8080...80 */
+
+/* Nonzero if any byte in x is zero */
+#define	HASZERO(x)	(((x) - ONES) & ~(x) & HIGHS)
+/* Nonzero if any byte in x is less than n (n <= 128) */
+#define	HASLESS(x,n)	(((x) - ONES * (n)) & ~(x) & HIGHS)
+
+/* Return the number of bytes at the start of buf that are neither a nor b,
+ * nor (if ctl is set) less than STUFF_CTL. The caller decides what to do
+ * about the byte that stopped the scan; note that with ctl set, this
+ * stops at every control character whether or not it actually needs to
+ * be escaped.
+ */
+uint
+stuff_run(
+const uint8 *buf,
+uint len,
+uint8 a,
+uint8 b,
+int ctl
+){
+	const uint8 *cp = buf;
+	const uint8 *end = buf + len;
+	sword pa,pb,w;
+
+	/* Bytewise until aligned */
+	while(cp < end && ((unsigned long)cp & (sizeof(sword)-1)) != 0){
+		if(*cp == a || *cp == b || (ctl && *cp < STUFF_CTL))
+			return cp - buf;
+		cp++;
+	}
+	pa = ONES * a;
+	pb = ONES * b;
+	while(end - cp >= (long)sizeof(sword)){
+		memcpy(&w,cp,sizeof(w));
+		if(HASZERO(w ^ pa) || HASZERO(w ^ pb)
+		 || (ctl && HASLESS(w,STUFF_CTL)))
+			break;	/* Something in this word; find it below */
+		cp += sizeof(sword);
+	}
+	while(cp < end){
+		if(*cp == a || *cp == b || (ctl && *cp < STUFF_CTL))
+			break;
+		cp++;
+	}
+	return cp - buf;
+}
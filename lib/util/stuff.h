@@ -0,0 +1,13 @@
+#ifndef	_KA9Q_STUFF_H
+#define	_KA9Q_STUFF_H
+
+#include "global.h"
+
+/* Byte-stuffing support for the async framers (SLIP, KISS, HDLC/PPP) */
+
+#define	STUFF_CTL	0x20	/* Bytes below this are "control" characters */
+
+/* In stuff.c: */
+uint stuff_run(const uint8 *buf,uint len,uint8 a,uint8 b,int ctl);
+
+#endif	/* _KA9Q_STUFF_H */
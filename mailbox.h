@@ -62,13 +62,12 @@ struct mbx {
 	int newmsgs;		/* number of new messages in mail box */
 	int change;		/* mail file changed */
 	int anyread;		/* true if any message has been read */
-	kFILE *mfile;		/* mail data file pointer */
+	kFILE *mfile;		/* mail area file, read in place */
 	char area[64];		/* name of current mail area */
 	long mboxsize;		/* size of mailbox when opened */
 	long mysize;		/* size of my private mailbox */
 	struct let *mbox;
 	char *stdinbuf;		/* the stdio buffer for the mail file */
-	char *stdoutbuf;	/* the stdio file io buffer for the temp file */
 } ;
 
 /* Structure used for automatic flushing of gateway sockets */
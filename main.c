@@ -366,7 +366,7 @@ void *p
 		argc--;
 		argv++;
 	} else {
-		interval = MSPTICK;
+		interval = SESFLUSH;
 	}
 	if((sp = newsession(Cmdline,REPEAT,1)) == NULL){
 		kprintf("Too many sessions\n");
@@ -447,6 +447,53 @@ get_asy(int dev)
 	else
 		return tmp;
 }
+/* Blocking burst read from asynch line, without copying
+ * Sets *bufp to the next run of contiguous bytes in the receive fifo and
+ * returns its length, or -1 if aborting. The bytes stay in the fifo
+ * until given back with release_asy()
+ */
+int
+get_asy_burst(int dev,uint8 **bufp)
+{
+	struct fifo *fp;
+	int i_state,tmp;
+
+	if(dev < 0 || dev >= ASY_MAX){
+		kerrno = kEINVAL;
+		return -1;
+	}
+	fp = &Asy[dev].fifo;
+	for(;;){
+		i_state = disable();
+		tmp = fp->cnt;
+		restore(i_state);
+		if(tmp != 0)
+			break;
+		if((kerrno = kwait(fp)) != 0)
+			return -1;
+	}
+	*bufp = fp->rp;
+	if(tmp > &fp->buf[fp->bufsize] - fp->rp)
+		tmp = &fp->buf[fp->bufsize] - fp->rp;	/* Stop at wrap */
+	return tmp;
+}
+/* Release the first cnt bytes of a burst returned by get_asy_burst() */
+void
+release_asy(int dev,int cnt)
+{
+	struct fifo *fp;
+	int i_state;
+
+	if(dev < 0 || dev >= ASY_MAX || cnt <= 0)
+		return;
+	fp = &Asy[dev].fifo;
+	i_state = disable();
+	fp->cnt -= cnt;
+	restore(i_state);
+	fp->rp += cnt;
+	if(fp->rp >= &fp->buf[fp->bufsize])
+		fp->rp = fp->buf;
+}
 
 /* Interrupt handler for 8250 asynch chip (called from asyvec.asm) */
 void
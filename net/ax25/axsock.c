@@ -415,6 +415,7 @@ int cnt
 			ASSIGN(*nup,*up);
 			axp->user = ns;
 			nup->cb.ax25 = axp;
+			nup->pollev = NULL;
 			/* Allocate new memory for the name areas */
 			nup->name = mallocw(sizeof(struct ksockaddr_ax));
 			nup->peername = mallocw(sizeof(struct ksockaddr_ax));
@@ -446,12 +447,12 @@ int cnt
 		memcpy(sp.ax->iface,axp->iface->name,ILEN);
 		up->peernamelen = sizeof(struct ksockaddr_ax);
 		/* Wake up the guy accepting it, and let him run */
-		ksignal(oup,1);
+		sockwake(oup,1);
 		kwait(NULL);
 		return;
 	}
 	/* Wake up anyone waiting, and let them run */
-	ksignal(up,1);
+	sockwake(up,1);
 	kwait(NULL);
 }
 /* AX.25 transmit upcall */
@@ -461,7 +462,7 @@ struct ax25_cb *axp,
 int cnt
 ){
 	/* Wake up anyone waiting, and let them run */
-	ksignal(itop(axp->user),1);
+	sockwake(itop(axp->user),1);
 	kwait(NULL);
 }
 /* AX25 state change upcall routine */
@@ -496,7 +497,7 @@ int new
 	default:	/* Other transitions are ignored */
 		break;
 	}
-	ksignal(up,0);	/* In case anybody's waiting */
+	sockwake(up,0);	/* In case anybody's waiting */
 }
 
 /* Issue an automatic bind of a local AX25 address */
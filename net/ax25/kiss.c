@@ -42,7 +42,8 @@ kiss_init(struct iface *ifp)
 
 	sp->iface = ifp;
 	sp->send = asy_send;
-	sp->get = get_asy;
+	sp->get = get_asy_burst;
+	sp->release = release_asy;
 	sp->type = CL_KISS;
 	ifp->rxproc = newproc( ifn = if_name( ifp, " rx" ),
 		256,slip_rx,xdev,NULL,NULL,0);
@@ -34,7 +34,7 @@ struct iface Loopback = {
 	NULL,	/* rxproc	*/
 	NULL,	/* txproc	*/
 	NULL,	/* supv		*/
-	NULL,	/* outq		*/
+	{ NULL, NULL, 0, 0 },	/* outq		*/
 	0,		/* outlim	*/
 	0,		/* txbusy	*/
 	NULL,		/* dstate	*/
@@ -75,7 +75,7 @@ struct iface Encap = {
 	NULL,	/* rxproc	*/
 	NULL,	/* txproc	*/
 	NULL,	/* supv		*/
-	NULL,	/* outq		*/
+	{ NULL, NULL, 0, 0 },	/* outq		*/
 	0,		/* outlim	*/
 	0,		/* txbusy	*/
 	NULL,		/* dstate	*/
@@ -110,6 +110,10 @@ char Noipaddr[] = "IP address field missing, and ip address not set\n";
  * send IP datagrams. It waits on the interface's IP output queue (outq),
  * extracts IP datagrams placed there in priority order by ip_route(),
  * and sends them to the device's send routine.
+ *
+ * Up to IF_TXBATCH datagrams are sent before giving up the CPU. If the
+ * device has a rawbatch routine, the frames its raw routine is handed
+ * during the batch are held and passed to rawbatch in one call at the end.
  */
 void
 if_tx(int dev,void *arg1,void *unused)
@@ -117,28 +121,41 @@ if_tx(int dev,void *arg1,void *unused)
 	struct mbuf *bp;	/* Buffer to send */
 	struct iface *iface;	/* Pointer to interface control block */
 	struct qhdr qhdr;
+	int n,i;
 
 	iface = arg1;
 	for(;;){
-		while(iface->outq == NULL)
+		while(iface->outq.head == NULL)
 			kwait(&iface->outq);
 
 		iface->txbusy = 1;
-		bp = dequeue(&iface->outq);
-		pullup(&bp,&qhdr,sizeof(qhdr));
-		if(iface->dtickle != NULL && (*iface->dtickle)(iface) == -1){
+		if(iface->rawbatch != NULL)
+			iface->txbatch = 1;
+		for(n=0;n < IF_TXBATCH && iface->outq.head != NULL;n++){
+			bp = dequeue_mq(&iface->outq);
+			pullup(&bp,&qhdr,sizeof(qhdr));
+			if(iface->dtickle != NULL && (*iface->dtickle)(iface) == -1){
 #ifdef	notdef	/* Confuses some non-compliant hosts */
-			struct ip ip;
+				struct ip ip;
 
-			/* Link redial failed; bounce with unreachable */
-			ntohip(&ip,&bp);
-			icmp_output(&ip,bp,ICMP_DEST_UNREACH,ICMP_HOST_UNREACH,
-			 NULL);
+				/* Link redial failed; bounce with unreachable */
+				ntohip(&ip,&bp);
+				icmp_output(&ip,bp,ICMP_DEST_UNREACH,ICMP_HOST_UNREACH,
+				 NULL);
 #endif
-			free_p(&bp);
-		} else {
-			(*iface->send)(&bp,iface,qhdr.gateway,qhdr.tos);
+				free_p(&bp);
+			} else {
+				(*iface->send)(&bp,iface,qhdr.gateway,qhdr.tos);
+			}
+		}
+		if(iface->txbatch){
+			iface->txbatch = 0;
+			if(iface->txhold.head != NULL)
+				(*iface->rawbatch)(iface,&iface->txhold);
 		}
+		for(i=0;i < IF_TXHIST-1 && (2 << i) <= n;i++)
+			;
+		iface->txhist[i]++;
 		iface->txbusy = 0;
 
 		/* Let other tasks run, just in case send didn't block */
@@ -157,9 +174,8 @@ network(int i,void *v1,void *v2)
 loop:
 	for(;;){
 		i_state = disable();
-		bp = Hopper;
-		if(bp != NULL){
-			bp = dequeue(&Hopper);
+		if(Hopper.head != NULL){
+			bp = dequeue_mq(&Hopper);
 			restore(i_state);
 			break;
 		}
@@ -198,7 +214,7 @@ net_route(struct iface *ifp,struct mbuf **bpp)
 	if(bpp == NULL || *bpp == NULL)
 		return 0;	/* bogus */
 	pushdown(bpp,&ifp,sizeof(ifp));
-	enqueue(&Hopper,bpp);
+	enqueue_mq(&Hopper,bpp);
 	return 0;
 }
 
@@ -240,7 +256,7 @@ if_detach(struct iface *ifp)
 {
 	struct iface *iftmp;
 	struct route *rp,*rptmp;
-	int i,j;
+	int j;
 
 	if(ifp == &Loopback || ifp == &Encap)
 		return -1;
@@ -249,14 +265,12 @@ if_detach(struct iface *ifp)
 	if(R_default.iface == ifp)
 		rt_drop(0L,0);	/* Drop default route */
 
-	for(i=0;i<HASHMOD;i++){
-		for(j=0;j<32;j++){
-			for(rp = Routes[j][i];rp != NULL;rp = rptmp){
-				/* Save next pointer in case we delete this entry */
-				rptmp = rp->next;
-				if(rp->iface == ifp)
-					rt_drop(rp->target,rp->bits);
-			}
+	for(j=0;j<32;j++){
+		for(rp = Routes[j];rp != NULL;rp = rptmp){
+			/* Save next pointer in case we delete this entry */
+			rptmp = rp->next;
+			if(rp->iface == ifp)
+				rt_drop(rp->target,rp->bits);
 		}
 	}
 	/* Unforward any other interfaces forwarding to this one */
@@ -60,6 +60,9 @@ extern struct iftype Iftypes[];
 
 
 /* Interface control structure */
+#define	IF_TXBATCH	16	/* Max packets sent by if_tx between yields */
+#define	IF_TXHIST	5	/* Histogram buckets: 1, 2-3, 4-7, 8-15, 16 */
+
 struct iface {
 	struct iface *next;	/* Linked list pointer */
 	char *name;		/* Ascii string with interface name */
@@ -85,7 +88,7 @@ struct iface {
 	struct proc *txproc;	/* IP send process */
 	struct proc *supv;	/* Supervisory process, if any */
 
-	struct mbuf *outq;	/* IP datagram transmission queue */
+	struct mqueue outq;	/* IP datagram transmission queue */
 	int outlim;		/* Limit on outq length */
 	int txbusy;		/* Transmitter is busy */
 
@@ -129,6 +132,15 @@ struct iface {
 	int32 rawrecvcnt;	/* Raw packets received */
 	int32 lastsent;		/* Clock time of last send */
 	int32 lastrecv;		/* Clock time of last receive */
+
+	/* Batched transmit. If the device provides rawbatch, if_tx sets
+	 * txbatch while it sends a batch; the device's raw routine then
+	 * just queues frames on txhold and rawbatch sends them all at once
+	 */
+	int (*rawbatch)(struct iface *,struct mqueue *);
+	int txbatch;		/* Batch in progress, hold raw frames */
+	struct mqueue txhold;	/* Frames held for rawbatch */
+	int32 txhist[IF_TXHIST];	/* if_tx batch sizes, by power of two */
 };
 extern struct iface *Ifaces;	/* Head of interface list */
 extern struct iface  Loopback;	/* Optional loopback interface */
@@ -141,7 +153,7 @@ struct qhdr {
 };
 
 extern char Noipaddr[];
-extern struct mbuf *Hopper;
+extern struct mqueue Hopper;
 
 /* In iface.c: */
 int bitbucket(struct iface *ifp,struct mbuf **bp);
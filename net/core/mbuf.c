@@ -112,6 +112,31 @@ ambufw(uint size)
 	bp->refcnt++;
 	return bp;
 }
+/* Allocate an mbuf whose data is size bytes of external storage at data,
+ * e.g. a mapped file. The storage is described by a header of its own,
+ * and what's returned is a duplicate of that, so nothing will write
+ * into the storage or push headers down in front of it. When the last
+ * reference goes, release is called with the storage header (data and
+ * size as given here) to give the storage back.
+ */
+struct mbuf *
+ext_mbuf(uint8 *data,uint size,void (*release)(struct mbuf *))
+{
+	struct mbuf *xp,*bp;
+
+	xp = (struct mbuf *)mallocw(sizeof(struct mbuf));
+	memset(xp,0,sizeof(struct mbuf));
+	xp->data = data;
+	xp->size = xp->cnt = size;
+	xp->release = release;
+	xp->refcnt = 1;		/* Held by bp */
+
+	bp = ambufw(0);
+	bp->dup = xp;
+	bp->data = data;
+	bp->cnt = size;
+	return bp;
+}
 
 /* Decrement the reference pointer in an mbuf. If it goes to zero,
  * free all resources associated with mbuf.
@@ -134,7 +159,12 @@ free_mbuf(struct mbuf **bpp)
 		free_mbuf(&bptmp);	/* Follow indirection */
 	}
 	/* Decrement reference count. If it has gone to zero, free it. */
-	if(--bp->refcnt <= 0){
+	if(--bp->refcnt <= 0 && bp->release != NULL){
+		/* External storage; see ext_mbuf() */
+		Freembufs++;
+		(*bp->release)(bp);
+		free(bp);
+	} else if(bp->refcnt <= 0){
 		Freembufs++;
 
 		i_state = disable();
@@ -503,6 +533,164 @@ dequeue(struct mbuf **q)
 	return bp;
 }	
 
+/* Append packet to end of counted packet queue */
+void
+enqueue_mq(
+struct mqueue *q,
+struct mbuf **bpp
+){
+	if(q == NULL || bpp == NULL || *bpp == NULL)
+		return;
+	insert_mq(q,q->tail,bpp);
+	ksignal(q,1);
+}
+/* Unlink a packet from the head of a counted queue */
+struct mbuf *
+dequeue_mq(struct mqueue *q)
+{
+	struct mbuf *bp;
+	uint8 i_state;
+
+	if(q == NULL)
+		return NULL;
+	i_state = disable();
+	if((bp = q->head) != NULL)
+		unlink_mq(q,NULL,bp);
+	restore(i_state);
+	return bp;
+}
+/* Insert a packet into a counted queue just after prev, or at the head
+ * if prev is NULL
+ */
+void
+insert_mq(
+struct mqueue *q,
+struct mbuf *prev,
+struct mbuf **bpp
+){
+	struct mbuf *bp;
+	uint8 i_state;
+	uint cnt;
+
+	if(q == NULL || bpp == NULL || (bp = *bpp) == NULL)
+		return;
+	cnt = len_p(bp);
+	i_state = disable();
+	if(prev == NULL){
+		bp->anext = q->head;
+		q->head = bp;
+	} else {
+		bp->anext = prev->anext;
+		prev->anext = bp;
+	}
+	if(bp->anext == NULL)
+		q->tail = bp;
+	q->pkts++;
+	q->bytes += cnt;
+	*bpp = NULL;	/* We've consumed it */
+	restore(i_state);
+}
+/* Remove packet bp, which follows prev (or is at the head if prev is
+ * NULL), from a counted queue
+ */
+void
+unlink_mq(
+struct mqueue *q,
+struct mbuf *prev,
+struct mbuf *bp
+){
+	uint8 i_state;
+
+	i_state = disable();
+	if(prev == NULL)
+		q->head = bp->anext;
+	else
+		prev->anext = bp->anext;
+	if(q->tail == bp)
+		q->tail = prev;
+	bp->anext = NULL;
+	q->pkts--;
+	q->bytes -= len_p(bp);
+	restore(i_state);
+}
+/* Free everything on a counted queue, whether packets or a byte stream */
+void
+free_mq(struct mqueue *q)
+{
+	struct mbuf *bp;
+
+	if(q->pkts == 0){
+		bp = take_mq(q);	/* Stream, or already empty */
+		free_p(&bp);
+		return;
+	}
+	while((bp = dequeue_mq(q)) != NULL)
+		free_p(&bp);
+}
+/* Crunch the packet (or stream) at the head of a counted queue, keeping
+ * the tail pointer valid
+ */
+void
+crunch_mq(struct mqueue *q)
+{
+	struct mbuf *bp;
+
+	if(q == NULL || (bp = q->head) == NULL)
+		return;
+	mbuf_crunch(&q->head);
+	/* A crunched packet is a single new mbuf. If it was the last
+	 * packet, or this is a byte stream, it's now also the tail
+	 */
+	if(q->head != bp && (q->tail == bp || q->pkts == 0))
+		q->tail = q->head;
+}
+/* Append data to the end of a counted byte stream */
+void
+append_mq(
+struct mqueue *q,
+struct mbuf **bpp
+){
+	struct mbuf *bp;
+
+	if(q == NULL || bpp == NULL || (bp = *bpp) == NULL)
+		return;
+	if(q->head == NULL)
+		q->head = bp;
+	else
+		q->tail->next = bp;
+	for(;;){
+		q->bytes += bp->cnt;
+		if(bp->next == NULL)
+			break;
+		bp = bp->next;
+	}
+	q->tail = bp;
+	*bpp = NULL;	/* We've consumed it */
+}
+/* Pull data off the front of a counted byte stream */
+uint
+pullup_mq(struct mqueue *q,void *buf,uint cnt)
+{
+	uint n;
+
+	n = pullup(&q->head,buf,cnt);
+	q->bytes -= n;
+	if(q->head == NULL)
+		q->tail = NULL;
+	return n;
+}
+/* Take the entire contents of a counted byte stream, leaving it empty */
+struct mbuf *
+take_mq(struct mqueue *q)
+{
+	struct mbuf *bp;
+
+	bp = q->head;
+	q->head = q->tail = NULL;
+	q->bytes = 0;
+	return bp;
+}
+
 /* Copy user data into an mbuf */
 struct mbuf *
 qdata(const void *data,uint cnt)
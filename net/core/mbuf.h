@@ -16,8 +16,23 @@ struct mbuf {
 	struct mbuf *dup;	/* Pointer to duplicated mbuf */
 	uint8 *data;		/* Active working pointers */
 	uint cnt;
+	void (*release)(struct mbuf *);	/* Gives back external storage */
 };
 
+/* Counted packet queue. Packets are linked through their anext fields as
+ * on a plain queue, but the tail pointer and running counts make adding
+ * to the end, removing from the front and asking the length all O(1).
+ * When used as a byte stream (append_mq/pullup_mq) the mbufs are instead
+ * linked through next, tail points to the last mbuf and pkts is unused.
+ */
+struct mqueue {
+	struct mbuf *head;	/* First packet (or mbuf) on queue */
+	struct mbuf *tail;	/* Last packet (or mbuf) on queue */
+	uint pkts;		/* Count of packets on queue */
+	int32 bytes;		/* Count of data bytes on queue */
+};
+#define	len_mq(q)	((q)->pkts)
+
 #define	PULLCHAR(bpp)\
  ((bpp) != NULL && (*bpp) != NULL && (*bpp)->cnt > 1 ? \
  ((*bpp)->cnt--,*(*bpp)->data++) : pullchar(bpp))
@@ -27,6 +42,7 @@ struct mbuf *alloc_mbuf(uint size);
 void free_mbuf(struct mbuf **bpp);
 
 struct mbuf *ambufw(uint size);
+struct mbuf *ext_mbuf(uint8 *data,uint size,void (*release)(struct mbuf *));
 struct mbuf *copy_p(struct mbuf *bp,uint cnt);
 void incref_p(struct mbuf *hp);
 uint dup_p(struct mbuf **hp,struct mbuf *bp,uint offset,uint cnt);
@@ -41,6 +57,16 @@ void enqueue(struct mbuf **q,struct mbuf **bpp);
 void free_q(struct mbuf **q);
 uint len_q(struct mbuf *bp);
 
+void enqueue_mq(struct mqueue *q,struct mbuf **bpp);
+struct mbuf *dequeue_mq(struct mqueue *q);
+void insert_mq(struct mqueue *q,struct mbuf *prev,struct mbuf **bpp);
+void unlink_mq(struct mqueue *q,struct mbuf *prev,struct mbuf *bp);
+void free_mq(struct mqueue *q);
+void crunch_mq(struct mqueue *q);
+void append_mq(struct mqueue *q,struct mbuf **bpp);
+uint pullup_mq(struct mqueue *q,void *buf,uint cnt);
+struct mbuf *take_mq(struct mqueue *q);
+
 struct mbuf *qdata(const void *data,uint cnt);
 uint dqdata(struct mbuf *bp,void *buf,unsigned cnt);
 
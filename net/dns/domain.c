@@ -36,13 +36,33 @@
 #undef	DEBUG				/* for certain trace messages */
 #undef	DEBUG_PAIN			/* for painful debugging */
 
+/* The memory cache. Every record is on the Dcache list, newest first,
+ * and on a hash chain chosen by its name and class; records with a
+ * positive ttl are also in a heap ordered by expiry time. Only records
+ * from the file count against Dcache_size, and the oldest of those are
+ * the first to go.
+ */
+#define	DCACHE_HASH	128		/* hash chains */
 static struct rr *Dcache = NULL;	/* Cache of resource records */
+static struct rr *Dcache_tail = NULL;	/* oldest record */
+static struct rr *Dcache_hash[DCACHE_HASH];
+static struct rr **Dcache_heap = NULL;	/* expiry heap, 1-based */
+static int Dcache_heapcnt = 0;
+static int Dcache_heapmax = 0;
+static int Dcache_count = 0;		/* records in cache */
+static int Dcache_files = 0;		/* of which RR_FILE */
 static int Dcache_size = 20;		/* size limit */
 static time_t Dcache_time = 0L; 	/* timestamp */
 
+static long Dcache_hits = 0;		/* statistics */
+static long Dcache_misses = 0;
+static long Dcache_evicts = 0;
+static long Dcache_expired = 0;
+
 static int Dfile_clean = FALSE; 	/* discard expired records (flag) */
 static int Dfile_reading = 0;		/* read interlock (count) */
 static int Dfile_writing = 0;		/* write interlock (count) */
+static int Dindex_building = 0;		/* index rebuild interlock (flag) */
 
 struct proc *Dfile_updater = NULL;
 static int32 Dfile_wait_absolute = 0L;	/* timeout Clock time */
@@ -51,6 +71,28 @@ static int Dfile_wait_relative = 300;	/* timeout file activity (seconds) */
 static struct dserver *Dservers = NULL; /* List of potential servers */
 static int Dserver_retries = 2;		/* Attempts to reach servers */
 
+/* A question sent to the servers and not yet answered. All the
+ * processes asking the same question wait on the one query.
+ */
+struct dquery {
+	struct dquery *next;	/* Outstanding list */
+	struct rr *rrp;		/* Question */
+	uint id;		/* ID in query and response headers */
+	int32 sent;		/* msclock() when last sent */
+	int tries;		/* Times sent to the servers */
+	int waiters;		/* Processes waiting for the answer */
+	int done;		/* Answered or given up (flag) */
+	int result;		/* 0 if answered, -1 if not */
+};
+int Dsocket = -1;			/* Socket for all queries */
+static struct proc *Dresolver = NULL;	/* Receives answers on Dsocket */
+static struct dquery *Dqueries = NULL;	/* Outstanding queries */
+static uint Dquery_id;			/* Last ID used */
+static int Dquery_outstanding = 0;	/* statistics */
+static long Dquery_started = 0;
+static long Dquery_coalesced = 0;
+static long Dquery_unmatched = 0;
+
 static char *Dsuffix = NULL;	/* Default suffix for names without periods */
 static int Dtrace = FALSE;
 static char *Dtypes[] = {
@@ -75,12 +117,38 @@ static char *Dtypes[] = {
 static int Ndtypes = 17;
 static char delim[] = " \t\r\n";
 
+/* Index to the domain file, kept alongside it with an .idx extension.
+ * After the header come nsorted entries sorted by name hash and offset,
+ * for binary search, then nlog entries for records since appended to
+ * the file. The index is only believed if the file's size and modify
+ * time are still those recorded, so editing the file by hand simply
+ * causes it to be rebuilt.
+ */
+#define	DINDEX_MAGIC	0x4e444931L	/* "NDI1" */
+#define	DINDEX_HDR	24		/* header bytes on disk */
+#define	DINDEX_ENT	12		/* entry bytes on disk */
+#define	DINDEX_LOG	64		/* base allowance of appended entries */
+
+struct dindex {
+	int32 size;		/* Size of domain file indexed */
+	int32 mtime;		/* and its modify time */
+	int32 epoch;		/* Time file ttls count down from */
+	int32 nsorted;		/* Sorted entries */
+	int32 nlog;		/* Appended entries that follow them */
+};
+struct dient {
+	int32 hash;		/* Hash of name */
+	int32 offset;		/* Start of record's line */
+	int32 owner;		/* Start of line giving its name */
+};
+
 static int docache(int argc,char *argv[],void *p);
 static int dosuffix(int argc,char *argv[],void *p);
 
 static int docacheclean(int argc,char *argv[],void *p);
 static int docachelist(int argc,char *argv[],void *p);
 static int docachesize(int argc,char *argv[],void *p);
+static int docachestats(int argc,char *argv[],void *p);
 static int docachewait(int argc,char *argv[],void *p);
 
 static void dlist_add(struct dserver *dp);
@@ -90,6 +158,7 @@ static int dodnsdrop(int argc,char *argv[],void *p);
 static int dodnslist(int argc,char *argv[],void *p);
 static int dodnsquery(int argc,char *argv[],void *p);
 static int dodnsretry(int argc,char *argv[],void *p);
+static int dodnsstatus(int argc,char *argv[],void *p);
 static int dodnstrace(int argc,char *argv[],void *p);
 
 static char * dtype(int value);
@@ -101,6 +170,15 @@ static struct rr *copy_rr_list(struct rr *rrlp);
 static struct rr *make_rr(int source,
 	char *dname,uint class,uint type,int32 ttl,uint rdl,void *data);
 
+static uint dcache_hash(char *name,uint class);
+static void heap_up(int i);
+static void heap_down(int i);
+static void heap_insert(struct rr *rrp);
+static void heap_remove(struct rr *rrp);
+static void dcache_ttl(struct rr *rrp,int32 now);
+static void dcache_expire(void);
+static void dcache_trim(void);
+static struct rr *dcache_take(struct rr *rrlp);
 static void dcache_add(struct rr *rrlp);
 static void dcache_drop(struct rr *rrp);
 static struct rr *dcache_search(struct rr *rrlp);
@@ -108,12 +186,29 @@ static void dcache_update(struct rr *rrlp);
 
 static struct rr *get_rr(kFILE *fp, struct rr *lastrrp);
 static void put_rr(kFILE *fp,struct rr *rrp);
+static char *dindex_name(char *ext);
+static kFILE *dindex_open(char *mode,struct dindex *dip,struct stat *dstat);
+static int dindex_get(kFILE *fp,long i,struct dient *dep);
+static void dindex_put(kFILE *fp,struct dient *dep);
+static void dindex_puthdr(kFILE *fp,struct dindex *dip);
+static int dient_cmp(const void *a,const void *b);
+static int dindex_build(int32 epoch);
+static struct rr *dindex_search(kFILE *ifp,struct dindex *dip,
+	kFILE *dbase,struct rr *rrlp,int32 elapsed);
+static int dindex_append(struct rr *rrlp);
+static void rr_supersede(struct rr **rrlpp,struct rr *rrp);
 static struct rr *dfile_search(struct rr *rrlp);
 static void dfile_update(int s,void *unused,void *p);
 
 static void dumpdomain(struct dhdr *dhp,int32 rtt);
-static int dns_makequery(uint op,struct rr *rrp,
+static int dns_makequery(uint op,uint id,struct rr *rrp,
 	uint8 *buffer,uint buflen);
+static uint dquery_newid(void);
+static void dquery_finish(struct dquery *dq,int result);
+static void dquery_release(struct dquery *dq);
+static void dquery_send(struct dquery *dq);
+static void dresolver(int unused,void *v1,void *v2);
+static void dns_answer(struct dhdr *dhp);
 static int dns_query(struct rr *rrlp);
 
 static int isaddr(char *s);
@@ -131,6 +226,7 @@ static struct cmds Dcmds[] = {
 	{ "list",	dodnslist,	0, 0, NULL },
 	{ "query",	dodnsquery,	512, 2, "query <hostid>" },
 	{ "retry",	dodnsretry,	0, 0, NULL },
+	{ "status",	dodnsstatus,	0, 0, NULL },
 	{ "suffix",	dosuffix,	0, 0, NULL },
 	{ "trace",	dodnstrace,	0, 0, NULL },
 	{ "cache",	docache,	0, 0, NULL },
@@ -141,6 +237,7 @@ static struct cmds Dcachecmds[] = {
 	{ "clean",	docacheclean,	0, 0, NULL },
 	{ "list",	docachelist,  512, 0, NULL },
 	{ "size",	docachesize,	0, 0, NULL },
+	{ "stats",	docachestats,	0, 0, NULL },
 	{ "wait",	docachewait,	0, 0, NULL },
 	{ NULL },
 };
@@ -209,6 +306,7 @@ void *p;
 
 	for(rrp=Dcache;rrp!=NULL;rrp=rrp->next)
 	{
+		dcache_ttl(rrp,secclock());
 		put_rr(kstdout,rrp);
 		if(--row == 0){
 			row = keywait("--More--",0);
@@ -256,6 +354,21 @@ void *p;
 	return result;
 }
 
+static int
+docachestats(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	(void)dcache_search(NULL); /* update expiries */
+
+	kprintf("Records %d, %d from file (limit %d), %d timing out\n",
+	 Dcache_count,Dcache_files,Dcache_size,Dcache_heapcnt);
+	kprintf("Hits %ld misses %ld evictions %ld expired %ld\n",
+	 Dcache_hits,Dcache_misses,Dcache_evicts,Dcache_expired);
+	return 0;
+}
+
 static int
 docachewait(argc,argv,p)
 int argc;
@@ -424,6 +537,27 @@ void *p;
 	return setint( &Dserver_retries, "server retries", argc,argv );
 }
 
+static int
+dodnsstatus(argc,argv,p)
+int argc;
+char *argv[];
+void *p;
+{
+	struct dquery *dq;
+	long asked;
+
+	asked = Dquery_started + Dquery_coalesced;
+	kprintf("Queries outstanding %d, sent %ld, coalesced %ld (%ld%%)\n",
+	 Dquery_outstanding,Dquery_started,Dquery_coalesced,
+	 asked != 0 ? 100L * Dquery_coalesced / asked : 0L);
+	kprintf("Responses unmatched %ld\n",Dquery_unmatched);
+	for(dq = Dqueries; dq != NULL; dq = dq->next){
+		kprintf("id %-6u tries %-3d waiters %-4d %s %s\n",
+		 dq->id,dq->tries,dq->waiters,dtype(dq->rrp->type),dq->rrp->name);
+	}
+	return 0;
+}
+
 static int
 dodnstrace(argc,argv,p)
 int argc;
@@ -750,37 +884,239 @@ void *data)
  **	Domain Cache Utilities
  **/
 
+/* Hash a domain name, ignoring case, together with its class */
+static uint
+dcache_hash(char *name,uint class)
+{
+	uint h = class;
+
+	if(name != NULL){
+		while(*name != '\0')
+			h = h * 31 + tolower(*(uint8 *)name++);
+	}
+	return h;
+}
+
+/* Move a heap entry up or down until the heap is in order again */
+static void
+heap_up(int i)
+{
+	struct rr *rrp = Dcache_heap[i];
+
+	while(i > 1 && Dcache_heap[i/2]->expires > rrp->expires){
+		Dcache_heap[i] = Dcache_heap[i/2];
+		Dcache_heap[i]->heapidx = i;
+		i /= 2;
+	}
+	Dcache_heap[i] = rrp;
+	rrp->heapidx = i;
+}
+static void
+heap_down(int i)
+{
+	struct rr *rrp = Dcache_heap[i];
+	int child;
+
+	while((child = 2*i) <= Dcache_heapcnt){
+		if(child < Dcache_heapcnt
+		 && Dcache_heap[child+1]->expires < Dcache_heap[child]->expires)
+			child++;
+		if(rrp->expires <= Dcache_heap[child]->expires)
+			break;
+		Dcache_heap[i] = Dcache_heap[child];
+		Dcache_heap[i]->heapidx = i;
+		i = child;
+	}
+	Dcache_heap[i] = rrp;
+	rrp->heapidx = i;
+}
+static void
+heap_insert(struct rr *rrp)
+{
+	struct rr **newheap;
+
+	if(Dcache_heapcnt + 1 >= Dcache_heapmax){
+		Dcache_heapmax = Dcache_heapmax == 0 ? 64 : 2 * Dcache_heapmax;
+		newheap = (struct rr **)mallocw(Dcache_heapmax * sizeof(struct rr *));
+		if(Dcache_heap != NULL){
+			memcpy(newheap,Dcache_heap,
+			 (Dcache_heapcnt + 1) * sizeof(struct rr *));
+			free(Dcache_heap);
+		}
+		Dcache_heap = newheap;
+	}
+	Dcache_heap[++Dcache_heapcnt] = rrp;
+	heap_up(Dcache_heapcnt);
+}
+static void
+heap_remove(struct rr *rrp)
+{
+	int i;
+
+	if((i = rrp->heapidx) == 0)
+		return;
+	rrp->heapidx = 0;
+	if(i == Dcache_heapcnt--)
+		return;
+	Dcache_heap[i] = Dcache_heap[Dcache_heapcnt + 1];
+	Dcache_heap[i]->heapidx = i;
+	heap_up(i);
+	heap_down(Dcache_heap[i]->heapidx);
+}
+
+/* Bring the ttl of a cached record up to date */
+static void
+dcache_ttl(struct rr *rrp,int32 now)
+{
+	if(rrp->heapidx != 0 && (rrp->ttl = rrp->expires - now) <= 0L)
+		rrp->ttl = 1L;	/* dcache_expire() hasn't got to it yet */
+}
+
+/* Time out cache entries whose ttl has run out. They stay in the
+ * cache with a zero ttl, to be used if the servers can't be reached.
+ */
+static void
+dcache_expire(void)
+{
+	struct rr *rrp;
+	int32 now;
+
+	time(&Dcache_time);
+	now = secclock();
+	while(Dcache_heapcnt > 0 && (rrp = Dcache_heap[1])->expires <= now){
+		heap_remove(rrp);
+		rrp->ttl = 0L;
+		Dcache_expired++;
+	}
+}
+
+/* Trim the cache to size, discarding the oldest file records first */
+static void
+dcache_trim(void)
+{
+	struct rr *rrp, *prev_rrp;
+
+	for(rrp = Dcache_tail; rrp != NULL && Dcache_files > Dcache_size;
+	 rrp = prev_rrp){
+		prev_rrp = rrp->last;
+		if(rrp->source == RR_FILE){
+			dcache_drop(rrp);
+			free_rr(&rrp);
+			Dcache_evicts++;
+		}
+	}
+}
+
+/* Remove from the cache and return the records matching any in rrlp.
+ * Only the hash chains of the names being sought need be looked at,
+ * except for inverse queries, which don't have a name.
+ */
+static struct rr *
+dcache_take(struct rr *rrlp)
+{
+	struct rr *qrrp, *rrp, *next_rrp;
+	struct rr **rrpp, *result_rrlp;
+	uint h;
+	int scanned = FALSE;
+
+	rrpp = &result_rrlp;
+	for(qrrp = rrlp; qrrp != NULL; qrrp = qrrp->next){
+		if(qrrp->source == RR_INQUERY){
+			if(scanned)
+				continue;
+			scanned = TRUE;
+			rrp = Dcache;
+			h = 0;
+		} else {
+			h = dcache_hash(qrrp->name,qrrp->class);
+			rrp = Dcache_hash[h % DCACHE_HASH];
+		}
+		for(; rrp != NULL; rrp = next_rrp){
+			next_rrp = (qrrp->source == RR_INQUERY) ? rrp->next : rrp->hnext;
+			if(qrrp->source != RR_INQUERY && rrp->hash != h)
+				continue;
+			if(compare_rr_list(rrlp,rrp) == 0){
+				dcache_drop(rrp);
+				*rrpp = rrp;
+				rrpp = &rrp->next;
+			}
+		}
+	}
+	*rrpp = NULL;
+	return result_rrlp;
+}
+
+/* Put a list of records at the front of the cache, in the same order */
 static void
 dcache_add(struct rr *rrlp)
 {
 	struct rr *last_rrp;
 	struct rr *save_rrp;
+	struct rr **hpp;
+	int32 now;
 
 	if(rrlp == NULL)
 		return;
 
+	now = secclock();
 	save_rrp = rrlp;
 	last_rrp = NULL;
 	while(rrlp != NULL){
 		rrlp->last = last_rrp;
 		last_rrp = rrlp;
+		if(rrlp->ttl > 0L){
+			rrlp->expires = now + rrlp->ttl;
+			heap_insert(rrlp);
+		}
+		if(rrlp->source == RR_FILE)
+			Dcache_files++;
+		Dcache_count++;
 		rrlp = rrlp->next;
 	}
 	last_rrp->next = Dcache;
 	if(Dcache != NULL)
 		Dcache->last = last_rrp;
+	else
+		Dcache_tail = last_rrp;
 	Dcache = save_rrp;
+
+	/* Hash them in backwards, so each chain keeps the list's order */
+	for(rrlp = last_rrp; rrlp != NULL; rrlp = rrlp->last){
+		rrlp->hash = dcache_hash(rrlp->name,rrlp->class);
+		hpp = &Dcache_hash[rrlp->hash % DCACHE_HASH];
+		rrlp->hnext = *hpp;
+		*hpp = rrlp;
+	}
 }
 
+/* Take a record out of the cache, leaving its ttl current */
 static void
 dcache_drop(struct rr *rrp)
 {
+	struct rr **hpp;
+
+	for(hpp = &Dcache_hash[rrp->hash % DCACHE_HASH]; *hpp != NULL;
+	 hpp = &(*hpp)->hnext){
+		if(*hpp == rrp){
+			*hpp = rrp->hnext;
+			break;
+		}
+	}
+	rrp->hnext = NULL;
+	dcache_ttl(rrp,secclock());
+	heap_remove(rrp);
+	if(rrp->source == RR_FILE)
+		Dcache_files--;
+	Dcache_count--;
+
 	if(rrp->last != NULL)
 		rrp->last->next = rrp->next;
 	else
 		Dcache = rrp->next;
 	if(rrp->next != NULL)
 		rrp->next->last = rrp->last;
+	else
+		Dcache_tail = rrp->last;
 	rrp->last =
 	rrp->next = NULL;
 }
@@ -795,11 +1131,7 @@ dcache_drop(struct rr *rrp)
 static struct rr *
 dcache_search(struct rr *rrlp)
 {
-	struct rr *rrp, *test_rrp;
-	struct rr **rrpp, *result_rrlp;
-	int32 elapsed;
-	time_t now;
-	int count = 0;
+	struct rr *result_rrlp;
 
 #ifdef DEBUG
 	if(Dtrace && rrlp != NULL){
@@ -807,26 +1139,15 @@ dcache_search(struct rr *rrlp)
 	}
 #endif
 
-	elapsed = (int32)(time(&now) - Dcache_time);
-	Dcache_time = now;
+	dcache_expire();
+	dcache_trim();
+	if(rrlp == NULL)
+		return NULL;
 
-	rrpp = &result_rrlp;
-	for(rrp = Dcache; (test_rrp = rrp) != NULL;){
-		rrp = rrp->next;
-					/* timeout entries */
-		if(test_rrp->ttl > 0L
-		&& (test_rrp->ttl -= elapsed) <= 0L)
-			test_rrp->ttl = 0L;
-
-		if(compare_rr_list(rrlp,test_rrp) == 0){
-			dcache_drop( *rrpp = test_rrp );
-			rrpp = &(*rrpp)->next;
-		} else if(test_rrp->source == RR_FILE && ++count > Dcache_size){
-			dcache_drop(test_rrp);
-			free_rr(&test_rrp);
-		}
-	}
-	*rrpp = NULL;
+	if((result_rrlp = dcache_take(rrlp)) != NULL)
+		Dcache_hits++;
+	else
+		Dcache_misses++;
 	return result_rrlp;
 }
 
@@ -838,10 +1159,12 @@ dcache_update(struct rr *rrlp)
 
 	if(rrlp == NULL)
 		return;
-	rr1 = dcache_search(rrlp);	/* remove duplicates, first */
+	dcache_expire();
+	rr1 = dcache_take(rrlp);	/* remove duplicates, first */
 
 	free_rr(&rr1);
 	dcache_add(rrlp);
+	dcache_trim();
 }
 
 
@@ -1077,6 +1400,390 @@ put_rr(kFILE *fp,struct rr *rrp)
 	}
 }
 
+/**
+ **	Index Utilities
+ **/
+
+/* Return the domain file's name with its extension replaced */
+static char *
+dindex_name(char *ext)
+{
+	char *name;
+
+	name = strdup(Dfile);
+	strcpy(&name[strlen(name)-3],ext);
+	return name;
+}
+
+/* Open the index and read its header, provided it is current for
+ * the domain file whose status is given. Returns NULL if not.
+ */
+static kFILE *
+dindex_open(char *mode,struct dindex *dip,struct stat *dstat)
+{
+	kFILE *fp;
+	char *name;
+	uint8 buf[DINDEX_HDR];
+
+	name = dindex_name("idx");
+	fp = kfopen(name,mode);
+	FREE(name);
+	if(fp == NULL)
+		return NULL;
+	if(kfread(buf,1,DINDEX_HDR,fp) != DINDEX_HDR
+	 || get32(&buf[0]) != DINDEX_MAGIC){
+		kfclose(fp);
+		return NULL;
+	}
+	dip->size = get32(&buf[4]);
+	dip->mtime = get32(&buf[8]);
+	dip->epoch = get32(&buf[12]);
+	dip->nsorted = get32(&buf[16]);
+	dip->nlog = get32(&buf[20]);
+	if(dip->size != (int32)dstat->st_size
+	 || dip->mtime != (int32)dstat->st_mtime){
+		kfclose(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+/* Read entry i of the index. Returns -1 on error. */
+static int
+dindex_get(kFILE *fp,long i,struct dient *dep)
+{
+	uint8 buf[DINDEX_ENT];
+
+	if(kfseek(fp,DINDEX_HDR + i * DINDEX_ENT,kSEEK_SET) != 0
+	 || kfread(buf,1,DINDEX_ENT,fp) != DINDEX_ENT)
+		return -1;
+	dep->hash = get32(&buf[0]);
+	dep->offset = get32(&buf[4]);
+	dep->owner = get32(&buf[8]);
+	return 0;
+}
+
+/* Write an entry at the current position */
+static void
+dindex_put(kFILE *fp,struct dient *dep)
+{
+	uint8 buf[DINDEX_ENT];
+
+	put32(&buf[0],dep->hash);
+	put32(&buf[4],dep->offset);
+	put32(&buf[8],dep->owner);
+	kfwrite(buf,1,DINDEX_ENT,fp);
+}
+
+/* Write the header at the start of the index */
+static void
+dindex_puthdr(kFILE *fp,struct dindex *dip)
+{
+	uint8 buf[DINDEX_HDR];
+
+	put32(&buf[0],DINDEX_MAGIC);
+	put32(&buf[4],dip->size);
+	put32(&buf[8],dip->mtime);
+	put32(&buf[12],dip->epoch);
+	put32(&buf[16],dip->nsorted);
+	put32(&buf[20],dip->nlog);
+	kfseek(fp,0L,kSEEK_SET);
+	kfwrite(buf,1,DINDEX_HDR,fp);
+}
+
+static int
+dient_cmp(const void *a,const void *b)
+{
+	const struct dient *ap = a;
+	const struct dient *bp = b;
+
+	if(ap->hash != bp->hash)
+		return (uint32)ap->hash < (uint32)bp->hash ? -1 : 1;
+	if(ap->offset != bp->offset)
+		return ap->offset < bp->offset ? -1 : 1;
+	return 0;
+}
+
+/* Read through the domain file and write a fresh index for it, whose
+ * ttls count from epoch. Returns -1 on failure.
+ */
+static int
+dindex_build(int32 epoch)
+{
+	kFILE *dbase, *ifp;
+	struct stat dstat;
+	struct dindex di;
+	struct dient *entries;
+	struct rr *frrp, *oldrrp;
+	char *tmpname, *name;
+	int32 nentries, maxentries, offset, owner;
+	long i;
+
+	if((dbase = kfopen(Dfile,READ_TEXT)) == NULL)
+		return -1;
+	if(fstat(kfileno(dbase),&dstat) != 0){
+		kfclose(dbase);
+		return -1;
+	}
+	maxentries = 256;
+	entries = (struct dient *)mallocw(maxentries * sizeof(struct dient));
+	nentries = 0;
+	owner = 0;
+	oldrrp = NULL;
+	for(;;){
+		offset = kftell(dbase);
+		if((frrp = get_rr(dbase,oldrrp)) == NULL)
+			break;
+		if(frrp->name != NULL
+		 && (oldrrp == NULL || oldrrp->name == NULL
+		 || strcmp(frrp->name,oldrrp->name) != 0))
+			owner = offset;
+		free_rr(&oldrrp);
+		if(frrp->type != TYPE_MISSING
+		&& frrp->rdlength > 0){
+			if(nentries == maxentries){
+				struct dient *newentries;
+
+				maxentries *= 2;
+				newentries = (struct dient *)mallocw(maxentries
+				 * sizeof(struct dient));
+				memcpy(newentries,entries,
+				 nentries * sizeof(struct dient));
+				free(entries);
+				entries = newentries;
+			}
+			entries[nentries].hash = dcache_hash(frrp->name,0);
+			entries[nentries].offset = offset;
+			entries[nentries].owner = owner;
+			nentries++;
+		}
+		oldrrp = frrp;
+		if(!main_exit)
+			kwait(NULL);	/* run in background */
+	}
+	free_rr(&oldrrp);
+	kfclose(dbase);
+
+	qsort(entries,nentries,sizeof(struct dient),dient_cmp);
+
+	tmpname = dindex_name("idt");
+	if((ifp = kfopen(tmpname,WRITE_BINARY)) == NULL){
+		FREE(tmpname);
+		free(entries);
+		return -1;
+	}
+	di.size = dstat.st_size;
+	di.mtime = dstat.st_mtime;
+	di.epoch = epoch;
+	di.nsorted = nentries;
+	di.nlog = 0;
+	dindex_puthdr(ifp,&di);
+	for(i=0;i<nentries;i++)
+		dindex_put(ifp,&entries[i]);
+	free(entries);
+	if(kfflush(ifp) != 0 || kferror(ifp)){
+		kfclose(ifp);
+		unlink(tmpname);
+		FREE(tmpname);
+		return -1;
+	}
+	kfclose(ifp);
+	name = dindex_name("idx");
+	unlink(name);
+	rename(tmpname,name);
+	FREE(name);
+	FREE(tmpname);
+	return 0;
+}
+
+/* Add a record to the end of a list, first removing any records that
+ * it would replace in the cache
+ */
+static void
+rr_supersede(struct rr **rrlpp,struct rr *rrp)
+{
+	struct rr *old_rrp;
+
+	while(*rrlpp != NULL){
+		if(compare_rr(rrp,*rrlpp) == 0){
+			old_rrp = *rrlpp;
+			*rrlpp = old_rrp->next;
+			old_rrp->next = NULL;
+			free_rr(&old_rrp);
+		} else
+			rrlpp = &(*rrlpp)->next;
+	}
+	*rrlpp = rrp;
+}
+
+/* Look up records in the domain file through its index. Records
+ * appended later supersede earlier ones they match, as they would
+ * have replaced them had the file been rewritten.
+ */
+static struct rr *
+dindex_search(kFILE *ifp,struct dindex *dip,kFILE *dbase,
+struct rr *rrlp,int32 elapsed)
+{
+	struct rr *qrrp, *frrp, *ownrrp, *result_rrlp;
+	struct dient de, *found;
+	int32 nfound, maxfound, lo, hi, mid, last;
+	uint32 h;
+	long i;
+
+	maxfound = 16;
+	found = (struct dient *)mallocw(maxfound * sizeof(struct dient));
+	nfound = 0;
+	for(qrrp = rrlp; qrrp != NULL; qrrp = qrrp->next){
+		h = dcache_hash(qrrp->name,0);
+
+		/* Find the first sorted entry with this hash */
+		lo = 0;
+		hi = dip->nsorted;
+		while(lo < hi){
+			mid = lo + (hi - lo) / 2;
+			if(dindex_get(ifp,mid,&de) == -1)
+				break;
+			if((uint32)de.hash < h)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		/* Take it and the rest with the same hash, then any
+		 * matching entries from the log
+		 */
+		for(i = lo; i < dip->nsorted + dip->nlog; i++){
+			if(dindex_get(ifp,i,&de) == -1)
+				break;
+			if((uint32)de.hash != h){
+				if(i < dip->nsorted)
+					i = dip->nsorted - 1;
+				continue;
+			}
+			if(nfound == maxfound){
+				struct dient *newfound;
+
+				maxfound *= 2;
+				newfound = (struct dient *)mallocw(maxfound
+				 * sizeof(struct dient));
+				memcpy(newfound,found,nfound * sizeof(struct dient));
+				free(found);
+				found = newfound;
+			}
+			found[nfound++] = de;
+		}
+	}
+	/* Visit the records in file order, once each */
+	for(i = 0; i < nfound; i++)
+		found[i].hash = 0;
+	qsort(found,nfound,sizeof(struct dient),dient_cmp);
+
+	result_rrlp = NULL;
+	last = -1;
+	for(i = 0; i < nfound; i++){
+		if(found[i].offset == last)
+			continue;
+		last = found[i].offset;
+		ownrrp = NULL;
+		if(found[i].owner != found[i].offset){
+			kfseek(dbase,found[i].owner,kSEEK_SET);
+			ownrrp = get_rr(dbase,NULL);
+		}
+		kfseek(dbase,found[i].offset,kSEEK_SET);
+		frrp = get_rr(dbase,ownrrp);
+		free_rr(&ownrrp);
+		if(frrp == NULL)
+			continue;
+		if(frrp->type != TYPE_MISSING
+		&& frrp->rdlength > 0
+		&& compare_rr_list(rrlp,frrp) == 0){
+			if(frrp->ttl > 0L
+			&& (frrp->ttl -= elapsed) <= 0L)
+				frrp->ttl = 0L;
+			rr_supersede(&result_rrlp,frrp);
+		} else
+			free_rr(&frrp);
+		if(!main_exit)
+			kwait(NULL);	/* run multiple sessions */
+	}
+	free(found);
+	return result_rrlp;
+}
+
+/* Append new records to the domain file and its index, instead of
+ * rewriting both. Returns -1 if the index isn't current or the log has
+ * grown long enough to be worth merging; the file must be rewritten.
+ */
+static int
+dindex_append(struct rr *rrlp)
+{
+	kFILE *dbase, *ifp;
+	struct stat dstat;
+	struct dindex di;
+	struct dient de;
+	struct rr *rrp;
+	int32 adjust, n;
+	int result = -1;
+
+	n = 0;
+	for(rrp = rrlp; rrp != NULL; rrp = rrp->next)
+		n++;
+
+	/* wait for everyone else to finish reading */
+	Dfile_writing++;
+	while(Dfile_reading > 0)
+		kwait(&Dfile_writing);
+
+	if((dbase = kfopen(Dfile,UPDATE_TEXT)) == NULL)
+		goto done;
+	if(fstat(kfileno(dbase),&dstat) != 0
+	 || (ifp = dindex_open(UPDATE_BINARY,&di,&dstat)) == NULL){
+		kfclose(dbase);
+		goto done;
+	}
+	if(di.nlog + n > DINDEX_LOG + di.nsorted / 8){
+		kfclose(ifp);
+		kfclose(dbase);
+		goto done;
+	}
+	/* The file's ttls count down from its epoch, not from now */
+	adjust = (int32)(Dcache_time - (time_t)di.epoch);
+
+	kfseek(dbase,0L,kSEEK_END);
+	kfseek(ifp,DINDEX_HDR + (di.nsorted + di.nlog) * DINDEX_ENT,kSEEK_SET);
+	for(rrp = rrlp; rrp != NULL; rrp = rrp->next){
+		int32 ttl;
+
+		if(rrp->type == TYPE_MISSING || rrp->rdlength == 0)
+			continue;
+		de.hash = dcache_hash(rrp->name,0);
+		de.offset = de.owner = kftell(dbase);
+		ttl = rrp->ttl;
+		if(rrp->ttl > 0L)
+			rrp->ttl += adjust;
+		put_rr(dbase,rrp);
+		rrp->ttl = ttl;
+		dindex_put(ifp,&de);
+		di.nlog++;
+	}
+	if(kfflush(dbase) != 0 || kferror(dbase)
+	 || fstat(kfileno(dbase),&dstat) != 0){
+		/* Leave the index stale, to be rebuilt */
+		kfclose(dbase);
+		kfclose(ifp);
+		goto done;
+	}
+	kfclose(dbase);
+	di.size = dstat.st_size;
+	di.mtime = dstat.st_mtime;
+	dindex_puthdr(ifp,&di);
+	kfclose(ifp);
+	result = 0;
+done:
+	Dfile_writing = 0;
+	ksignal(&Dfile_reading,0);
+	return result;
+}
+
 /* Search local database for resource records.
  * Returns RR list, or NULL if no record found.
  */
@@ -1084,10 +1791,12 @@ static struct rr *
 dfile_search(struct rr *rrlp)
 {
 	struct rr *frrp;
-	struct rr **rrpp, *result_rrlp, *oldrrp;
+	struct rr *result_rrlp, *oldrrp;
 	int32 elapsed;
-	kFILE *dbase;
+	kFILE *dbase, *ifp;
 	struct stat dstat;
+	struct dindex di;
+	int contiguous;
 
 #ifdef DEBUG
 	if(Dtrace){
@@ -1109,12 +1818,42 @@ dfile_search(struct rr *rrlp)
 		Dfile_reading--;
 		return NULL;
 	}
-	if((elapsed = (int32)(Dcache_time - (time_t)dstat.st_ctime)) < 0L)
+
+	/* Use the index unless it's an inverse query, which has no
+	 * name to look up. Rebuild it first if it's out of date, unless
+	 * someone else is already doing so. Even an out of date index
+	 * says what the file's ttls count down from; failing that, it's
+	 * when the file was last written.
+	 */
+	for(frrp = rrlp; frrp != NULL; frrp = frrp->next){
+		if(frrp->source == RR_INQUERY)
+			break;
+	}
+	di.epoch = (int32)dstat.st_ctime;
+	di.nlog = -1;
+	if((ifp = dindex_open(READ_BINARY,&di,&dstat)) == NULL
+	 && frrp == NULL && !Dindex_building){
+		Dindex_building = TRUE;
+		if(dindex_build(di.epoch) == 0)
+			ifp = dindex_open(READ_BINARY,&di,&dstat);
+		Dindex_building = FALSE;
+	}
+	if((elapsed = (int32)(Dcache_time - (time_t)di.epoch)) < 0L)
 		elapsed = -elapsed;	/* arbitrary time mismatch */
+	if(ifp != NULL && frrp == NULL){
+		result_rrlp = dindex_search(ifp,&di,dbase,rrlp,elapsed);
+		kfclose(ifp);
+		goto done;
+	}
+	/* Records are in name order only if none have been appended,
+	 * and only a current index can say so
+	 */
+	contiguous = (ifp != NULL && di.nlog == 0);
+	if(ifp != NULL)
+		kfclose(ifp);
 
-	result_rrlp = NULL;		/* for contiguous test below */
+	result_rrlp = NULL;
 	oldrrp = NULL;
-	rrpp = &result_rrlp;
 	while((frrp = get_rr(dbase,oldrrp)) != NULL){
 		free_rr(&oldrrp);
 		if(frrp->type != TYPE_MISSING
@@ -1123,9 +1862,9 @@ dfile_search(struct rr *rrlp)
 			if(frrp->ttl > 0L
 			&& (frrp->ttl -= elapsed) <= 0L)
 				frrp->ttl = 0L;
-			*rrpp = frrp;
-			rrpp = &(*rrpp)->next;
 			oldrrp = copy_rr(frrp);
+			/* Later records replace the earlier ones they match */
+			rr_supersede(&result_rrlp,frrp);
 		} else {
 			oldrrp = frrp;
 			/*
@@ -1134,7 +1873,8 @@ dfile_search(struct rr *rrlp)
 				we can stop searching.  Multiple queries must
 				read the whole file.
 			*/
-			if(rrlp->type != TYPE_ANY
+			if(contiguous
+			&& rrlp->type != TYPE_ANY
 			&& rrlp->next == NULL
 			&& result_rrlp != NULL)
 				break;
@@ -1143,8 +1883,7 @@ dfile_search(struct rr *rrlp)
 			kwait(NULL);	/* run multiple sessions */
 	}
 	free_rr(&oldrrp);
-	*rrpp = NULL;
-
+done:
 	kfclose(dbase);
 
 	if(--Dfile_reading <= 0){
@@ -1161,10 +1900,14 @@ dfile_search(struct rr *rrlp)
 static void
 dfile_update(int s,void *unused,void *p)
 {
-	struct rr **rrpp, *rrlp, *oldrrp;
-	char *newname;
-	kFILE *old_fp, *new_fp;
+	struct rr **rrpp, *rrlp, *oldrrp, *logrrlp;
+	char *newname, *name;
+	kFILE *old_fp, *new_fp, *ifp;
 	struct stat old_stat, new_stat;
+	struct dindex di;
+	struct dient de;
+	long logstart;
+	time_t base;
 
 	logmsg(-1,"update Domain.txt initiated");
 
@@ -1176,8 +1919,7 @@ dfile_update(int s,void *unused,void *p)
 	kfclose(kstdout);
 	kstdout = kfdup(Cmdpp->output);
 
-	newname = strdup(Dfile);
-	strcpy(&newname[strlen(newname)-3],"tmp");
+	newname = dindex_name("tmp");
 
 	while(Dfile_wait_absolute != 0L && !main_exit){
 		struct rr *frrp;
@@ -1195,23 +1937,10 @@ dfile_update(int s,void *unused,void *p)
 
 		logmsg(-1,"update Domain.txt");
 
-		/* create new file for copy */
-		if((new_fp = kfopen(newname,WRITE_TEXT)) == NULL){
-			kprintf("dfile_update: can't create %s!\n",newname);
-			break;
-		}
-		if(fstat(kfileno(new_fp),&new_stat) != 0){
-			kprintf("dfile_update: can't get new_file status!\n");
-			kfclose(new_fp);
-			break;
-		}
-
-		kwait(NULL);	/* file operations can be slow */
-
 		/* timeout the cache one last time before writing */
 		(void)dcache_search(NULL);
 
-		/* copy new RRs out to the new file */
+		/* take copies of the new RRs */
 		/* (can't wait here, the cache might change) */
 		rrpp = &rrlp;
 		for(frrp = Dcache; frrp != NULL; frrp = frrp->next ){
@@ -1220,23 +1949,58 @@ dfile_update(int s,void *unused,void *p)
 			case RR_ANSWER:
 			case RR_AUTHORITY:
 			case RR_ADDITIONAL:
+				dcache_ttl(frrp,secclock());
 				*rrpp = copy_rr(frrp);
-				if(frrp->type != TYPE_MISSING
-				&& frrp->rdlength > 0)
-					put_rr(new_fp,frrp);
 				rrpp = &(*rrpp)->next;
 				frrp->source = RR_FILE;
+				Dcache_files++;
 				break;
 			}
 		}
 		*rrpp = NULL;
 
+		/* Usually they can just be added to the end */
+		if(dindex_append(rrlp) == 0){
+			free_rr(&rrlp);
+			continue;
+		}
+
+		/* Otherwise merge them into a new copy of the file */
+		if((new_fp = kfopen(newname,WRITE_TEXT)) == NULL){
+			kprintf("dfile_update: can't create %s!\n",newname);
+			free_rr(&rrlp);
+			break;
+		}
+		if(fstat(kfileno(new_fp),&new_stat) != 0){
+			kprintf("dfile_update: can't get new_file status!\n");
+			kfclose(new_fp);
+			free_rr(&rrlp);
+			break;
+		}
+
+		kwait(NULL);	/* file operations can be slow */
+
+		/* write the copies out to the new file, which may
+		 * wait for the disk
+		 */
+		for(frrp = rrlp; frrp != NULL; frrp = frrp->next){
+			if(frrp->type != TYPE_MISSING
+			&& frrp->rdlength > 0)
+				put_rr(new_fp,frrp);
+		}
+
 		/* open up the old file, concurrently with everyone else */
 		if((old_fp = kfopen(Dfile,READ_TEXT)) == NULL){
 			/* great! no old file, so we're ready to go. */
 			kfclose(new_fp);
-			rename(newname,Dfile);
 			free_rr(&rrlp);
+			Dfile_writing++;
+			while(Dfile_reading > 0)
+				kwait(&Dfile_writing);
+			rename(newname,Dfile);
+			dindex_build((int32)new_stat.st_ctime);
+			Dfile_writing = 0;
+			ksignal(&Dfile_reading,0);
 			break;
 		}
 		if(fstat(kfileno(old_fp),&old_stat) != 0){
@@ -1246,19 +2010,56 @@ dfile_update(int s,void *unused,void *p)
 			free_rr(&rrlp);
 			break;
 		}
-		if((elapsed = (int32)(new_stat.st_ctime - old_stat.st_ctime)) < 0L)
+
+		/* The old file's ttls count from when its index was built,
+		 * if it has one. Records appended since then start at
+		 * logstart.
+		 */
+		base = old_stat.st_ctime;
+		logstart = -1;
+		if((ifp = dindex_open(READ_BINARY,&di,&old_stat)) != NULL){
+			base = (time_t)di.epoch;
+			if(di.nlog > 0 && dindex_get(ifp,di.nsorted,&de) == 0)
+				logstart = de.offset;
+			kfclose(ifp);
+		}
+		if((elapsed = (int32)(new_stat.st_ctime - base)) < 0L)
 			elapsed = -elapsed;	/* file times are inconsistant */
 
+		/* Appended records go next, later ones replacing earlier */
+		logrrlp = NULL;
+		if(logstart >= 0){
+			kfseek(old_fp,logstart,kSEEK_SET);
+			while((frrp = get_rr(old_fp,NULL)) != NULL){
+				if(frrp->type != TYPE_MISSING
+				&& frrp->rdlength > 0
+				&& compare_rr_list(rrlp,frrp) != 0){
+					if(frrp->ttl > 0L
+					&& (frrp->ttl -= elapsed) <= 0L)
+						frrp->ttl = 0L;
+					rr_supersede(&logrrlp,frrp);
+				} else
+					free_rr(&frrp);
+			}
+			for(frrp = logrrlp; frrp != NULL; frrp = frrp->next){
+				if(frrp->ttl != 0 || !Dfile_clean)
+					put_rr(new_fp,frrp);
+			}
+			kfseek(old_fp,0L,kSEEK_SET);
+		}
+
 		/* Now append any non-duplicate records */
 		oldrrp = NULL;
-		while((frrp = get_rr(old_fp,oldrrp)) != NULL){
+		while((logstart < 0 || kftell(old_fp) < logstart)
+		 && (frrp = get_rr(old_fp,oldrrp)) != NULL){
 			free_rr(&oldrrp);
 			if(frrp->name == NULL
 			&& frrp->comment != NULL)
 				put_rr(new_fp,frrp);
 			if(frrp->type != TYPE_MISSING
 			&& frrp->rdlength > 0
-			&& compare_rr_list(rrlp,frrp) != 0){
+			&& compare_rr_list(rrlp,frrp) != 0
+			&& compare_rr_list(logrrlp,frrp) != 0){
 				if(frrp->ttl > 0L
 				&& (frrp->ttl -= elapsed) <= 0L)
 					frrp->ttl = 0L;
@@ -1273,14 +2074,22 @@ dfile_update(int s,void *unused,void *p)
 		kfclose(new_fp);
 		kfclose(old_fp);
 		free_rr(&rrlp);
+		free_rr(&logrrlp);
 
 		/* wait for everyone else to finish reading */
 		Dfile_writing++;
 		while(Dfile_reading > 0)
 			kwait(&Dfile_writing);
 
+		/* The old index's epoch doesn't hold for the new file;
+		 * don't leave it behind if the rebuild fails
+		 */
+		name = dindex_name("idx");
+		unlink(name);
+		FREE(name);
 		unlink(Dfile);
 		rename(newname,Dfile);
+		dindex_build((int32)new_stat.st_ctime);
 
 		Dfile_writing = 0;
 		ksignal(&Dfile_reading,0);
@@ -1330,6 +2139,7 @@ dumpdomain(struct dhdr *dhp,int32 rtt)
 static int
 dns_makequery(
 uint op,	/* operation */
+uint id,	/* query ID */
 struct rr *srrp,/* Search RR */
 uint8 *buffer,	/* Area for query */
 uint buflen	/* Length of same */
@@ -1341,8 +2151,7 @@ uint buflen	/* Length of same */
 	uint dlen,len;
 
 	cp = buffer;
-	/* Use millisecond clock for timestamping */
-	cp = put16(cp,msclock());
+	cp = put16(cp,id);
 	parameter = (op << 11)
 			| 0x0100;	/* Recursion desired */
 	cp = put16(cp,parameter);
@@ -1380,98 +2189,171 @@ uint buflen	/* Length of same */
 	return cp - buffer;
 }
 
-/* domain server resolution loop
- * returns: any answers in cache.
- *	(future features)
- *	multiple queries.
- *	inverse queries.
- * return value: 0 if something added to cache, -1 if error
+/* Pick an ID for a new query that no outstanding query is using */
+static uint
+dquery_newid(void)
+{
+	struct dquery *dq;
+
+	for(;;){
+		Dquery_id = (Dquery_id + 1) & 0xffff;
+		for(dq = Dqueries; dq != NULL; dq = dq->next)
+			if(dq->id == Dquery_id)
+				break;
+		if(dq == NULL)
+			return Dquery_id;
+	}
+}
+
+/* Take a query off the outstanding list and tell its waiters how it
+ * went
  */
-static int
-dns_query(struct rr *rrlp)
+static void
+dquery_finish(struct dquery *dq,int result)
 {
-	struct mbuf *bp;
-	struct dhdr *dhp;
-	struct dserver *dp;	/* server list */
-	int32 rtt,abserr;
-	int tried = 0;		/* server list has been retried (count) */
+	struct dquery **dqp;
 
-	if((dp = Dservers) == NULL)
-		return -1;
+	for(dqp = &Dqueries; *dqp != NULL; dqp = &(*dqp)->next){
+		if(*dqp == dq){
+			*dqp = dq->next;
+			Dquery_outstanding--;
+			break;
+		}
+	}
+	dq->next = NULL;
+	dq->result = result;
+	dq->done = TRUE;
+	ksignal(dq,0);
+}
 
-	for(;;){
-		uint8 *buf;
-		int len;
-		struct ksockaddr_in server_in;
-		int s;
-		int rval;
+/* Drop a waiter's hold on a query, freeing it after the last one */
+static void
+dquery_release(struct dquery *dq)
+{
+	if(--dq->waiters == 0 && dq->done){
+		free_rr(&dq->rrp);
+		free(dq);
+	}
+}
 
+/* Send a query to every server at once */
+static void
+dquery_send(struct dquery *dq)
+{
+	struct dserver *dp;
+	struct ksockaddr_in server_in;
+	uint8 *buf;
+	int len;
+
+	buf = mallocw(512);
+	len = dns_makequery(0,dq->id,dq->rrp,buf,512);
+	dq->sent = msclock();
+	dq->tries++;
+	for(dp = Dservers; dp != NULL; dp = dp->next){
 		dp->queries++;
-
-		s = ksocket(kAF_INET,kSOCK_DGRAM,0);
 		server_in.sin_family = kAF_INET;
 		server_in.sin_port = IPPORT_DOMAIN;
 		server_in.sin_addr.s_addr = dp->address;
 
 		if(Dtrace){
 			kprintf("dns_query: querying server %s for %s\n",
-			 inet_ntoa(dp->address),rrlp->name);
+			 inet_ntoa(dp->address),dq->rrp->name);
 		}
-
-		buf = mallocw(512);
-		len = dns_makequery(0,rrlp,buf,512);
-		if(ksendto(s,buf,len,0,(struct ksockaddr *)&server_in,sizeof(server_in)) == -1)
+		if(ksendto(Dsocket,buf,len,0,(struct ksockaddr *)&server_in,
+		 sizeof(server_in)) == -1)
 			kperror("domain sendto");
-		FREE(buf);
-		kalarm(max(dp->timeout,100));
-		/* Wait for something to happen */
-		rval = recv_mbuf(s,&bp,0,NULL,0);
-		kalarm(0L);
-		close_s(s);
+	}
+	FREE(buf);
+}
 
-		if(Dtrace){
-			if(kerrno == 0)
-				kprintf("dns_query: received message length %d\n",rval);
-			else
-				kperror("dns_query");
-		}
+/* Process that receives every answer on the resolver socket and hands
+ * each to the query with the same ID. The first server to answer a
+ * query wins; the others' answers find no query and are dropped.
+ */
+static void
+dresolver(int unused,void *v1,void *v2)
+{
+	struct mbuf *bp;
+	struct dhdr *dhp;
+	struct dquery *dq;
+	struct dserver *dp;
+	struct ksockaddr_in from;
+	int fromlen;
+	int32 rtt,abserr;
+
+	/* Produce trace output on command session rather than the one
+	 * that invoked us
+	 */
+	kfclose(kstdin);
+	kstdin = kfdup(Cmdpp->input);
+	kfclose(kstdout);
+	kstdout = kfdup(Cmdpp->output);
 
-		if(rval > 0)
+	for(;;){
+		fromlen = sizeof(from);
+		if(recv_mbuf(Dsocket,&bp,0,(struct ksockaddr *)&from,&fromlen) <= 0)
 			break;
 
-		if(kerrno == kEABORT)
-			return -1;		/* Killed by "reset" command */
+		if(Dtrace)
+			kprintf("dns_query: received message length %d from %s\n",
+			 len_p(bp),inet_ntoa(from.sin_addr.s_addr));
+
+		dhp = (struct dhdr *) mallocw(sizeof(struct dhdr));
+		ntohdomain(dhp,&bp);	/* Convert to local format */
 
-		/* Timeout; back off this one and try another server */
-		dp->timeout <<= 1;
-		if((dp = dp->next) == NULL){
-			dp = Dservers;
-			if(Dserver_retries > 0 && ++tried > Dserver_retries)
-				return -1;
+		for(dq = Dqueries; dq != NULL; dq = dq->next)
+			if(dq->id == dhp->id)
+				break;
+		for(dp = Dservers; dp != NULL; dp = dp->next)
+			if(dp->address == from.sin_addr.s_addr)
+				break;
+		if(dq == NULL || dp == NULL || dhp->qr != RESPONSE
+		 || dhp->questions == NULL
+		 || STRICMP(dhp->questions->name,dq->rrp->name) != 0){
+			/* Late, duplicate or bogus */
+			Dquery_unmatched++;
+			free_rr(&dhp->questions);
+			free_rr(&dhp->answers);
+			free_rr(&dhp->authority);
+			free_rr(&dhp->additional);
+			FREE(dhp);
+			continue;
+		}
+		dp->responses++;
+
+		/* Compute and update the round trip time, unless the
+		 * query was sent more than once and we can't tell which
+		 * copy this answers
+		 */
+		rtt = (int32)(msclock() - dq->sent);
+		if(dq->tries == 1){
+			abserr = rtt > dp->srtt ? rtt - dp->srtt : dp->srtt - rtt;
+			dp->srtt = ((AGAIN-1) * dp->srtt + rtt + (AGAIN/2)) >> LAGAIN;
+			dp->mdev = ((DGAIN-1) * dp->mdev + abserr + (DGAIN/2)) >> LDGAIN;
+			dp->timeout = 4 * dp->mdev + dp->srtt;
 		}
-	}
 
-	/* got a response */
-	dp->responses++;
-	dhp = (struct dhdr *) mallocw(sizeof(struct dhdr));
-	ntohdomain(dhp,&bp);	/* Convert to local format */
+		/* move to top of list for next time */
+		if(dp->prev != NULL){
+			dlist_drop(dp);
+			dlist_add(dp);
+		}
 
-	/* Compute and update the round trip time */
-	rtt = (int32) ((uint)msclock() - dhp->id);
-	abserr = rtt > dp->srtt ? rtt - dp->srtt : dp->srtt - rtt;
-	dp->srtt = ((AGAIN-1) * dp->srtt + rtt + (AGAIN/2)) >> LAGAIN;
-	dp->mdev = ((DGAIN-1) * dp->mdev + abserr + (DGAIN/2)) >> LDGAIN;
-	dp->timeout = 4 * dp->mdev + dp->srtt;
+		if(Dtrace)
+			dumpdomain(dhp,rtt);
 
-	/* move to top of list for next time */
-	if(dp->prev != NULL){
-		dlist_drop(dp);
-		dlist_add(dp);
+		dns_answer(dhp);
+		dquery_finish(dq,0);
 	}
+	close_s(Dsocket);
+	Dsocket = -1;
+	Dresolver = NULL;
+}
 
-	if(Dtrace)
-		dumpdomain(dhp,rtt);
-
+/* Put the records from a response into the cache */
+static void
+dns_answer(struct dhdr *dhp)
+{
 	/* Add negative reply to answers.  This assumes that there was
 	 * only one question, which is true for all questions we send.
 	 */
@@ -1509,7 +2391,102 @@ dns_query(struct rr *rrlp)
 		keywait(NULL,1);	/* so we can look around */
 #endif
 	FREE(dhp);
-	return 0;
+}
+
+/* domain server resolution loop
+ * returns: any answers in cache.
+ *	(future features)
+ *	multiple queries.
+ *	inverse queries.
+ * The question is sent to all the servers at once, and resent to them
+ * all each time the slowest one's timeout passes without an answer.
+ * A process asking a question that's already outstanding waits for
+ * that query's answer instead of sending its own.
+ * return value: 0 if something added to cache, -1 if error
+ */
+static int
+dns_query(struct rr *rrlp)
+{
+	struct dquery *dq;
+	struct dserver *dp;
+	int32 timeout;
+	int rval;
+
+	if(Dservers == NULL)
+		return -1;
+
+	for(dq = Dqueries; dq != NULL; dq = dq->next){
+		if(dq->rrp->type == rrlp->type
+		 && dq->rrp->class == rrlp->class
+		 && STRICMP(dq->rrp->name,rrlp->name) == 0)
+			break;
+	}
+	if(dq != NULL){
+		/* Somebody's already asking; wait for their answer */
+		Dquery_coalesced++;
+		dq->waiters++;
+		while(!dq->done){
+			if(kwait(dq) == kEABORT){
+				dquery_release(dq);
+				return -1;	/* Killed by "reset" command */
+			}
+		}
+		rval = dq->result;
+		dquery_release(dq);
+		return rval;
+	}
+
+	if(Dsocket == -1){
+		if((Dsocket = ksocket(kAF_INET,kSOCK_DGRAM,0)) == -1)
+			return -1;
+		Dquery_id = msclock();
+		Dresolver = newproc("domain resolver",
+			1024,dresolver,0,NULL,NULL,0);
+	}
+	dq = (struct dquery *)callocw(1,sizeof(struct dquery));
+	dq->rrp = copy_rr(rrlp);
+	dq->id = dquery_newid();
+	dq->waiters = 1;
+	dq->next = Dqueries;
+	Dqueries = dq;
+	Dquery_outstanding++;
+	Dquery_started++;
+
+	for(;;){
+		dquery_send(dq);
+		timeout = 0;
+		for(dp = Dservers; dp != NULL; dp = dp->next)
+			timeout = max(timeout,dp->timeout);
+
+		/* Wait for something to happen */
+		kalarm(max(timeout,100));
+		rval = 0;
+		while(!dq->done && (rval = kwait(dq)) == 0)
+			;
+		kalarm(0L);
+		if(dq->done)
+			break;
+
+		if(Dtrace){
+			kerrno = rval;
+			kperror("dns_query");
+		}
+		if(rval == kEABORT){
+			dquery_finish(dq,-1);	/* Killed by "reset" command */
+			break;
+		}
+		/* Timeout; back off all the servers and try again */
+		for(dp = Dservers; dp != NULL; dp = dp->next)
+			dp->timeout <<= 1;
+		if(Dservers == NULL
+		 || (Dserver_retries > 0 && dq->tries > Dserver_retries)){
+			dquery_finish(dq,-1);
+			break;
+		}
+	}
+	rval = dq->result;
+	dquery_release(dq);
+	return rval;
 }
 
 
@@ -127,6 +127,12 @@ struct rr {
 		char *name;		/* for domain names */
 		char *data;		/* for anything else */
 	} rdata;
+
+	/* Used only while the record is in the memory cache */
+	struct rr *hnext;	/* Hash chain */
+	uint hash;		/* Hash of name and class */
+	int heapidx;		/* Position in expiry heap, 0 if none */
+	int32 expires;		/* secclock() time that ttl runs out */
 };
 extern struct proc *Dfile_updater;
 
@@ -1,4 +1,3 @@
-#undef SIM
 /* Upper half of IP, consisting of send/receive primitives, including
  * fragment reassembly, for higher level protocols.
  * Not needed when running as a standalone gateway.
@@ -161,7 +160,7 @@ int32 spi		/* Security association, if any */
 		dup_p(&bp1,*bpp,0,len_p(*bpp));
 		if(bp1 != NULL){
 			htonip(ip,&bp1,IP_CS_OLD);
-			enqueue(&rp->rcvq,&bp1);
+			enqueue_mq(&rp->rcvq,&bp1);
 			if(rp->r_upcall != NULL)
 				(*rp->r_upcall)(rp);
 		} else {
@@ -388,7 +387,7 @@ del_ip(struct raw_ip *rpp)
 	else
 		Raw_ip = rp->next;
 	/* Free resources */
-	free_q(&rp->rcvq);
+	free_mq(&rp->rcvq);
 	free(rp);
 }
 
@@ -525,7 +524,7 @@ ip_garbage(int red)
 	}
 	/* Run through the raw IP queue */
 	for(rwp = Raw_ip;rwp != NULL;rwp = rwp->next)
-		mbuf_crunch(&rwp->rcvq);
+		crunch_mq(&rwp->rcvq);
 
 	/* Walk through interface output queues and decrement IP TTLs.
 	 * Discard and return ICMP TTL exceeded messages for any that
@@ -548,22 +547,22 @@ ip_garbage(int red)
 void
 ttldec(struct iface *ifp)
 {
-	struct mbuf *bp,*bpprev,*bpnext;
+	struct mbuf *bp,*bpprev,*bpnext,*tbp;
 	struct qhdr qhdr;
 	struct ip ip;
 
 	bpprev = NULL;
-	for(bp = ifp->outq; bp != NULL;bpprev = bp,bp = bpnext){
+	for(bp = ifp->outq.head; bp != NULL;bpprev = bp,bp = bpnext){
 		bpnext = bp->anext;
+		/* Take it off the queue while we work on it, since pullup
+		 * and pushdown may change its first mbuf
+		 */
+		unlink_mq(&ifp->outq,bpprev,bp);
 		pullup(&bp,&qhdr,sizeof(qhdr));
 		ntohip(&ip,&bp);
 		if(--ip.ttl == 0){
 			/* Drop packet */
 			icmp_output(&ip,bp,ICMP_TIME_EXCEED,0,NULL);
-			if(bpprev == NULL)	/* First on queue */
-				ifp->outq = bpnext;
-			else
-				bpprev->anext = bpnext;
 			free_p(&bp);
 			bp = bpprev; 
 			continue;
@@ -571,11 +570,8 @@ ttldec(struct iface *ifp)
 		/* Put IP and queue headers back, restore to queue */
 		htonip(&ip,&bp,0);
 		pushdown(&bp,&qhdr,sizeof(qhdr));
-		if(bpprev == NULL)	/* First on queue */
-			ifp->outq = bp;
-		else
-			bpprev->anext = bp;
-		bp->anext = bpnext;
+		tbp = bp;
+		insert_mq(&ifp->outq,bpprev,&tbp);
 	}
 }
 
@@ -589,14 +585,14 @@ rquench(struct iface *ifp,int drop)
 	struct ip ip;
 	struct mbuf *bpdup;
 
-	if((i = len_q(ifp->outq)) == 0)
+	if((i = len_mq(&ifp->outq)) == 0)
 		return;	/* Queue is empty */
 
 	i = urandom(i);	/* Select a victim */
 
 	/* Search for i-th message on queue */
 	bplast = NULL;
-	for(bp = ifp->outq;bp != NULL && i>0;i--,bplast=bp,bp=bp->anext)
+	for(bp = ifp->outq.head;bp != NULL && i>0;i--,bplast=bp,bp=bp->anext)
 		;
 	if(bp == NULL)
 		return;	/* "Can't happen" */
@@ -611,9 +607,6 @@ rquench(struct iface *ifp,int drop)
 		return;	/* All done */
 
 	/* Drop the packet */
-	if(bplast != NULL)
-		bplast->anext = bp->anext;
-	else
-		ifp->outq = bp->anext;	/* First on list */
+	unlink_mq(&ifp->outq,bplast,bp);
 	free_p(&bp);
 }
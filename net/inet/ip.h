@@ -99,7 +99,7 @@ struct route {
 	struct timer timer;	/* Time until aging of this entry */
 	int32 uses;		/* Usage count */
 };
-extern struct route *Routes[32][HASHMOD];	/* Routing table */
+extern struct route *Routes[32];	/* Routing table entries, by length - 1 */
 extern struct route R_default;			/* Default route entry */
 
 /* Cache for the last-used routing entry, speeds up the common case where
@@ -141,7 +141,7 @@ extern struct reasm *Reasmq;	/* The list of reassembly descriptors */
 struct raw_ip {
 	struct raw_ip *next;	/* Linked list pointer */
 
-	struct mbuf *rcvq;	/* receive queue */
+	struct mqueue rcvq;	/* receive queue */
 	void (*r_upcall)(struct raw_ip *);
 	int protocol;		/* Protocol */
 	int user;		/* User linkage */
@@ -201,6 +201,6 @@ int ntohip(struct ip *ip,struct mbuf **bpp);
 uint lcsum(uint16 *wp,uint len);
 
 /* In sim.c: */
-void net_sim(struct mbuf *bp);
+void net_sim(struct mbuf **bpp);
 
 #endif /* _KA9Q_IP_H */
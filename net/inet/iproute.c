@@ -25,7 +25,27 @@
 /* note: this is /only/ for a bootp packet check */
 #include "service/bootp/bootp.h"
 
-struct route *Routes[32][HASHMOD];	/* Routing table */
+/* The routing table proper is a path-compressed binary (PATRICIA-style)
+ * trie keyed on target prefix, so a longest-match lookup touches only the
+ * nodes on one root-to-leaf path instead of probing every prefix length.
+ * Each node stands for one prefix; it either carries the route for exactly
+ * that prefix, or is a pure branch point where two longer prefixes diverge.
+ * Routes are also kept on a list per prefix length for the benefit of
+ * code that walks the whole table.
+ */
+struct rt_node {
+	struct rt_node *child[2];	/* Longer prefixes, by next bit */
+	int32 key;			/* Prefix, don't-care bits zero */
+	unsigned int bits;		/* Prefix length, 0-32 */
+	struct route *route;		/* Route for this exact prefix, if any */
+};
+static struct rt_node *Rt_root;
+
+/* Netmask for a prefix length, and bit n (0 = MSB) of an address */
+#define	RT_MASK(bits)	((bits) == 0 ? 0 : (int32)(0xffffffffUL << (32-(bits))))
+#define	RT_BIT(a,n)	((int)(((uint32)(a) >> (31-(n))) & 1))
+
+struct route *Routes[32];	/* Routing table entries, by length - 1 */
 struct route R_default = {		/* Default route entry */
 	NULL, NULL,
 	0,0,0,
@@ -38,6 +58,9 @@ int32 Rtchits;
 
 static int q_pkt(struct iface *iface,int32 gateway,struct ip *ip,
 	struct mbuf **bpp,int ckgood);
+static struct rt_node **rt_find(int32 target,unsigned int bits);
+static void rt_insert(struct route *rp);
+static void rt_remove(int32 target,unsigned int bits);
 
 
 /* Route an IP datagram. This is the "hopper" through which all IP datagrams,
@@ -385,14 +408,13 @@ int ckgood
 	qhdr.tos = (ip->tos & 0xfc);
 	qhdr.gateway = gateway;
 
-	if(iface->outq == NULL){
+	if(iface->outq.head == NULL){
 		/* Queue empty, no priority decisions to be made
 		 * This is the usual case for fast networks like Ethernet,
 		 * so we can avoid some time-consuming stuff
 		 */
 		pushdown(bpp,&qhdr,sizeof(qhdr));
-		iface->outq = *bpp;
-		*bpp = NULL;
+		insert_mq(&iface->outq,NULL,bpp);
 	} else {
 		/* See if this packet references a "priority" TCP port number */
 		if(ip->protocol == TCP_PTCL && ip->offset == 0){
@@ -412,27 +434,28 @@ int ckgood
 			free_p(&tbp);
 		}
 		pushdown(bpp,&qhdr,sizeof(qhdr));
-		/* Search the queue looking for the first packet with precedence
-		 * lower than our packet
+		/* Most packets are no more urgent than the last one queued,
+		 * so check the tail before searching the whole queue
 		 */
-		tlast = NULL;
-		for(tbp = iface->outq;tbp != NULL;tlast=tbp,tbp = tbp->anext){
-			memcpy(&qtmp,tbp->data,sizeof(qtmp));
-			if(qhdr.tos > qtmp.tos){
-				break;	/* Add it just before tbp */
-			}
-		}
-		(*bpp)->anext = tbp;
-		if(tlast == NULL){
-			/* First on queue */
-			iface->outq = *bpp;
+		memcpy(&qtmp,iface->outq.tail->data,sizeof(qtmp));
+		if(qhdr.tos <= qtmp.tos){
+			tlast = iface->outq.tail;
 		} else {
-			tlast->anext = *bpp;
+			/* Search the queue looking for the first packet with
+			 * precedence lower than our packet
+			 */
+			tlast = NULL;
+			for(tbp = iface->outq.head;tbp != NULL;tlast=tbp,tbp = tbp->anext){
+				memcpy(&qtmp,tbp->data,sizeof(qtmp));
+				if(qhdr.tos > qtmp.tos){
+					break;	/* Add it just before tbp */
+				}
+			}
 		}
-		*bpp = NULL;
+		insert_mq(&iface->outq,tlast,bpp);
 	}
 	ksignal(&iface->outq,1);
-	if(iface->outlim != 0 && len_q(iface->outq) >= iface->outlim){
+	if(iface->outlim != 0 && len_mq(&iface->outq) >= iface->outlim){
 		/* Output queue is at limit; return source quench to
 		 * the sender of a randomly selected packet on the queue
 		 */
@@ -515,14 +538,17 @@ uint8 private		/* Inhibit advertising this entry ? */
 		 * entry and put it in.
 		 */
 		rp = (struct route *)callocw(1,sizeof(struct route));
-		/* Insert at head of table */
+		rp->target = target;
+		rp->bits = bits;
+		/* Insert at head of list */
 		rp->prev = NULL;
-		hp = &Routes[bits-1][hash_ip(target)];
+		hp = &Routes[bits-1];
 		rp->next = *hp;
 		if(rp->next != NULL)
 			rp->next->prev = rp;
 		*hp = rp;
 		rp->uses = 0;
+		rt_insert(rp);
 	}
 	rp->target = target;
 	rp->bits = bits;
@@ -562,24 +588,17 @@ unsigned int bits
 	if(bits > 32)
 		bits = 32;
 
-	/* Mask off target according to width */
-	target &= ~0L << (32-bits);
-
-	/* Search appropriate chain for existing entry */
-	for(rp = Routes[bits-1][hash_ip(target)];rp != NULL;rp = rp->next){
-		if(rp->target == target)
-			break;
-	}
-	if(rp == NULL)
+	if((rp = rt_blookup(target,bits)) == NULL)
 		return -1;	/* Not in table */
 
 	stop_timer(&rp->timer);
+	rt_remove(rp->target,bits);
 	if(rp->next != NULL)
 		rp->next->prev = rp->prev;
 	if(rp->prev != NULL)
 		rp->prev->next = rp->next;
 	else
-		Routes[bits-1][hash_ip(target)] = rp->next;
+		Routes[bits-1] = rp->next;
 
 	free(rp);
 	return 0;
@@ -671,18 +690,16 @@ int32 addr;
 		return ifp->addr;
 }
 #endif
-/* Look up target in hash table, matching the entry having the largest number
- * of leading bits in common. Return default route if not found;
- * if default route not set, return NULL
+/* Look up target in the routing table, matching the entry having the
+ * largest number of leading bits in common. Return default route if not
+ * found; if default route not set, return NULL
  */
 struct route *
 rt_lookup(target)
 int32 target;
 {
 	struct route *rp;
-	int bits;
-	int32 tsave;
-	int32 mask;
+	struct rt_node *np;
 	struct rt_cache *rcp;
 
 	Rtlookups++;
@@ -692,28 +709,28 @@ int32 target;
 		Rtchits++;
 		return rp;
 	}
-	tsave = target;
-
-	mask = ~0;	/* All ones */
-	for(bits = 31;bits >= 0; bits--){
-		target &= mask;
-		for(rp = Routes[bits][hash_ip(target)];rp != NULL;rp = rp->next){
-			if(rp->target != target
-			 || (rp->iface == &Encap && rp->gateway == tsave))
-				continue;
-			/* Stash in cache and return */
-			rcp->target = tsave;
-			rcp->route = rp;
-			return rp;
-		}
-		mask <<= 1;
+	/* Walk down the trie for as long as the node prefixes match,
+	 * remembering the last (i.e., longest) usable route seen. Don't
+	 * send an encapsulated packet through its own tunnel endpoint.
+	 */
+	rp = NULL;
+	for(np = Rt_root;np != NULL;np = np->child[RT_BIT(target,np->bits)]){
+		if(((target ^ np->key) & RT_MASK(np->bits)) != 0)
+			break;
+		if(np->route != NULL && !(np->route->iface == &Encap
+		 && np->route->gateway == target))
+			rp = np->route;
+		if(np->bits == 32)
+			break;
 	}
-	if(R_default.iface != NULL){
-		rcp->target = tsave;
-		rcp->route = &R_default;
-		return &R_default;
-	} else
-		return NULL;
+	if(rp == NULL && R_default.iface != NULL)
+		rp = &R_default;
+	if(rp != NULL){
+		/* Stash in cache */
+		rcp->target = target;
+		rcp->route = rp;
+	}
+	return rp;
 }
 /* Search routing table for entry with specific width */
 struct route *
@@ -721,7 +738,7 @@ rt_blookup(target,bits)
 int32 target;
 unsigned int bits;
 {
-	struct route *rp;
+	struct rt_node **npp;
 
 	if(bits == 0){
 		if(R_default.iface != NULL)
@@ -729,15 +746,14 @@ unsigned int bits;
 		else
 			return NULL;
 	}
+	if(bits > 32)
+		bits = 32;
 	/* Mask off target according to width */
-	target &= ~0L << (32-bits);
+	target &= RT_MASK(bits);
 
-	for(rp = Routes[bits-1][hash_ip(target)];rp != NULL;rp = rp->next){
-		if(rp->target == target){
-			return rp;
-		}
-	}
-	return NULL;
+	if((npp = rt_find(target,bits)) == NULL)
+		return NULL;
+	return (*npp)->route;
 }
 /* Scan the routing table. For each entry, see if there's a less-specific
  * one that points to the same interface and gateway. If so, delete
@@ -747,26 +763,124 @@ void
 rt_merge(
 int trace
 ){
-	int bits,i,j;
+	int bits,j;
 	struct route *rp,*rpnext,*rp1;
 
 	for(bits=32;bits>0;bits--){
-		for(i = 0;i<HASHMOD;i++){
-			for(rp = Routes[bits-1][i];rp != NULL;rp = rpnext){
-				rpnext = rp->next;
-				for(j=bits-1;j >= 0;j--){
-					if((rp1 = rt_blookup(rp->target,j)) != NULL
-					 && rp1->iface == rp->iface
-					 && rp1->gateway == rp->gateway){
-						if(trace > 1)
-							kprintf("merge %s %d\n",
-							 inet_ntoa(rp->target),
-							 rp->bits);
-						rt_drop(rp->target,rp->bits);
-						break;
-					}
+		for(rp = Routes[bits-1];rp != NULL;rp = rpnext){
+			rpnext = rp->next;
+			for(j=bits-1;j >= 0;j--){
+				if((rp1 = rt_blookup(rp->target,j)) != NULL
+				 && rp1->iface == rp->iface
+				 && rp1->gateway == rp->gateway){
+					if(trace > 1)
+						kprintf("merge %s %d\n",
+						 inet_ntoa(rp->target),
+						 rp->bits);
+					rt_drop(rp->target,rp->bits);
+					break;
 				}
 			}
 		}
 	}
 }
+/* Find the trie node for an exact prefix. Returns a pointer to the link
+ * that points at it, or NULL if there's no such node
+ */
+static struct rt_node **
+rt_find(
+int32 target,
+unsigned int bits
+){
+	struct rt_node **npp,*np;
+
+	for(npp = &Rt_root;(np = *npp) != NULL;
+	 npp = &np->child[RT_BIT(target,np->bits)]){
+		if(np->bits > bits || ((target ^ np->key) & RT_MASK(np->bits)) != 0)
+			return NULL;
+		if(np->bits == bits)
+			return npp;
+	}
+	return NULL;
+}
+/* Enter a new route into the trie */
+static void
+rt_insert(
+struct route *rp
+){
+	struct rt_node **npp,*np,*nn,*branch;
+	int32 key = rp->target;
+	unsigned int bits = rp->bits;
+	unsigned int common;
+
+	nn = (struct rt_node *)callocw(1,sizeof(struct rt_node));
+	nn->key = key;
+	nn->bits = bits;
+	nn->route = rp;
+	for(npp = &Rt_root;(np = *npp) != NULL;
+	 npp = &np->child[RT_BIT(key,np->bits)]){
+		/* Count leading bits in common, up to the shorter prefix */
+		for(common = 0;common < min(bits,np->bits)
+		 && RT_BIT(key,common) == RT_BIT(np->key,common);common++)
+			;
+		if(common == np->bits){
+			if(np->bits == bits){
+				/* Already here as a branch point; take it over */
+				np->route = rp;
+				free(nn);
+				return;
+			}
+			continue;	/* Ours is longer; keep going down */
+		}
+		if(common == bits){
+			/* Ours is a prefix of this node; go just above it */
+			nn->child[RT_BIT(np->key,bits)] = np;
+			*npp = nn;
+			return;
+		}
+		/* The two diverge; join them under a new branch node */
+		branch = (struct rt_node *)callocw(1,sizeof(struct rt_node));
+		branch->key = key & RT_MASK(common);
+		branch->bits = common;
+		branch->child[RT_BIT(key,common)] = nn;
+		branch->child[RT_BIT(np->key,common)] = np;
+		*npp = branch;
+		return;
+	}
+	*npp = nn;
+}
+/* Take a route out of the trie, pruning any nodes no longer needed */
+static void
+rt_remove(
+int32 target,
+unsigned int bits
+){
+	struct rt_node **path[33];	/* Links followed from the root */
+	struct rt_node **npp,*np;
+	int depth = 0;
+
+	for(npp = &Rt_root;(np = *npp) != NULL;
+	 npp = &np->child[RT_BIT(target,np->bits)]){
+		if(np->bits > bits || ((target ^ np->key) & RT_MASK(np->bits)) != 0)
+			return;		/* Not in trie */
+		path[depth++] = npp;
+		if(np->bits == bits)
+			break;
+	}
+	if(np == NULL)
+		return;
+	np->route = NULL;
+	/* A node without a route survives only as the branch point between
+	 * two children. Work back up the path removing or bypassing any
+	 * node that no longer qualifies; stop at the first one that does.
+	 */
+	while(depth-- > 0){
+		npp = path[depth];
+		np = *npp;
+		if(np->route != NULL
+		 || (np->child[0] != NULL && np->child[1] != NULL))
+			break;
+		*npp = np->child[0] != NULL ? np->child[0] : np->child[1];
+		free(np);
+	}
+}
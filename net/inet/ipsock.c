@@ -46,7 +46,7 @@ int *fromlen;
 	struct ip ip;
 	int cnt;
 
-	while((rip = up->cb.rip) != NULL && rip->rcvq == NULL){
+	while((rip = up->cb.rip) != NULL && rip->rcvq.head == NULL){
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
 			return -1;
@@ -59,7 +59,7 @@ int *fromlen;
 		kerrno = kENOTCONN;
 		return -1;
 	}
-	*bpp = dequeue(&rip->rcvq);
+	*bpp = dequeue_mq(&rip->rcvq);
 	ntohip(&ip,bpp);
 
 	cnt = len_p(*bpp);
@@ -109,7 +109,7 @@ int rtx;
 
 	switch(rtx){	
 	case 0:
-		len = len_q(up->cb.rip->rcvq);
+		len = len_mq(&up->cb.rip->rcvq);
 		break;
 	case 1:
 		len = 0;		
@@ -142,7 +142,7 @@ static void
 rip_recv(rp)
 struct raw_ip *rp;
 {
-	ksignal(itop(rp->user),1);
+	sockwake(itop(rp->user),1);
 	kwait(NULL);
 }
 /* Issue an automatic bind of a local address */
@@ -1,9 +1,13 @@
 /* Simulate a network path by introducing delay (propagation and queuing),
  * bandwidth (delay as a function of packet size), duplication and loss.
- * Intended for use with the loopback interface
+ * Intended for use with the loopback interface: when built with SIM
+ * defined, ip_send() hands loopback traffic to net_sim(), which applies
+ * the loss and propagation delay, and optionally a bottleneck link of
+ * limited rate with a finite queue in front of it.
  */
 #include "top.h"
 
+#include "lib/std/stdio.h"
 #include "global.h"
 #include "net/core/mbuf.h"
 #include "core/timer.h"
@@ -12,6 +16,7 @@
 #include "net/inet/ip.h"
 
 static void simfunc(void *p);
+static void simloop(void *p);
 
 struct pkt {
 	struct iface *iface;
@@ -19,20 +24,40 @@ struct pkt {
 	struct mbuf *bp;
 };
 
+/* Datagram in the loopback delay line */
+struct lpkt {
+	struct lpkt *next;
+	int32 due;		/* msclock() time to deliver it */
+	struct mbuf *bp;
+};
+static struct lpkt *Simhead,*Simtail;
+static struct timer Simtimer;
+static int32 Simfree;		/* msclock() when the bottleneck goes idle */
+
 struct {
 	int32 prop;	/* Fixed prop delay, ms */
 	int32 base;	/* Xmit time, base per pkt, ms */
 	int32 perbyte;	/* Xmit time, ms/byte */
+	int32 loss;	/* Packets dropped, percent */
+	int32 dropped;	/* Count of packets dropped */
+	int32 rate;	/* Loopback bottleneck, bytes/sec; 0 if none */
+	int32 qlimit;	/* Bytes queued for it before tail drop; 0 if no limit */
 } Simctl = {
-	250,80,2};
+	250,80,2,0,0,0,0};
 static int dopropdelay(int,char **,void *);
 static int dobasedelay(int,char **,void *);
 static int doperbytedelay(int,char **,void *);
+static int doloss(int,char **,void *);
+static int doqlimit(int,char **,void *);
+static int dorate(int,char **,void *);
 
 static struct cmds Simcmds[] = {
 	{ "propdelay",	dopropdelay,	0, 0, NULL },
 	{ "basedelay",	dobasedelay,	0, 0, NULL },
+	{ "loss",	doloss,		0, 0, NULL },
 	{ "perbyte",	doperbytedelay,	0, 0, NULL },
+	{ "queue",	doqlimit,	0, 0, NULL },
+	{ "rate",	dorate,		0, 0, NULL },
 	{ NULL },
 };
 
@@ -56,6 +81,34 @@ doperbytedelay(int argc,char *argv[],void *p)
 {
 	return setlong(&Simctl.perbyte,"Simulator per byte delay, ms",argc,argv);
 }
+static int
+doloss(int argc,char *argv[],void *p)
+{
+	if(argc < 2)
+		kprintf("Packets dropped: %ld\n",Simctl.dropped);
+	return setlong(&Simctl.loss,"Simulator loss, percent",argc,argv);
+}
+static int
+dorate(int argc,char *argv[],void *p)
+{
+	return setlong(&Simctl.rate,"Simulator loopback rate, bytes/sec",argc,argv);
+}
+static int
+doqlimit(int argc,char *argv[],void *p)
+{
+	return setlong(&Simctl.qlimit,"Simulator loopback queue limit, bytes",
+	 argc,argv);
+}
+/* Decide whether to lose a packet */
+static int
+simdrop(struct mbuf **bpp)
+{
+	if(Simctl.loss <= 0 || urandom(100) >= Simctl.loss)
+		return 0;
+	free_p(bpp);
+	Simctl.dropped++;
+	return 1;
+}
 
 /* Send packet after delay */
 static void
@@ -83,11 +136,15 @@ sim_tx(int dev,void *arg1,void *unused)
 
         iface = arg1;
         for(;;){
-                while(iface->outq == NULL)
+                while(iface->outq.head == NULL)
                         kwait(&iface->outq);
 
 		iface->txbusy = 1;
-                bp = dequeue(&iface->outq);
+                bp = dequeue_mq(&iface->outq);
+		if(simdrop(&bp)){
+			iface->txbusy = 0;
+			continue;
+		}
                 /* Simulate transmission time */
 		if(Simctl.base+Simctl.perbyte != 0)
 	                ppause(Simctl.base+Simctl.perbyte*len_p(bp));
@@ -111,3 +168,70 @@ sim_tx(int dev,void *arg1,void *unused)
 	}
 }
 
+/* Loopback path, for ip_send() when built with SIM. Datagrams that
+ * aren't lost wait in a FIFO delay line and are passed to the network
+ * task in the order sent once the propagation delay is up.
+ */
+void
+net_sim(struct mbuf **bpp)
+{
+	struct lpkt *lp;
+	int32 now,due,len;
+
+	if(simdrop(bpp))
+		return;
+	now = due = msclock();
+	if(Simctl.rate != 0){
+		/* Queue for the bottleneck, or drop off the tail if the
+		 * queue's full
+		 */
+		len = len_p(*bpp);
+		if(Simfree - now > 0)
+			due = Simfree;
+		if(Simctl.qlimit != 0
+		 && (due - now) * Simctl.rate / 1000 + len > Simctl.qlimit){
+			free_p(bpp);
+			Simctl.dropped++;
+			return;
+		}
+		Simfree = due += len * 1000 / Simctl.rate;
+	}
+	due += Simctl.prop;
+	if(due == now && Simhead == NULL){
+		net_route(&Loopback,bpp);
+		return;
+	}
+	lp = (struct lpkt *)mallocw(sizeof(struct lpkt));
+	lp->next = NULL;
+	lp->due = due;
+	lp->bp = *bpp;
+	*bpp = NULL;
+	if(Simhead == NULL)
+		Simhead = lp;
+	else
+		Simtail->next = lp;
+	Simtail = lp;
+	if(!run_timer(&Simtimer)){
+		Simtimer.func = simloop;
+		set_timer(&Simtimer,max(due - now,1));
+		start_timer(&Simtimer);
+	}
+}
+/* Deliver what's due from the delay line */
+static void
+simloop(void *p)
+{
+	struct lpkt *lp;
+	int32 now;
+
+	now = msclock();
+	while((lp = Simhead) != NULL && lp->due - now <= 0){
+		Simhead = lp->next;
+		net_route(&Loopback,&lp->bp);
+		free(lp);
+	}
+	if(Simhead != NULL){
+		set_timer(&Simtimer,max(Simhead->due - now,1));
+		start_timer(&Simtimer);
+	}
+}
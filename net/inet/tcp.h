@@ -18,7 +18,9 @@
 #define	DEF_RTT	5000	/* Initial guess at round trip time (5 sec) */
 #define	MSL2	30	/* Guess at two maximum-segment lifetimes */
 #define	MIN_RTO	500L	/* Minimum timeout, milliseconds */
-#define	DEF_WSCALE	0	/* Our window scale option */
+#define	DEF_WSCALE	7	/* Our window scale option */
+#define	DEF_MAXWND	1048576L	/* Default limit of window auto-tuning */
+#define	TCBHASH	256	/* # of TCB hash chains; must be a power of 2 */
 
 #define	geniss()	((int32)msclock() << 12) /* Increment clock at 4 MB/sec */
 
@@ -38,6 +40,18 @@
  */
 #define TCPLEN		20	/* Minimum Header length, bytes */
 #define	TCP_MAXOPT	40	/* Largest option field, bytes */
+#define	TCP_MAXSACK	4	/* Most SACK blocks that fit in the options */
+#define	TCP_MAXDUP	8	/* Most sndq mbufs a segment shares, not copies */
+#define	TCP_MAXRESEQ	32	/* Most out-of-order ranges held per connection */
+#define	TCP_MAXSACKENT	32	/* Most ranges on the SACK scoreboard */
+#define	PACE_GRAIN	(1000L*MSPTICK)	/* Pacing resolution, us: one tick */
+#define	PACE_CREDIT	(2*PACE_GRAIN)	/* Most lateness a paced burst makes up */
+
+/* One SACK block: the other end holds sequence numbers start..end-1 */
+struct sackblk {
+	int32 start;
+	int32 end;
+};
 struct tcp {
 	uint source;	/* Source port */
 	uint dest;	/* Destination port */
@@ -50,6 +64,8 @@ struct tcp {
 	uint8 wsopt;			/* Optional window scale factor */
 	uint32 tsval;			/* Outbound timestamp */
 	uint32 tsecr;			/* Timestamp echo field */
+	int nsack;			/* Count of SACK blocks */
+	struct sackblk sack[TCP_MAXSACK];	/* SACK option blocks */
 	struct {
 		unsigned int congest:1;	/* Echoed IP congestion experienced bit */
 		unsigned int urg:1;
@@ -61,6 +77,7 @@ struct tcp {
 		unsigned int mss:1;	/* MSS option present */
 		unsigned int wscale:1;	/* Window scale option present */
 		unsigned int tstamp:1;	/* Timestamp option present */
+		unsigned int sackperm:1;	/* SACK-permitted option present */
 	} flags;
 };
 /* TCP options */
@@ -72,15 +89,60 @@ struct tcp {
 #define	WSCALE_LENGTH	3
 #define	TSTAMP_KIND	8
 #define	TSTAMP_LENGTH	10
+#define	SACKPERM_KIND	4
+#define	SACKPERM_LENGTH	2
+#define	SACK_KIND	5
+#define	SACK_LENGTH(n)	(2 + 8*(n))
+
+/* Sender's SACK scoreboard entry, kept sorted and disjoint */
+struct sackent {
+	struct sackent *next;
+	int32 start;
+	int32 end;
+};
 
-/* Resequencing queue entry */
+/* Resequencing queue entry: a run of contiguous out-of-order data,
+ * merged from however many segments brought it
+ */
 struct reseq {
-	struct reseq *next;	/* Linked-list pointer */
-	struct tcp seg;		/* TCP header */
+	struct tcp seg;		/* TCP header of the latest, with seq of the first */
 	struct mbuf *bp;	/* data */
 	uint length;		/* data length */
 	char tos;		/* Type of service */
 };
+/* Private state of the congestion control algorithms in tcpcc.c */
+struct cubic {
+	int32 wmax;		/* Window when last reduced, bytes */
+	int32 wlast;		/* Previous wmax, for fast convergence */
+	int32 epoch;		/* msclock() when growth resumed; 0 if not yet */
+	int32 k;		/* Time from epoch to get back to origin, ms */
+	int32 origin;		/* Window at the plateau of the curve */
+	int32 west;		/* What Reno would have grown to since epoch */
+};
+#define	BBR_BWROUNDS	10	/* Rounds the bandwidth max filter spans */
+struct bbr {
+	int mode;		/* Phase of the model's control loop */
+#define	BBR_STARTUP	0	/* Doubling to find the bottleneck rate */
+#define	BBR_DRAIN	1	/* Draining the queue startup built */
+#define	BBR_PROBE_BW	2	/* Cycling around the estimated rate */
+#define	BBR_PROBE_RTT	3	/* Backing off to remeasure the path delay */
+	int cycle;		/* Step in the PROBE_BW gain cycle */
+	int32 bw[BBR_BWROUNDS];	/* Delivery rate in recent rounds, bytes/sec */
+	int32 btlbw;		/* Bottleneck rate: the largest of bw[] */
+	int32 fullbw;		/* Rate at which startup last grew enough */
+	int fullcnt;		/* Rounds since then */
+	int32 minrtt;		/* Smallest recent RTT, ms; -1 if none */
+	int32 rtttime;		/* msclock() when minrtt was taken */
+	int32 round;		/* Count of round trips */
+	int32 rndseq;		/* Ack that ends the current round */
+	int32 rndtime;		/* msclock() when it began */
+	int32 rnddlv;		/* delivered when it began */
+	int32 delivered;	/* Total bytes acked */
+	int lossy;		/* Loss recovery in this round */
+	int32 probeend;		/* msclock() to leave PROBE_RTT */
+	int32 prior;		/* cwind to go back to after PROBE_RTT */
+};
+
 /* These numbers match those defined in the MIB for TCP connection state */
 enum tcp_state {
 	TCP_CLOSED=1,
@@ -99,6 +161,8 @@ enum tcp_state {
 /* TCP connection control block */
 struct tcb {
 	struct tcb *next;	/* Linked list pointer */
+	struct tcb *prev;
+	struct tcb *hnext;	/* Hash chain pointer */
 
 	struct connection conn;
 
@@ -145,9 +209,14 @@ struct tcb {
 	int32 rerecv;		/* Count of duplicate bytes received */
 	int32 mss;		/* Maximum segment size */
 
-	int32 window;		/* Receiver window and send queue limit */
+	int32 window;		/* Receive buffer size */
 	int32 limit;		/* Send queue limit */
 
+	/* Receive buffer auto-tuning */
+	int32 rcvrtt;		/* Round trip as seen by the receiver, ms */
+	int32 rcvtime;		/* msclock() when the drain count began */
+	int32 rcvcopied;	/* Bytes read by the user since then */
+
 	void (*r_upcall)(struct tcb *tcb,int32 cnt);
 		/* Call when "significant" amount of data arrives */
 	void (*t_upcall)(struct tcb *tcb,int32 cnt);
@@ -164,19 +233,44 @@ struct tcb {
 		unsigned int congest:1;	/* Copy of last IP congest bit received */
 		int ts_ok:1;	/* We're using timestamps */
 		int ws_ok:1;		/* We're using window scaling */
+		unsigned int sack_ok:1;	/* We're using selective acks */
+		unsigned int recovery:1;	/* In SACK loss recovery */
+		unsigned int rxtfirst:1;	/* Owe the first recovery retransmission */
 	} flags;
 	char tos;		/* Type of service (for IP) */
 	int backoff;		/* Backoff interval */
 
-	struct mbuf *rcvq;	/* Receive queue */
-	struct mbuf *sndq;	/* Send queue */
+	struct mqueue rcvq;	/* Receive queue */
+	struct mqueue sndq;	/* Send queue */
 	int32 rcvcnt;		/* Count of items on rcvq */
 	int32 sndcnt;		/* Number of unacknowledged sequence numbers on
 				 * sndq. NB: includes SYN and FIN, which don't
 				 * actually appear on sndq!
 				 */
+	struct mbuf *sndcur;	/* Last sndq mbuf a segment was taken from */
+	int32 sndoff;		/* Offset of sndcur's first byte on sndq */
+
+	struct reseq *reseq;	/* Out-of-order data, sorted by sequence */
+	int nreseq;		/* Entries in use in reseq[] */
+	int maxreseq;		/* Entries allocated in reseq[] */
+	int32 sackseq;		/* Start of last segment put on reseq */
+
+	/* Selective acknowledgment (RFC 2018/6675) sender state */
+	struct sackent *sacked;	/* Scoreboard: ranges above snd.una the
+				 * other end says it has
+				 */
+	int nsacked;		/* Entries on sacked */
+	int32 recover;		/* snd.nxt when loss recovery began */
+	int32 highrxt;		/* End of last recovery retransmission */
+
+	struct tcp_cc *cc;	/* Congestion control algorithm */
+	union {
+		struct cubic cubic;
+		struct bbr bbr;
+	} ccstate;		/* ...and its private state */
+	struct timer pacer;	/* Releases segments held back by pacing */
+	int32 pace_next;	/* usclock() when the next may be sent */
 
-	struct reseq *reseq;	/* Out-of-order segment queue */
 	struct timer timer;	/* Retransmission timer */
 	int32 rtt_time;		/* Stored clock values for RTT */
 	int32 rttseq;		/* Sequence number being timed */
@@ -198,6 +292,23 @@ struct tcb {
 	int32 inlen;		/* Average receive data size */
 	int32 inrate;		/* Average receive packet interval,ms */
 };
+/* Congestion control algorithm. The generic code calls these at the
+ * events below and leaves the window arithmetic to them
+ */
+struct tcp_cc {
+	char *name;
+	void (*init)(struct tcb *tcb);	/* Start (or switch to) this one */
+	void (*on_ack)(struct tcb *tcb,int32 acked,int32 rtt);
+		/* New data acked; rtt is a sample in ms, or -1 if none */
+	void (*on_loss)(struct tcb *tcb);
+		/* Loss recovery begins; set ssthresh to continue at */
+	void (*on_rto)(struct tcb *tcb);
+		/* Retransmission timeout or source quench */
+	int32 (*pacing_rate)(struct tcb *tcb);
+		/* Bytes/sec to send at, or 0 to send as the window allows */
+	void (*status)(struct tcb *tcb);	/* Show private state */
+};
+
 /* TCP round-trip time cache */
 struct tcp_rtt {
 	int32 addr;		/* Destination IP address */
@@ -234,10 +345,21 @@ extern struct mib_entry Tcp_mib[];
 #define	NUMTCPMIB	15
 
 extern struct tcb *Tcbs;
+extern int32 Tcb_lookups;
+extern int32 Tcb_probes;
 extern char *Tcpstates[];
 extern char *Tcpreasons[];
 
+/* In tcpcc.c: */
+extern struct tcp_cc Tcp_ccs[];
+struct tcp_cc *cc_lookup(char *name);
+void cc_set(struct tcb *tcb,struct tcp_cc *cc);
+
 /* In tcpcmd.c: */
+extern int Tcp_autotune;
+extern struct tcp_cc *Tcp_cc;
+extern int32 Tcp_maxwnd;
+extern int Tcp_sack;
 extern int Tcp_tstamps;
 extern int32 Tcp_irtt;
 extern uint Tcp_limit;
@@ -260,11 +382,26 @@ void tcp_input(struct iface *iface,struct ip *ip,struct mbuf **bpp,
 	int rxbroadcast,int32 said);
 void tcp_icmp(int32 icsource,int32 source,int32 dest,
 	uint8 type,uint8 code,struct mbuf **bpp);
+void free_reseq(struct tcb *tcb);
+
+/* In tcpsack.c: */
+int sack_blocks(struct tcb *tcb,struct sackblk *blocks,int max);
+void sack_update(struct tcb *tcb,struct tcp *seg);
+void sack_prune(struct tcb *tcb);
+void sack_free(struct tcb *tcb);
+int sack_islost(struct tcb *tcb,int32 seq);
+int32 sack_skip(struct tcb *tcb,int32 seq,int32 *limit);
+int32 sack_pipe(struct tcb *tcb);
+int sack_nextseg(struct tcb *tcb,int32 *seqp,int32 *lenp);
+#define	SACK_HOLE	1	/* Unsacked, not yet retransmitted */
+#define	SACK_LOST	2	/* Ditto, and taken to be lost */
 
 /* In tcpsubr.c: */
 void close_self(struct tcb *tcb,int reason);
 struct tcb *create_tcb(struct connection *conn);
 struct tcb *lookup_tcb(struct connection *conn);
+void link_tcb(struct tcb *tcb);
+int unlink_tcb(struct tcb *tcb);
 void rtt_add(int32 addr,int32 rtt);
 struct tcp_rtt *rtt_get(int32 addr);
 int seq_ge(int32 x,int32 y);
@@ -273,6 +410,8 @@ int seq_le(int32 x,int32 y);
 int seq_lt(int32 x,int32 y);
 int seq_within(int32 x,int32 low,int32 high);
 void settcpstate(struct tcb *tcb,enum tcp_state newstate);
+void tcp_rcvtune(struct tcb *tcb,int32 cnt);
+void tcp_sndtune(struct tcb *tcb);
 void tcp_garbage(int red);
 
 /* In tcpout.c: */
@@ -281,6 +420,7 @@ void tcp_output(struct tcb *tcb);
 /* In tcptimer.c: */
 int32 backoff(int n);
 void tcp_timeout(void *p);
+void tcp_pace(void *p);
 
 /* In tcpuser.c: */
 int close_tcp(struct tcb *tcb);
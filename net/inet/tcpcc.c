@@ -0,0 +1,476 @@
+/* TCP congestion control algorithms
+ *
+ * Each TCB points to one of the entries in Tcp_ccs[]. update() in tcpin.c
+ * calls it as data is acked and when loss recovery begins, tcp_timeout()
+ * when the retransmission timer expires, and tcp_output() asks it for a
+ * pacing rate. What it does to cwind and ssthresh is its own business.
+ *
+ * reno	Slow start and additive increase, as this code has always done
+ * cubic	CUBIC (RFC 9438): the window regrows along a cubic curve centred
+ *	on where the last loss happened, so it recovers quickly on long
+ *	fat paths and then probes gently near the old operating point
+ * bbr	A model-based scheme after Cardwell et al.'s BBR: it estimates
+ *	the bottleneck rate and the propagation delay, paces at about that
+ *	rate and keeps roughly one bandwidth-delay product in flight. Loss
+ *	alone doesn't shrink the window
+ */
+#include "top.h"
+
+#include "lib/std/stdio.h"
+#include "global.h"
+#include "core/timer.h"
+#include "net/core/mbuf.h"
+
+#include "lib/inet/netuser.h"
+
+#include "net/inet/internet.h"
+#include "net/inet/tcp.h"
+
+static void reno_ack(struct tcb *tcb,int32 acked,int32 rtt);
+static void reno_loss(struct tcb *tcb);
+static void reno_rto(struct tcb *tcb);
+static void cubic_init(struct tcb *tcb);
+static void cubic_ack(struct tcb *tcb,int32 acked,int32 rtt);
+static void cubic_loss(struct tcb *tcb);
+static void cubic_rto(struct tcb *tcb);
+static int32 cubic_rate(struct tcb *tcb);
+static void cubic_status(struct tcb *tcb);
+static void cubic_reduce(struct tcb *tcb);
+static void bbr_init(struct tcb *tcb);
+static void bbr_ack(struct tcb *tcb,int32 acked,int32 rtt);
+static void bbr_loss(struct tcb *tcb);
+static void bbr_rto(struct tcb *tcb);
+static int32 bbr_rate(struct tcb *tcb);
+static void bbr_status(struct tcb *tcb);
+static void bbr_round(struct tcb *tcb);
+static int32 bbr_bdp(struct tcb *tcb,int gain);
+static int bbr_gain(struct tcb *tcb);
+static void slowstart(struct tcb *tcb,int32 acked);
+static uint32 icbrt(uint64 x);
+
+/* Algorithm table; the first entry is the default for new connections.
+ * init, pacing_rate and status may be NULL
+ */
+struct tcp_cc Tcp_ccs[] = {
+	{ "reno",	NULL,		reno_ack,	reno_loss,	reno_rto,
+		NULL,		NULL },
+	{ "cubic",	cubic_init,	cubic_ack,	cubic_loss,	cubic_rto,
+		cubic_rate,	cubic_status },
+	{ "bbr",	bbr_init,	bbr_ack,	bbr_loss,	bbr_rto,
+		bbr_rate,	bbr_status },
+	{ NULL }
+};
+
+/* Look up an algorithm by name, or any unique-enough prefix of one */
+struct tcp_cc *
+cc_lookup(char *name)
+{
+	struct tcp_cc *cc;
+
+	for(cc = Tcp_ccs;cc->name != NULL;cc++)
+		if(STRNICMP(cc->name,name,strlen(name)) == 0)
+			return cc;
+	return NULL;
+}
+
+/* Put a connection under an algorithm. The window and threshold carry
+ * over, so this can be done at any time
+ */
+void
+cc_set(struct tcb *tcb,struct tcp_cc *cc)
+{
+	tcb->cc = cc;
+	memset(&tcb->ccstate,0,sizeof(tcb->ccstate));
+	if(cc->init != NULL)
+		(*cc->init)(tcb);
+}
+
+/* Slow start, common to reno and cubic below ssthresh. Expand by the
+ * amount acked, but not beyond the offered window
+ */
+static void
+slowstart(struct tcb *tcb,int32 acked)
+{
+	tcb->cwind += min(acked,tcb->mss);
+	if(tcb->cwind > tcb->snd.wnd)
+		tcb->cwind = tcb->snd.wnd;
+}
+
+/* Reno */
+static void
+reno_ack(struct tcb *tcb,int32 acked,int32 rtt)
+{
+	/* Expand congestion window if not already at limit and if
+	 * this packet wasn't retransmitted
+	 */
+	if(tcb->cwind >= tcb->snd.wnd || tcb->flags.retran
+	 || tcb->flags.recovery)
+		return;
+	if(tcb->cwind < tcb->ssthresh){
+		/* Still doing slow start/CUTE, expand by amount acked */
+		slowstart(tcb,acked);
+		return;
+	}
+	/* Steady-state test of extra path capacity */
+	tcb->cwind += ((long)tcb->mss * tcb->mss) / tcb->cwind;
+	/* Don't expand beyond the offered window */
+	if(tcb->cwind > tcb->snd.wnd)
+		tcb->cwind = tcb->snd.wnd;
+}
+/* Halve the data in flight (RFC 5681) */
+static void
+reno_loss(struct tcb *tcb)
+{
+	tcb->ssthresh = (tcb->snd.nxt - tcb->snd.una)/2;
+	tcb->ssthresh = max(tcb->ssthresh,2*tcb->mss);
+}
+static void
+reno_rto(struct tcb *tcb)
+{
+	/* Reduce slowstart threshold to half current window */
+	tcb->ssthresh = tcb->cwind / 2;
+	tcb->ssthresh = max(tcb->ssthresh,tcb->mss);
+	/* Shrink congestion window to 1 packet */
+	tcb->cwind = tcb->mss;
+}
+
+/* CUBIC. The curve is W(t) = C(t-K)^3 + Wmax segments, with C = 0.4 and t
+ * in seconds; counting bytes and milliseconds the cubic term becomes
+ * mss * (t-K)^3 / CUBIC_SCALE. Products are taken in 64 bits
+ */
+#define	CUBIC_BETA	7		/* Window kept on loss, tenths */
+#define	CUBIC_SCALE	2500000000UL	/* 1e9 ms^3/s^3 over C */
+#define	CUBIC_MAXT	0x1fffffL	/* Largest t-K cubed, ms; ~35 min */
+
+static void
+cubic_init(struct tcb *tcb)
+{
+	tcb->ccstate.cubic.k = -1;	/* No epoch yet */
+}
+static void
+cubic_ack(struct tcb *tcb,int32 acked,int32 rtt)
+{
+	struct cubic *cp = &tcb->ccstate.cubic;
+	int32 now,t,target;
+	uint64 delta;
+
+	if(tcb->cwind >= tcb->snd.wnd || tcb->flags.retran
+	 || tcb->flags.recovery)
+		return;
+	if(tcb->cwind < tcb->ssthresh){
+		slowstart(tcb,acked);
+		return;
+	}
+	now = msclock();
+	if(cp->k < 0){
+		/* Start of a growth epoch. Work out how long the curve
+		 * takes to climb back to where the last loss happened
+		 */
+		cp->epoch = now;
+		if(cp->wmax > tcb->cwind){
+			cp->k = icbrt((uint64)(cp->wmax - tcb->cwind)
+			 * CUBIC_SCALE / tcb->mss);
+			cp->origin = cp->wmax;
+		} else {
+			cp->k = 0;
+			cp->origin = tcb->cwind;
+		}
+		cp->west = tcb->cwind;
+	}
+	/* Aim for where the curve will be a round trip from now */
+	t = now - cp->epoch + tcb->srtt - cp->k;
+	delta = min(t < 0 ? -t : t,CUBIC_MAXT);
+	delta = delta * delta * delta / 1000000 * tcb->mss / 2500;
+	delta = min(delta,(uint64)tcb->cwind);
+	target = (t < 0) ? cp->origin - (int32)delta : cp->origin + (int32)delta;
+	target = min(target,tcb->cwind + tcb->cwind/2);
+
+	/* Never do worse than Reno would with the same reduction */
+	cp->west += (int32)((uint64)acked * tcb->mss
+	 * 3 * (10 - CUBIC_BETA) / ((10 + CUBIC_BETA) * tcb->cwind));
+	target = max(target,cp->west);
+
+	if(target > tcb->cwind){
+		tcb->cwind += (int32)((uint64)(target - tcb->cwind) * acked
+		 / tcb->cwind);
+		if(tcb->cwind > tcb->snd.wnd)
+			tcb->cwind = tcb->snd.wnd;
+	}
+}
+/* Note the window at the loss and set the threshold below it */
+static void
+cubic_reduce(struct tcb *tcb)
+{
+	struct cubic *cp = &tcb->ccstate.cubic;
+
+	/* If the window didn't get back to the previous loss point,
+	 * someone else is taking bandwidth; give up a bit more
+	 */
+	if(tcb->cwind < cp->wlast)
+		cp->wmax = tcb->cwind / 20 * (10 + CUBIC_BETA);
+	else
+		cp->wmax = tcb->cwind;
+	cp->wlast = tcb->cwind;
+	cp->k = -1;
+	tcb->ssthresh = tcb->cwind / 10 * CUBIC_BETA;
+}
+static void
+cubic_loss(struct tcb *tcb)
+{
+	cubic_reduce(tcb);
+	tcb->ssthresh = max(tcb->ssthresh,2*tcb->mss);
+}
+static void
+cubic_rto(struct tcb *tcb)
+{
+	cubic_reduce(tcb);
+	tcb->ssthresh = max(tcb->ssthresh,tcb->mss);
+	tcb->cwind = tcb->mss;
+}
+/* Spread the window over the round trip: twice over in slow start so
+ * it can still double, a fifth over after that
+ */
+static int32
+cubic_rate(struct tcb *tcb)
+{
+	if(tcb->srtt <= 0)
+		return 0;
+	return (int32)((uint64)tcb->cwind * 100
+	 * (tcb->cwind < tcb->ssthresh ? 20 : 12) / tcb->srtt);
+}
+static void
+cubic_status(struct tcb *tcb)
+{
+	struct cubic *cp = &tcb->ccstate.cubic;
+
+	kprintf("Cubic: Wmax %lu",cp->wmax);
+	if(cp->k >= 0)
+		kprintf(" K %lu ms epoch %lu ms ago",cp->k,msclock() - cp->epoch);
+	kprintf(" Reno est %lu\n",cp->west);
+}
+
+/* Integer cube root (Hacker's Delight, figure 11-5, widened to 64 bits) */
+static uint32
+icbrt(uint64 x)
+{
+	uint64 b,y = 0;
+	int s;
+
+	for(s = 63;s >= 0;s -= 3){
+		y += y;
+		b = 3*y*(y + 1) + 1;
+		if((x >> s) >= b){
+			x -= b << s;
+			y++;
+		}
+	}
+	return (uint32)y;
+}
+
+/* BBR. Gains are in 256ths */
+#define	BBR_UNIT	256
+#define	BBR_HIGHGAIN	739	/* 2/ln 2, to double every round */
+#define	BBR_DRAINGAIN	89	/* 1/BBR_HIGHGAIN */
+#define	BBR_CWNDGAIN	512	/* Window in steady state, in BDPs */
+#define	BBR_CYCLE	8	/* Rounds in the PROBE_BW cycle */
+#define	BBR_RTTWIN	10000L	/* Lifetime of a minrtt sample, ms */
+#define	BBR_PROBETIME	200L	/* Least time in PROBE_RTT, ms */
+#define	BBR_MINCWND(tcb)	(4*(tcb)->mss)
+
+/* Pacing gains of the PROBE_BW cycle: push a quarter over the estimate
+ * for a round, drain what that queued, then cruise
+ */
+static int Bbr_cycle[BBR_CYCLE] = {
+	320, 192, 256, 256, 256, 256, 256, 256
+};
+static char *Bbr_modes[] = {
+	"startup", "drain", "probe bw", "probe rtt"
+};
+
+static void
+bbr_init(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	bp->mode = BBR_STARTUP;
+	bp->minrtt = -1;
+}
+static void
+bbr_ack(struct tcb *tcb,int32 acked,int32 rtt)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+	int32 now,rate,target;
+	int i;
+
+	now = msclock();
+	bp->delivered += acked;
+
+	/* The propagation delay is the least RTT seen lately. If that's
+	 * gone stale, the queue may not have emptied since; shrink the
+	 * window for a while to find out
+	 */
+	if(rtt >= 0){
+		if(bp->minrtt < 0 || rtt <= bp->minrtt){
+			bp->minrtt = rtt;
+			bp->rtttime = now;
+		} else if(now - bp->rtttime > BBR_RTTWIN
+		 && bp->mode != BBR_PROBE_RTT){
+			bp->minrtt = rtt;
+			bp->rtttime = now;
+			bp->prior = tcb->cwind;
+			bp->probeend = now + max(BBR_PROBETIME,rtt);
+			bp->mode = BBR_PROBE_RTT;
+		}
+	}
+	/* A round ends when what was sent as it began is acked. Take the
+	 * delivery rate over it as a bandwidth sample, unless there was
+	 * loss recovery: the ack that ends that also covers data that
+	 * arrived earlier, and would make the rate look too high
+	 */
+	if(bp->round == 0 || seq_ge(tcb->snd.una + acked,bp->rndseq)){
+		bp->round++;
+		if(bp->round != 1 && now != bp->rndtime && !bp->lossy
+		 && !tcb->flags.recovery){
+			rate = (int32)((uint64)(bp->delivered - bp->rnddlv)
+			 * 1000 / (now - bp->rndtime));
+			bp->bw[bp->round % BBR_BWROUNDS] = rate;
+		} else
+			bp->bw[bp->round % BBR_BWROUNDS] = 0;
+		bp->btlbw = 0;
+		for(i=0;i<BBR_BWROUNDS;i++)
+			bp->btlbw = max(bp->btlbw,bp->bw[i]);
+		bp->lossy = 0;
+		bp->rndseq = tcb->snd.nxt;
+		bp->rndtime = now;
+		bp->rnddlv = bp->delivered;
+		bbr_round(tcb);
+	}
+	if(bp->mode == BBR_DRAIN && tcb->snd.nxt - tcb->snd.una - acked
+	 <= bbr_bdp(tcb,BBR_UNIT)){
+		/* Queue drained; cruise, starting somewhere past the
+		 * probing steps so flows sharing a link stay out of step
+		 */
+		bp->mode = BBR_PROBE_BW;
+		bp->cycle = 2 + urandom(BBR_CYCLE-2);
+	}
+	if(bp->mode == BBR_PROBE_RTT){
+		if((long)(now - bp->probeend) < 0){
+			tcb->cwind = BBR_MINCWND(tcb);
+			return;
+		}
+		bp->mode = (bp->fullcnt >= 3) ? BBR_PROBE_BW : BBR_STARTUP;
+		tcb->cwind = max(tcb->cwind,bp->prior);
+	}
+	if(bp->btlbw == 0){
+		/* No model yet; grow as in slow start */
+		tcb->cwind += acked;
+		return;
+	}
+	target = bbr_bdp(tcb,bp->mode == BBR_PROBE_BW ? BBR_CWNDGAIN
+	 : BBR_HIGHGAIN);
+	/* Allow for the other end delaying its acks */
+	target = max(target + 2*tcb->mss,BBR_MINCWND(tcb));
+	if(tcb->flags.recovery)
+		tcb->cwind = min(tcb->cwind,target);
+	else if(bp->mode != BBR_STARTUP)
+		tcb->cwind = min(tcb->cwind + acked,target);
+	else if(tcb->cwind < target)
+		tcb->cwind += acked;
+}
+/* Once-a-round steps of the control loop */
+static void
+bbr_round(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	switch(bp->mode){
+	case BBR_STARTUP:
+		/* The pipe is full once the rate has failed to grow by a
+		 * quarter for three rounds
+		 */
+		if(bp->btlbw >= bp->fullbw + bp->fullbw/4){
+			bp->fullbw = bp->btlbw;
+			bp->fullcnt = 0;
+		} else if(++bp->fullcnt >= 3)
+			bp->mode = BBR_DRAIN;
+		break;
+	case BBR_PROBE_BW:
+		bp->cycle = (bp->cycle + 1) % BBR_CYCLE;
+		break;
+	}
+}
+/* The bandwidth-delay product times a gain, in bytes */
+static int32
+bbr_bdp(struct tcb *tcb,int gain)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	if(bp->minrtt < 0)
+		return 0;
+	return (int32)((uint64)bp->btlbw * bp->minrtt / 1000 * gain / BBR_UNIT);
+}
+/* Pacing gain for the current mode */
+static int
+bbr_gain(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	switch(bp->mode){
+	case BBR_STARTUP:
+		return BBR_HIGHGAIN;
+	case BBR_DRAIN:
+		return BBR_DRAINGAIN;
+	case BBR_PROBE_BW:
+		return Bbr_cycle[bp->cycle];
+	}
+	return BBR_UNIT;
+}
+/* Loss alone says little about the rate, but it does say the queue has
+ * overflowed. Recover with about one BDP in flight so it drains;
+ * without a model yet, halve as Reno would
+ */
+static void
+bbr_loss(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	bp->lossy = 1;
+	if(bp->btlbw == 0)
+		reno_loss(tcb);
+	else
+		tcb->ssthresh = min(tcb->cwind,
+		 max(bbr_bdp(tcb,BBR_UNIT) + 2*tcb->mss,BBR_MINCWND(tcb)));
+}
+/* Start again from one segment, but keep the model; the window grows
+ * straight back to what it says
+ */
+static void
+bbr_rto(struct tcb *tcb)
+{
+	tcb->ccstate.bbr.lossy = 1;
+	tcb->ssthresh = tcb->cwind;
+	tcb->cwind = tcb->mss;
+}
+static int32
+bbr_rate(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	if(bp->btlbw == 0){
+		/* No model yet; go by the window */
+		if(tcb->srtt <= 0)
+			return 0;
+		return (int32)((uint64)tcb->cwind * 1000 * BBR_HIGHGAIN
+		 / BBR_UNIT / tcb->srtt);
+	}
+	return (int32)((uint64)bp->btlbw * bbr_gain(tcb) / BBR_UNIT);
+}
+static void
+bbr_status(struct tcb *tcb)
+{
+	struct bbr *bp = &tcb->ccstate.bbr;
+
+	kprintf("BBR: %s round %lu btlbw %lu bytes/sec min rtt %ld ms bdp %lu gain %d/%d\n",
+	 Bbr_modes[bp->mode],bp->round,bp->btlbw,bp->minrtt,
+	 bbr_bdp(tcb,BBR_UNIT),bbr_gain(tcb),BBR_UNIT);
+}
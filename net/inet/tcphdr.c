@@ -25,6 +25,7 @@ int32 ipdest
 ){
 	uint hdrlen;
 	uint8 *cp;
+	int i;
 
 	if(bpp == NULL)
 		return;
@@ -35,6 +36,14 @@ int32 ipdest
 		hdrlen += TSTAMP_LENGTH;
 	if(tcph->flags.wscale)
 		hdrlen += WSCALE_LENGTH;
+	if(tcph->flags.sackperm)
+		hdrlen += SACKPERM_LENGTH;
+	/* SACK blocks get whatever option space is left */
+	while(tcph->nsack != 0
+	 && hdrlen + SACK_LENGTH(tcph->nsack) > TCPLEN + TCP_MAXOPT)
+		tcph->nsack--;
+	if(tcph->nsack != 0)
+		hdrlen += SACK_LENGTH(tcph->nsack);
 
 	hdrlen = (hdrlen + 3) & 0xfc;	/* Round up to multiple of 4 */
 	pushdown(bpp,NULL,hdrlen);
@@ -82,6 +91,18 @@ int32 ipdest
 		*cp++ = WSCALE_LENGTH;
 		*cp++ = tcph->wsopt;
 	}
+	if(tcph->flags.sackperm){
+		*cp++ = SACKPERM_KIND;
+		*cp++ = SACKPERM_LENGTH;
+	}
+	if(tcph->nsack != 0){
+		*cp++ = SACK_KIND;
+		*cp++ = SACK_LENGTH(tcph->nsack);
+		for(i=0;i<tcph->nsack;i++){
+			cp = put32(cp,tcph->sack[i].start);
+			cp = put32(cp,tcph->sack[i].end);
+		}
+	}
 	if(tcph->checksum == 0){
 		/* Recompute header checksum */
 		struct pseudo_header ph;
@@ -99,7 +120,7 @@ ntohtcp(
 struct tcp *tcph,
 struct mbuf **bpp
 ){
-	int hdrlen,i,optlen,kind;
+	int hdrlen,i,j,optlen,kind;
 	int flags;
 	uint8 hdrbuf[TCPLEN],*cp;
 	uint8 options[TCP_MAXOPT];
@@ -174,9 +195,23 @@ struct mbuf **bpp
 				tcph->flags.tstamp = 1;
 			}
 			break;
+		case SACKPERM_KIND:
+			if(optlen == SACKPERM_LENGTH)
+				tcph->flags.sackperm = 1;
+			break;
+		case SACK_KIND:
+			if(optlen < SACK_LENGTH(1) || ((optlen - 2) % 8) != 0
+			 || optlen > i + 1)
+				break;
+			tcph->nsack = min((optlen - 2)/8,TCP_MAXSACK);
+			for(j=0;j<tcph->nsack;j++){
+				tcph->sack[j].start = get32(&cp[8*j]);
+				tcph->sack[j].end = get32(&cp[8*j+4]);
+			}
+			break;
 		}
 		optlen = max(2,optlen);	/* Enforce legal minimum */
-		i -= optlen;
+		i -= optlen - 1;	/* Kind byte is already counted */
 		cp += optlen - 2;
 	}
 	return (int)hdrlen;
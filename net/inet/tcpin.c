@@ -26,6 +26,8 @@ static void get_reseq(struct tcb *tcb,uint8 *tos,struct tcp *seq,
 static int trim(struct tcb *tcb,struct tcp *seg,struct mbuf **bpp,
 	uint *length);
 static int in_window(struct tcb *tcb,int32 seq);
+static void join_reseq(struct mbuf **bpp,int32 *cur,int32 seq,
+	struct mbuf **bp,uint length);
 
 /* This function is called from IP with the IP header in machine byte order,
  * along with a mbuf chain pointing to the TCP header.
@@ -111,14 +113,15 @@ int32 said		/* Authenticated packet */
 			ASSIGN(*ntcb,*tcb);
 			tcb = ntcb;
 			tcb->timer.arg = tcb;
-			/* Put on list */
-			tcb->next = Tcbs;
-			Tcbs = tcb;
-		}
+			tcb->pacer.arg = tcb;
+		} else
+			unlink_tcb(tcb);	/* Rehashed below */
 		/* Put all the socket info into the TCB */
 		tcb->conn.local.address = ip->dest;
 		tcb->conn.remote.address = ip->source;
 		tcb->conn.remote.port = seg.source;
+		/* Put on list under the completed connection */
+		link_tcb(tcb);
 	}
 	tcb->flags.congest = ip->flags.congest;
 	/* Do unsynchronized-state processing (p. 65-68) */
@@ -336,8 +339,18 @@ int32 said		/* Authenticated packet */
 				tcb->inrate = (7*tcb->inrate + t - tcb->lastrx)/8;
 				tcb->lastrx = t;
 				tcb->inlen = (7*tcb->inlen + length)/8;
+				/* The echoed timestamp times the round trip
+				 * from this end, for receive window tuning
+				 */
+				if(tcb->flags.ts_ok && seg.flags.tstamp
+				 && seg.tsecr != 0 && t - seg.tsecr >= 0){
+					if(tcb->rcvrtt == 0)
+						tcb->rcvrtt = t - seg.tsecr;
+					else
+						tcb->rcvrtt = (7*tcb->rcvrtt + t - seg.tsecr)/8;
+				}
 				/* Place on receive queue */
-				append(&tcb->rcvq,bpp);
+				append_mq(&tcb->rcvq,bpp);
 				tcb->rcvcnt += length;
 				tcb->rcv.nxt += length;
 				tcb->rcv.wnd -= length;
@@ -396,7 +409,7 @@ int32 said		/* Authenticated packet */
 		/* Scan the resequencing queue, looking for a segment we can handle,
 		 * and freeing all those that are now obsolete.
 		 */
-		while(tcb->reseq != NULL && seq_ge(tcb->rcv.nxt,tcb->reseq->seg.seq)){
+		while(tcb->nreseq != 0 && seq_ge(tcb->rcv.nxt,tcb->reseq[0].seg.seq)){
 			get_reseq(tcb,&ip->tos,&seg,bpp,&length);
 			if(trim(tcb,&seg,bpp,&length) == 0)
 				goto gotone;
@@ -452,13 +465,8 @@ struct mbuf **bpp		/* First 8 bytes of TCP header */
 		tcb->unreach++;
 		break;
 	case ICMP_QUENCH:
-		/* Source quench; reduce slowstart threshold to half
-		 * current window and restart slowstart
-		 */
-		tcb->ssthresh = tcb->cwind / 2;
-		tcb->ssthresh = max(tcb->ssthresh,tcb->mss);
-		/* Shrink congestion window to 1 packet */
-		tcb->cwind = tcb->mss;
+		/* Source quench; back off just as on a timeout */
+		(*tcb->cc->on_rto)(tcb);
 		tcb->quench++;
 		break;
 	}
@@ -509,6 +517,8 @@ struct tcp *seg	/* Offending TCP header */
 	seg->flags.mss = 0;
 	seg->flags.wscale = 0;
 	seg->flags.tstamp = 0;
+	seg->flags.sackperm = 0;
+	seg->nsack = 0;
 	seg->wnd = 0;
 	seg->up = 0;
 	seg->checksum = 0;	/* force recomputation */
@@ -567,6 +577,10 @@ uint length
 		tcb->snd.wl1 = seg->seq;
 		tcb->snd.wl2 = seg->ack;
 	}
+	/* Note what the other end holds beyond the ack */
+	if(tcb->flags.sack_ok && seg->nsack != 0)
+		sack_update(tcb,seg);
+
 	/* See if anything new is being acknowledged */
 	if(seq_lt(seg->ack,tcb->snd.una))
 		return;	/* Old ack, ignore */
@@ -581,6 +595,27 @@ uint length
 			 */
 			return;
 		}
+		if(tcb->flags.sack_ok){
+			/* SACK loss recovery (RFC 6675). Begin once enough
+			 * dupacks have arrived, or enough has been SACKed past
+			 * snd.una, but not while acks for data sent before
+			 * the last recovery or timeout are still coming in.
+			 * tcp_output() does the rest.
+			 */
+			tcb->dupacks++;
+			if(!tcb->flags.recovery && seq_ge(tcb->snd.una,tcb->recover)
+			 && (tcb->dupacks >= TCPDUPACKS
+			 || sack_islost(tcb,tcb->snd.una))){
+				(*tcb->cc->on_loss)(tcb);
+				tcb->recover = tcb->snd.nxt;
+				tcb->cwind = tcb->ssthresh;
+				tcb->highrxt = tcb->snd.una;
+				tcb->snd.ptr = tcb->snd.nxt;
+				tcb->flags.recovery = 1;
+				tcb->flags.rxtfirst = 1;
+			}
+			return;
+		}
 		/* Van Jacobson "fast recovery" code */
 		if(++tcb->dupacks == TCPDUPACKS){
 			/* We've had a burst of do-nothing acks, so
@@ -590,12 +625,10 @@ uint length
 			 */
 			int32 ptrsave;
 
-			/* Knock the threshold down just as though
-			 * this were a timeout, since we've had
+			/* Knock the threshold down, since we've had
 			 * network congestion.
 			 */
-			tcb->ssthresh = tcb->cwind/2;
-			tcb->ssthresh = max(tcb->ssthresh,tcb->mss);
+			(*tcb->cc->on_loss)(tcb);
 
 			/* Manipulate the machinery in tcp_output() to
 			 * retransmit just the missing packet
@@ -628,7 +661,17 @@ uint length
 		return;
 	}
 	/* We're here, so the ACK must have actually acked something */
-	if(tcb->dupacks >= TCPDUPACKS && tcb->cwind > tcb->ssthresh){
+	if(tcb->flags.recovery){
+		/* Stay in recovery until everything outstanding when it
+		 * began has been acked
+		 */
+		if(seq_ge(seg->ack,tcb->recover)){
+			tcb->flags.recovery = 0;
+			tcb->flags.rxtfirst = 0;
+			tcb->cwind = tcb->ssthresh;
+		}
+	} else if(!tcb->flags.sack_ok && tcb->dupacks >= TCPDUPACKS
+	 && tcb->cwind > tcb->ssthresh){
 		/* The acks have finally gotten "unstuck". So now we
 		 * can "deflate" the congestion window, i.e. take it
 		 * back down to where it would be after slow start
@@ -639,24 +682,6 @@ uint length
 	tcb->dupacks = 0;
 	acked = seg->ack - tcb->snd.una;
 
-	/* Expand congestion window if not already at limit and if
-	 * this packet wasn't retransmitted
-	 */
-	if(tcb->cwind < tcb->snd.wnd && !tcb->flags.retran){
-		if(tcb->cwind < tcb->ssthresh){
-			/* Still doing slow start/CUTE, expand by amount acked */
-			tcb->cwind += min(acked,tcb->mss);
-		} else {
-			/* Steady-state test of extra path capacity */
-			tcb->cwind += ((long)tcb->mss * tcb->mss) / tcb->cwind;
-		}
-		/* Don't expand beyond the offered window */
-		if(tcb->cwind > tcb->snd.wnd)
-			tcb->cwind = tcb->snd.wnd;
-	}
-	tcb->cwind = min(tcb->cwind,tcb->sndcnt);	/* Clamp */
-	tcb->cwind = max(tcb->cwind,tcb->mss);
-
 	/* Round trip time estimation */
 	rtt = -1;	/* Init to invalid value */
 	if(tcb->flags.ts_ok && seg->flags.tstamp){
@@ -691,6 +716,12 @@ uint length
 		tcb->outrate = (7*tcb->outrate + t - tcb->lastack)/8;
 		tcb->lastack = t;
 	}
+	/* Let congestion control open the window */
+	(*tcb->cc->on_ack)(tcb,acked,rtt);
+	tcb->cwind = min(tcb->cwind,tcb->sndcnt);	/* Clamp */
+	tcb->cwind = max(tcb->cwind,tcb->mss);
+	tcp_sndtune(tcb);
+
 	tcb->sndcnt -= acked;	/* Update virtual byte count on snd queue */
 	tcb->snd.una = seg->ack;
 
@@ -704,7 +735,12 @@ uint length
 	 * pullup won't be able to remove it from the queue, but that
 	 * causes no harm.
 	 */
-	pullup(&tcb->sndq,NULL,(uint)acked);
+	pullup_mq(&tcb->sndq,NULL,(uint)acked);
+	/* The cursor survives only if its mbuf wasn't pulled up */
+	if(tcb->sndcur != NULL && (tcb->sndoff -= acked) <= 0)
+		tcb->sndcur = NULL;
+	if(tcb->sacked != NULL)
+		sack_prune(tcb);
 
 	/* Stop retransmission timer, but restart it if there is still
 	 * unacknowledged data.
@@ -730,7 +766,7 @@ uint length
 	 */
 	if(acked != 0 && tcb->t_upcall
 	 && (tcb->state == TCP_ESTABLISHED || tcb->state == TCP_CLOSE_WAIT)){
-		(*tcb->t_upcall)(tcb,tcb->window - tcb->sndcnt);
+		(*tcb->t_upcall)(tcb,tcb->limit - tcb->sndcnt);
 	}
 }
 
@@ -779,6 +815,8 @@ struct tcp *seg
 		tcb->flags.ts_ok = 1;
 		tcb->ts_recent = seg->tsval;
 	}
+	if(seg->flags.sackperm && Tcp_sack)
+		tcb->flags.sack_ok = 1;
 	/* Check the MTU of the interface we'll use to reach this guy
 	 * and lower the MSS so that unnecessary fragmentation won't occur
 	 */
@@ -803,12 +841,21 @@ send_syn(struct tcb *tcb)
 {
 	tcb->iss = geniss();
 	tcb->rttseq = tcb->snd.wl2 = tcb->snd.una = tcb->iss;
-	tcb->snd.ptr = tcb->snd.nxt = tcb->rttseq;
+	tcb->snd.ptr = tcb->snd.nxt = tcb->recover = tcb->rttseq;
 	tcb->sndcnt++;
 	tcb->flags.force = 1;
 }
 
-/* Add an entry to the resequencing queue in the proper place */
+/* End of the sequence space taken by an entry, less any FIN */
+#define	RESEQ_END(rp)	((rp)->seg.seq + (rp)->seg.flags.syn + (rp)->length)
+
+/* Add a segment to the resequencing queue. The queue is an array of
+ * ranges sorted by sequence number; the segment is merged with any it
+ * overlaps or touches, so the queue holds one entry per run of data
+ * no matter how it arrived, and a binary search finds the place.
+ * Segments that make no sense (data beyond a FIN we hold) are dropped,
+ * as is the highest range if the queue is full.
+ */
 static void
 add_reseq(
 struct tcb *tcb,
@@ -817,40 +864,133 @@ struct tcp *seg,
 struct mbuf **bpp,
 uint length
 ){
-	struct reseq *rp,*rp1;
+	struct reseq *rp,*nrp;
+	struct mbuf *bp;
+	int32 start,end,cur;
+	int i,j,lo,hi,placed,fin;
 
-	/* Allocate reassembly descriptor */
-	if((rp = (struct reseq *)malloc(sizeof (struct reseq))) == NULL){
-		/* No space, toss on floor */
+	tcb->sackseq = seg->seq;
+	start = seg->seq;
+	end = start + seg->flags.syn + length;
+
+	/* Find the first entry that reaches our start */
+	lo = 0;
+	hi = tcb->nreseq;
+	while(lo < hi){
+		i = (lo + hi) / 2;
+		if(seq_lt(RESEQ_END(&tcb->reseq[i]),start))
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	i = lo;
+	/* And the entries from there we overlap or touch */
+	for(j = i;j < tcb->nreseq && seq_le(tcb->reseq[j].seg.seq,end)
+	 && !tcb->reseq[j].seg.flags.syn;j++)
+		;
+	if(j == i || seg->flags.syn){
+		/* Nothing to merge with; a new entry goes in at i */
+		if(tcb->nreseq == tcb->maxreseq){
+			if(tcb->maxreseq == TCP_MAXRESEQ){
+				/* Full. Give up the highest range, the one
+				 * that will be longest waiting, if we're
+				 * below it; otherwise give up this one
+				 */
+				if(i == tcb->nreseq){
+					free_p(bpp);
+					return;
+				}
+				free_p(&tcb->reseq[--tcb->nreseq].bp);
+			} else {
+				nrp = (struct reseq *)malloc(2 * max(tcb->maxreseq,2)
+				 * sizeof(struct reseq));
+				if(nrp == NULL){
+					/* No space, toss on floor */
+					free_p(bpp);
+					return;
+				}
+				if(tcb->nreseq != 0)
+					memcpy(nrp,tcb->reseq,tcb->nreseq * sizeof(struct reseq));
+				free(tcb->reseq);
+				tcb->reseq = nrp;
+				tcb->maxreseq = min(2 * max(tcb->maxreseq,2),TCP_MAXRESEQ);
+			}
+		}
+		rp = &tcb->reseq[i];
+		memmove(rp+1,rp,(tcb->nreseq - i) * sizeof(struct reseq));
+		tcb->nreseq++;
+		ASSIGN(rp->seg,*seg);
+		rp->tos = tos;
+		rp->bp = (*bpp);
+		*bpp = NULL;
+		rp->length = length;
+		return;
+	}
+	/* A FIN must stay at the end of what we hold */
+	cur = RESEQ_END(&tcb->reseq[j-1]);
+	if(seq_gt(end,cur))
+		cur = end;
+	fin = seg->flags.fin;
+	if(fin && end != cur){
 		free_p(bpp);
 		return;
 	}
+	for(rp = &tcb->reseq[i];rp < &tcb->reseq[j];rp++){
+		if(rp->seg.flags.fin && RESEQ_END(rp) != cur){
+			free_p(bpp);
+			return;
+		}
+		fin |= rp->seg.flags.fin;
+	}
+	/* Splice the data together in sequence order, dropping overlaps */
+	rp = &tcb->reseq[i];
+	if(seq_lt(start,rp->seg.seq))
+		cur = start;
+	else
+		cur = rp->seg.seq;
+	bp = NULL;
+	placed = 0;
+	for(;rp < &tcb->reseq[j];rp++){
+		if(!placed && seq_lt(start,rp->seg.seq)){
+			join_reseq(&bp,&cur,start,bpp,length);
+			placed = 1;
+		}
+		join_reseq(&bp,&cur,rp->seg.seq,&rp->bp,rp->length);
+	}
+	if(!placed)
+		join_reseq(&bp,&cur,start,bpp,length);
+
+	/* The merged entry takes the latest header, for its ack and window */
+	rp = &tcb->reseq[i];
+	start = seq_lt(start,rp->seg.seq) ? start : rp->seg.seq;
 	ASSIGN(rp->seg,*seg);
+	rp->seg.seq = start;
+	rp->seg.flags.fin = fin;
 	rp->tos = tos;
-	rp->bp = (*bpp);
-	*bpp = NULL;
-	rp->length = length;
-
-	/* Place on reassembly list sorting by starting seq number */
-	rp1 = tcb->reseq;
-	if(rp1 == NULL || seq_lt(seg->seq,rp1->seg.seq)){
-		/* Either the list is empty, or we're less than all other
-		 * entries; insert at beginning.
-		 */
-		rp->next = rp1;
-		tcb->reseq = rp;
-	} else {
-		/* Find the last entry less than us */
-		for(;;){
-			if(rp1->next == NULL || seq_lt(seg->seq,rp1->next->seg.seq)){
-				/* We belong just after this one */
-				rp->next = rp1->next;
-				rp1->next = rp;
-				break;
-			}
-			rp1 = rp1->next;
-		}
+	rp->bp = bp;
+	rp->length = cur - start;
+	memmove(rp+1,&tcb->reseq[j],(tcb->nreseq - j) * sizeof(struct reseq));
+	tcb->nreseq -= j - i - 1;
+}
+
+/* Append the part of a range of data, starting at seq, that lies beyond
+ * *cur to the chain being built in *bpp, and advance *cur past it
+ */
+static void
+join_reseq(
+struct mbuf **bpp,
+int32 *cur,
+int32 seq,
+struct mbuf **bp,
+uint length
+){
+	if(seq_le(seq + length,*cur)){
+		free_p(bp);	/* Nothing new */
+		return;
 	}
+	pullup(bp,NULL,(uint)(*cur - seq));
+	append(bpp,bp);
+	*cur = seq + length;
 }
 
 /* Fetch the first entry off the resequencing queue */
@@ -864,16 +1004,30 @@ uint *length
 ){
 	struct reseq *rp;
 
-	if((rp = tcb->reseq) == NULL)
+	if(tcb->nreseq == 0)
 		return;
-
-	tcb->reseq = rp->next;
-
+	rp = &tcb->reseq[0];
 	*tos = rp->tos;
 	ASSIGN(*seg,rp->seg);
 	*bp = rp->bp;
 	*length = rp->length;
-	free(rp);
+	if(--tcb->nreseq == 0)
+		free_reseq(tcb);	/* Give back the array */
+	else
+		memmove(rp,rp+1,tcb->nreseq * sizeof(struct reseq));
+}
+
+/* Discard the resequencing queue */
+void
+free_reseq(struct tcb *tcb)
+{
+	struct reseq *rp;
+
+	for(rp = tcb->reseq;rp < &tcb->reseq[tcb->nreseq];rp++)
+		free_p(&rp->bp);
+	free(tcb->reseq);
+	tcb->reseq = NULL;
+	tcb->nreseq = tcb->maxreseq = 0;
 }
 
 /* Trim segment to fit window. Return 0 if OK, -1 if segment is
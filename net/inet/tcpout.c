@@ -13,6 +13,8 @@
 #include "net/inet/tcp.h"
 #include "net/inet/ip.h"
 
+static struct mbuf *tcp_data(struct tcb *tcb,int32 offset,uint cnt);
+
 /* Send a segment on the specified connection. One gets sent only
  * if there is data to be sent or if "force" is non zero
  */
@@ -28,6 +30,13 @@ tcp_output(struct tcb *tcb)
 	int32 sent;		/* Sequence count (incl SYN/FIN) already
 				 * in the pipe but not yet acked */
 	int32 rto;		/* Retransmit timeout setting */
+	int32 seq;		/* First sequence number to be sent */
+	int32 len;
+	int32 room;		/* Bytes before the next SACKed range */
+	int32 mss;		/* Largest segment, less room for SACKs */
+	int rxt;		/* Recovery retransmission of a hole */
+	int32 rate;		/* Pacing rate, bytes/sec; 0 if none */
+	int32 now;
 
 	if(tcb == NULL)
 		return;
@@ -41,57 +50,135 @@ tcp_output(struct tcb *tcb)
 	}
 	for(;;){
 		memset(&seg,0,sizeof(seg));
-		/* Compute data already in flight */
-		sent = tcb->snd.ptr - tcb->snd.una;
+		rxt = 0;
+		room = -1;
 
-		/* Compute usable send window as minimum of offered
-		 * and congestion windows, minus data already in flight.
-		 * Be careful that the window hasn't shrunk --
-		 * these are unsigned vars.
-		 */
-		usable = min(tcb->snd.wnd,tcb->cwind);
-		if(usable > sent)
-			usable -= sent;	/* Most common case */
-		else if(usable == 0 && sent == 0)
-			usable = 1;	/* Closed window probe */
-		else
-			usable = 0;	/* Window closed or shrunken */
-
-		/* Compute size of segment we *could* send. This is the
-		 * smallest of the usable window, the mss, or the amount
-		 * we have on hand. (I don't like optimistic windows)
-		 */
-		ssize = min(tcb->sndcnt - sent,usable);
-		ssize = min(ssize,tcb->mss);
-
-		/* Now we decide if we actually want to send it.
-		 * Apply John Nagle's "single outstanding segment" rule.
-		 * If data is already in the pipeline, don't send
-		 * more unless it is MSS-sized, the very last packet,
-		 * or we're being forced to transmit anyway (e.g., to
-		 * ack incoming data).
+		/* Report what's waiting on the resequencing queue. The
+		 * blocks take option space, so shrink the segment to suit.
+		 * Never on a SYN, whose own options leave too little room
 		 */
-		if(!tcb->flags.force && sent != 0 && ssize < tcb->mss
-		 && !(tcb->state == TCP_FINWAIT1 && ssize == tcb->sndcnt-sent)){
-			ssize = 0;
+		mss = tcb->mss;
+		if(tcb->flags.sack_ok && tcb->nreseq != 0
+		 && tcb->state != TCP_SYN_SENT && tcb->state != TCP_SYN_RECEIVED){
+			seg.nsack = sack_blocks(tcb,seg.sack,
+			 tcb->flags.ts_ok ? TCP_MAXSACK-1 : TCP_MAXSACK);
+			if(seg.nsack != 0)
+				mss -= (SACK_LENGTH(seg.nsack) + 3) & ~3;
 		}
-	 	/* Unless the tcp syndata option is on, inhibit data until
-		 * our SYN has been acked. This ought to be OK, but some
-		 * old TCPs have problems with data piggybacked on SYNs.
-		 */
-		if(!tcb->flags.synack && !Tcp_syndata){
-			if(tcb->snd.ptr == tcb->iss)
-				ssize = min(1,ssize);	/* Send only SYN */
+		if(tcb->flags.recovery){
+			/* SACK loss recovery (RFC 6675). Send holes taken to
+			 * be lost, then new data, then other holes, for as long
+			 * as the estimated data in the network leaves room
+			 * for a segment in the congestion window. The first
+			 * retransmission goes regardless.
+			 */
+			seq = tcb->snd.nxt;
+			len = 0;
+			usable = tcb->cwind - sack_pipe(tcb);
+			if(tcb->flags.rxtfirst || usable >= mss){
+				rxt = sack_nextseg(tcb,&seq,&len);
+				sent = tcb->snd.nxt - tcb->snd.una;
+				if(rxt != SACK_LOST && tcb->snd.wnd > sent
+				 && tcb->sndcnt > sent){
+					/* New data, if the receiver has room;
+					 * Nagle's rule still applies
+					 */
+					usable = min(tcb->sndcnt - sent,tcb->snd.wnd - sent);
+					usable = min(usable,mss);
+					if(usable == mss || usable == tcb->sndcnt - sent){
+						seq = tcb->snd.ptr = tcb->snd.nxt;
+						len = usable;
+						rxt = 0;
+					}
+				}
+			}
+			ssize = min(len,mss);
+			sent = seq - tcb->snd.una;
+		} else {
+			/* Don't resend what the other end already has */
+			if(tcb->sacked != NULL && seq_lt(tcb->snd.ptr,tcb->snd.nxt))
+				tcb->snd.ptr = sack_skip(tcb,tcb->snd.ptr,&room);
+			seq = tcb->snd.ptr;
+
+			/* Compute data already in flight */
+			sent = tcb->snd.ptr - tcb->snd.una;
+
+			/* Compute usable send window as minimum of offered
+			 * and congestion windows, minus data already in flight.
+			 * Be careful that the window hasn't shrunk --
+			 * these are unsigned vars.
+			 */
+			usable = min(tcb->snd.wnd,tcb->cwind);
+			if(usable > sent)
+				usable -= sent;	/* Most common case */
+			else if(usable == 0 && sent == 0)
+				usable = 1;	/* Closed window probe */
 			else
-				ssize = 0;	/* Don't send anything */
+				usable = 0;	/* Window closed or shrunken */
+
+			/* Compute size of segment we *could* send. This is the
+			 * smallest of the usable window, the mss, or the amount
+			 * we have on hand. (I don't like optimistic windows)
+			 */
+			ssize = min(tcb->sndcnt - sent,usable);
+			ssize = min(ssize,mss);
+			if(room != -1 && ssize > room)
+				ssize = room;	/* Stop at the hole's end */
+
+			/* Now we decide if we actually want to send it.
+			 * Apply John Nagle's "single outstanding segment" rule.
+			 * If data is already in the pipeline, don't send
+			 * more unless it is MSS-sized, the very last packet,
+			 * a whole hole the other end is missing, or we're
+			 * being forced to transmit anyway (e.g., to ack
+			 * incoming data).
+			 */
+			if(!tcb->flags.force && sent != 0 && ssize < mss
+			 && ssize != room
+			 && !(tcb->state == TCP_FINWAIT1 && ssize == tcb->sndcnt-sent)){
+				ssize = 0;
+			}
+		 	/* Unless the tcp syndata option is on, inhibit data until
+			 * our SYN has been acked. This ought to be OK, but some
+			 * old TCPs have problems with data piggybacked on SYNs.
+			 */
+			if(!tcb->flags.synack && !Tcp_syndata){
+				if(tcb->snd.ptr == tcb->iss)
+					ssize = min(1,ssize);	/* Send only SYN */
+				else
+					ssize = 0;	/* Don't send anything */
+			}
+			/* If we're forced to send an ack while retransmitting,
+			 * don't send any data. This will let us use the current
+			 * sequence number, which may be necessary for the
+			 * ack to be accepted by the receiver
+			 */
+			if(tcb->flags.force && tcb->snd.ptr != tcb->snd.nxt)
+				ssize = 0;
 		}
-		/* If we're forced to send an ack while retransmitting,
-		 * don't send any data. This will let us use the current
-		 * sequence number, which may be necessary for the
-		 * ack to be accepted by the receiver
+		/* Space segments out at the rate congestion control
+		 * asks for. There's nothing to space them from when
+		 * nothing is in flight, so that one goes at once.
+		 * The pacer can't wake more finely than a clock tick,
+		 * so everything due before the next one goes now, and
+		 * when it wakes late the time lost is made up, up to
+		 * PACE_CREDIT
 		 */
-		if(tcb->flags.force && tcb->snd.ptr != tcb->snd.nxt)
-			ssize = 0;
+		rate = 0;
+		if(ssize != 0 && tcb->cc->pacing_rate != NULL)
+			rate = (*tcb->cc->pacing_rate)(tcb);
+		if(rate != 0){
+			now = usclock();
+			if(sent != 0 && (long)(tcb->pace_next - now) > PACE_GRAIN){
+				/* Too soon; come back when it's time */
+				set_timer(&tcb->pacer,
+				 (tcb->pace_next - now - PACE_GRAIN + 999) / 1000);
+				start_timer(&tcb->pacer);
+				ssize = 0;
+				rxt = 0;
+			} else if((long)(now - tcb->pace_next) > PACE_CREDIT)
+				tcb->pace_next = now - PACE_CREDIT;
+		}
 		if(ssize == 0 && !tcb->flags.force)
 			break;		/* No need to send anything */
 
@@ -117,7 +204,9 @@ tcp_output(struct tcb *tcb)
 			/* Send SYN */
 			seg.flags.syn = 1;
 			dsize--;	/* SYN isn't really in snd queue */
-			/* Also send MSS, wscale and tstamp (if OK) */
+			/* Also send MSS, wscale, tstamp and SACK-permitted
+			 * (if OK)
+			 */
 			seg.mss = Tcp_mss;
 			seg.flags.mss = 1;
 			seg.wsopt = DEF_WSCALE;
@@ -126,6 +215,9 @@ tcp_output(struct tcb *tcb)
 				seg.flags.tstamp = 1;
 				seg.tsval = msclock();
 			}
+			if(Tcp_sack && (tcb->state == TCP_SYN_SENT
+			 || tcb->flags.sack_ok))
+				seg.flags.sackperm = 1;
 		}
 		/* If there's no data, use snd.nxt rather than snd.ptr to
 		 * ensure ack acceptance in case we were retransmitting
@@ -133,19 +225,20 @@ tcp_output(struct tcb *tcb)
 		if(ssize == 0)
 			seg.seq = tcb->snd.nxt;
 		else
-			seg.seq = tcb->snd.ptr;
+			seg.seq = seq;
 		tcb->last_ack_sent = seg.ack = tcb->rcv.nxt;
 		if(seg.flags.syn || !tcb->flags.ws_ok)
-			seg.wnd = tcb->rcv.wnd;
+			seg.wnd = min(tcb->rcv.wnd,MAXINT16);
 		else
 			seg.wnd = tcb->rcv.wnd >> tcb->rcv.wind_scale;
 
-		/* Now try to extract some data from the send queue. Since
+		/* Now try to get some data from the send queue. Since
 		 * SYN and FIN occupy sequence space and are reflected in
-		 * sndcnt but don't actually sit in the send queue, extract
-		 * will return one less than dsize if a FIN needs to be sent.
+		 * sndcnt but don't actually sit in the send queue, we'll
+		 * get one less than dsize if a FIN needs to be sent. The
+		 * headers go in front, in an mbuf of their own.
 		 */
-		dbp = ambufw(NET_HDR_PAD+dsize);
+		dbp = ambufw(NET_HDR_PAD);
 		dbp->data += NET_HDR_PAD;	/* Allow room for other hdrs */
 		if(dsize != 0){
 			int32 offset;
@@ -157,8 +250,8 @@ tcp_output(struct tcb *tcb)
 			if(!tcb->flags.synack && sent != 0)
 				offset--;
 
-			dbp->cnt = extract(tcb->sndq,(uint)offset,dbp->data,dsize);
-			if(dbp->cnt != dsize){
+			dbp->next = tcp_data(tcb,offset,dsize);
+			if(len_p(dbp->next) != dsize){
 				/* We ran past the end of the send queue;
 				 * send a FIN
 				 */
@@ -173,19 +266,25 @@ tcp_output(struct tcb *tcb)
 			seg.flags.psh = 1;
 
 		/* If this transmission includes previously transmitted data,
-		 * snd.nxt will already be past snd.ptr. In this case,
+		 * snd.nxt will already be past it. In this case,
 		 * compute the amount of retransmitted data and keep score
 		 */
-		if(tcb->snd.ptr < tcb->snd.nxt)
-			tcb->resent += min(tcb->snd.nxt - tcb->snd.ptr,ssize);
+		if(seq_lt(seq,tcb->snd.nxt))
+			tcb->resent += min(tcb->snd.nxt - seq,ssize);
 
-		tcb->snd.ptr += ssize;
-		/* If this is the first transmission of a range of sequence
-		 * numbers, record it so we'll accept acknowledgments
-		 * for it later
-		 */
-		if(seq_gt(tcb->snd.ptr,tcb->snd.nxt))
-			tcb->snd.nxt = tcb->snd.ptr;
+		if(rxt){
+			/* A hole resent during recovery; snd.ptr stays put */
+			tcb->highrxt = seq + ssize;
+			tcb->flags.rxtfirst = 0;
+		} else {
+			tcb->snd.ptr += ssize;
+			/* If this is the first transmission of a range of
+			 * sequence numbers, record it so we'll accept
+			 * acknowledgments for it later
+			 */
+			if(seq_gt(tcb->snd.ptr,tcb->snd.nxt))
+				tcb->snd.nxt = tcb->snd.ptr;
+		}
 
 		if(tcb->flags.ts_ok && seg.flags.ack){
 			seg.flags.tstamp = 1;
@@ -207,14 +306,16 @@ tcp_output(struct tcb *tcb)
 				start_timer(&tcb->timer);
 
 			/* If round trip timer isn't running, start it */
-			if(tcb->flags.ts_ok || !tcb->flags.rtt_run){
+			if(!rxt && (tcb->flags.ts_ok || !tcb->flags.rtt_run)){
 				tcb->flags.rtt_run = 1;
 				tcb->rtt_time = msclock();
 				tcb->rttseq = tcb->snd.ptr;
 				tcb->rttack = tcb->snd.una;
 			}
 		}
-		if(tcb->flags.retran)
+		if(rate != 0)
+			tcb->pace_next += (int32)((uint64)ssize * 1000000 / rate);
+		if(tcb->flags.retran || rxt)
 			tcpRetransSegs++;
 		else
 			tcpOutSegs++;
@@ -223,3 +324,51 @@ tcp_output(struct tcb *tcb)
 		 TCP_PTCL,tcb->tos,0,&dbp,len_p(dbp),0,0);
 	}
 }
+/* Return cnt bytes from offset on the send queue, or as many as there
+ * are. The data is normally shared with the send queue by dup_p() rather
+ * than copied; it's only copied when it lies in so many little mbufs
+ * (e.g., from a character-at-a-time user) that the headers would cost
+ * more than the copy. The search for offset starts from the cursor left
+ * by the last call, so a window's worth of segments doesn't walk the
+ * queue from the front each time.
+ */
+static struct mbuf *
+tcp_data(struct tcb *tcb,int32 offset,uint cnt)
+{
+	struct mbuf *bp,*dbp;
+	int32 off;
+	uint avail;
+	int n;
+
+	if(tcb->sndcur == NULL || offset < tcb->sndoff){
+		tcb->sndcur = tcb->sndq.head;
+		tcb->sndoff = 0;
+	}
+	bp = tcb->sndcur;
+	off = tcb->sndoff;
+	while(bp != NULL && off + bp->cnt <= offset){
+		off += bp->cnt;
+		bp = bp->next;
+	}
+	if(bp == NULL)
+		return NULL;	/* Past the end; only a FIN is left */
+	tcb->sndcur = bp;
+	tcb->sndoff = off;
+	offset -= off;
+
+	/* See how many mbufs the data spans, and how much there is */
+	avail = 0;
+	for(n = 0;bp != NULL && avail < cnt + offset;n++){
+		avail += bp->cnt;
+		bp = bp->next;
+	}
+	avail = min(avail - offset,cnt);
+	if(n <= TCP_MAXDUP){
+		if(dup_p(&dbp,tcb->sndcur,(uint)offset,avail) == avail)
+			return dbp;
+		free_p(&dbp);	/* Out of mbuf headers; copy instead */
+	}
+	dbp = ambufw(avail);
+	dbp->cnt = extract(tcb->sndcur,(uint)offset,dbp->data,avail);
+	return dbp;
+}
@@ -0,0 +1,291 @@
+/* TCP selective acknowledgment (RFC 2018) and SACK-based loss recovery
+ * (RFC 6675)
+ *
+ * The receiver describes its resequencing queue in up to TCP_MAXSACK
+ * blocks on each ack, the block holding the latest arrival first. The
+ * sender merges the blocks into a scoreboard of ranges above snd.una,
+ * and from that decides which holes are lost and how much data is still
+ * in the network. The scoreboard is only advice: data stays on the send
+ * queue until it is cumulatively acked, and the scoreboard is discarded
+ * on a timeout in case the receiver has thrown away what it was holding.
+ */
+#include "top.h"
+
+#include "global.h"
+#include "core/timer.h"
+#include "net/core/mbuf.h"
+
+#include "lib/inet/netuser.h"
+
+#include "net/inet/internet.h"
+#include "net/inet/tcp.h"
+
+/* The loss test of RFC 6675 IsLost(), given the number of scoreboard
+ * entries and bytes lying above a sequence number
+ */
+#define	LOST(tcb,cnt,bytes) \
+	((cnt) >= TCPDUPACKS || (bytes) > (TCPDUPACKS-1) * (tcb)->mss)
+
+static void sack_add(struct tcb *tcb,int32 start,int32 end);
+static void sack_total(struct tcb *tcb,int *cnt,int32 *bytes);
+
+/* Fill in up to max SACK blocks describing the resequencing queue,
+ * whose entries are already merged runs of data. The block holding the
+ * most recently queued segment goes first, as RFC 2018 asks; the rest
+ * follow in sequence order. Returns the number of blocks.
+ */
+int
+sack_blocks(struct tcb *tcb,struct sackblk *blocks,int max)
+{
+	struct reseq *rp;
+	int32 start,end;
+	int n = 1;	/* blocks[0] is saved for the latest arrival */
+	int found = 0;
+
+	if(max <= 0)
+		return 0;
+	for(rp = tcb->reseq;rp < &tcb->reseq[tcb->nreseq];rp++){
+		start = rp->seg.seq;
+		end = start + rp->length;
+		if(start == end)
+			continue;	/* Bare FIN; nothing to report */
+		if(!found && seq_ge(tcb->sackseq,start)
+		 && seq_lt(tcb->sackseq,end)){
+			blocks[0].start = start;
+			blocks[0].end = end;
+			found = 1;
+		} else if(n < max){
+			blocks[n].start = start;
+			blocks[n].end = end;
+			n++;
+		}
+	}
+	if(!found){
+		n--;
+		memmove(&blocks[0],&blocks[1],n * sizeof(struct sackblk));
+	}
+	return n;
+}
+
+/* Merge the SACK blocks of an incoming segment into the scoreboard.
+ * Blocks that are malformed, already acked or beyond what we've sent
+ * are ignored.
+ */
+void
+sack_update(struct tcb *tcb,struct tcp *seg)
+{
+	struct sackblk *bp;
+	int32 start;
+
+	for(bp = seg->sack;bp < &seg->sack[seg->nsack];bp++){
+		if(!seq_lt(bp->start,bp->end) || seq_le(bp->end,tcb->snd.una)
+		 || seq_gt(bp->end,tcb->snd.nxt))
+			continue;
+		start = seq_lt(bp->start,tcb->snd.una) ? tcb->snd.una : bp->start;
+		sack_add(tcb,start,bp->end);
+	}
+}
+
+/* Add a range to the scoreboard, coalescing with whatever it touches.
+ * A peer can't make it grow without limit: once it's full the highest
+ * range is dropped, being the one least likely to matter soon
+ */
+static void
+sack_add(struct tcb *tcb,int32 start,int32 end)
+{
+	struct sackent *sp,*sp1,**spp,**lastp;
+
+	/* Find the first entry that reaches our start */
+	for(spp = &tcb->sacked;(sp = *spp) != NULL && seq_lt(sp->end,start);
+	 spp = &sp->next)
+		;
+	if(sp == NULL || seq_lt(end,sp->start)){
+		/* Touches nothing; link in a new entry here */
+		if(tcb->nsacked >= TCP_MAXSACKENT){
+			if(sp == NULL)
+				return;	/* We'd be the highest */
+			for(lastp = spp;(*lastp)->next != NULL;lastp = &(*lastp)->next)
+				;
+			free(*lastp);
+			*lastp = NULL;
+			tcb->nsacked--;
+			if(lastp == spp)
+				sp = NULL;	/* That was the one after us */
+		}
+		if((sp1 = (struct sackent *)malloc(sizeof(struct sackent))) == NULL)
+			return;	/* It's only advice */
+		sp1->start = start;
+		sp1->end = end;
+		sp1->next = sp;
+		*spp = sp1;
+		tcb->nsacked++;
+		return;
+	}
+	if(seq_lt(start,sp->start))
+		sp->start = start;
+	if(seq_gt(end,sp->end))
+		sp->end = end;
+	/* Absorb any entries we now reach */
+	while((sp1 = sp->next) != NULL && seq_le(sp1->start,sp->end)){
+		if(seq_gt(sp1->end,sp->end))
+			sp->end = sp1->end;
+		sp->next = sp1->next;
+		free(sp1);
+		tcb->nsacked--;
+	}
+}
+
+/* Drop the scoreboard entries that snd.una has moved past */
+void
+sack_prune(struct tcb *tcb)
+{
+	struct sackent *sp;
+
+	while((sp = tcb->sacked) != NULL && seq_le(sp->end,tcb->snd.una)){
+		tcb->sacked = sp->next;
+		free(sp);
+		tcb->nsacked--;
+	}
+	if(sp != NULL && seq_lt(sp->start,tcb->snd.una))
+		sp->start = tcb->snd.una;
+}
+
+/* Discard the whole scoreboard */
+void
+sack_free(struct tcb *tcb)
+{
+	struct sackent *sp;
+
+	while((sp = tcb->sacked) != NULL){
+		tcb->sacked = sp->next;
+		free(sp);
+	}
+	tcb->nsacked = 0;
+}
+
+/* Count the scoreboard entries and the bytes they cover */
+static void
+sack_total(struct tcb *tcb,int *cnt,int32 *bytes)
+{
+	struct sackent *sp;
+
+	*cnt = 0;
+	*bytes = 0;
+	for(sp = tcb->sacked;sp != NULL;sp = sp->next){
+		(*cnt)++;
+		*bytes += sp->end - sp->start;
+	}
+}
+
+/* Return true if enough has been selectively acked above seq to take
+ * it as lost (RFC 6675 IsLost())
+ */
+int
+sack_islost(struct tcb *tcb,int32 seq)
+{
+	struct sackent *sp;
+	int32 bytes = 0;
+	int cnt = 0;
+
+	for(sp = tcb->sacked;sp != NULL;sp = sp->next){
+		if(seq_le(sp->end,seq))
+			continue;
+		cnt++;
+		bytes += sp->end - (seq_gt(seq,sp->start) ? seq : sp->start);
+	}
+	return LOST(tcb,cnt,bytes);
+}
+
+/* If seq falls in a range the other end already has, return the first
+ * sequence number past it; otherwise return seq. *room is set to the
+ * number of bytes from there to the next such range, or -1 if there's
+ * none below snd.nxt.
+ */
+int32
+sack_skip(struct tcb *tcb,int32 seq,int32 *room)
+{
+	struct sackent *sp;
+
+	*room = -1;
+	for(sp = tcb->sacked;sp != NULL;sp = sp->next){
+		if(seq_le(sp->end,seq))
+			continue;
+		if(seq_le(sp->start,seq)){
+			seq = sp->end;
+			continue;
+		}
+		*room = sp->start - seq;
+		break;
+	}
+	return seq;
+}
+
+/* Estimate the data still in the network during recovery (RFC 6675
+ * SetPipe()). Unsacked data counts unless it's taken to be lost, and
+ * counts again if it has been retransmitted since recovery began.
+ */
+int32
+sack_pipe(struct tcb *tcb)
+{
+	struct sackent *sp;
+	int32 lo,hi,bytes,pipe = 0;
+	int cnt;
+
+	sack_total(tcb,&cnt,&bytes);
+	lo = tcb->snd.una;
+	for(sp = tcb->sacked;;sp = sp->next){
+		hi = (sp != NULL) ? sp->start : tcb->snd.nxt;
+		if(seq_lt(lo,hi)){
+			if(!LOST(tcb,cnt,bytes))
+				pipe += hi - lo;
+			if(seq_gt(tcb->highrxt,lo))
+				pipe += (seq_lt(tcb->highrxt,hi) ? tcb->highrxt : hi) - lo;
+		}
+		if(sp == NULL)
+			break;
+		cnt--;
+		bytes -= sp->end - sp->start;
+		lo = sp->end;
+	}
+	return pipe;
+}
+
+/* Pick the next hole to retransmit during recovery (RFC 6675 NextSeg()
+ * rules 1 and 3). The first hole not yet retransmitted that is taken to
+ * be lost is preferred, and returns SACK_LOST; failing that the first
+ * one below a SACKed range not yet retransmitted at all returns
+ * SACK_HOLE. The caller is to send new data, if it can, in preference
+ * to a SACK_HOLE. Returns 0 if there's nothing to retransmit.
+ */
+int
+sack_nextseg(struct tcb *tcb,int32 *seqp,int32 *lenp)
+{
+	struct sackent *sp;
+	int32 lo,hi,seq,bytes;
+	int cnt,ret = 0;
+
+	sack_total(tcb,&cnt,&bytes);
+	lo = tcb->snd.una;
+	for(sp = tcb->sacked;;sp = sp->next){
+		hi = (sp != NULL) ? sp->start : tcb->snd.nxt;
+		seq = seq_gt(tcb->highrxt,lo) ? tcb->highrxt : lo;
+		if(seq_lt(seq,hi)){
+			if(tcb->flags.rxtfirst || LOST(tcb,cnt,bytes)){
+				*seqp = seq;
+				*lenp = min(hi - seq,tcb->mss);
+				return SACK_LOST;
+			}
+			if(ret == 0 && sp != NULL){
+				*seqp = seq;
+				*lenp = min(hi - seq,tcb->mss);
+				ret = SACK_HOLE;
+			}
+		}
+		if(sp == NULL)
+			break;
+		cnt--;
+		bytes -= sp->end - sp->start;
+		lo = sp->end;
+	}
+	return ret;
+}
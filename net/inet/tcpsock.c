@@ -132,7 +132,7 @@ so_tcp_send(struct usock *up,struct mbuf **bpp,struct ksockaddr *to)
 	cnt = send_tcp(tcb,bpp);
 
 	while((tcb = up->cb.tcb) != NULL &&
-	 tcb->sndcnt > tcb->window){
+	 tcb->sndcnt > tcb->limit){
 		/* Send queue is full */
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
@@ -196,12 +196,40 @@ so_tcp_close(struct usock *up)
 	}
 	return 0;
 }
+/* Readiness for kpoll() */
+int
+so_tcp_poll(struct usock *up)
+{
+	struct tcb *tcb;
+	int mask = 0;
+
+	if((tcb = up->cb.tcb) == NULL)
+		return kPOLLIN|kPOLLHUP;	/* Reset or closed */
+	if(up->rdysock != -1)
+		mask |= kPOLLIN;		/* Connection to accept */
+	if(tcb->rcvcnt != 0)
+		mask |= kPOLLIN;
+	switch(tcb->state){
+	case TCP_CLOSE_WAIT:
+	case TCP_CLOSING:
+	case TCP_LAST_ACK:
+	case TCP_TIME_WAIT:
+		mask |= kPOLLIN;		/* recv will return EOF */
+		break;
+	default:
+		break;
+	}
+	if((tcb->state == TCP_ESTABLISHED || tcb->state == TCP_CLOSE_WAIT)
+	 && tcb->sndcnt < tcb->limit)
+		mask |= kPOLLOUT;
+	return mask;
+}
 /* TCP receive upcall routine */
 static void
 s_trcall(struct tcb *tcb,int32 cnt)
 {
 	/* Wake up anybody waiting for data, and let them run */
-	ksignal(itop(tcb->user),1);
+	sockwake(itop(tcb->user),1);
 	kwait(NULL);
 }
 /* TCP transmit upcall routine */
@@ -209,7 +237,7 @@ static void
 s_ttcall(struct tcb *tcb,int32 cnt)
 {
 	/* Wake up anybody waiting to send data, and let them run */
-	ksignal(itop(tcb->user),1);
+	sockwake(itop(tcb->user),1);
 	kwait(NULL);
 }
 /* TCP state change upcall routine */
@@ -238,7 +266,7 @@ s_tscall(struct tcb *tcb,int old,int new)
 			up->errcodes[0] = tcb->reason;
 			up->errcodes[1] = tcb->type;
 			up->errcodes[2] = tcb->code;
-			ksignal(up,0); /* Wake up anybody waiting */
+			sockwake(up,0); /* Wake up anybody waiting */
 		}
 		del_tcp(&tcb);
 		break;
@@ -256,6 +284,7 @@ s_tscall(struct tcb *tcb,int old,int new)
 			ASSIGN(*nup,*up);
 			tcb->user = ns;
 			nup->cb.tcb = tcb;
+			nup->pollev = NULL;	/* Not part of the listener's poll */
 			/* Allocate new memory for the name areas */
 			nup->name = mallocw(SOCKSIZE);
 			nup->peername = mallocw(SOCKSIZE);
@@ -286,13 +315,13 @@ s_tscall(struct tcb *tcb,int old,int new)
 		up->peernamelen = SOCKSIZE;
 
 		/* Wake up the guy accepting it, and let him run */
-		ksignal(oup,1);
+		sockwake(oup,1);
 		kwait(NULL);
 		break;
 	default:	/* Ignore all other state transitions */
 		break;
 	}
-	ksignal(up,0);	/* In case anybody's waiting */
+	sockwake(up,0);	/* In case anybody's waiting */
 }
 /* Discard data received on a TCP connection. Used after a receive shutdown or
  * close_s until the TCB disappears.
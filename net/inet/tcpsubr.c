@@ -3,6 +3,7 @@
  *  sequence number logical operations
  *  state transitions
  *  RTT cacheing
+ *  buffer auto-tuning
  *  garbage collection
  *
  * Copyright 1991 Phil Karn, KA9Q
@@ -43,6 +44,8 @@ char *Tcpreasons[] = {
 	"ICMP"		/* Not actually used */
 };
 struct tcb *Tcbs;		/* Head of control block list */
+int32 Tcb_lookups;		/* Calls to lookup_tcb() */
+int32 Tcb_probes;		/* TCBs examined by those calls */
 uint Tcp_mss = DEF_MSS;		/* Maximum segment size to be sent with SYN */
 int32 Tcp_irtt = DEF_RTT;	/* Initial guess at round trip time */
 int Tcp_trace;			/* State change tracing flag */
@@ -68,35 +71,92 @@ struct mib_entry Tcp_mib[] = {
 };
 
 
+/* TCBs are hashed on their connection for demultiplexing. Fully
+ * specified connections hash on all four fields; listeners (those with
+ * no remote socket) go in a separate table hashed on local port alone,
+ * so that the wildcard probes made for an incoming SYN land in the same
+ * short chain whether or not the listener gave a local address.
+ */
+static struct tcb *Tcb_hash[TCBHASH];	/* Connected TCBs */
+static struct tcb *Tcb_listen[TCBHASH];	/* Listening TCBs */
+
+static struct tcb **
+tcb_chain(struct connection *conn)
+{
+	uint32 h;
+
+	if(conn->remote.address == 0 && conn->remote.port == 0)
+		return &Tcb_listen[conn->local.port & (TCBHASH-1)];
+
+	h = (uint32)conn->remote.address ^ (uint32)conn->local.address;
+	h ^= ((uint32)conn->remote.port << 16) ^ conn->local.port;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return &Tcb_hash[h & (TCBHASH-1)];
+}
+
 /* Look up TCP connection
  * Return TCB pointer or NULL if nonexistant.
- * Also move the entry to the top of the list to speed future searches.
  */
 struct tcb *
 lookup_tcb(conn)
 struct connection *conn;
 {
 	struct tcb *tcb;
-	struct tcb *tcblast = NULL;
 
-	for(tcb=Tcbs;tcb != NULL;tcblast = tcb,tcb = tcb->next){
+	Tcb_lookups++;
+	for(tcb = *tcb_chain(conn);tcb != NULL;tcb = tcb->hnext){
+		Tcb_probes++;
 		/* Yet another structure compatibility hack */
 		if(conn->remote.port == tcb->conn.remote.port
 		 && conn->local.port == tcb->conn.local.port
 		 && conn->remote.address == tcb->conn.remote.address
-		 && conn->local.address == tcb->conn.local.address){
-			if(tcblast != NULL){
-				/* Move to top of list */
-				tcblast->next = tcb->next;
-				tcb->next = Tcbs;
-				Tcbs = tcb;
-			}
+		 && conn->local.address == tcb->conn.local.address)
 			return tcb;
-		}
-
 	}
 	return NULL;
 }
+/* Put a TCB on the list and enter it in the hash table under its
+ * current connection. Must be done again (after an unlink_tcb()) if
+ * the connection ever changes.
+ */
+void
+link_tcb(struct tcb *tcb)
+{
+	struct tcb **hp;
+
+	tcb->prev = NULL;
+	tcb->next = Tcbs;
+	if(tcb->next != NULL)
+		tcb->next->prev = tcb;
+	Tcbs = tcb;
+
+	hp = tcb_chain(&tcb->conn);
+	tcb->hnext = *hp;
+	*hp = tcb;
+}
+/* Remove a TCB from the list and hash table. Return -1 if it wasn't there */
+int
+unlink_tcb(struct tcb *tcb)
+{
+	struct tcb **hp;
+
+	for(hp = tcb_chain(&tcb->conn);*hp != NULL;hp = &(*hp)->hnext){
+		if(*hp == tcb)
+			break;
+	}
+	if(*hp == NULL)
+		return -1;
+	*hp = tcb->hnext;
+
+	if(tcb->next != NULL)
+		tcb->next->prev = tcb->prev;
+	if(tcb->prev != NULL)
+		tcb->prev->next = tcb->next;
+	else
+		Tcbs = tcb->next;
+	return 0;
+}
 
 /* Create a TCB, return pointer. Return pointer if TCB already exists. */
 struct tcb *
@@ -124,9 +184,12 @@ struct connection *conn;
 	set_timer(&tcb->timer,tcb->srtt);
 	tcb->timer.func = tcp_timeout;
 	tcb->timer.arg = tcb;
+	tcb->pacer.func = tcp_pace;
+	tcb->pacer.arg = tcb;
+	tcb->rcvtime = msclock();
+	cc_set(tcb,Tcp_cc);
 
-	tcb->next = Tcbs;
-	Tcbs = tcb;		
+	link_tcb(tcb);
 	return tcb;
 }
 
@@ -136,22 +199,16 @@ close_self(tcb,reason)
 struct tcb *tcb;
 int reason;
 {
-	struct reseq *rp1;
-	struct reseq *rp;
-
 	if(tcb == NULL)
 		return;
 
 	stop_timer(&tcb->timer);
+	stop_timer(&tcb->pacer);
 	tcb->reason = reason;
 
 	/* Flush reassembly queue; nothing more can arrive */
-	for(rp = tcb->reseq;rp != NULL;rp = rp1){
-		rp1 = rp->next;
-		free_p(&rp->bp);
-		free(rp);
-	}
-	tcb->reseq = NULL;
+	free_reseq(tcb);
+	sack_free(tcb);
 	settcpstate(tcb,TCP_CLOSED);
 }
 
@@ -178,14 +235,12 @@ int32 x,y;
 {
 	return (long)(x-y) < 0;
 }
-#ifdef	notdef
 int
 seq_le(x,y)
 int32 x,y;
 {
 	return (long)(x-y) <= 0;
 }
-#endif	/* notdef */
 int
 seq_gt(x,y)
 int32 x,y;
@@ -262,7 +317,7 @@ enum tcp_state newstate;
 	case TCP_ESTABLISHED:
 		/* Notify the user that he can begin sending data */
 		if(tcb->t_upcall)
-			(*tcb->t_upcall)(tcb,tcb->window - tcb->sndcnt);
+			(*tcb->t_upcall)(tcb,tcb->limit - tcb->sndcnt);
 		break;
 	default:
 		break;
@@ -312,31 +367,85 @@ int32 addr;
 	return tp;
 }
 
+/* Receive buffer auto-tuning. Called as the user reads cnt bytes. Once
+ * a round trip, see how much was read over it; the other end may send
+ * that much the next round trip while we read it, so the window must be
+ * at least twice as big to keep it going. The window only grows, up to
+ * Tcp_maxwnd, and not while memory is short.
+ */
+void
+tcp_rcvtune(tcb,cnt)
+struct tcb *tcb;
+int32 cnt;
+{
+	int32 now,rtt,elapsed,want,cap;
+
+	if(!Tcp_autotune)
+		return;
+	tcb->rcvcopied += cnt;
+	now = msclock();
+	elapsed = now - tcb->rcvtime;
+	rtt = (tcb->rcvrtt != 0) ? tcb->rcvrtt : tcb->srtt;
+	if(elapsed < max(rtt,1))
+		return;
+	/* Drained per round trip, times two */
+	want = (int32)((uint64)tcb->rcvcopied * 2 * max(rtt,1) / elapsed);
+	/* Plus a segment: the sender fills the window only in whole
+	 * segments and the scaled window is rounded down, so without it
+	 * the window would settle at two segments
+	 */
+	want += tcb->mss;
+	tcb->rcvcopied = 0;
+	tcb->rcvtime = now;
+
+	/* Without window scaling the window field can't say any more */
+	cap = tcb->flags.ws_ok ? (int32)MAXINT16 << tcb->rcv.wind_scale
+	 : MAXINT16;
+	want = min(want,min(cap,Tcp_maxwnd));
+	if(want > tcb->window && availmem() == 0){
+		tcb->rcv.wnd += want - tcb->window;
+		tcb->window = want;
+	}
+}
+/* Send buffer auto-sizing. Let the user queue twice the congestion
+ * window, so there's another window's worth ready when an ack opens
+ * it. Like the receive buffer, this only grows.
+ */
+void
+tcp_sndtune(tcb)
+struct tcb *tcb;
+{
+	int32 want;
+
+	if(!Tcp_autotune)
+		return;
+	want = min(2 * tcb->cwind,Tcp_maxwnd);
+	if(want > tcb->limit && availmem() == 0)
+		tcb->limit = want;
+}
+
 /* TCP garbage collection - called by storage allocator when free space
  * runs low. The send and receive queues are crunched. If the situation
- * is red, the resequencing queue is discarded; otherwise it is
- * also crunched.
+ * is red, the resequencing queue and SACK scoreboard are discarded;
+ * otherwise the resequencing queue is also crunched.
  */
 void
 tcp_garbage(red)
 int red;
 {
 	struct tcb *tcb;
-	struct reseq *rp,*rp1;
+	struct reseq *rp;
 
 	for(tcb = Tcbs;tcb != NULL;tcb = tcb->next){
-		mbuf_crunch(&tcb->rcvq);
-		mbuf_crunch(&tcb->sndq);
-		for(rp = tcb->reseq;rp != NULL;rp = rp1){
-			rp1 = rp->next;
-			if(red){
-				free_p(&rp->bp);
-				free(rp);
-			} else {
+		crunch_mq(&tcb->rcvq);
+		crunch_mq(&tcb->sndq);
+		tcb->sndcur = NULL;
+		if(red){
+			free_reseq(tcb);
+			sack_free(tcb);
+		} else {
+			for(rp = tcb->reseq;rp < &tcb->reseq[tcb->nreseq];rp++)
 				mbuf_crunch(&rp->bp);
-			}
 		}
-		if(red)
-			tcb->reseq = NULL;
 	}
 }
@@ -35,11 +35,18 @@ tcp_timeout(void *p)
 		tcb->timeouts++;
 		tcb->flags.retran = 1;	/* Indicate > 1  transmission */
 		tcb->backoff++;
-		/* Reduce slowstart threshold to half current window */
-		tcb->ssthresh = tcb->cwind / 2;
-		tcb->ssthresh = max(tcb->ssthresh,tcb->mss);
-		/* Shrink congestion window to 1 packet */
-		tcb->cwind = tcb->mss;
+		/* Congestion control shrinks the window, typically to
+		 * one packet
+		 */
+		(*tcb->cc->on_rto)(tcb);
+		/* Abandon any SACK recovery, and don't start another until
+		 * what's been sent so far is acked. Forget what the other
+		 * end said it had, too, since it's allowed to change its mind
+		 */
+		tcb->flags.recovery = 0;
+		tcb->flags.rxtfirst = 0;
+		tcb->recover = tcb->snd.nxt;
+		sack_free(tcb);
 		/* Retransmit just the oldest unacked packet */
 		ptrsave = tcb->snd.ptr;
 		tcb->snd.ptr = tcb->snd.una;
@@ -47,6 +54,12 @@ tcp_timeout(void *p)
 		tcb->snd.ptr = ptrsave;
 	}
 }
+/* Pacing timer; it's time to send what was held back */
+void
+tcp_pace(void *p)
+{
+	tcp_output((struct tcb *)p);
+}
 /* Backoff function - the subject of much research */
 int32
 backoff(int n)
@@ -57,9 +57,9 @@ int user		/* User linkage area */
 	}
 	tcb->user = user;
 	if(window != 0)
-		tcb->window = tcb->rcv.wnd = window;
+		tcb->window = tcb->rcv.wnd = tcb->limit = window;
 	else
-		tcb->window = tcb->rcv.wnd = Tcp_window;
+		tcb->window = tcb->rcv.wnd = tcb->limit = Tcp_window;
 	tcb->snd.wnd = 1;	/* Allow space for sending a SYN */
 	tcb->r_upcall = r_upcall;
 	tcb->t_upcall = t_upcall;
@@ -103,7 +103,7 @@ struct mbuf **bpp
 	case TCP_LISTEN:
 		if(tcb->conn.remote.address == 0 && tcb->conn.remote.port == 0){
 			/* Save data for later */
-			append(&tcb->sndq,bpp);
+			append_mq(&tcb->sndq,bpp);
 			tcb->sndcnt += cnt;
 			break;
 		}		
@@ -115,7 +115,7 @@ struct mbuf **bpp
 	case TCP_SYN_RECEIVED:
 	case TCP_ESTABLISHED:
 	case TCP_CLOSE_WAIT:
-		append(&tcb->sndq,bpp);
+		append_mq(&tcb->sndq,bpp);
 		tcb->sndcnt += cnt;
 		tcp_output(tcb);
 		break;
@@ -137,6 +137,8 @@ struct tcb *tcb,
 struct mbuf **bpp,
 int32 cnt
 ){
+	int32 owind;
+
 	if(tcb == NULL || bpp == (struct mbuf **)NULL){
 		Net_error = INVALID;
 		return -1;
@@ -171,17 +173,18 @@ int32 cnt
 	/* See if the user can take all of it */
 	if(tcb->rcvcnt <= cnt){
 		cnt = tcb->rcvcnt;
-		*bpp = tcb->rcvq;
-		tcb->rcvq = NULL;
+		*bpp = take_mq(&tcb->rcvq);
 	} else {
 		*bpp = ambufw(cnt);
-		pullup(&tcb->rcvq,(*bpp)->data,cnt);
+		pullup_mq(&tcb->rcvq,(*bpp)->data,cnt);
 		(*bpp)->cnt = cnt;
 	}
 	tcb->rcvcnt -= cnt;
+	owind = tcb->rcv.wnd;
 	tcb->rcv.wnd += cnt;
+	tcp_rcvtune(tcb,cnt);
 	/* Do a window update if it was less than one packet and now it's more */
-	if(tcb->rcv.wnd > tcb->mss && tcb->rcv.wnd - cnt < tcb->mss){
+	if(tcb->rcv.wnd > tcb->mss && owind < tcb->mss){
 		tcb->flags.force = 1;
 		tcp_output(tcb);
 	}
@@ -236,32 +239,19 @@ int
 del_tcp(struct tcb **conn)
 {
 	struct tcb *tcb;
-	struct tcb *tcblast = NULL;
-	struct reseq *rp,*rp1;
 
 	/* Remove from list */
-	for(tcb=Tcbs;tcb != NULL;tcblast = tcb,tcb = tcb->next)
-		if(tcb == *conn)
-			break;
-	if(tcb == NULL){
+	if((tcb = *conn) == NULL || unlink_tcb(tcb) == -1){
 		Net_error = INVALID;
 		return -1;	/* conn was NULL, or not on list */ 
 	}
 	*conn = NULL;
-	if(tcblast != NULL)
-		tcblast->next = tcb->next;
-	else
-		Tcbs = tcb->next;	/* was first on list */
 
 	stop_timer(&tcb->timer);
-	for(rp = tcb->reseq;rp != NULL;rp = rp1){
-		rp1 = rp->next;
-		free_p(&rp->bp);
-		free(rp);
-	}
-	tcb->reseq = NULL;
-	free_p(&tcb->rcvq);
-	free_p(&tcb->sndq);
+	stop_timer(&tcb->pacer);
+	free_reseq(tcb);
+	free_mq(&tcb->rcvq);
+	free_mq(&tcb->sndq);
 	free(tcb);
 	return 0;
 }
@@ -115,12 +115,11 @@ struct mbuf **bp;		/* Place to stash data packet */
 		Net_error = NO_CONN;
 		return -1;
 	}
-	if(up->rcvcnt == 0){
+	if(len_mq(&up->rcvq) == 0){
 		Net_error = WOULDBLK;
 		return -1;
 	}
-	buf = dequeue(&up->rcvq);
-	up->rcvcnt--;
+	buf = dequeue_mq(&up->rcvq);
 
 	/* Strip socket header */
 	pullup(&buf,&sp,sizeof(struct ksocket));
@@ -142,7 +141,6 @@ struct mbuf **bp;		/* Place to stash data packet */
 int
 del_udp(struct udp_cb **conn)
 {
-	struct mbuf *bp;
 	struct udp_cb *up;
 	struct udp_cb *udplast = NULL;
 
@@ -157,12 +155,7 @@ del_udp(struct udp_cb **conn)
 	}
 	*conn = NULL;
 	/* Get rid of any pending packets */
-	while(up->rcvcnt != 0){
-		bp = up->rcvq;
-		up->rcvq = up->rcvq->anext;
-		free_p(&bp);
-		up->rcvcnt--;
-	}
+	free_mq(&up->rcvq);
 	/* Remove from list */
 	if(udplast != NULL)
 		udplast->next = up->next;
@@ -240,11 +233,10 @@ int32 said
 	pushdown(bpp,&fsocket,sizeof(fsocket));
 
 	/* Queue it */
-	enqueue(&up->rcvq,bpp);
-	up->rcvcnt++;
+	enqueue_mq(&up->rcvq,bpp);
 	udpInDatagrams++;
 	if(up->r_upcall)
-		(*up->r_upcall)(iface,up,up->rcvcnt);
+		(*up->r_upcall)(iface,up,len_mq(&up->rcvq));
 }
 /* Look up UDP socket. 
  * Return control block pointer or NULL if nonexistant
@@ -281,7 +273,7 @@ int red;
 	register struct udp_cb *udp;
 
 	for(udp = Udps;udp != NULL; udp = udp->next){
-		mbuf_crunch(&udp->rcvq);
+		crunch_mq(&udp->rcvq);
 	}
 }
 
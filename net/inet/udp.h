@@ -37,8 +37,7 @@ struct udp_cb {
 	struct ksocket socket;	/* Local port accepting datagrams */
 	void (*r_upcall)(struct iface *iface,struct udp_cb *,int);
 				/* Function to call when one arrives */
-	struct mbuf *rcvq;	/* Queue of pending datagrams */
-	int rcvcnt;		/* Count of pending datagrams */
+	struct mqueue rcvq;	/* Queue of pending datagrams */
 	int user;		/* User link */
 };
 extern struct udp_cb *Udps;	/* Hash table for UDP structures */
@@ -130,7 +130,7 @@ int rtx;
 
 	switch(rtx){
 	case 0:
-		len = up->cb.udp->rcvcnt;
+		len = len_mq(&up->cb.udp->rcvq);
 		break;
 	case 1:
 		len = 0;
@@ -157,13 +157,24 @@ int how;
 	close_s(s);
 	return 0;
 }
+/* Readiness for kpoll(). Datagrams are sent without blocking. */
+int
+so_udp_poll(up)
+struct usock *up;
+{
+	if(up->cb.udp == NULL)
+		return kPOLLIN|kPOLLHUP;
+	if(up->cb.udp->rcvq.head != NULL)
+		return kPOLLIN|kPOLLOUT;
+	return kPOLLOUT;
+}
 static void
 s_urcall(iface,udp,cnt)
 struct iface *iface;
 struct udp_cb *udp;
 int cnt;
 {
-	ksignal(itop(udp->user),1);
+	sockwake(itop(udp->user),1);
 	kwait(NULL);
 }
 
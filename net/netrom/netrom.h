@@ -106,7 +106,7 @@ struct raw_nr {
 	struct raw_nr *prev;
 	struct raw_nr *next;
 
-	struct mbuf *rcvq;	/* receive queue */
+	struct mqueue rcvq;	/* receive queue */
 	uint8 protocol;		/* Protocol */
 };
 
@@ -173,7 +173,7 @@ struct raw_nr *rpp;
 	if(rp->next != NULL)
 		rp->next->prev = rp->prev;
 	/* Free resources */
-	free_q(&rp->rcvq);
+	free_mq(&rp->rcvq);
 	free(rp);
 }
 
@@ -263,7 +263,7 @@ struct ax25_cb *iaxp;			/* incoming ax25 control block */
 				if(pbp != NULL &&
 				 (hbp = htonnr3(&n3hdr)) != NULL){
 					append(&hbp,&pbp);
-					enqueue(&rnr->rcvq,&hbp);
+					enqueue_mq(&rnr->rcvq,&hbp);
 				} else {
 					free_p(&pbp);
 					free_p(&hbp);
@@ -100,7 +100,7 @@ int *fromlen;
 	struct nr3hdr n3hdr;
 
 	while((rnr = up->cb.rnr) != NULL
-	 && rnr->rcvq == NULL){
+	 && rnr->rcvq.head == NULL){
 		if(up->noblock){
 			kerrno = kEWOULDBLOCK;
 			return -1;
@@ -113,7 +113,7 @@ int *fromlen;
 		kerrno = kENOTCONN;
 		return -1;
 	}
-	*bpp = dequeue(&rnr->rcvq);
+	*bpp = dequeue_mq(&rnr->rcvq);
 	ntohnr3(&n3hdr,bpp);
 	cnt = len_p(*bpp);
 	if(from != NULL && fromlen != NULL
@@ -223,7 +223,7 @@ int rtx;
 
 	switch(rtx){	
 	case 0:
-		len = len_q(up->cb.rnr->rcvq);
+		len = len_mq(&up->cb.rnr->rcvq);
 		break;
 	case 1:
 		len = 0;		
@@ -317,7 +317,7 @@ struct nr4cb *cb;
 uint cnt;
 {
 	/* Wake up anybody waiting for data, and let them run */
-	ksignal(itop(cb->user),1);
+	sockwake(itop(cb->user),1);
 	kwait(NULL);
 }
 /* NET/ROM transmit upcall routine */
@@ -327,7 +327,7 @@ struct nr4cb *cb;
 uint cnt;
 {
 	/* Wake up anybody waiting to send data, and let them run */
-	ksignal(itop(cb->user),1);
+	sockwake(itop(cb->user),1);
 	kwait(NULL);
 }
 /* NET/ROM state change upcall routine */
@@ -369,6 +369,7 @@ int old,new;
 			ASSIGN(*nup,*up);
 			cb->user = ns;
 			nup->cb.nr4 = cb;
+			nup->pollev = NULL;
 			cb->clone = 0; /* to avoid getting here again */
 			/* Allocate new memory for the name areas */
 			nup->name = mallocw(sizeof(struct ksockaddr_nr));
@@ -398,11 +399,11 @@ int old,new;
 		up->peernamelen = sizeof(struct ksockaddr_nr);
 
 		/* Wake up the guy accepting it, and let him run */
-		ksignal(oup,1);
+		sockwake(oup,1);
 		kwait(NULL);
 	}
  	/* Ignore all other state transitions */	
-	ksignal(up,0);	/* In case anybody's waiting */
+	sockwake(up,0);	/* In case anybody's waiting */
 }
 
 int
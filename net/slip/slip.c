@@ -9,18 +9,21 @@
  */
 #include "top.h"
 
+#include <string.h>
 #include "lib/std/stdio.h"
 #include "global.h"
 #include "net/core/mbuf.h"
 #include "net/core/iface.h"
 #include "core/asy.h"
 #include "core/trace.h"
+#include "lib/util/stuff.h"
 
 #include "net/inet/ip.h"
 #include "net/slhc/slhc.h"
 #include "net/slip/slip.h"
 
 static struct mbuf *slip_decode(struct slip *sp,uint8 c);
+static void slip_store(struct slip *sp,const uint8 *buf,uint len);
 static struct mbuf *slip_encode(struct mbuf **bpp);
 
 /* Slip level control structure */
@@ -50,7 +53,8 @@ struct iface *ifp;
 
 	sp->iface = ifp;
 	sp->send = asy_send;
-	sp->get = get_asy;
+	sp->get = get_asy_burst;
+	sp->release = release_asy;
 	sp->type = CL_SERIAL_LINE;
 	if(ifp->send == vjslip_send){
 		sp->slcomp = slhc_init(16,16);
@@ -132,8 +136,10 @@ static struct mbuf *
 slip_encode(struct mbuf **bpp)
 {
 	struct mbuf *lbp;	/* Mbuf containing line-ready packet */
+	struct mbuf *bp;
 	register uint8 *cp;
-	int c;
+	uint8 *sp;
+	uint len,n;
 
 	/* Allocate output mbuf that's twice as long as the packet.
 	 * This is a worst-case guess (consider a packet full of FR_ENDs!)
@@ -149,21 +155,27 @@ slip_encode(struct mbuf **bpp)
 	/* Flush out any line garbage */
 	*cp++ = FR_END;
 
-	/* Copy input to output, escaping special characters */
-	while((c = PULLCHAR(bpp)) != -1){
-		switch(c){
-		case FR_ESC:
-			*cp++ = FR_ESC;
-			*cp++ = T_FR_ESC;
-			break;
-		case FR_END:
-			*cp++ = FR_ESC;
-			*cp++ = T_FR_END;
-			break;
-		default:
-			*cp++ = c;
+	/* Copy input to output, escaping special characters.
+	 * Runs of ordinary characters are copied in bulk.
+	 */
+	for(bp = *bpp;bp != NULL;bp = bp->next){
+		sp = bp->data;
+		len = bp->cnt;
+		while(len != 0){
+			if(*sp == FR_END || *sp == FR_ESC){
+				*cp++ = FR_ESC;
+				*cp++ = (*sp++ == FR_END) ? T_FR_END : T_FR_ESC;
+				len--;
+				continue;
+			}
+			n = stuff_run(sp,len,FR_END,FR_ESC,0);
+			memcpy(cp,sp,n);
+			cp += n;
+			sp += n;
+			len -= n;
 		}
 	}
+	free_p(bpp);
 	*cp++ = FR_END;
 	lbp->cnt = cp - lbp->data;
 	return lbp;
@@ -209,31 +221,48 @@ slip_decode(
 			break;
 		}
 	}
-	/* We reach here with a character for the buffer;
-	 * make sure there's space for it
-	 */
-	if(sp->rbp_head == NULL){
-		/* Allocate first mbuf for new packet */
-		if((sp->rbp_tail = sp->rbp_head = alloc_mbuf(SLIP_ALLOC)) == NULL)
-			return NULL; /* No memory, drop */
-		sp->rcp = sp->rbp_head->data;
-	} else if(sp->rbp_tail->cnt == SLIP_ALLOC){
-		/* Current mbuf is full; link in another */
-		if((sp->rbp_tail->next = alloc_mbuf(SLIP_ALLOC)) == NULL){
-			/* No memory, drop whole thing */
-			free_p(&sp->rbp_head);
-			sp->rbp_head = NULL;
-			return NULL;
+	/* We reach here with a character for the buffer */
+	slip_store(sp,&c,1);
+	return NULL;
+}
+/* Append received characters to the packet being assembled */
+static void
+slip_store(
+  struct slip *sp,
+  const uint8 *buf,
+  uint len
+)
+{
+	uint n;
+
+	while(len != 0){
+		/* Make sure there's space */
+		if(sp->rbp_head == NULL){
+			/* Allocate first mbuf for new packet */
+			if((sp->rbp_tail = sp->rbp_head = alloc_mbuf(SLIP_ALLOC)) == NULL)
+				return; /* No memory, drop */
+			sp->rcp = sp->rbp_head->data;
+		} else if(sp->rbp_tail->cnt == SLIP_ALLOC){
+			/* Current mbuf is full; link in another */
+			if((sp->rbp_tail->next = alloc_mbuf(SLIP_ALLOC)) == NULL){
+				/* No memory, drop whole thing */
+				free_p(&sp->rbp_head);
+				sp->rbp_head = NULL;
+				return;
+			}
+			sp->rbp_tail = sp->rbp_tail->next;
+			sp->rcp = sp->rbp_tail->data;
 		}
-		sp->rbp_tail = sp->rbp_tail->next;
-		sp->rcp = sp->rbp_tail->data;
+		/* Store as much as will fit, increment fragment and total
+		 * byte counts
+		 */
+		n = min(len,SLIP_ALLOC - sp->rbp_tail->cnt);
+		memcpy(sp->rcp,buf,n);
+		sp->rcp += n;
+		sp->rbp_tail->cnt += n;
+		buf += n;
+		len -= n;
 	}
-	/* Store the character, increment fragment and total
-	 * byte counts
-	 */
-	*sp->rcp++ = c;
-	sp->rbp_tail->cnt++;
-	return NULL;
 }
 
 
@@ -248,42 +277,62 @@ void *p2;
 	struct mbuf *bp;
 	register struct slip *sp;
 	int cdev;
+	uint8 *cp;
+	int cnt,n;
+	uint run;
 
 	sp = &Slip[xdev];
 	cdev = sp->iface->dev;
 
-	while ( (c = sp->get(cdev)) != -1 ) {
-		if((bp = slip_decode(sp,c)) == NULL)
-			continue;	/* More to come */
-
-		if (sp->iface->trace & IF_TRACE_RAW)
-			raw_dump(sp->iface,IF_TRACE_IN,bp);
-
-		if ((c = bp->data[0]) & SL_TYPE_COMPRESSED_TCP) {
-			if ( sp->slcomp == NULL ||
-			     slhc_uncompress(sp->slcomp, &bp) <= 0 )
-			{
-				free_p(&bp);
-				sp->errors++;
+	while ( (cnt = (*sp->get)(cdev,&cp)) > 0 ) {
+		for(n = 0;n < cnt;){
+			/* Store runs of ordinary characters in bulk */
+			if(!(sp->escaped & SLIP_FLAG)
+			 && cp[n] != FR_END && cp[n] != FR_ESC){
+				run = stuff_run(&cp[n],cnt-n,FR_END,FR_ESC,0);
+				slip_store(sp,&cp[n],run);
+				n += run;
 				continue;
 			}
-		} else if (c >= SL_TYPE_UNCOMPRESSED_TCP) {
-			bp->data[0] &= 0x4f;
-			if ( sp->slcomp == NULL ||
-			     slhc_remember(sp->slcomp, &bp) <= 0 )
-			{
-				free_p(&bp);
-				sp->errors++;
-				continue;
+			if((bp = slip_decode(sp,cp[n++])) == NULL)
+				continue;	/* More to come */
+
+			/* Give back what we've used before letting anyone else run */
+			(*sp->release)(cdev,n);
+			cp += n;
+			cnt -= n;
+			n = 0;
+
+			if (sp->iface->trace & IF_TRACE_RAW)
+				raw_dump(sp->iface,IF_TRACE_IN,bp);
+
+			if ((c = bp->data[0]) & SL_TYPE_COMPRESSED_TCP) {
+				if ( sp->slcomp == NULL ||
+				     slhc_uncompress(sp->slcomp, &bp) <= 0 )
+				{
+					free_p(&bp);
+					sp->errors++;
+					continue;
+				}
+			} else if (c >= SL_TYPE_UNCOMPRESSED_TCP) {
+				bp->data[0] &= 0x4f;
+				if ( sp->slcomp == NULL ||
+				     slhc_remember(sp->slcomp, &bp) <= 0 )
+				{
+					free_p(&bp);
+					sp->errors++;
+					continue;
+				}
 			}
+			net_route( sp->iface, &bp);
+			/* Especially on slow machines, serial I/O can be quite
+			 * compute intensive, so release the machine before we
+			 * do the next packet.  This will allow this packet to
+			 * go on toward its ultimate destination. [Karn]
+			 */
+			kwait(NULL);
 		}
-		net_route( sp->iface, &bp);
-		/* Especially on slow machines, serial I/O can be quite
-		 * compute intensive, so release the machine before we
-		 * do the next packet.  This will allow this packet to
-		 * go on toward its ultimate destination. [Karn]
-		 */
-		kwait(NULL);
+		(*sp->release)(cdev,n);
 	}
 	if(sp->iface->rxproc == Curproc)
 		sp->iface->rxproc = NULL;
@@ -33,7 +33,8 @@ struct slip {
 	uint errors;		/* Receiver input errors */
 	int type;		/* Protocol of input */
 	int (*send)(int,struct mbuf **);	/* send mbufs to device */
-	int (*get)(int);	/* fetch input chars from device */
+	int (*get)(int,uint8 **);	/* fetch burst of input chars from device */
+	void (*release)(int,int);	/* consume chars from burst */
 	struct slcompress *slcomp;	/* TCP header compression table */
 };
 
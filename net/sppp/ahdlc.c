@@ -3,6 +3,7 @@
 
 #include "global.h"
 #include "lib/util/crc.h"
+#include "lib/util/stuff.h"
 #include "core/trace.h"
 
 #include "net/sppp/ahdlc.h"
@@ -128,19 +129,37 @@ struct mbuf *
 ahdlctx(bp)
 struct mbuf *bp;
 {
-	struct mbuf *obp;
-	uint8 *cp;
-	int c;
-	uint fcs;
+	struct mbuf *obp,*bp1;
+	uint8 *cp,*sp;
+	uint len,run;
+	uint8 c;
+	uint16 fcs;
 
 	fcs = FCS_START;
 	obp = ambufw(5+2*len_p(bp));	/* Allocate worst-case */
 	cp = obp->data;
-	while((c = PULLCHAR(&bp)) != -1){
-		fcs = FCS(fcs,c);
-		cp = putbyte(cp,c);
+	for(bp1 = bp;bp1 != NULL;bp1 = bp1->next){
+		sp = bp1->data;
+		len = bp1->cnt;
+		while(len != 0){
+			c = *sp;
+			if(c == HDLC_FLAG || c == HDLC_ESC_ASYNC){
+				fcs = FCS(fcs,c);
+				cp = putbyte(cp,c);
+				sp++;
+				len--;
+				continue;
+			}
+			/* Copy the whole run that needs no escaping */
+			run = stuff_run(sp,len,HDLC_ESC_ASYNC,HDLC_FLAG,0);
+			len -= run;
+			memcpy(cp,sp,run);
+			crc_update(sp,run,&fcs);
+			cp += run;
+			sp += run;
+		}
 	}
-	free_p(&bp);	/* Shouldn't be necessary */
+	free_p(&bp);
 	fcs ^= 0xffff;
 	cp = putbyte(cp,fcs);
 	cp = putbyte(cp,fcs >> 8);
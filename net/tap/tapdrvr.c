@@ -24,6 +24,7 @@
 #include "net/arp/arp.h"
 #include "lib/inet/netuser.h"
 #include "unix/nosunix.h"
+#include "unix/rxring_unix.h"
 
 #include "net/tap/tapdrvr.h"
 
@@ -39,20 +40,18 @@ struct tapdrvr {
 	struct iovec write_vec[MAX_FRAGS];
 	uint32 overflows;
 
-	/* These members are to be protected by the interrupt lock */
-	uint8          *read_buf;
-	size_t          read_buf_sz;
-	size_t          read_buf_cnt;
-	int             read_buf_busy;
-	pthread_cond_t  read_buf_avl; /* Read thread done with buffer */
+	struct rxring   ring;	/* Packets from the read thread */
 	pthread_t       read_thread;
 };
 
 static struct tapdrvr Tapdrvr[TAP_MAX];
 
 static int tap_raw(struct iface *iface, struct mbuf **bpp);
+static int tap_rawbatch(struct iface *iface, struct mqueue *q);
+static int tap_write(struct iface *iface, struct mbuf **bpp);
 static void tap_rx(int dev,void *p1,void *p2);
 static int tap_stop(struct iface *iface);
+static void tap_status(struct iface *iface);
 static void *tap_io_read_proc(void *);
 
 /* Attach a tap driver to the system
@@ -113,15 +112,9 @@ tap_attach(int argc, char *argv[], void *p)
 		kprintf("Can't set info: %s\n", strerror(errno));
 		goto SetTapInfoFailed;
 	}
-	if ((tap->read_buf = (uint8 *) malloc(mtu)) == NULL) {
-		kprintf("Out of memory for read buffer.\n");
-		goto ReadBufAllocFailed;
-	}
-	tap->read_buf_sz = mtu;
-	tap->read_buf_busy = 0;
-	if (pthread_cond_init(&tap->read_buf_avl, NULL) != 0) {
-		kprintf("Can't init read cond: %s\n", strerror(errno));
-		goto CantInitReadCond;
+	if (rxring_init(&tap->ring, mtu) != 0) {
+		kprintf("Can't init read ring: %s\n", strerror(errno));
+		goto CantInitReadRing;
 	}
 	if (pthread_create(&tap->read_thread,NULL,tap_io_read_proc,tap) != 0) {
 		kprintf("Can't start read thread: %s\n", strerror(errno));
@@ -145,7 +138,9 @@ tap_attach(int argc, char *argv[], void *p)
 	if_tap->mtu = mtu;
 	if_tap->dev = i;
 	if_tap->raw = tap_raw;
+	if_tap->rawbatch = tap_rawbatch;
 	if_tap->stop = tap_stop;
+	if_tap->show = tap_status;
 	tap->iface = if_tap;
 
 	setencap(if_tap,"Ethernet");
@@ -167,10 +162,8 @@ MallocIfaceFailed:
 	pthread_cancel(tap->read_thread);
 	pthread_join(tap->read_thread, &dummy);
 CantStartReadThread:
-	pthread_cond_destroy(&tap->read_buf_avl);
-CantInitReadCond:
-	free(tap->read_buf);
-ReadBufAllocFailed:
+	rxring_free(&tap->ring);
+CantInitReadRing:
 SetTapInfoFailed:
 GetTapInfoFailed:
 	close(tap->fd);
@@ -185,6 +178,35 @@ BadEAddr:
 /* Send raw packet (caller provides header) */
 static int
 tap_raw(struct iface *iface, struct mbuf **bpp)
+{
+	/* Hold it for tap_rawbatch if if_tx is sending a batch */
+	if (iface->txbatch) {
+		enqueue_mq(&iface->txhold, bpp);
+		return 0;
+	}
+	return tap_write(iface, bpp);
+}
+
+/* Send a batch of raw packets queued up by tap_raw.
+ * The device takes one frame per write, so this just writes them back
+ * to back without giving up the CPU in between.
+ */
+static int
+tap_rawbatch(struct iface *iface, struct mqueue *q)
+{
+	struct mbuf *bp;
+	int ret = 0;
+
+	while ((bp = dequeue_mq(q)) != NULL) {
+		if (tap_write(iface, &bp) == -1)
+			ret = -1;
+	}
+	return ret;
+}
+
+/* Write a single frame to the device */
+static int
+tap_write(struct iface *iface, struct mbuf **bpp)
 {
 	struct tapdrvr *tap;
 	size_t i;
@@ -227,23 +249,22 @@ static void *
 tap_io_read_proc(void *tapp)
 {
 	struct tapdrvr *tap = (struct tapdrvr *) tapp;
+	uint8 *buf;
 	ssize_t res;
 
-	interrupt_enter();
 	for (;;) {
 		/*
-		 * Wait for read buffer to become unbusy.
+		 * Wait for a free slot in the receive ring.
 	 	 * We use this scheme so that if NOS gets busy, we simply
 		 * let packets queue up in the host kernel, where there is
 		 * more space for them. The alternative is to read them
 		 * here and possibly drop them if there's no room in NOS
 		 * to accomodate.
 		 */
-		while (tap->read_buf_busy)
-			interrupt_cond_wait(&tap->read_buf_avl);
-		interrupt_leave();
+		buf = rxring_space(&tap->ring);
 
-		res = read(tap->fd, tap->read_buf, tap->read_buf_sz);
+		/* Read straight into the slot's mbuf */
+		res = read(tap->fd, buf, tap->ring.bufsize);
 		if (res == -1)
 			break;
 
@@ -255,10 +276,7 @@ tap_io_read_proc(void *tapp)
 		 * kernel and no packets larger than the MTU will ever be
 		 * passed to us.
 		 */
-		interrupt_enter();
-		tap->read_buf_cnt = res;
-		tap->read_buf_busy = 1;
-		ksignal(&tap->read_buf, 1);
+		rxring_put(&tap->ring, res);
 	}
 
 	return NULL;
@@ -276,43 +294,45 @@ tap_stop(struct iface *iface)
 	close(tap->fd);
 	pthread_cancel(tap->read_thread);
 	pthread_join(tap->read_thread, &dummy);
-	pthread_cond_destroy(&tap->read_buf_avl);
-	free(tap->read_buf);
+	rxring_free(&tap->ring);
 	return 0;
 }
 
+/* Show receive ring statistics */
+static void
+tap_status(struct iface *iface)
+{
+	struct rxring *r;
+
+	r = &Tapdrvr[iface->dev].ring;
+	kprintf("\trx ring %d slots: packets %ld batches %ld (avg %ld.%02ld) full %ld\n",
+	 RXRING_SIZE, r->packets, r->batches,
+	 r->batches != 0 ? r->packets / r->batches : 0,
+	 r->batches != 0 ? (r->packets * 100 / r->batches) % 100 : 0,
+	 r->full);
+}
+
 static void
 tap_rx(int dev,void *p1,void *p2)
 {
 	struct iface *iface = (struct iface *)p1;
 	struct tapdrvr *tap = (struct tapdrvr *)p2;
+	struct mqueue q;
 	struct mbuf *bp;
-	int i_state;
 
+	memset(&q, 0, sizeof(q));
 	for (;;) {
-		while (tap->read_buf_busy == 0)
-			if (kwait(&tap->read_buf) != 0)
-				return;
-
 		/*
-		 * Allocate a buffer for the packet, anticipating that
-		 * the network hopper will want to insert an interface
-		 * descriptor on the packet as well.
+		 * Collect every packet the read thread has finished with.
+		 * The ring's mbufs already have room at the front for the
+		 * interface descriptor the network hopper adds, so they
+		 * are passed on as they are.
 		 */
-		bp = ambufw(tap->read_buf_cnt+sizeof(struct iface *));
-		bp->data += sizeof(struct iface *);
-
-		/* Copy the data into the packet buffer */
-		memcpy(bp->data, tap->read_buf, tap->read_buf_cnt);
-		bp->cnt = tap->read_buf_cnt;
-
-		/* Return the buffer to the read thread */
-		i_state = disable();
-		tap->read_buf_busy = 0;
-		pthread_cond_signal(&tap->read_buf_avl);
-		restore(i_state);
+		if (rxring_take(&tap->ring, &q) == -1)
+			return;
 
-		/* Pass the packet to the network stack */
-		net_route(iface,&bp);
+		/* Pass the packets to the network stack */
+		while ((bp = dequeue_mq(&q)) != NULL)
+			net_route(iface,&bp);
 	}
 }
@@ -22,6 +22,7 @@
 
 #include "lib/inet/netuser.h"
 #include "unix/nosunix.h"
+#include "unix/rxring_unix.h"
 #include "net/tun/tundrvr.h"
 
 /* Maximum number of fragments to tolerate in an outgoing packet */
@@ -34,20 +35,18 @@ struct tundrvr {
 	struct iovec write_vec[MAX_FRAGS];
 	uint32 overflows;
 
-	/* These members are to be protected by the interrupt lock */
-	uint8          *read_buf;
-	size_t          read_buf_sz;
-	size_t          read_buf_cnt;
-	int             read_buf_busy;
-	pthread_cond_t  read_buf_avl; /* Read thread done with buffer */
+	struct rxring   ring;	/* Packets from the read thread */
 	pthread_t       read_thread;
 };
 
 static struct tundrvr Tundrvr[TUN_MAX];
 
 static int tun_raw(struct iface *iface, struct mbuf **bpp);
+static int tun_rawbatch(struct iface *iface, struct mqueue *q);
+static int tun_write(struct iface *iface, struct mbuf **bpp);
 static void tun_rx(int dev,void *p1,void *p2);
 static int tun_stop(struct iface *iface);
+static void tun_status(struct iface *iface);
 static void *tun_io_read_proc(void *);
 
 /* Attach a tun driver to the system
@@ -99,15 +98,9 @@ tun_attach(int argc, char *argv[], void *p)
 		kprintf("Can't set info: %s\n", strerror(errno));
 		goto SetTunInfoFailed;
 	}
-	if ((tun->read_buf = (uint8 *) malloc(mtu)) == NULL) {
-		kprintf("Out of memory for read buffer.\n");
-		goto ReadBufAllocFailed;
-	}
-	tun->read_buf_sz = mtu;
-	tun->read_buf_busy = 0;
-	if (pthread_cond_init(&tun->read_buf_avl, NULL) != 0) {
-		kprintf("Can't init read cond: %s\n", strerror(errno));
-		goto CantInitReadCond;
+	if (rxring_init(&tun->ring, mtu) != 0) {
+		kprintf("Can't init read ring: %s\n", strerror(errno));
+		goto CantInitReadRing;
 	}
 	if (pthread_create(&tun->read_thread,NULL,tun_io_read_proc,tun) != 0) {
 		kprintf("Can't start read thread: %s\n", strerror(errno));
@@ -126,7 +119,9 @@ tun_attach(int argc, char *argv[], void *p)
 	if_tun->mtu = mtu;
 	if_tun->dev = i;
 	if_tun->raw = tun_raw;
+	if_tun->rawbatch = tun_rawbatch;
 	if_tun->stop = tun_stop;
+	if_tun->show = tun_status;
 	tun->iface = if_tun;
 
 	setencap(if_tun,"None");
@@ -146,10 +141,8 @@ MallocIfaceFailed:
 	pthread_cancel(tun->read_thread);
 	pthread_join(tun->read_thread, &dummy);
 CantStartReadThread:
-	pthread_cond_destroy(&tun->read_buf_avl);
-CantInitReadCond:
-	free(tun->read_buf);
-ReadBufAllocFailed:
+	rxring_free(&tun->ring);
+CantInitReadRing:
 SetTunInfoFailed:
 GetTunInfoFailed:
 	close(tun->fd);
@@ -163,6 +156,35 @@ AlreadyExists:
 /* Send raw packet (caller provides header) */
 static int
 tun_raw(struct iface *iface, struct mbuf **bpp)
+{
+	/* Hold it for tun_rawbatch if if_tx is sending a batch */
+	if (iface->txbatch) {
+		enqueue_mq(&iface->txhold, bpp);
+		return 0;
+	}
+	return tun_write(iface, bpp);
+}
+
+/* Send a batch of raw packets queued up by tun_raw.
+ * The device takes one frame per write, so this just writes them back
+ * to back without giving up the CPU in between.
+ */
+static int
+tun_rawbatch(struct iface *iface, struct mqueue *q)
+{
+	struct mbuf *bp;
+	int ret = 0;
+
+	while ((bp = dequeue_mq(q)) != NULL) {
+		if (tun_write(iface, &bp) == -1)
+			ret = -1;
+	}
+	return ret;
+}
+
+/* Write a single frame to the device */
+static int
+tun_write(struct iface *iface, struct mbuf **bpp)
 {
 	struct tundrvr *tun;
 	size_t i;
@@ -205,23 +227,22 @@ static void *
 tun_io_read_proc(void *tunp)
 {
 	struct tundrvr *tun = (struct tundrvr *) tunp;
+	uint8 *buf;
 	ssize_t res;
 
-	interrupt_enter();
 	for (;;) {
 		/*
-		 * Wait for read buffer to become unbusy.
+		 * Wait for a free slot in the receive ring.
 	 	 * We use this scheme so that if NOS gets busy, we simply
 		 * let packets queue up in the host kernel, where there is
 		 * more space for them. The alternative is to read them
 		 * here and possibly drop them if there's no room in NOS
 		 * to accomodate.
 		 */
-		while (tun->read_buf_busy)
-			interrupt_cond_wait(&tun->read_buf_avl);
-		interrupt_leave();
+		buf = rxring_space(&tun->ring);
 
-		res = read(tun->fd, tun->read_buf, tun->read_buf_sz);
+		/* Read straight into the slot's mbuf */
+		res = read(tun->fd, buf, tun->ring.bufsize);
 		if (res == -1)
 			break;
 
@@ -233,10 +254,7 @@ tun_io_read_proc(void *tunp)
 		 * kernel and no packets larger than the MTU will ever be
 		 * passed to us.
 		 */
-		interrupt_enter();
-		tun->read_buf_cnt = res;
-		tun->read_buf_busy = 1;
-		ksignal(&tun->read_buf, 1);
+		rxring_put(&tun->ring, res);
 	}
 
 	return NULL;
@@ -254,43 +272,45 @@ tun_stop(struct iface *iface)
 	close(tun->fd);
 	pthread_cancel(tun->read_thread);
 	pthread_join(tun->read_thread, &dummy);
-	pthread_cond_destroy(&tun->read_buf_avl);
-	free(tun->read_buf);
+	rxring_free(&tun->ring);
 	return 0;
 }
 
+/* Show receive ring statistics */
+static void
+tun_status(struct iface *iface)
+{
+	struct rxring *r;
+
+	r = &Tundrvr[iface->dev].ring;
+	kprintf("\trx ring %d slots: packets %ld batches %ld (avg %ld.%02ld) full %ld\n",
+	 RXRING_SIZE, r->packets, r->batches,
+	 r->batches != 0 ? r->packets / r->batches : 0,
+	 r->batches != 0 ? (r->packets * 100 / r->batches) % 100 : 0,
+	 r->full);
+}
+
 static void
 tun_rx(int dev,void *p1,void *p2)
 {
 	struct iface *iface = (struct iface *)p1;
 	struct tundrvr *tun = (struct tundrvr *)p2;
+	struct mqueue q;
 	struct mbuf *bp;
-	int i_state;
 
+	memset(&q, 0, sizeof(q));
 	for (;;) {
-		while (tun->read_buf_busy == 0)
-			if (kwait(&tun->read_buf) != 0)
-				return;
-
 		/*
-		 * Allocate a buffer for the packet, anticipating that
-		 * the network hopper will want to insert an interface
-		 * descriptor on the packet as well.
+		 * Collect every packet the read thread has finished with.
+		 * The ring's mbufs already have room at the front for the
+		 * interface descriptor the network hopper adds, so they
+		 * are passed on as they are.
 		 */
-		bp = ambufw(tun->read_buf_cnt+sizeof(struct iface *));
-		bp->data += sizeof(struct iface *);
-
-		/* Copy the data into the packet buffer */
-		memcpy(bp->data, tun->read_buf, tun->read_buf_cnt);
-		bp->cnt = tun->read_buf_cnt;
-
-		/* Return the buffer to the read thread */
-		i_state = disable();
-		tun->read_buf_busy = 0;
-		pthread_cond_signal(&tun->read_buf_avl);
-		restore(i_state);
+		if (rxring_take(&tun->ring, &q) == -1)
+			return;
 
-		/* Pass the packet to the network stack */
-		net_route(iface,&bp);
+		/* Pass the packets to the network stack */
+		while ((bp = dequeue_mq(&q)) != NULL)
+			net_route(iface,&bp);
 	}
 }
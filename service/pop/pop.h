@@ -31,7 +31,8 @@ struct pop_scb {
 	char	buf[BUF_LEN],	/* input line buffer */
 		count,		/* line buffer length */
 		username[64];	/* user/folder name */
-	kFILE	*wf;		/* work folder file pointer */
+	kFILE	*wf;		/* mail folder file pointer */
+	struct mailarea folder;	/* index of the messages in it */
 	int	folder_len,	/* number of msgs in current folder */
 		msg_num;	/* current msg number */
 	long	msg_len;	/* length of current msg */
@@ -43,17 +44,9 @@ struct pop_scb {
 		*msg_status;	/* message status array pointer */
 };
 
-/* Response messages */
-
-static char	count_rsp[]    = "#%d messages in this folder\n",
-		error_rsp[]    = "- ERROR: %s\n",
-		greeting_msg[] = "+ POP2 %s\n",
-/*		length_rsp[]   = "=%ld bytes in this message\n", */
-		length_rsp[]   = "=%ld characters in Message #%d\n",
-		msg_line[]     = "%s\n",
-		no_mail_rsp[]  = "+ No mail, sorry\n",
-		no_more_rsp[]  = "=%d No more messages in this folder\n",
-		signoff_msg[]  = "+ Bye, thanks for calling\n";
+/* In popserv.c: */
+void open_folder(struct pop_scb *scb);
+void close_folder(struct pop_scb *scb);
 
 /* ------------------------ end of header file ---------------------------- */
 
@@ -26,6 +26,8 @@
 #include "core/proc.h"
 #include "files.h"
 
+#include "service/smtp/smtp.h"
+#include "lib/smtp/mailidx.h"
 #include "service/pop/pop.h"
 
 extern char Nospace[];
@@ -34,7 +36,6 @@ static struct pop_scb *create_scb(void);
 static void delete_scb(struct pop_scb *scb);
 static void popserv(int s,void *unused,void *p);
 static int poplogin(char *pass,char *username);
-static void rrip(register char *s);
 int newmail(struct pop_scb *);
 int isdeleted(struct pop_scb *,int);
 
@@ -43,6 +44,17 @@ void pop_sm(struct pop_scb *scb);
 
 static int Spop = -1; /* prototype socket for service */
 
+/* Response messages */
+
+static char	count_rsp[]    = "#%d messages in this folder\n",
+		error_rsp[]    = "- ERROR: %s\n",
+		greeting_msg[] = "+ POP2 %s\n",
+/*		length_rsp[]   = "=%ld bytes in this message\n", */
+		length_rsp[]   = "=%ld characters in Message #%d\n",
+		no_mail_rsp[]  = "+ No mail, sorry\n",
+		no_more_rsp[]  = "=%d No more messages in this folder\n",
+		signoff_msg[]  = "+ Bye, thanks for calling\n";
+
 /* Start up POP receiver service */
 int
 pop1(argc,argv,p)
@@ -179,31 +191,17 @@ register struct pop_scb *scb;
 		return;
 	if (scb->wf != NULL)
 		kfclose(scb->wf);
+	mi_free(&scb->folder);
 	if (scb->msg_status  != NULL)
 		free(scb->msg_status);
 
 	free(scb);
 }
 
-/* replace terminating end of line marker(s) (\r and \n) with null */
-static void
-rrip(s)
-register char *s;
-{
-	register char *cp;
-
-	if((cp = strchr(s,'\r')) != NULL)
-		*cp = '\0';
-	if((cp = strchr(s,'\n')) != NULL)
-		*cp = '\0';
-}
-
 /* --------------------- start of POP server code ------------------------ */
 
 #define	BITS_PER_WORD		16
 
-#define isSOM(x)		((strncmp(x,"From ",5) == 0))
-
 /* Command string specifications */
 
 static char	ackd_cmd[] = "ACKD",
@@ -376,10 +374,12 @@ close_folder(scb)
 struct pop_scb *scb;
 {
 	char folder_pathname[64];
-	char line[BUF_LEN];
-	kFILE *fd;
-	int deleted = FALSE;
-	int msg_no = 0;
+	char tmp_pathname[64];
+	kFILE *fd, *nfd;
+	struct mailarea na;
+	struct mailmsg *mp, *np;
+	long pos, next, end;
+	int msg_no, tries = 0;
 	struct stat folder_stat;
 
 	if (scb->wf == NULL)
@@ -390,6 +390,7 @@ struct pop_scb *scb;
 
 		kfclose(scb->wf);
 		scb->wf = NULL;
+		mi_free(&scb->folder);
 
 		free(scb->msg_status);
 		scb->msg_status = NULL;
@@ -397,61 +398,93 @@ struct pop_scb *scb;
 	}
 
 
-	sprintf(folder_pathname,"%s/%s.txt",Mailspool,scb->username);
+	if (snprintf(folder_pathname,sizeof(folder_pathname),"%s/%s.txt",
+	    Mailspool,scb->username) >= sizeof(folder_pathname)
+	 || snprintf(tmp_pathname,sizeof(tmp_pathname),"%s/%s.tmp",
+	    Mailspool,scb->username) >= sizeof(tmp_pathname)) {
+		state_error(scb,"Mail folder name too long");
+		return;
+	}
 
-	if (newmail(scb)) {
-		/* copy new mail into the work file and save the
-		   message count for later */
+	/* keep deliveries out while the folder is replaced */
 
-		if ((fd = kfopen(folder_pathname,"r")) == NULL) {
-			state_error(scb,"Unable to add new mail to folder");
+	while (mlock(Mailspool,scb->username)) {
+		if (++tries == 10) {
+			state_error(scb,"Mail folder is busy");
 			return;
 		}
-
-		kfseek(scb->wf,0,kSEEK_END);
-		kfseek(fd,scb->folder_file_size,kSEEK_SET);
-		while (!kfeof(fd)) {
-			kfgets(line,BUF_LEN,fd);
-			kfputs(line,scb->wf);
-		}
-
-		kfclose(fd);
+		ppause(1000);
 	}
 
-	/* now create the updated mail folder */
-
-	if ((fd = kfopen(folder_pathname,"w")) == NULL){
+	if ((nfd = kfopen(tmp_pathname,WRITE_TEXT)) == NULL){
+		rmlock(Mailspool,scb->username);
 		state_error(scb,"Unable to update mail folder");
 		return;
 	}
 
-	krewind(scb->wf);
-	while (!kfeof(scb->wf)){
-		kfgets(line,BUF_LEN,scb->wf);
-
-		if (isSOM(line)){
-			msg_no++;
-			if (msg_no <= scb->folder_len)
-				deleted = isdeleted(scb,msg_no);
-			else
-				deleted = FALSE;
-		}
+	/* copy whatever came before the first message, then the messages
+	   we're keeping, straight from the folder by their offsets */
 
-		if (deleted)
+	memset(&na,0,sizeof(na));
+	pos = next = (scb->folder_len > 0) ? scb->folder.msgs[0].start : 0;
+	mi_copy(scb->wf,0L,pos,nfd);
+	for (msg_no = 1; msg_no <= scb->folder_len; msg_no++) {
+		if (isdeleted(scb,msg_no))
 			continue;
 
-		kfputs(line,fd);
+		mp = &scb->folder.msgs[msg_no - 1];
+		mi_copy(scb->wf,mp->start == next ? -1L : mp->start,mp->size,nfd);
+		next = mp->start + mp->size;
+		np = mi_add(&na);
+		*np = *mp;
+		np->start = pos;
+		pos += mp->size;
 	}
 
-	kfclose(fd);
+	/* then add any mail that arrived since the folder was opened */
+
+	if (newmail(scb) && (fd = kfopen(folder_pathname,READ_TEXT)) != NULL) {
+		kfseek(fd,0L,kSEEK_END);
+		end = kftell(fd);
+		mi_copy(fd,scb->folder_file_size,end - scb->folder_file_size,nfd);
+		msg_no = na.nmsgs;
+		mi_scan(fd,scb->folder_file_size,&na);
+		for (; msg_no < na.nmsgs; msg_no++)
+			na.msgs[msg_no].start += pos - scb->folder_file_size;
+		pos += end - scb->folder_file_size;
+		kfclose(fd);
+	}
+	na.size = pos;
+
+	if (kfflush(nfd) != 0 || kferror(nfd)) {
+		kfclose(nfd);
+		unlink(tmp_pathname);
+		mi_free(&na);
+		rmlock(Mailspool,scb->username);
+		state_error(scb,"Unable to update mail folder");
+		return;
+	}
+	kfclose(nfd);
+
+	/* now replace the folder with the updated one, and index it */
+
+	unlink(folder_pathname);
+	rename(tmp_pathname,folder_pathname);
+	mi_remove(folder_pathname);
 
 	/* trash the updated mail folder if it is empty */
 
 	if ((stat(folder_pathname,&folder_stat) == 0) && (folder_stat.st_size == 0))
 		unlink(folder_pathname);
+	else
+		mi_write(folder_pathname,&na);
+
+	mi_free(&na);
+	rmlock(Mailspool,scb->username);
 
 	kfclose(scb->wf);
 	scb->wf = NULL;
+	mi_free(&scb->folder);
 
 	free(scb->msg_status);
 	scb->msg_status = NULL;
@@ -462,9 +495,6 @@ open_folder(scb)
 struct pop_scb	*scb;
 {
 	char folder_pathname[64];
-	char line[BUF_LEN];
-	kFILE *fd;
-	kFILE *ktmpfile();
 	struct stat folder_stat;
 
 
@@ -476,31 +506,20 @@ struct pop_scb	*scb;
 		 return;
 	}
 
-	scb->folder_file_size = folder_stat.st_size;
-	if ((fd = kfopen(folder_pathname,"r")) == NULL){
+	/* the messages are read in place, found through the folder's
+	   index rather than by copying it to a work file */
+
+	if ((scb->wf = kfopen(folder_pathname,READ_TEXT)) == NULL){
 		state_error(scb,"Unable to open mail folder");
 		return;
 	}
 
-	if ((scb->wf = ktmpfile()) == NULL) {
-		state_error(scb,"Unable to create work folder");
+	if (mi_open(folder_pathname,&scb->folder) != 0) {
+		state_error(scb,"Unable to index mail folder");
 		return;
 	}
-
-	while(!kfeof(fd)) {
-		kfgets(line,BUF_LEN,fd);
-
-		/* scan for begining of a message */
-
-		if (isSOM(line))
-			scb->folder_len++;
-
-		/* now put  the line in the work file */
-
-		kfputs(line,scb->wf);
-	}
-
-	kfclose(fd);
+	scb->folder_file_size = scb->folder.size;
+	scb->folder_len = scb->folder.nmsgs;
 
 	scb->msg_status_size = (scb->folder_len) / BITS_PER_WORD;
 
@@ -542,9 +561,6 @@ void
 retrieve_message(scb)
 struct pop_scb	*scb;
 {
-	char line[BUF_LEN];
-	long cnt;
-
 	if (scb == NULL)	/* check for null -- wa6smn */
 		return;
 	if (scb->msg_len == 0) {
@@ -552,14 +568,10 @@ struct pop_scb	*scb;
 		return;
 	}
 
-	cnt  = scb->msg_len;
-	while(!kfeof(scb->wf) && (cnt > 0)) {
-		kfgets(line,BUF_LEN,scb->wf);
-		rrip(line);
+	/* the network stream is in text mode, so each newline goes out
+	   as CRLF, as counted in msg_len */
 
-		(void) kfprintf(scb->network,msg_line,line);
-		cnt -= (strlen(line)+2);	/* Compensate for CRLF */
-	}
+	mi_copy(scb->wf,scb->curpos,scb->nextpos - scb->curpos,scb->network);
 
 	scb->state = NEXT;
 }
@@ -569,39 +581,23 @@ get_message(scb,msg_no)
 struct pop_scb	*scb;
 int msg_no;
 {
-	char line[BUF_LEN];
+	struct mailmsg *mp;
 
 	if (scb == NULL)	/* check for null -- wa6smn */
 		return;
 	scb->msg_len = 0;
-	if (msg_no > scb->folder_len) {
+	if (msg_no < 1 || msg_no > scb->folder_len) {
 		scb->curpos  = 0;
 		scb->nextpos = 0;
 		return;
-	} else {
-		/* find the message and its length */
-
-		krewind(scb->wf);
-		while (!kfeof(scb->wf) && (msg_no > -1)) {
-			if (msg_no > 0)
-				scb->curpos = kftell(scb->wf);
-			
-			kfgets(line,BUF_LEN,scb->wf);
-			rrip(line);
-
-			if (isSOM(line))
-				msg_no--;
-
-			if (msg_no != 0)
-				continue;
-
-			scb->nextpos  = kftell(scb->wf);
-			scb->msg_len += (strlen(line)+2);	/* Add CRLF */
-		}
 	}
 
-	if (scb->msg_len > 0)
-		kfseek(scb->wf,scb->curpos,kSEEK_SET);
+	/* find the message and its length */
+
+	mp = &scb->folder.msgs[msg_no - 1];
+	scb->curpos  = mp->start;
+	scb->nextpos = mp->start + mp->size;
+	scb->msg_len = mp->size + mp->lines;	/* Add CR to each LF */
 
 	/* we need the pointers even if the message was deleted */
 
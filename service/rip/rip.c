@@ -64,7 +64,7 @@ int trig;		/* Send only triggered updates? */
 int us;			/* Include our address in update */
 {
 	uint8 *cp;
-	int i,bits,numroutes,maxroutes;
+	int bits,numroutes,maxroutes;
 	uint pktsize;
 	struct mbuf *bp;
 	struct route *rp;
@@ -108,29 +108,27 @@ int us;			/* Include our address in update */
 		}
 	}
 	for(bits=0;bits<32;bits++){
-		for(i=0;i<HASHMOD;i++){
-			for(rp = Routes[bits][i];rp != NULL;rp=rp->next){
-				if(rp->flags.rtprivate
-				 || (trig && !rp->flags.rttrig)) 
-					continue;
-
-				if(numroutes >= maxroutes){
-					/* Packet full, flush and make another */
-					bp->cnt = RIPHEADER + numroutes * RIPROUTE;
-					send_udp(&lsock,&fsock,0,0,&bp,bp->cnt,0,0);
-					Rip_stat.output++;
-					if((bp = alloc_mbuf(pktsize)) == NULL)
-						return; 
-					numroutes = 0;
-					cp = putheader(bp->data,RIPCMD_RESPONSE,RIPVERSION);
-				}
-				if(!split || iface != rp->iface){
-			 		cp = putentry(cp,RIP_IPFAM,rp->target,rp->metric+1);
-					numroutes++;
-				} else if(trig){
-			 		cp = putentry(cp,RIP_IPFAM,rp->target,RIP_INFINITY);
-					numroutes++;
-				}
+		for(rp = Routes[bits];rp != NULL;rp=rp->next){
+			if(rp->flags.rtprivate
+			 || (trig && !rp->flags.rttrig)) 
+				continue;
+
+			if(numroutes >= maxroutes){
+				/* Packet full, flush and make another */
+				bp->cnt = RIPHEADER + numroutes * RIPROUTE;
+				send_udp(&lsock,&fsock,0,0,&bp,bp->cnt,0,0);
+				Rip_stat.output++;
+				if((bp = alloc_mbuf(pktsize)) == NULL)
+					return; 
+				numroutes = 0;
+				cp = putheader(bp->data,RIPCMD_RESPONSE,RIPVERSION);
+			}
+			if(!split || iface != rp->iface){
+		 		cp = putentry(cp,RIP_IPFAM,rp->target,rp->metric+1);
+				numroutes++;
+			} else if(trig){
+		 		cp = putentry(cp,RIP_IPFAM,rp->target,RIP_INFINITY);
+				numroutes++;
 			}
 		}
 	}
@@ -277,7 +275,7 @@ void
 rip_trigger()
 {
 	struct rip_list *rl;
-	int bits,i;
+	int bits;
 	struct route *rp;
 
 	for(rl=Rip_list;rl != NULL;rl = rl->next){
@@ -286,10 +284,8 @@ rip_trigger()
 	/* Clear the trigger list */
 	R_default.flags.rttrig = 0;
 	for(bits=0;bits<32;bits++){
-		for(i=0;i<HASHMOD;i++){
-			for(rp = Routes[bits][i];rp != NULL;rp = rp->next){
-				rp->flags.rttrig = 0;
-			}
+		for(rp = Routes[bits];rp != NULL;rp = rp->next){
+			rp->flags.rttrig = 0;
 		}
 	}
 }
@@ -7,6 +7,9 @@
 #define	LINELEN		256
 #define SLINELEN	64
 #define MBOXLEN		8		/* max size of a mail box name */
+#define	SMTPROUTETTL	900		/* seconds to believe a mail route */
+#define	SMTPBACKMIN	120		/* first retry delay after a failure */
+#define	SMTPBACKMAX	14400		/* longest retry delay */
 
 /* types of address used by smtp in an address list */
 #define BADADDR	0
@@ -29,12 +32,35 @@ struct smtpsv {
 	kFILE *data;		/* Temporary input file pointer */
 };
 
+/* used by smtpcli to keep route and retry state for a destination host */
+struct smtphost {
+	struct	smtphost *next;
+	char	*name;		/* host name, as queued */
+	int32	addr;		/* where its mail goes, 0 if unknown */
+	int32	expires;	/* when addr must be looked up again */
+	int32	retry;		/* don't try to send to it before this time */
+	int32	backoff;	/* current retry delay, seconds */
+	int	refs;		/* queued jobs for this host */
+};
+
+/* used by smtpcli as an entry in its index of the outbound queue */
+struct smtpq {
+	struct	smtpq *next;
+	struct	smtpq *prev;
+	char	jobname[9];	/* the prefix of the job file name */
+	struct	smtphost *host;	/* where it's going */
+	char	*from;		/* address of sender */
+	struct list *to;	/* Linked list of recipients */
+	int	busy;		/* handed to a client session */
+};
+
 /* used by smtpcli as a queue entry for a single message */
 struct smtp_job {
 	struct 	smtp_job *next;	/* pointer to next mail job for this system */
 	char	jobname[9];	/* the prefix of the job file name */
 	char	*from;		/* address of sender */
 	struct list *to;	/* Linked list of recipients */
+	struct	smtpq *qp;	/* its entry in the queue index */
 };
 
 /* control structure used by an smtp client session */
@@ -48,8 +74,10 @@ struct smtpcli {
 	char	cnt;		/* Length of input buffer */
 	kFILE	*tfile;
 	struct	smtp_job *jobq;
+	struct	smtp_job *jobtail;	/* Last job on jobq */
 	struct	list 	*errlog;	
 	int lock;		/* In use */
+	int pipelining;		/* Server offered PIPELINING */
 };
 
 /* smtp server routing mode */
@@ -79,6 +107,7 @@ int mlock(char *dir,char *id);
 int rmlock(char *dir,char *id);
 void del_list(struct list *lp);
 int32 mailroute(char *dest);
+void smtpq_add(char *id,char *host,char *from,struct list *to);
 
 #endif	/* _KA9Q_SMTP_H */
 
@@ -5,6 +5,7 @@
 
 #include "lib/std/stdio.h"
 #include <time.h>
+#include <sys/stat.h>
 #ifdef UNIX
 #include <sys/types.h>
 #endif
@@ -27,6 +28,7 @@
 #include "net/dns/domain.h"
 
 #include "service/smtp/smtp.h"
+#include "lib/smtp/mailidx.h"
 
 char *Days[7] = {  "Sun","Mon","Tue","Wed","Thu","Fri","Sat" };
 char *Months[12] = { "Jan","Feb","Mar","Apr","May","Jun",
@@ -487,7 +489,11 @@ struct list *tolist;
 		else {
 			char buf[LINELEN];
 			int tocnt = 0;
+			struct stat st;
 			sprintf(mailbox,"%s/%s.txt",Mailspool,ap->val);
+			/* Note where the message will start, for the index */
+			if(stat(mailbox,&st) != 0)
+				st.st_size = st.st_mtime = 0;
 #ifndef	AMIGA
 			if((fp = kfopen(mailbox,APPEND_TEXT)) != NULL) {
 #else
@@ -531,6 +537,9 @@ struct list *tolist;
 					kfprintf(fp,"\n");
 				/* Leave a blank line between msgs */
 				kfclose(fp);
+				if(!fail)
+					mi_append(mailbox,(long)st.st_size,
+					 (long)st.st_mtime);
 				kprintf("New mail arrived for %s\n",ap->val);
 				if(host != NULL){
 					krewind(data); /* Send return receipt */
@@ -710,6 +719,10 @@ char *from;
 		smtplog("queue job %s To: %s From: %s",prefix,ap->val,from);
 	}
 	kfclose(fp);
+	/* Tell the client while the job is still locked, so it can't also
+	 * pick it up from disk
+	 */
+	smtpq_add(prefix,host,from,to);
 	(void) rmlock(Mailqdir,prefix);
 	return 0;
 }
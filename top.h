@@ -10,6 +10,11 @@
 #define USE_SYSTEM_SPRINTF
 #define UNIX
 #define MODERN_UNIX
+/* UNIX_COROUTINES, if defined by the build, runs all NOS processes as
+ * coroutines on the main thread instead of one pthread each. TICKLESS
+ * has the clock thread sleep until the next timer expires rather than
+ * wake on every tick.
+ */
 #endif
 
 #endif	/* _KA9Q_TOP_H */
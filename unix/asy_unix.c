@@ -234,6 +234,32 @@ get_asy(int dev)
 		return tmp;
 }
 
+/* Blocking burst read from asynch line, without copying
+ * Sets *bufp to the next run of received bytes and returns its length,
+ * or -1 if aborting. The bytes must be given back with release_asy()
+ * before the next call.
+ */
+int
+get_asy_burst(int dev, uint8 **bufp)
+{
+	struct asy *asyp;
+
+	if(dev < 0 || dev >= ASY_MAX)
+		return -1;
+	asyp = &Asy[dev];
+
+	return unix_socket_read_span(asyp->socket_entry, bufp);
+}
+
+/* Release the first cnt bytes of a burst returned by get_asy_burst() */
+void
+release_asy(int dev, int cnt)
+{
+	if(dev < 0 || dev >= ASY_MAX)
+		return;
+	unix_socket_read_done(Asy[dev].socket_entry, cnt);
+}
+
 int
 doasystat(argc,argv,p)
 int argc;
@@ -4,6 +4,9 @@
  */
 #include "top.h"
 
+#include <dirent.h>
+#include <fnmatch.h>
+#include <string.h>
 #include "global.h"
 #include "lib/std/stdio.h"
 #include "lib/std/dirutil.h"
@@ -22,12 +25,88 @@ dir(char *path,int full)
 	return fp;
 }
 
+/* A wildcard scan of one directory */
+struct filedir {
+	DIR *dirp;
+	char *pattern;		/* Last component of the name, to match */
+};
+
+/* Start a wildcard filename scan. Each caller has its own, so scans
+ * that wait between names don't disturb each other.
+ */
+struct filedir *
+filedir_open(char *name)
+{
+	struct filedir *fdp;
+	char *cp;
+
+	fdp = (struct filedir *)callocw(1,sizeof(struct filedir));
+	fdp->pattern = strdup(name);
+	if((cp = strrchr(fdp->pattern,'/')) != NULL){
+		*cp++ = '\0';
+		fdp->dirp = opendir(fdp->pattern[0] != '\0' ? fdp->pattern : "/");
+	} else {
+		cp = fdp->pattern;
+		fdp->dirp = opendir(".");
+	}
+	/* Keep just the last component to match against */
+	memmove(fdp->pattern,cp,strlen(cp)+1);
+	return fdp;
+}
+/* Next name in the scan matching its pattern. Like the DOS version,
+ * only names that fit 8.3 are returned; callers size ret_str for that.
+ * Returns -1, with ret_str empty, at the end.
+ */
 int
-filedir(char *name,int times,char *ret_str)
+filedir_next(struct filedir *fdp,char *ret_str)
 {
-	ret_str[0] = '\0';	
+	struct dirent *dp;
+
+	ret_str[0] = '\0';
+	if(fdp->dirp == NULL)
+		return -1;
+	while((dp = readdir(fdp->dirp)) != NULL){
+		if(strlen(dp->d_name) <= 12
+		 && fnmatch(fdp->pattern,dp->d_name,FNM_PERIOD) == 0){
+			strcpy(ret_str,dp->d_name);
+			return 0;
+		}
+	}
+	closedir(fdp->dirp);
+	fdp->dirp = NULL;
 	return -1;
 }
+void
+filedir_close(struct filedir *fdp)
+{
+	if(fdp == NULL)
+		return;
+	if(fdp->dirp != NULL)
+		closedir(fdp->dirp);
+	free(fdp->pattern);
+	free(fdp);
+}
+
+/* Wildcard filename lookup. Call with times == 0 for the first name in
+ * the directory matching the pattern, and non-zero for each one after.
+ * There is only one such scan at a time; callers that may wait in the
+ * middle of theirs should use filedir_open() instead.
+ */
+int
+filedir(char *name,int times,char *ret_str)
+{
+	static struct filedir *fdp;
+
+	if(times == 0){
+		filedir_close(fdp);
+		fdp = filedir_open(name);
+	}
+	if(fdp == NULL){
+		ret_str[0] = '\0';
+		return -1;
+	}
+	return filedir_next(fdp,ret_str);
+}
 
 static void
 notimp()
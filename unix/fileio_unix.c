@@ -0,0 +1,202 @@
+/* Host file I/O offload. See fileio_unix.h.
+ *
+ * Requests are queued FIFO under a host mutex and picked up by whichever
+ * I/O thread is free. On completion the thread stores the result, sets
+ * the done flag and ksignal()s the request from interrupt context. The
+ * waiting process checks the flag before each kwait(); a signal that
+ * arrives between the check and the wait is held in the interrupt signal
+ * queue until the wait is posted, so it isn't lost.
+ */
+#include "top.h"
+
+#ifndef UNIX
+#error "This file should only be built on POSIX/UNIX systems."
+#endif
+
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "global.h"
+#include "net/core/mbuf.h"
+#include "core/proc.h"
+#include "unix/nosunix.h"
+#include "unix/fileio_unix.h"
+
+static pthread_once_t Fio_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t Fio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Fio_avail = PTHREAD_COND_INITIALIZER;
+static struct fioreq *Fio_head;
+static struct fioreq **Fio_tail = &Fio_head;
+
+static void fio_do(struct fioreq *rq);
+static void *fio_thread(void *arg);
+
+static void
+fio_init(void)
+{
+	pthread_t tid;
+	int i;
+
+	for(i=0;i<FIO_THREADS;i++){
+		if(pthread_create(&tid,NULL,fio_thread,NULL) == 0)
+			pthread_detach(tid);
+	}
+}
+
+/* Carry out a request. Runs on an I/O thread, without any NOS lock. */
+static void
+fio_do(struct fioreq *rq)
+{
+	struct mbuf *bp;
+	long total = 0;
+	long off;
+	ssize_t n = 0;
+
+	switch(rq->op){
+	case FIO_READ:
+		bp = rq->bp;
+		if(rq->offset < 0)
+			n = read(rq->fd,bp->data,rq->cnt);
+		else
+			n = pread(rq->fd,bp->data,rq->cnt,rq->offset);
+		total = n;
+		break;
+	case FIO_WRITE:
+	case FIO_APPEND:
+		off = rq->offset;
+		if(rq->op == FIO_APPEND){
+			lseek(rq->fd,0L,SEEK_END);
+			off = -1;
+		}
+		for(bp = rq->bp;bp != NULL;bp = bp->next){
+			if(off < 0)
+				n = write(rq->fd,bp->data,bp->cnt);
+			else
+				n = pwrite(rq->fd,bp->data,bp->cnt,off + total);
+			if(n > 0)
+				total += n;
+			if(n != bp->cnt)
+				break;
+		}
+		if(n < 0 && total == 0)
+			total = -1;
+		break;
+	}
+	rq->err = (total < 0) ? errno : 0;
+	rq->result = total;
+}
+
+static void *
+fio_thread(void *arg)
+{
+	struct fioreq *rq;
+
+	for(;;){
+		pthread_mutex_lock(&Fio_lock);
+		while((rq = Fio_head) == NULL)
+			pthread_cond_wait(&Fio_avail,&Fio_lock);
+		if((Fio_head = rq->next) == NULL)
+			Fio_tail = &Fio_head;
+		pthread_mutex_unlock(&Fio_lock);
+
+		fio_do(rq);
+
+		interrupt_enter();
+		__atomic_store_n(&rq->done,1,__ATOMIC_RELEASE);
+		ksignal(rq,0);	/* Waiters re-check done themselves */
+		interrupt_leave();
+	}
+	return NULL;
+}
+
+/* Queue a request and return at once. Its fields must not be touched
+ * again until fio_wait() has been called on it.
+ */
+void
+fio_start(struct fioreq *rq)
+{
+	rq->busy = 1;
+	rq->done = 0;
+	rq->next = NULL;
+	if(Curproc == NULL){
+		/* Nobody to wait yet; do it in line */
+		fio_do(rq);
+		rq->done = 1;
+		return;
+	}
+	pthread_once(&Fio_once,fio_init);
+	pthread_mutex_lock(&Fio_lock);
+	*Fio_tail = rq;
+	Fio_tail = &rq->next;
+	pthread_cond_signal(&Fio_avail);
+	pthread_mutex_unlock(&Fio_lock);
+}
+
+/* Wait for a started request to finish and return its result, with
+ * errno set from the host if it failed. Returns at once if the request
+ * isn't outstanding.
+ */
+long
+fio_wait(struct fioreq *rq)
+{
+	if(rq->busy){
+		/* An alert can't cut this short; the thread still owns
+		 * the buffers until it says it's done
+		 */
+		while(!__atomic_load_n(&rq->done,__ATOMIC_ACQUIRE))
+			kwait(rq);
+		rq->busy = 0;
+	}
+	if(rq->result < 0)
+		errno = rq->err;
+	return rq->result;
+}
+
+/* Start a request and wait for it */
+long
+fio_io(struct fioreq *rq)
+{
+	fio_start(rq);
+	return fio_wait(rq);
+}
+
+/* Replacements for read() and write() at the current file position.
+ * The request is on the heap so that if we're killed while waiting it
+ * is merely lost, rather than completed onto a stack that's gone.
+ */
+int
+fio_read(int fd,void *buf,uint cnt)
+{
+	struct fioreq *rq;
+	long n;
+
+	rq = callocw(1,sizeof(struct fioreq));
+	rq->op = FIO_READ;
+	rq->fd = fd;
+	rq->offset = -1;
+	rq->cnt = cnt;
+	rq->bp = ambufw(cnt);
+	if((n = fio_io(rq)) > 0)
+		memcpy(buf,rq->bp->data,n);
+	free_p(&rq->bp);
+	free(rq);
+	return n;
+}
+int
+fio_write(int fd,const void *buf,uint cnt)
+{
+	struct fioreq *rq;
+	long n;
+
+	rq = callocw(1,sizeof(struct fioreq));
+	rq->op = FIO_WRITE;
+	rq->fd = fd;
+	rq->offset = -1;
+	rq->cnt = cnt;
+	rq->bp = qdata(buf,cnt);
+	n = fio_io(rq);
+	free_p(&rq->bp);
+	free(rq);
+	return n;
+}
@@ -0,0 +1,49 @@
+/* Host file I/O offload.
+ *
+ * A read() or write() on a slow disk would otherwise be made with the
+ * NOS process lock held, stopping every process (timers and interface
+ * receivers included) until it returns. Instead the calling process
+ * fills in a request and queues it for one of a small pool of host I/O
+ * threads, then kwait()s on the request until the thread has done the
+ * system call and signalled completion. Other processes run meanwhile.
+ *
+ * The data always lives in mbufs owned by the request, never in the
+ * caller's memory, so a request can be left to complete on its own
+ * (write-behind, read-ahead) and a caller that is killed while waiting
+ * can't have its stack scribbled on afterwards.
+ */
+#ifndef KA9Q_FILEIO_UNIX_H
+#define KA9Q_FILEIO_UNIX_H
+
+#include "top.h"
+
+#include "global.h"
+#include "net/core/mbuf.h"
+
+#define	FIO_THREADS	2	/* Host I/O threads */
+
+struct fioreq {
+	struct fioreq *next;	/* On the pending queue */
+	enum {
+		FIO_READ,	/* Read up to cnt bytes into bp */
+		FIO_WRITE,	/* Write the chain bp */
+		FIO_APPEND	/* Write the chain bp at end of file */
+	} op;
+	int fd;
+	long offset;		/* File offset, or -1 for the current position */
+	uint cnt;		/* Bytes to read, or total bytes to write */
+	struct mbuf *bp;	/* Data, owned by the request */
+	long result;		/* Bytes transferred, or -1 */
+	int err;		/* Host errno when result is -1 */
+	int busy;		/* Started and not yet waited for */
+	int done;		/* Set by the I/O thread */
+	int held;		/* In use by a process; see lib/std/stdio.c */
+};
+
+extern	void fio_start(struct fioreq *rq);
+extern	long fio_wait(struct fioreq *rq);
+extern	long fio_io(struct fioreq *rq);
+extern	int fio_read(int fd,void *buf,uint cnt);
+extern	int fio_write(int fd,const void *buf,uint cnt);
+
+#endif /* KA9Q_FILEIO_UNIX_H */
@@ -29,6 +29,13 @@
  * as the "interrupt mutex". When an interrupt thread wishes to interact
  * with NOS processes it must first aqcuire the interrupt mutex, and when
  * it is done it releases the mutex.
+ *
+ * Handing control between process threads costs a condition variable
+ * signal, a mutex handoff and a trip through the host scheduler. When
+ * built with UNIX_COROUTINES, NOS processes instead run as coroutines on
+ * the main thread, each with its own stack, and a switch is just a
+ * _setjmp()/_longjmp() pair as on the other ports. Device threads and
+ * the interrupt mutex work the same way in both cases.
  */
 #include "top.h"
 
@@ -36,15 +43,30 @@
 #error "This file should only be built on POSIX/UNIX systems."
 #endif
 
+#ifdef UNIX_COROUTINES
+/* glibc's fortified longjmp refuses to jump to another stack */
+#undef _FORTIFY_SOURCE
+#endif
+
 #include <pthread.h>
 #include <assert.h>
+#ifdef UNIX_COROUTINES
+#include <setjmp.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include "lib/std//stdio.h"
 #include "global.h"
 #include "core/proc.h"
 #include "commands.h"
 
 static void pproc(struct proc *pp); /* Print a process entry line for PS */
+#ifdef UNIX_COROUTINES
+static void proc_start(void);	/* Coroutine entry point for new process */
+#else
 static void *proc_entry(void *pptr);/* pthread entry point for new process */
+#endif
 
 /* The lock which is held by the running process and which keeps other
  * processes from running at the same time.
@@ -126,6 +148,12 @@ void *p;
 	Ksig.maxentries = 0;
 	kprintf("kwaits %lu nops %lu from int %lu\n",
 	 Ksig.kwaits,Ksig.kwaitnops,Ksig.kwaitints);
+	kprintf("proc pool %u/%u hiwat %u reused %lu created %lu\n",
+	 Procpool.cnt,PROCPOOL,Procpool.hiwat,Procpool.reused,
+	 Procpool.created);
+	Procpool.hiwat = Procpool.cnt;
+	kprintf("timers worst late %ld ms\n",(long)Timer_late * MSPTICK);
+	Timer_late = 0;
 	kprintf(__FWPTR" stksize   "__FWPTR" fl  in  out  name\n", "PID",
 		"event");
 
@@ -168,6 +196,7 @@ struct proc *pp;
 	 insock,outsock,pp->name);
 }
 
+#ifndef UNIX_COROUTINES
 /* Machine-dependent initialization of the first task (which starts
  * on its own and is inducted into the system.
  */
@@ -264,6 +293,8 @@ pteardown(struct proc *pp)
 	pthread_cond_destroy(&pp->cond);
 }
 
+#endif	/* UNIX_COROUTINES */
+
 unsigned
 phash(event)
 void *event;
@@ -348,6 +379,21 @@ interrupt_cond_wait(pthread_cond_t *cond)
 	pthread_setspecific(g_interrupts_disabled, (const void *)1);
 }
 
+/*
+ * As above, but give up waiting once the absolute time "abstime" has
+ * passed. Returns ETIMEDOUT in that case, as pthread_cond_timedwait does.
+ */
+int
+interrupt_cond_timedwait(pthread_cond_t *cond, const struct timespec *abstime)
+{
+	int ret;
+
+	pthread_setspecific(g_interrupts_disabled, (const void *)0);
+	ret = pthread_cond_timedwait(cond, &g_interrupt_mutex, abstime);
+	pthread_setspecific(g_interrupts_disabled, (const void *)1);
+	return ret;
+}
+
 void
 interrupt_leave()
 {
@@ -375,6 +421,7 @@ giveup()
 	pthread_mutex_unlock(&g_interrupt_mutex);
 }
 
+#ifndef UNIX_COROUTINES
 /* Pause the current thread and wait until signaled to run again.
  *
  * The calling thread must be holding the g_curproc_mutex. If it isn't
@@ -424,12 +471,16 @@ proc_entry(void *pptr)
 	if (self->flags.exit)
 		goto ExitBeforeStart;
 
-	/* We're now the running process. Call the process function */
-	assert(Curproc == self);
-	self->pc(self->iarg, self->parg1, self->parg2);
+	/* We're now the running process. Call the process function,
+	 * and again each time newproc() recycles us from the pool
+	 */
+	for (;;) {
+		assert(Curproc == self);
+		self->pc(self->iarg, self->parg1, self->parg2);
 
-	/* Process function has returned. We're done running. */
-	killself();
+		/* Process function has returned. We're done running. */
+		poolself();
+	}
 
 	/* Not reached */
 	return NULL;
@@ -439,3 +490,170 @@ ExitBeforeStart:
 	pthread_mutex_unlock(&g_curproc_mutex);
 	return NULL;
 }
+#endif	/* UNIX_COROUTINES */
+
+#ifdef UNIX_COROUTINES
+/* Coroutine process backend.
+ *
+ * Each process gets an mmap()ed stack with an inaccessible guard page
+ * below it, so running off the end faults instead of quietly corrupting
+ * a neighbour. Stacks of dead processes are kept on a small free list
+ * since most processes ask for the same size.
+ *
+ * A new process is started with makecontext()/swapcontext() just far
+ * enough to record its entry point with _setjmp(); from then on it is
+ * dispatched with _longjmp() like any other. The _ versions don't save
+ * or restore the signal mask, which keeps switches out of the kernel.
+ */
+#define	STKPOOL	16		/* Free stacks kept for reuse */
+
+static struct {
+	void *base;		/* Start of mapping, guard page first */
+	size_t size;		/* Usable size, excluding the guard page */
+} Stkpool[STKPOOL];
+static int Nstkpool;
+static size_t Pagesize;
+
+static struct proc *Startproc;	/* Process being set up by psetup() */
+static ucontext_t Psetup_ctx;	/* Where to return to from proc_start() */
+
+/* Usable stack size for a process, rounded up to whole pages */
+static size_t
+stk_size(struct proc *pp)
+{
+	return (pp->stksize + Pagesize - 1) & ~(Pagesize - 1);
+}
+
+static void *
+stk_alloc(size_t size)
+{
+	void *base;
+	int i;
+
+	for(i=0;i<Nstkpool;i++){
+		if(Stkpool[i].size == size){
+			base = Stkpool[i].base;
+			Stkpool[i] = Stkpool[--Nstkpool];
+			return base;
+		}
+	}
+	base = mmap(NULL,size + Pagesize,PROT_READ|PROT_WRITE,
+	 MAP_PRIVATE|MAP_ANON,-1,0);
+	if(base == MAP_FAILED)
+		return NULL;
+	if(mprotect(base,Pagesize,PROT_NONE) != 0){
+		munmap(base,size + Pagesize);
+		return NULL;
+	}
+	return base;
+}
+
+static void
+stk_free(void *base,size_t size)
+{
+	if(Nstkpool < STKPOOL){
+		Stkpool[Nstkpool].base = base;
+		Stkpool[Nstkpool].size = size;
+		Nstkpool++;
+		return;
+	}
+	munmap(base,size + Pagesize);
+}
+
+/* Machine-dependent initialization of the first task, which runs on the
+ * main thread's own stack
+ */
+void
+init_psetup(struct proc *pp)
+{
+	Pagesize = sysconf(_SC_PAGESIZE);
+
+	pp->flags.run = 1;
+	pp->flags.exit = 0;
+	pp->flags.istate = istate();
+}
+
+/* Machine-dependent initialization of a task */
+void
+psetup(pp,iarg,parg1,parg2,pc)
+struct proc *pp;	/* Pointer to task structure */
+int iarg;		/* Generic integer arg */
+void *parg1;		/* Generic pointer arg #1 */
+void *parg2;		/* Generic pointer arg #2 */
+void (*pc)(int,void*,void*);	/* Initial execution address */
+{
+	ucontext_t uc;
+	size_t size;
+
+	pp->pc = pc;
+	/* Task initially runs with interrupts on */
+	pp->flags.istate = 1;
+	pp->flags.run = 0;
+
+	size = stk_size(pp);
+	if((pp->stack = stk_alloc(size)) == NULL){
+		perror("process stack");
+		exit(1);
+	}
+	if(getcontext(&uc) != 0){
+		perror("getcontext");
+		exit(1);
+	}
+	uc.uc_stack.ss_sp = (char *)pp->stack + Pagesize;
+	uc.uc_stack.ss_size = size;
+	uc.uc_link = NULL;
+	makecontext(&uc,proc_start,0);
+
+	/* Run the new stack just long enough to save its starting state */
+	Startproc = pp;
+	swapcontext(&Psetup_ctx,&uc);
+}
+
+/* Entry point of a new process stack */
+static void
+proc_start(void)
+{
+	if(_setjmp(Startproc->env) == 0)
+		setcontext(&Psetup_ctx);	/* Back to psetup() */
+
+	/* First dispatched by kwait(). Call the process function,
+	 * and again each time newproc() recycles us from the pool
+	 */
+	for(;;){
+		Curproc->pc(Curproc->iarg,Curproc->parg1,Curproc->parg2);
+
+		/* Process function has returned. We're done running. */
+		poolself();
+	}
+}
+
+/* Release a dead process's stack. It can't be the running process. */
+void
+pteardown(struct proc *pp)
+{
+	assert(pp != Curproc);
+	stk_free(pp->stack,stk_size(pp));
+	pp->stack = NULL;
+}
+
+/* Save this process's state and switch to Curproc, chosen by kwait().
+ * Returns when some other process switches back to us.
+ */
+void
+proc_sleep(struct proc *self)
+{
+	assert(self->flags.run == 1);
+	self->flags.run = 0;
+	if(_setjmp(self->env) == 0)
+		_longjmp(Curproc->env,1);
+
+	/* We have been switched back to at this point */
+	assert(Curproc == self);
+}
+
+void
+proc_wakeup(struct proc *other)
+{
+	other->flags.run = 1;
+}
+#endif	/* UNIX_COROUTINES */
@@ -20,6 +20,8 @@ void proc_sleep(struct proc *);
 void proc_wakeup(struct proc *);
 void interrupt_enter(void);
 void interrupt_cond_wait(pthread_cond_t *cond);
+int interrupt_cond_timedwait(pthread_cond_t *cond,
+    const struct timespec *abstime);
 void interrupt_leave(void);
 
 #endif	/* _KA9Q_UNIX_HARDWARE_H */
@@ -0,0 +1,159 @@
+/* Packet receive ring shared between a host reader thread and a NOS
+ * receive process. See rxring_unix.h for the division of labour.
+ *
+ * The producer and consumer indices run freely and are reduced modulo
+ * RXRING_SIZE on use, so prod - cons is always the number of packets
+ * waiting. Each index is stored with release semantics by its owner and
+ * loaded with acquire semantics by the other side, which is all the
+ * ordering the slots themselves need.
+ *
+ * The sleep flags need more care: each side stores its flag and then
+ * looks at the other side's index, while the other side stores its index
+ * and then looks at the flag. A full fence between the store and the
+ * load on both sides guarantees at least one of them sees the other's
+ * store, so a wakeup can't be lost.
+ */
+#include "top.h"
+
+#ifndef UNIX
+#error "This file should only be built on POSIX/UNIX systems."
+#endif
+
+#include <pthread.h>
+
+#include "global.h"
+#include "net/core/mbuf.h"
+#include "core/proc.h"
+#include "unix/nosunix.h"
+#include "unix/rxring_unix.h"
+
+#define	RXRING_MASK	(RXRING_SIZE-1)
+
+#define	LOAD_ACQ(p)	__atomic_load_n((p),__ATOMIC_ACQUIRE)
+#define	STORE_REL(p,v)	__atomic_store_n((p),(v),__ATOMIC_RELEASE)
+#define	FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Allocate a receive buffer, leaving room at the front for the
+ * interface pointer that net_route() will push on
+ */
+static struct mbuf *
+rxring_alloc(struct rxring *r)
+{
+	struct mbuf *bp;
+
+	bp = ambufw(r->bufsize + sizeof(struct iface *));
+	bp->data += sizeof(struct iface *);
+	return bp;
+}
+
+/* Set up a ring and fill every slot. Called from NOS before the reader
+ * thread is started.
+ */
+int
+rxring_init(struct rxring *r, uint bufsize)
+{
+	int i;
+
+	memset(r,0,sizeof(*r));
+	r->bufsize = bufsize;
+	if(pthread_cond_init(&r->rd_avail,NULL) != 0)
+		return -1;
+	for(i=0;i<RXRING_SIZE;i++)
+		r->slot[i] = rxring_alloc(r);
+	return 0;
+}
+
+/* Release a ring. The reader thread must already be gone. */
+void
+rxring_free(struct rxring *r)
+{
+	int i;
+
+	for(i=0;i<RXRING_SIZE;i++)
+		free_p(&r->slot[i]);
+	pthread_cond_destroy(&r->rd_avail);
+}
+
+/* Reader thread: return the data area of the next free slot, waiting
+ * for the consumer to free one if the ring is full. Called without the
+ * interrupt lock held.
+ */
+uint8 *
+rxring_space(struct rxring *r)
+{
+	if(r->prod - LOAD_ACQ(&r->cons) == RXRING_SIZE){
+		interrupt_enter();
+		r->full++;
+		__atomic_store_n(&r->rd_sleeping,1,__ATOMIC_RELAXED);
+		FENCE();
+		while(r->prod - LOAD_ACQ(&r->cons) == RXRING_SIZE)
+			interrupt_cond_wait(&r->rd_avail);
+		__atomic_store_n(&r->rd_sleeping,0,__ATOMIC_RELAXED);
+		interrupt_leave();
+	}
+	return r->slot[r->prod & RXRING_MASK]->data;
+}
+
+/* Reader thread: publish the packet of cnt bytes just read into the
+ * slot returned by rxring_space(), waking the consumer if it's asleep
+ */
+void
+rxring_put(struct rxring *r, uint cnt)
+{
+	r->slot[r->prod & RXRING_MASK]->cnt = cnt;
+	STORE_REL(&r->prod,r->prod + 1);
+	FENCE();
+	if(__atomic_load_n(&r->rx_sleeping,__ATOMIC_RELAXED)){
+		interrupt_enter();
+		if(r->rx_sleeping){
+			r->rx_sleeping = 0;
+			ksignal(r,1);
+		}
+		interrupt_leave();
+	}
+}
+
+/* NOS process: wait for packets, then move every one that's ready onto
+ * q, refilling the slots behind them. Returns the number moved, or -1
+ * if the wait was interrupted.
+ */
+int
+rxring_take(struct rxring *r, struct mqueue *q)
+{
+	struct mbuf *bp;
+	uint prod,cons;
+	int cnt;
+
+	cons = r->cons;
+	for(;;){
+		if((prod = LOAD_ACQ(&r->prod)) != cons)
+			break;
+		__atomic_store_n(&r->rx_sleeping,1,__ATOMIC_RELAXED);
+		FENCE();
+		if((prod = LOAD_ACQ(&r->prod)) != cons){
+			__atomic_store_n(&r->rx_sleeping,0,__ATOMIC_RELAXED);
+			break;
+		}
+		if(kwait(r) != 0){
+			__atomic_store_n(&r->rx_sleeping,0,__ATOMIC_RELAXED);
+			return -1;
+		}
+	}
+	r->batches++;
+	for(cnt = 0;cons != prod;cons++,cnt++){
+		bp = r->slot[cons & RXRING_MASK];
+		r->slot[cons & RXRING_MASK] = rxring_alloc(r);
+		enqueue_mq(q,&bp);
+	}
+	r->packets += cnt;
+
+	/* Hand the refilled slots back to the reader */
+	STORE_REL(&r->cons,cons);
+	FENCE();
+	if(__atomic_load_n(&r->rd_sleeping,__ATOMIC_RELAXED)){
+		int i_state = disable();
+		pthread_cond_signal(&r->rd_avail);
+		restore(i_state);
+	}
+	return cnt;
+}
@@ -0,0 +1,50 @@
+/* Packet receive ring shared between a host reader thread and a NOS
+ * receive process.
+ *
+ * The ring holds RXRING_SIZE preallocated mbufs. The reader thread is the
+ * only producer: it reads each packet from the host directly into the
+ * next free mbuf and publishes it by advancing the producer index. The
+ * NOS receive process is the only consumer: it takes every packet that
+ * has been published, hands the mbufs up the stack as they are and puts
+ * fresh ones in their slots.
+ *
+ * Neither side takes the interrupt lock on the fast path. The reader
+ * only enters it to ksignal() a consumer that has said it is about to
+ * sleep, and the consumer only takes it to wake a reader that found the
+ * ring full, so a busy interface costs one signal per batch rather than
+ * one per packet.
+ */
+#ifndef KA9Q_RXRING_UNIX_H
+#define KA9Q_RXRING_UNIX_H
+
+#include "top.h"
+
+#include <pthread.h>
+
+#include "global.h"
+#include "net/core/mbuf.h"
+
+#define	RXRING_SIZE	32	/* Slots per ring, must be a power of two */
+
+struct rxring {
+	struct mbuf *slot[RXRING_SIZE];
+	uint prod;		/* Next slot to fill; written by reader only */
+	uint cons;		/* Next slot to take; written by NOS only */
+	int rx_sleeping;	/* Consumer is (about to be) in kwait() */
+	int rd_sleeping;	/* Reader is waiting for a free slot */
+	pthread_cond_t rd_avail; /* Slot freed for a waiting reader */
+	uint bufsize;		/* Data bytes in each slot */
+
+	/* Statistics */
+	long packets;		/* Packets passed up */
+	long batches;		/* Consumer wakeups that found packets */
+	long full;		/* Times the reader found the ring full */
+};
+
+extern	int rxring_init(struct rxring *r, uint bufsize);
+extern	void rxring_free(struct rxring *r);
+extern	uint8 *rxring_space(struct rxring *r);
+extern	void rxring_put(struct rxring *r, uint cnt);
+extern	int rxring_take(struct rxring *r, struct mqueue *q);
+
+#endif /* KA9Q_RXRING_UNIX_H */
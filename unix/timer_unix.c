@@ -13,6 +13,12 @@
  * the "Tick" global variable and the ksignal() calls. It will treat the
  * "disable()" and "restore()" interrupt blocking methods as a lock
  * barrier.
+ *
+ * When built with TICKLESS there is no periodic tick at all. The thread
+ * instead sleeps on a condition variable until the earliest pending timer
+ * expiration published by core/timer.c (see next_timer()), and is woken
+ * early through clock_kick() whenever a nearer timer is started. An idle
+ * system with no running timers makes no wakeups.
  */
 #include "top.h"
 
@@ -37,6 +43,11 @@ static void *timer_proc(void *dummy);
 /* The global timer ticking thread */
 static pthread_t g_timer_thread;
 
+#ifdef TICKLESS
+/* Signaled by clock_kick() when the next expiration changes */
+static pthread_cond_t g_timer_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
 /* Startup time */
 static struct timeval g_start_time;
 
@@ -73,6 +84,21 @@ msclock(void)
 	return duration_u / 1000;
 }
 
+/* Microseconds since start. It wraps after about 71 minutes, so only
+ * differences between readings mean anything.
+ */
+int32
+usclock(void)
+{
+	struct timeval now;
+	int64_t duration_u;
+
+	gettimeofday(&now, NULL);
+	duration_u = ((int64_t)(now.tv_sec - g_start_time.tv_sec)) * 1000000;
+	duration_u += (now.tv_usec - g_start_time.tv_usec);
+	return (int32)duration_u;
+}
+
 int32
 secclock(void)
 {
@@ -84,7 +110,73 @@ rdclock(void)
 {
 	return msclock() / MSPTICK;
 }
-	
+
+#ifdef TICKLESS
+/* Tell the timer thread that the next expiration has changed.
+ * Called from NOS processes; takes the interrupt lock if not held.
+ */
+void
+clock_kick(void)
+{
+	int i_state;
+
+	i_state = disable();
+	pthread_cond_signal(&g_timer_cond);
+	restore(i_state);
+}
+
+/* Release the interrupt lock if we're cancelled while holding it */
+static void
+timer_proc_cleanup(void *dummy)
+{
+	interrupt_leave();
+}
+
+static void *
+timer_proc(void *dummy)
+{
+	struct timeval now;
+	struct timespec deadline;
+	int32 next, delay;
+	uint32 gen, lastgen;
+
+	interrupt_enter();
+	pthread_cleanup_push(timer_proc_cleanup, NULL);
+	for (;;) {
+		if (!next_timer(&next, &gen)) {
+			/* Nothing running; sleep until a timer starts */
+			interrupt_cond_wait(&g_timer_cond);
+			continue;
+		}
+		delay = (next - rdclock()) * MSPTICK;
+		if (delay > 0) {
+			gettimeofday(&now, NULL);
+			deadline.tv_sec = now.tv_sec + delay / 1000;
+			deadline.tv_nsec = (now.tv_usec + (delay % 1000) * 1000)
+			    * 1000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			interrupt_cond_timedwait(&g_timer_cond, &deadline);
+			continue;
+		}
+		/* Due. Kick the timer process and wait for it to publish
+		 * the following expiration before looking again.
+		 */
+		Tick++;
+		ksignal(&Tick,1);
+		interrupt_leave();
+		interrupt_enter();
+		lastgen = gen;
+		while (next_timer(&next, &gen) && gen == lastgen)
+			interrupt_cond_wait(&g_timer_cond);
+	}
+	pthread_cleanup_pop(1);
+
+	return NULL;
+}
+#else
 static void *
 timer_proc(void *dummy)
 {
@@ -117,3 +209,4 @@ timer_proc(void *dummy)
 
 	return NULL;
 }
+#endif /* TICKLESS */
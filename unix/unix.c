@@ -184,11 +184,40 @@ availmem()
 	return 0;
 }
 
+/* Sum cnt 16-bit words for the Internet checksum. Since 2^16 == 1 in
+ * one's complement (mod 65535) arithmetic, the words can be added 64
+ * bits at a time with an end-around carry and folded down at the end.
+ */
 uint
 lcsum(uint16 *buf,uint cnt)
 {
-	uint32 sum = 0;
-
+	uint64 sum = 0;
+	uint64 w;
+
+	while(cnt >= 16){
+		memcpy(&w,buf,8);
+		sum += w;
+		sum += (sum < w);
+		memcpy(&w,buf+4,8);
+		sum += w;
+		sum += (sum < w);
+		memcpy(&w,buf+8,8);
+		sum += w;
+		sum += (sum < w);
+		memcpy(&w,buf+12,8);
+		sum += w;
+		sum += (sum < w);
+		buf += 16;
+		cnt -= 16;
+	}
+	while(cnt >= 4){
+		memcpy(&w,buf,8);
+		sum += w;
+		sum += (sum < w);
+		buf += 4;
+		cnt -= 4;
+	}
+	sum = (sum & 0xffffffff) + (sum >> 32);
 	while(cnt-- != 0)
 		sum += *buf++;
 	while(sum > 65535)
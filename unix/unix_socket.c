@@ -440,6 +440,62 @@ unix_socket_read(struct unix_socket_entry *us, void *buf, unsigned short cnt)
 	return cnt;
 }
 
+/*
+ * Blocking zero-copy read. Waits for data as unix_socket_read() does,
+ * then returns the length of the run of contiguous bytes starting at
+ * the FIFO read pointer, with *bufp pointing at them. The bytes stay in
+ * the FIFO (the read thread only ever writes into free space, so they
+ * can't change underneath the caller) until given back with
+ * unix_socket_read_done(); the caller may release fewer than it was
+ * shown and look at the rest again later.
+ */
+int
+unix_socket_read_span(struct unix_socket_entry *us, uint8 **bufp)
+{
+	int tmp, i_state;
+	struct unix_socket_fifo *fp;
+
+	fp = &us->fifo;
+
+	for (;;) {
+		i_state = disable();
+		tmp = fp->cnt;
+		if (tmp != 0)
+			break;
+		restore(i_state);
+		if ((kerrno = kwait(fp)) != 0)
+			return -1;
+	}
+	*bufp = fp->rp;
+	if (tmp > &fp->buf[fp->bufsize] - fp->rp)
+		tmp = &fp->buf[fp->bufsize] - fp->rp;	/* Stop at wrap */
+	restore(i_state);
+
+	return tmp;
+}
+
+/*
+ * Consume cnt bytes of a span returned by unix_socket_read_span().
+ */
+void
+unix_socket_read_done(struct unix_socket_entry *us, int cnt)
+{
+	int i_state;
+	struct unix_socket_fifo *fp;
+
+	if (cnt <= 0)
+		return;
+
+	fp = &us->fifo;
+
+	i_state = disable();
+	fp->cnt -= cnt;
+	fp->rp += cnt;
+	if (fp->rp >= &fp->buf[fp->bufsize])
+		fp->rp = fp->buf;
+	restore(i_state);
+}
+
 /*
  * Blocking write.
  */
@@ -83,6 +83,9 @@ extern	struct unix_socket_entry * unix_socket_create(const char *path,
 extern	int unix_socket_shutdown(struct unix_socket_entry *us);
 extern	int unix_socket_read(struct unix_socket_entry *us, void *buf,
 	    unsigned short cnt);
+extern	int unix_socket_read_span(struct unix_socket_entry *us,
+	    uint8 **bufp);
+extern	void unix_socket_read_done(struct unix_socket_entry *us, int cnt);
 extern	int unix_socket_write(struct unix_socket_entry *us, const void *buf,
 	    unsigned short cnt);
 